@@ -34,7 +34,20 @@
 #include <stdint.h>
 #include <string.h>
 
+//  Memory allocator for everything the library allocates. hint is passed
+//  back to each function, e.g. to name an arena.
+typedef struct {
+    void *(*alloc) (void *hint, size_t size);
+    void *(*realloc) (void *hint, void *ptr, size_t size);
+    void (*free) (void *hint, void *ptr);
+    void *hint;
+} zmtp_allocator_t;
+
 #include "zmtp_msg.h"
+#include "zmtp_multipart.h"
+#include "zmtp_stats.h"
+#include "zmtp_histogram.h"
+#include "zmtp_arena.h"
 #include "zmtp_dealer.h"
 
 enum zmtp_socket_type {
@@ -53,8 +66,59 @@ enum zmtp_socket_type {
 };
 
 
+//  Take all memory from allocator, or from malloc again if NULL. Call
+//  before creating any object, and free everything before switching
+//  again. Buffers given to zmtp_msg_from_data must come from the same
+//  allocator. Returns false if a function is missing.
+bool zmtp_set_allocator (const zmtp_allocator_t *allocator);
+
+//  Start the background I/O thread. Dealers created afterwards do their
+//  I/O on it instead of the calling thread. Optional; without it all I/O
+//  happens synchronously in the calling thread. On a NUMA machine starts
+//  one thread bound to each node instead, and serves each dealer from
+//  the node its packets arrive on.
 bool zmtp_init();
+
+//  Same as zmtp_init, starting the given number of I/O threads
+bool zmtp_init_io_threads (size_t io_threads);
+
+//  Same as zmtp_init, starting one I/O thread pinned to each CPU in cpus,
+//  or to each CPU the process may run on if cpus is NULL. Each dealer is
+//  served by the thread its connection hashes to.
+bool zmtp_init_cores (const int *cpus, size_t ncpus);
+
+//  Stop the background I/O threads; destroy all dealers first
 bool zmtp_deinit();
 
+//  Reuse each parsed endpoint for ttl msecs, so reconnects skip parsing
+//  it; 0 parses every time. Default is 60000.
+void zmtp_set_endpoint_ttl (int ttl);
+
+//  Cache the addresses of hostnames for ttl msecs, and lookups that
+//  failed for negative_ttl msecs. Names in use are looked up again in the
+//  background before their addresses expire, so connects do not wait on
+//  DNS. Defaults are 30000 and 5000.
+void zmtp_set_resolver_ttl (int ttl, int negative_ttl);
+
+//  First descriptor passed by socket activation
+#define ZMTP_LISTEN_FDS_START 3
+
+//  Return how many sockets systemd, or a supervisor speaking its socket
+//  activation protocol, passed to this process; they are descriptors
+//  ZMTP_LISTEN_FDS_START onwards, ready for zmtp_dealer_adopt. Returns 0
+//  if none were passed. Clears the variables so children do not inherit
+//  them.
+int zmtp_listen_fds ();
+
+//  Publish the counters of every dealer created afterwards in shared
+//  memory segment name, e.g. "/zmtp-myapp", every interval msecs, for
+//  zmtp_top to watch. NULL names the segment "/zmtp-<pid>". Setting the
+//  environment variable ZMTP_METRICS to a name, or to 1, does the same
+//  without changing the application.
+bool zmtp_init_metrics (const char *name, int interval);
+
+//  Stop publishing and remove the segment; destroy all dealers first
+bool zmtp_deinit_metrics ();
+
 
 #endif
@@ -0,0 +1,75 @@
+/*  =========================================================================
+    zmtp_arena - hugepage-backed allocator for buffers and payloads
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_ARENA_H_INCLUDED__
+#define __ZMTP_ARENA_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  What backs an arena's memory
+typedef enum {
+    ZMTP_ARENA_HUGETLB = 0,     //  Reserved 2 MB pages (MAP_HUGETLB)
+    ZMTP_ARENA_THP = 1,         //  Transparent huge pages, when available
+    ZMTP_ARENA_SMALL = 2        //  Ordinary pages
+} zmtp_arena_pages_t;
+
+//  Opaque class structure. Any thread may allocate from an arena.
+typedef struct _zmtp_arena_t zmtp_arena_t;
+
+//  @interface
+//  Constructor; maps size bytes, rounded up to 2 MB, from reserved huge
+//  pages, else from transparent huge pages, else from ordinary pages.
+//  Returns NULL with errno set if nothing can be mapped.
+zmtp_arena_t *
+    zmtp_arena_new (size_t size);
+
+//  Destructor; unmaps the arena. Uninstall its allocator and free every
+//  block first.
+void
+    zmtp_arena_destroy (zmtp_arena_t **self_p);
+
+//  Return an allocator taking memory from the arena, to install with
+//  zmtp_set_allocator. Requests up to 1 MB get power-of-two blocks, and
+//  larger ones runs of whole 2 MB pages. Requests larger than the arena,
+//  or made when it is full, go to malloc. Like malloc, the allocator only
+//  guarantees 16-byte (max_align_t) alignment.
+const zmtp_allocator_t *
+    zmtp_arena_allocator (zmtp_arena_t *self);
+
+//  Place the arena's pages on NUMA node node, moving any already touched,
+//  e.g. the node of the I/O thread that fills its buffers. The kernel
+//  falls back to other nodes if that one runs out. Returns 0, or -1 with
+//  errno set if the node does not exist or the platform cannot do it.
+int
+    zmtp_arena_set_node (zmtp_arena_t *self, int node);
+
+//  Return what backs the arena's memory
+zmtp_arena_pages_t
+    zmtp_arena_pages (zmtp_arena_t *self);
+
+//  Return bytes of the arena carved into blocks so far; freed blocks are
+//  kept for reuse and still count
+size_t
+    zmtp_arena_used (zmtp_arena_t *self);
+
+//  Self test of this class
+void
+    zmtp_arena_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
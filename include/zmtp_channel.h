@@ -17,16 +17,15 @@
 extern "C" {
 #endif
 
-//  Definitions ZMTP/2.0 protocol flags.
-enum {
-    ZMTP_MORE_FLAG = 1,
-    ZMTP_LARGE_FLAG = 2,
-    ZMTP_COMMAND_FLAG = 4,
-};
-
 //  Opaque class structure
 typedef struct _zmtp_channel_t zmtp_channel_t;
 
+//  Kernel timestamps a channel can ask for, or-ed together
+enum {
+    ZMTP_TIMESTAMP_RX = 1,      //  Stamp received messages
+    ZMTP_TIMESTAMP_TX = 2,      //  Report when sent frames left the host
+};
+
 //  @interface
 //  Constructor
 zmtp_channel_t *
@@ -36,6 +35,107 @@ zmtp_channel_t *
 void
     zmtp_channel_destroy (zmtp_channel_t **self_p);
 
+//  Set connect deadline in milliseconds; -1 (default) waits forever
+void
+    zmtp_channel_set_connect_timeout (zmtp_channel_t *self, int timeout);
+
+//  Return socket handle of the channel, or -1 if not connected
+int
+    zmtp_channel_fd (zmtp_channel_t *self);
+
+//  Count traffic in stats instead of the channel's own counters, so an
+//  owner can keep totals across channels. Set before connecting.
+void
+    zmtp_channel_set_stats (zmtp_channel_t *self, zmtp_stats_t *stats);
+
+//  Take a snapshot of the traffic counters; safe from any thread
+void
+    zmtp_channel_stats (zmtp_channel_t *self, zmtp_stats_t *stats);
+
+//  Record latencies of the given kind in histogram, which the caller owns
+//  and must keep until the channel is destroyed; NULL, the default, stops
+//  timing them. The channel times sends, blocking receives and the
+//  handshake. Set before connecting.
+void
+    zmtp_channel_set_histogram (zmtp_channel_t *self, zmtp_latency_t kind,
+                                zmtp_histogram_t *histogram);
+
+//  Ask the kernel for software timestamps on a TCP channel: with
+//  ZMTP_TIMESTAMP_RX each received message carries the time its bytes
+//  arrived (zmtp_msg_timestamp), with ZMTP_TIMESTAMP_TX the time each sent
+//  frame was handed to the device can be read back with
+//  zmtp_channel_send_timestamp. 0 turns both off. Takes effect now if
+//  connected, else once connected. Returns 0, or -1 with errno ENOTSUP if
+//  the platform has no SO_TIMESTAMPING.
+int
+    zmtp_channel_set_timestamping (zmtp_channel_t *self, int modes);
+
+//  Return the kernel transmit time of the oldest sent frame not yet
+//  reported. frame counts the frames sent since ZMTP_TIMESTAMP_TX was
+//  turned on, from 0; a gap means the caller fell behind and lost some.
+//  timestamp is nanoseconds since the epoch (CLOCK_REALTIME). Returns 0,
+//  or -1 with errno EAGAIN if that frame has not left yet.
+int
+    zmtp_channel_send_timestamp (zmtp_channel_t *self,
+                                 uint64_t *frame, int64_t *timestamp);
+
+//  Send bodies of threshold bytes or more with MSG_ZEROCOPY, straight from
+//  the message's pages; 0, the default, copies every body. The channel
+//  holds messages that own such bodies until the kernel is done, so they
+//  may be destroyed at once but their bodies must not change meanwhile.
+//  Takes effect now if connected, else once connected.
+//  Returns 0, or -1 with errno ENOTSUP if the platform has no zerocopy.
+int
+    zmtp_channel_set_zerocopy (zmtp_channel_t *self, size_t threshold);
+
+//  Return the number of sent bodies the kernel has not finished with
+size_t
+    zmtp_channel_zerocopy_pending (zmtp_channel_t *self);
+
+//  Over ipc://, pass bodies of threshold bytes or more as sealed memfds
+//  that the peer maps instead of reading; 0, the default, streams them.
+//  Not part of ZMTP: both peers must set it, and any value accepts
+//  memfds (SIZE_MAX to accept without sending). Set before connecting.
+//  Returns 0, or -1 with errno ENOTSUP if the platform has no memfds.
+int
+    zmtp_channel_set_memfd (zmtp_channel_t *self, size_t threshold);
+
+//  Set the socket type our READY names, one of enum zmtp_socket_type, or
+//  -1 (default) for none. With a type set, a peer that names a type it
+//  may not talk to fails the handshake with EPROTO. Set before
+//  connecting. Returns 0, or -1 with errno EINVAL.
+int
+    zmtp_channel_set_socket_type (zmtp_channel_t *self, int type);
+
+//  Set the identity our READY gives the peer; size 0 (default) gives
+//  none. Set before connecting. Returns 0, or -1 with errno EINVAL if it
+//  is longer than ZMTP_IDENTITY_MAX.
+int
+    zmtp_channel_set_identity (zmtp_channel_t *self,
+                               const void *data, size_t size);
+
+//  Return the socket type the peer named in its READY, or -1 if none
+int
+    zmtp_channel_peer_socket_type (zmtp_channel_t *self);
+
+//  Return the interned identity the peer gave in its READY, or NULL if
+//  none. The channel holds it; take a reference to keep it longer.
+zmtp_identity_t *
+    zmtp_channel_peer_identity (zmtp_channel_t *self);
+
+//  Return a property of the peer's READY by name, ignoring case, and set
+//  size to its size; NULL if it has none. The value is not copied: it
+//  points into the READY and lasts until the channel is destroyed.
+const byte *
+    zmtp_channel_peer_property (zmtp_channel_t *self, const char *name,
+                                size_t *size);
+
+//  Move the receive buffers to fresh memory first touched by the calling
+//  thread, so it lands on that thread's NUMA node. Call when handing the
+//  channel to another thread.
+void
+    zmtp_channel_relocate (zmtp_channel_t *self);
+
 //  Connect channel using local transport
 int
     zmtp_channel_ipc_connect (zmtp_channel_t *self, const char *path);
@@ -53,14 +153,68 @@ int
 int
     zmtp_channel_listen (zmtp_channel_t *test, const char *endpoint_str);
 
+//  Run the channel over socket fd, made by the caller, inherited from a
+//  supervisor, or one end of a socketpair. A connected socket is owned
+//  by the channel from now on, even if the call fails. From a listening
+//  socket one connection is accepted; the listener stays the caller's.
+//  Returns 0 once the handshake is done, else -1 with errno set.
+int
+    zmtp_channel_adopt (zmtp_channel_t *self, int fd);
+
 //  Send a ZMTP message to the channel
 int
     zmtp_channel_send (zmtp_channel_t *self, zmtp_msg_t *msg);
 
+//  Send as much of a ZMTP message as possible without blocking. Returns
+//  -1 with errno EAGAIN if the socket is full; the same message must then
+//  be passed again until the call returns 0.
+int
+    zmtp_channel_send_nowait (zmtp_channel_t *self, zmtp_msg_t *msg);
+
+//  Send size bytes of regular file fd from offset as one frame; flags may
+//  be ZMTP_MSG_MORE. The body goes from the page cache to the socket
+//  without passing through user space. Blocks until it is written.
+//  Returns 0, or -1 with errno set: EINVAL if the file is not regular or
+//  is too short, EBUSY if a frame is partly written; other errors mean
+//  the connection is broken.
+int
+    zmtp_channel_send_file (zmtp_channel_t *self, int fd, off_t offset,
+                            size_t size, byte flags);
+
+//  Send all parts of multipart, each but the last with ZMTP_MSG_MORE,
+//  gathered into one write. Blocks until it is all written. Returns 0, or
+//  -1 with errno set: EINVAL if there are no parts, EBUSY if a frame is
+//  partly written; other errors mean the connection is broken.
+int
+    zmtp_channel_send_multipart (zmtp_channel_t *self,
+                                 zmtp_multipart_t *multipart);
+
+//  Receive all parts of the next message into one multipart, blocking
+//  until the last has arrived; the caller destroys it. Returns NULL with
+//  errno set: EBUSY if zmtp_channel_recv_nowait left a frame half read,
+//  EPROTO if a command arrives inside the message; other errors mean the
+//  connection is broken.
+zmtp_multipart_t *
+    zmtp_channel_recv_multipart (zmtp_channel_t *self);
+
+//  Return true if a message has been partly written
+bool
+    zmtp_channel_sending (zmtp_channel_t *self);
+
+//  Return true if the channel is connected and between messages, with
+//  nothing pending either way, so it could be handed to another user
+bool
+    zmtp_channel_idle (zmtp_channel_t *self);
+
 //  Receive a ZMTP message off the channel
 zmtp_msg_t *
     zmtp_channel_recv (zmtp_channel_t *self);
 
+//  Receive a ZMTP message if one is complete, without blocking. Returns
+//  NULL with errno EAGAIN if more data is needed.
+zmtp_msg_t *
+    zmtp_channel_recv_nowait (zmtp_channel_t *self);
+
 //  Self test of this class
 void
     zmtp_channel_test (bool verbose);
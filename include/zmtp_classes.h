@@ -18,10 +18,23 @@
 #include "zmtp.h"
 
 //  Internal API
+#include "zmtpport.h"
+#include "zmtp_codec.h"
+#include "zmtp_identity.h"
 #include "zmtp_channel.h"
+#include "zmtp_pool.h"
 #include "zmtp_endpoint.h"
+#include "zmtp_mpscq.h"
+#include "zmtp_spscq.h"
+#include "zmtp_io_thread.h"
+#include "zmtp_ctx.h"
+#include "zmtp_msgq.h"
+#include "zmtp_metrics.h"
 #include "zmtp_ipc_endpoint.h"
+#include "zmtp_resolver.h"
 #include "zmtp_tcp_endpoint.h"
 #include "zmtp_udp_endpoint.h"
+#include "zmtp_util.h"
+#include "zmtp_trace.h"
 
 #endif
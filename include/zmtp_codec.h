@@ -0,0 +1,131 @@
+/*  =========================================================================
+    zmtp_codec - ZMTP frame encoding and decoding on memory buffers
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_CODEC_H_INCLUDED__
+#define __ZMTP_CODEC_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Definitions ZMTP/2.0 protocol flags.
+enum {
+    ZMTP_MORE_FLAG = 1,
+    ZMTP_LARGE_FLAG = 2,
+    ZMTP_COMMAND_FLAG = 4,
+};
+
+//  Largest frame header, flags plus 8-octet size
+#define ZMTP_CODEC_HEADER_MAX 9
+
+//  A complete frame found by zmtp_codec_scan
+typedef struct {
+    byte flags;                 //  Message flags, ZMTP_MSG_*
+    size_t offset;              //  Start of body from start of data
+    size_t size;                //  Size of body
+} zmtp_frame_t;
+
+//  A metadata property of a command, as encoded or as parsed. Parsed
+//  properties point into the command body, which must outlive them.
+typedef struct {
+    const char *name;           //  Property name, not terminated
+    size_t name_size;           //  1 to 255 octets
+    const byte *value;          //  Property value
+    size_t value_size;          //  Size of value
+} zmtp_property_t;
+
+//  A command parsed by zmtp_codec_parse_command, pointing into its body
+typedef struct {
+    const char *name;           //  Command name, not terminated
+    size_t name_size;           //  Size of name
+    const byte *properties;     //  Encoded properties after the name
+    size_t properties_size;     //  Size of properties
+} zmtp_command_t;
+
+//  @interface
+//  Encode the header of a frame carrying size bytes with the given message
+//  flags into buffer, which must hold ZMTP_CODEC_HEADER_MAX bytes. Returns
+//  the header size.
+size_t
+    zmtp_codec_encode_header (byte *buffer, byte msg_flags, size_t size);
+
+//  Encode msg as a whole frame into buffer. Returns the frame size, or 0
+//  if it does not fit in capacity bytes.
+size_t
+    zmtp_codec_encode (zmtp_msg_t *msg, byte *buffer, size_t capacity);
+
+//  Decode a frame header from the first size bytes of data. Returns the
+//  header size and sets the message flags and body size, or returns 0 if
+//  more bytes are needed.
+size_t
+    zmtp_codec_decode_header (const byte *data, size_t size,
+                              byte *msg_flags, uint64_t *body_size);
+
+//  Decode a whole frame from the first size bytes of data into a new
+//  message, and set consumed to the frame size. Returns NULL with errno
+//  set to EAGAIN if the frame is not complete, or EMSGSIZE if the body
+//  is too large for this platform.
+zmtp_msg_t *
+    zmtp_codec_decode (const byte *data, size_t size, size_t *consumed);
+
+//  Find the complete frames at the start of the first size bytes of data,
+//  up to max_frames of them, in one pass. Fills in frames, sets consumed
+//  to the bytes they cover, and returns how many were found. Stops early
+//  at a frame that is not complete.
+size_t
+    zmtp_codec_scan (const byte *data, size_t size,
+                     zmtp_frame_t *frames, size_t max_frames,
+                     size_t *consumed);
+
+//  Encode the body of a command with the given name and count metadata
+//  properties into buffer, as for READY. Returns the body size, or 0 if
+//  it does not fit in capacity bytes or a name is longer than 255.
+size_t
+    zmtp_codec_encode_command (byte *buffer, size_t capacity,
+                               const char *name,
+                               const zmtp_property_t *properties,
+                               size_t count);
+
+//  Parse the body of a command made of a name and metadata properties,
+//  checking every property, into a view of that body; nothing is copied.
+//  Returns 0, or -1 with errno EPROTO if the body is malformed.
+int
+    zmtp_codec_parse_command (const byte *data, size_t size,
+                              zmtp_command_t *command);
+
+//  Return true if the command name is name, ignoring case
+bool
+    zmtp_codec_command_is (const zmtp_command_t *command, const char *name);
+
+//  Step through the properties of a parsed command. Start with cursor 0;
+//  returns true and fills in property until there are no more.
+bool
+    zmtp_codec_next_property (const zmtp_command_t *command, size_t *cursor,
+                              zmtp_property_t *property);
+
+//  Return the value of a property of a parsed command, with names
+//  compared ignoring case, and set size to its size. Returns NULL if the
+//  command does not have it.
+const byte *
+    zmtp_codec_find_property (const zmtp_command_t *command,
+                              const char *name, size_t *size);
+
+//  Self test of this class
+void
+    zmtp_codec_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,85 @@
+/*  =========================================================================
+    zmtp_ctx - context owning the background I/O threads
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_CTX_H_INCLUDED__
+#define __ZMTP_CTX_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_ctx_t zmtp_ctx_t;
+
+//  @interface
+//  Constructor; starts io_threads I/O threads
+zmtp_ctx_t *
+    zmtp_ctx_new (size_t io_threads);
+
+//  Constructor; starts one I/O thread pinned to each of the ncpus CPUs
+//  listed in cpus, or to each CPU the process may run on if cpus is NULL.
+//  Returns NULL with errno set if a thread cannot be pinned.
+zmtp_ctx_t *
+    zmtp_ctx_new_cores (const int *cpus, size_t ncpus);
+
+//  Constructor; starts threads_per_node I/O threads bound to the CPUs of
+//  each NUMA node. Returns NULL with errno ENOTSUP if the topology is
+//  unknown, or as zmtp_ctx_new_cores if a thread cannot be bound.
+zmtp_ctx_t *
+    zmtp_ctx_new_numa (size_t threads_per_node);
+
+//  Destructor; stops the I/O threads. All sockets using the context must
+//  have been destroyed.
+void
+    zmtp_ctx_destroy (zmtp_ctx_t **self_p);
+
+//  Return the I/O thread that will serve a new socket; sockets are spread
+//  round-robin over the threads
+zmtp_io_thread_t *
+    zmtp_ctx_io_thread (zmtp_ctx_t *self);
+
+//  Return the I/O thread that will serve socket fd, connected to endpoint.
+//  A sharded context hashes the endpoint and the socket, so a socket
+//  always maps to the same thread while sockets to one endpoint spread
+//  out; a plain one spreads sockets round-robin.
+zmtp_io_thread_t *
+    zmtp_ctx_io_thread_for (zmtp_ctx_t *self, const char *endpoint, int fd);
+
+//  Return the I/O thread that will serve a connected socket: the thread
+//  pinned to the CPU that processes the socket's packets, else one on
+//  that CPU's NUMA node, else as zmtp_ctx_io_thread_for.
+zmtp_io_thread_t *
+    zmtp_ctx_io_thread_near (zmtp_ctx_t *self, const char *endpoint, int fd);
+
+//  Return number of I/O threads
+size_t
+    zmtp_ctx_io_threads (zmtp_ctx_t *self);
+
+//  Return number of NUMA nodes with CPUs, or 0 if the platform does not
+//  say
+size_t
+    zmtp_ctx_numa_nodes (void);
+
+//  Return the context started by zmtp_init, or NULL if none
+zmtp_ctx_t *
+    zmtp_ctx_default (void);
+
+//  Self test of this class
+void
+    zmtp_ctx_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,7 +17,19 @@
 extern "C" {
 #endif
 
-//  Opaque class structure
+//  What zmtp_dealer_send does when the outbound queue is full
+enum {
+    ZMTP_HWM_BLOCK = 0,         //  Wait until the peer makes room
+    ZMTP_HWM_EAGAIN = 1,        //  Fail with errno set to EAGAIN
+    ZMTP_HWM_DROP_OLDEST = 2,   //  Discard the oldest queued message
+    ZMTP_HWM_DROP_NEWEST = 3,   //  Discard the message being sent
+};
+
+//  Opaque class structure. A dealer created while zmtp_init is in effect
+//  has its socket served by a background I/O thread: send queues frames
+//  for that thread and returns, recv takes what the thread read ahead.
+//  Options must then be set before connect or listen. Like any socket, a
+//  dealer is used by one application thread at a time.
 typedef struct _zmtp_dealer_t zmtp_dealer_t;
 
 //  @interface
@@ -29,6 +41,78 @@ zmtp_dealer_t *
 void
     zmtp_dealer_destroy (zmtp_dealer_t **self_p);
 
+//  Set connect deadline in milliseconds; -1 (default) waits forever
+void
+    zmtp_dealer_set_connect_timeout (zmtp_dealer_t *self, int timeout);
+
+//  Set initial reconnect interval in msecs; default 100
+void
+    zmtp_dealer_set_reconnect_ivl (zmtp_dealer_t *self, int ivl);
+
+//  Set maximum reconnect interval in msecs; default 30000
+void
+    zmtp_dealer_set_reconnect_ivl_max (zmtp_dealer_t *self, int ivl_max);
+
+//  Set limit on outbound frames queued in the library; default 1000
+void
+    zmtp_dealer_set_sndhwm (zmtp_dealer_t *self, size_t sndhwm);
+
+//  Set limit on inbound frames read ahead; default 1000
+void
+    zmtp_dealer_set_rcvhwm (zmtp_dealer_t *self, size_t rcvhwm);
+
+//  Set what send does when the outbound queue is full; default
+//  ZMTP_HWM_BLOCK
+void
+    zmtp_dealer_set_sndhwm_policy (zmtp_dealer_t *self, int policy);
+
+//  Set msecs destroy waits for queued frames to be written; default -1,
+//  wait until they are
+void
+    zmtp_dealer_set_linger (zmtp_dealer_t *self, int linger);
+
+//  Return number of outbound frames queued in the library
+size_t
+    zmtp_dealer_sndq_size (zmtp_dealer_t *self);
+
+//  Return number of inbound frames read ahead of the application
+size_t
+    zmtp_dealer_rcvq_size (zmtp_dealer_t *self);
+
+//  Return number of messages dropped by the high-water mark policy
+size_t
+    zmtp_dealer_dropped (zmtp_dealer_t *self);
+
+//  Take a snapshot of the traffic counters, totalled over every connection
+//  the dealer made. Safe to call while an I/O thread serves the dealer.
+void
+    zmtp_dealer_stats (zmtp_dealer_t *self, zmtp_stats_t *stats);
+
+//  Time sends, blocking receives, handshakes and the wait in the outbound
+//  queue, for every connection the dealer makes. Default is off.
+void
+    zmtp_dealer_set_histograms (zmtp_dealer_t *self, bool enabled);
+
+//  Send bodies of threshold bytes or more with MSG_ZEROCOPY; 0, the
+//  default, copies them. A message written straight to the socket is
+//  held until the kernel is done with its body: it may be read and
+//  destroyed as usual, but its body must not change. Set before
+//  connecting.
+void
+    zmtp_dealer_set_zerocopy (zmtp_dealer_t *self, size_t threshold);
+
+//  Pass bodies of threshold bytes or more to an ipc:// peer as memfds it
+//  maps instead of reads; 0, the default, streams them. The peer must
+//  set it too. Set before connecting.
+void
+    zmtp_dealer_set_memfd (zmtp_dealer_t *self, size_t threshold);
+
+//  Return a snapshot of the latencies of the given kind, which the caller
+//  must destroy, or NULL if the dealer does not time them. Safe to call
+//  while an I/O thread serves the dealer.
+zmtp_histogram_t *
+    zmtp_dealer_histogram (zmtp_dealer_t *self, zmtp_latency_t kind);
+
 int
     zmtp_dealer_ipc_connect (zmtp_dealer_t *self, const char *addr);
 
@@ -42,12 +126,22 @@ int
 int
     zmtp_dealer_listen (zmtp_dealer_t *self, const char *endpoint_str);
 
+//  Talk over socket fd: a connected socket, which the dealer owns from
+//  now on, or a listening one to accept a connection from, which stays
+//  the caller's. The dealer does not reconnect. See zmtp_listen_fds.
+int
+    zmtp_dealer_adopt (zmtp_dealer_t *self, int fd);
+
 int
     zmtp_dealer_send (zmtp_dealer_t *self, zmtp_msg_t *msg);
 
 zmtp_msg_t *
     zmtp_dealer_recv (zmtp_dealer_t *self);
 
+//  Receive a message if one is available; NULL with errno EAGAIN if not
+zmtp_msg_t *
+    zmtp_dealer_recv_nowait (zmtp_dealer_t *self);
+
 //  Self test of this class
 void
     zmtp_dealer_test (bool verbose);
@@ -20,17 +20,50 @@ extern "C" {
 struct zmtp_endpoint {
     void (*destroy) (struct zmtp_endpoint **self_p);
     int (*connect) (struct zmtp_endpoint *self);
+    int (*connect_timeout) (struct zmtp_endpoint *self, int timeout);
     int (*listen) (struct zmtp_endpoint *self);
+    int refs;                   //  References beyond the first
 };
 
 typedef struct zmtp_endpoint zmtp_endpoint_t;
 
+//  Default msecs a parsed endpoint is reused for
+#define ZMTP_ENDPOINT_TTL 60000
+
+//  Parse an endpoint string, "ipc://path" or "tcp://host:port" with IPv6
+//  addresses in brackets. Hostnames are resolved by zmtp_resolver when
+//  connecting. Returns NULL with errno EINVAL if it is not valid.
+zmtp_endpoint_t *
+    zmtp_endpoint_new (const char *endpoint_str);
+
+//  Same as zmtp_endpoint_new, but reuses the endpoint parsed by an earlier
+//  lookup of the same string if that is younger than the cache TTL.
+//  Destroy the result as usual; it is shared, and must not be changed.
+zmtp_endpoint_t *
+    zmtp_endpoint_lookup (const char *endpoint_str);
+
+//  Take another reference to the endpoint; each one is destroyed
+zmtp_endpoint_t *
+    zmtp_endpoint_ref (zmtp_endpoint_t *self);
+
+//  Drop a reference to the endpoint, freeing it with the last one
 void
     zmtp_endpoint_destroy (zmtp_endpoint_t **self_p);
 
+//  Set msecs cached endpoints are reused for; 0 stops caching
+void
+    zmtp_endpoint_cache_set_ttl (int ttl);
+
+//  Forget every cached endpoint
+void
+    zmtp_endpoint_cache_purge (void);
+
 int
     zmtp_endpoint_connect (zmtp_endpoint_t *self);
 
+int
+    zmtp_endpoint_connect_timeout (zmtp_endpoint_t *self, int timeout);
+
 int
     zmtp_endpoint_listen (zmtp_endpoint_t *self);
 
@@ -0,0 +1,92 @@
+/*  =========================================================================
+    zmtp_histogram - log-bucketed latency histogram
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_HISTOGRAM_H_INCLUDED__
+#define __ZMTP_HISTOGRAM_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  What a latency histogram of a channel or dealer measures
+typedef enum {
+    ZMTP_LATENCY_SEND = 0,      //  Writing a frame, first try to last byte
+    ZMTP_LATENCY_RECV = 1,      //  Time spent in a blocking receive
+    ZMTP_LATENCY_HANDSHAKE = 2, //  Greeting and READY exchange
+    ZMTP_LATENCY_QUEUE = 3,     //  Frame waiting in the outbound queue
+    ZMTP_LATENCY_KINDS = 4
+} zmtp_latency_t;
+
+//  Opaque class structure. Values are nanoseconds, kept to within 1/16
+//  of their size. Only one thread records into a histogram; any thread
+//  may read it.
+typedef struct _zmtp_histogram_t zmtp_histogram_t;
+
+//  @interface
+//  Constructor
+zmtp_histogram_t *
+    zmtp_histogram_new (void);
+
+//  Destructor
+void
+    zmtp_histogram_destroy (zmtp_histogram_t **self_p);
+
+//  Record one value, in nanoseconds
+void
+    zmtp_histogram_record (zmtp_histogram_t *self, uint64_t nsecs);
+
+//  Add the values of other into self, e.g. to total several channels.
+//  Other may be recording meanwhile; self must not be.
+void
+    zmtp_histogram_merge (zmtp_histogram_t *self, zmtp_histogram_t *other);
+
+//  Return a snapshot of the histogram; safe from any thread
+zmtp_histogram_t *
+    zmtp_histogram_dup (zmtp_histogram_t *self);
+
+//  Return number of values recorded
+uint64_t
+    zmtp_histogram_count (zmtp_histogram_t *self);
+
+//  Return smallest value recorded, or 0 if none
+uint64_t
+    zmtp_histogram_min (zmtp_histogram_t *self);
+
+//  Return largest value recorded, or 0 if none
+uint64_t
+    zmtp_histogram_max (zmtp_histogram_t *self);
+
+//  Return mean of the values recorded, or 0 if none
+double
+    zmtp_histogram_mean (zmtp_histogram_t *self);
+
+//  Return the value at or below which the given percentage of values
+//  fall, e.g. 99.9, or 0 if none were recorded
+uint64_t
+    zmtp_histogram_percentile (zmtp_histogram_t *self, double percent);
+
+//  Write the histogram as text: a summary line, then one line per bucket
+//  in use giving its highest value, its count and the share of values up
+//  to and including it. Returns 0, or -1 if writing failed.
+int
+    zmtp_histogram_export (zmtp_histogram_t *self, FILE *file);
+
+//  Self test of this class
+void
+    zmtp_histogram_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+/*  =========================================================================
+    zmtp_identity - interned peer identities
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_IDENTITY_H_INCLUDED__
+#define __ZMTP_IDENTITY_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure. Equal identities are one object, so routing
+//  tables can key on the pointer and compare identities by address.
+typedef struct _zmtp_identity_t zmtp_identity_t;
+
+//  Longest identity ZMTP allows
+#define ZMTP_IDENTITY_MAX 255
+
+//  @interface
+//  Return the identity holding size bytes of data, creating it only if
+//  no one holds it yet; each result is destroyed. Returns NULL with errno
+//  EINVAL if size is 0 or longer than ZMTP_IDENTITY_MAX.
+zmtp_identity_t *
+    zmtp_identity_intern (const void *data, size_t size);
+
+//  Take another reference to the identity; each one is destroyed
+zmtp_identity_t *
+    zmtp_identity_ref (zmtp_identity_t *self);
+
+//  Drop a reference to the identity, freeing it with the last one
+void
+    zmtp_identity_destroy (zmtp_identity_t **self_p);
+
+//  Return the bytes of the identity
+const byte *
+    zmtp_identity_data (zmtp_identity_t *self);
+
+//  Return the size of the identity
+size_t
+    zmtp_identity_size (zmtp_identity_t *self);
+
+//  Return a hash of the identity, for routing tables
+uint32_t
+    zmtp_identity_hash (zmtp_identity_t *self);
+
+//  Return number of identities held
+size_t
+    zmtp_identity_count (void);
+
+//  Self test of this class
+void
+    zmtp_identity_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+/*  =========================================================================
+    zmtp_io_thread - background I/O thread
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_IO_THREAD_H_INCLUDED__
+#define __ZMTP_IO_THREAD_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Callbacks of an object whose socket is served by an I/O thread. Both
+//  are called on the I/O thread only.
+typedef struct {
+    //  Return socket to poll or -1 for none; set the poll events wanted
+    //  and the time (zmtp_clock_mono) of the next timer, -1 for none
+    int (*poll) (void *arg, short *events, int64_t *timer);
+    //  Handle poll events; revents is 0 when only the timer expired
+    void (*ready) (void *arg, short revents);
+} zmtp_io_handler_t;
+
+//  Function run on the I/O thread by a command
+typedef void (zmtp_io_fn) (void *arg, zmtp_msg_t *msg);
+
+//  Opaque class structure
+typedef struct _zmtp_io_thread_t zmtp_io_thread_t;
+
+//  Commands from one producer thread to one I/O thread, over a ring of
+//  their own
+typedef struct _zmtp_io_handoff_t zmtp_io_handoff_t;
+
+//  @interface
+//  Constructor; starts the thread
+zmtp_io_thread_t *
+    zmtp_io_thread_new (void);
+
+//  Destructor; stops and joins the thread. Handlers still registered are
+//  dropped without being called.
+void
+    zmtp_io_thread_destroy (zmtp_io_thread_t **self_p);
+
+//  Pin the thread to one CPU. Returns 0 if OK, -1 with errno set if the
+//  CPU does not exist or the platform cannot pin threads.
+int
+    zmtp_io_thread_set_cpu (zmtp_io_thread_t *self, int cpu);
+
+//  Let the thread run on any of the ncpus CPUs listed, e.g. those of one
+//  NUMA node. Returns 0 if OK, -1 with errno set if a CPU does not exist
+//  or the platform cannot pin threads.
+int
+    zmtp_io_thread_set_cpus (zmtp_io_thread_t *self,
+                             const int *cpus, size_t ncpus);
+
+//  Queue fn (arg, msg) to run on the I/O thread, in order with other
+//  commands. Safe to call from any thread; never blocks.
+void
+    zmtp_io_thread_post (zmtp_io_thread_t *self,
+                         zmtp_io_fn *fn, void *arg, zmtp_msg_t *msg);
+
+//  Open a handoff to the target I/O thread: a bounded SPSC ring that
+//  carries commands from one producer thread, in order, without taking
+//  an allocation or contending with other producers. Any one thread may
+//  post on it at a time, an application thread or another I/O thread.
+zmtp_io_handoff_t *
+    zmtp_io_handoff_new (zmtp_io_thread_t *target);
+
+//  Close the handoff from its producer thread; the I/O thread runs the
+//  commands still queued, then frees it. Close every handoff before its
+//  I/O thread is destroyed.
+void
+    zmtp_io_handoff_destroy (zmtp_io_handoff_t **self_p);
+
+//  Queue fn (arg, msg) to run on the handoff's I/O thread, in order with
+//  the handoff's other commands. Call from the producer thread only;
+//  never blocks. A full ring is bypassed through the thread's command
+//  queue without reordering anything.
+void
+    zmtp_io_handoff_post (zmtp_io_handoff_t *self,
+                          zmtp_io_fn *fn, void *arg, zmtp_msg_t *msg);
+
+//  Start polling on behalf of handler; call on the I/O thread only
+void
+    zmtp_io_thread_add (zmtp_io_thread_t *self,
+                        const zmtp_io_handler_t *handler, void *arg);
+
+//  Stop polling on behalf of handler; call on the I/O thread only
+void
+    zmtp_io_thread_remove (zmtp_io_thread_t *self, void *arg);
+
+//  Self test of this class
+void
+    zmtp_io_thread_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
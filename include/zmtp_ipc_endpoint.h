@@ -30,6 +30,9 @@ void
 int
     zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self);
 
+int
+    zmtp_ipc_endpoint_connect_timeout (zmtp_ipc_endpoint_t *self, int timeout);
+
 int
     zmtp_ipc_endpoint_listen (zmtp_ipc_endpoint_t *self);
 
@@ -0,0 +1,105 @@
+/*  =========================================================================
+    zmtp_metrics - counters published in shared memory
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_METRICS_H_INCLUDED__
+#define __ZMTP_METRICS_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Layout of the segment; readers check magic and version before use
+
+#define ZMTP_METRICS_MAGIC      0x7a6d74706d657472ULL
+#define ZMTP_METRICS_VERSION    1
+#define ZMTP_METRICS_SLOTS      256
+#define ZMTP_METRICS_ENDPOINT   112
+
+//  One socket's counters. The publisher makes seq odd while it rewrites
+//  the record, so readers retry until they see the same even seq before
+//  and after copying it.
+typedef struct {
+    uint64_t seq;               //  Seqlock sequence number
+    uint64_t id;                //  Socket serial number, 0 if slot is free
+    char endpoint [ZMTP_METRICS_ENDPOINT];  //  Peer or listening endpoint
+    uint64_t sndq;              //  Outbound frames not yet written
+    uint64_t rcvq;              //  Inbound frames not yet received
+    uint64_t dropped;           //  Messages dropped by the HWM policy
+    zmtp_stats_t stats;         //  Traffic counters
+} zmtp_metrics_record_t;
+
+typedef struct {
+    uint64_t magic;             //  ZMTP_METRICS_MAGIC
+    uint64_t version;           //  ZMTP_METRICS_VERSION
+    int64_t pid;                //  Publishing process
+    int64_t interval;           //  Msecs between updates
+    uint64_t updated;           //  Monotonic msecs of the last update
+    uint64_t unpublished;       //  Sockets that found no free slot
+    zmtp_metrics_record_t records [ZMTP_METRICS_SLOTS];
+} zmtp_metrics_segment_t;
+
+//  Fills in the sndq, rcvq, dropped and stats of a record; called on the
+//  publisher thread
+typedef void (zmtp_metrics_fn) (void *arg, zmtp_metrics_record_t *record);
+
+//  @interface
+//  Create shared memory segment name, e.g. "/zmtp-myapp", and start a
+//  thread that publishes the counters of every registered socket into it
+//  each interval msecs. NULL names it "/zmtp-<pid>". Returns 0, or -1 if
+//  already publishing (EALREADY) or the segment cannot be created.
+int
+    zmtp_metrics_start (const char *name, int interval);
+
+//  Stop publishing and remove the segment. Returns 0, or -1 if not
+//  publishing.
+int
+    zmtp_metrics_stop (void);
+
+//  Register a socket to publish, starting to publish first if environment
+//  variable ZMTP_METRICS names a segment ("1" for the default name).
+//  Returns the socket's slot, or -1 if not publishing or all slots are
+//  taken. sample must stay callable until the slot is removed.
+int
+    zmtp_metrics_add (const char *endpoint, zmtp_metrics_fn *sample,
+                      void *arg);
+
+//  Stop publishing a socket; sample is not called once this returns.
+//  Does nothing if slot is -1.
+void
+    zmtp_metrics_remove (int slot);
+
+//  Map segment name read-only, checking its layout. Returns NULL with
+//  errno set if it does not exist or is not a metrics segment. Release
+//  with zmtp_metrics_close.
+zmtp_metrics_segment_t *
+    zmtp_metrics_open (const char *name);
+
+//  Unmap a segment mapped by zmtp_metrics_open
+void
+    zmtp_metrics_close (zmtp_metrics_segment_t **segment_p);
+
+//  Take a consistent copy of a record while the publisher may be writing
+//  it. Returns 0, or -1 if the slot is free.
+int
+    zmtp_metrics_read (zmtp_metrics_segment_t *segment, size_t slot,
+                       zmtp_metrics_record_t *record);
+
+//  Self test of this class
+void
+    zmtp_metrics_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/*  =========================================================================
+    zmtp_mpscq - lock-free multi-producer, single-consumer queue
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_MPSCQ_H_INCLUDED__
+#define __ZMTP_MPSCQ_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Link embedded in every queued item; the queue never allocates
+typedef struct zmtp_mpscq_node {
+    struct zmtp_mpscq_node *next;
+} zmtp_mpscq_node_t;
+
+//  Queue structure, embedded by its owner
+typedef struct {
+    zmtp_mpscq_node_t *head;    //  Last pushed node, producers swap it
+    zmtp_mpscq_node_t *tail;    //  Next node to pop, consumer only
+    zmtp_mpscq_node_t stub;     //  Keeps the list non-empty
+} zmtp_mpscq_t;
+
+//  @interface
+//  Initialize an empty queue
+void
+    zmtp_mpscq_init (zmtp_mpscq_t *self);
+
+//  Append node; safe to call from any number of threads at once
+void
+    zmtp_mpscq_push (zmtp_mpscq_t *self, zmtp_mpscq_node_t *node);
+
+//  Remove and return the oldest node, or NULL if the queue is empty or a
+//  producer is half-way through a push. Only one thread may pop.
+zmtp_mpscq_node_t *
+    zmtp_mpscq_pop (zmtp_mpscq_t *self);
+
+//  Return true if there is nothing to pop
+bool
+    zmtp_mpscq_empty (zmtp_mpscq_t *self);
+
+//  Self test of this class
+void
+    zmtp_mpscq_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,6 +30,9 @@ struct _zmtp_msg_t {
     byte *data;                 //  Data part of message
     size_t size;                //  Size of data in bytes
     bool greedy;                //  Did we take ownership of data?
+    bool mapped;                //  Is data a file mapping to unmap?
+    int64_t timestamp;          //  Kernel receive time, 0 if unknown
+    uint32_t refs;              //  Holders besides the one that made it
 };
 
 
@@ -43,7 +46,8 @@ zmtp_msg_t *
     zmtp_msg_new (byte flags, size_t size);
 
 //  Constructor; takes ownership of data and frees it when destroying the
-//  message. Nullifies the data reference.
+//  message. data must come from the allocator installed with
+//  zmtp_set_allocator, malloc by default. Nullifies the data reference.
 zmtp_msg_t *
     zmtp_msg_from_data (byte flags, byte **data_p, size_t size);
 
@@ -52,6 +56,17 @@ zmtp_msg_t *
 zmtp_msg_t *
     zmtp_msg_from_const_data (byte flags, void *data, size_t size);
 
+//  Constructor that maps size bytes of file fd from offset read-only and
+//  unmaps them when destroying the message. The body is read straight
+//  from the page cache, without copying it in. Returns NULL with errno
+//  set if the file cannot be mapped.
+zmtp_msg_t *
+    zmtp_msg_from_file (byte flags, int fd, off_t offset, size_t size);
+
+//  Return a copy of the message; the copy owns its own data buffer
+zmtp_msg_t *
+    zmtp_msg_dup (zmtp_msg_t *self);
+
 //  Destructor; frees message data and destroys the message
 void
     zmtp_msg_destroy (zmtp_msg_t **self_p);
@@ -68,6 +83,12 @@ byte *
 size_t
     zmtp_msg_size (zmtp_msg_t *self);
 
+//  Return the time the kernel received the message, in nanoseconds since
+//  the epoch (CLOCK_REALTIME), or 0 if the channel it came from does not
+//  timestamp receives. See zmtp_channel_set_timestamping.
+int64_t
+    zmtp_msg_timestamp (zmtp_msg_t *self);
+
 //  Self test of this class
 void
     zmtp_msg_test (bool verbose);
@@ -0,0 +1,75 @@
+/*  =========================================================================
+    zmtp_msgq - FIFO queue of messages
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_MSGQ_H_INCLUDED__
+#define __ZMTP_MSGQ_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_msgq_t zmtp_msgq_t;
+
+//  @interface
+//  Constructor
+zmtp_msgq_t *
+    zmtp_msgq_new (void);
+
+//  Destructor; destroys all queued messages
+void
+    zmtp_msgq_destroy (zmtp_msgq_t **self_p);
+
+//  Append message to the tail of the queue; takes ownership of the
+//  message and nullifies the reference.
+void
+    zmtp_msgq_push (zmtp_msgq_t *self, zmtp_msg_t **msg_p);
+
+//  Same as zmtp_msgq_push, keeping a timestamp with the message
+void
+    zmtp_msgq_push_stamped (zmtp_msgq_t *self, zmtp_msg_t **msg_p,
+                            int64_t stamp);
+
+//  Remove and return message at the head of the queue, or NULL if empty
+zmtp_msg_t *
+    zmtp_msgq_pop (zmtp_msgq_t *self);
+
+//  Return message at the head of the queue without removing it
+zmtp_msg_t *
+    zmtp_msgq_first (zmtp_msgq_t *self);
+
+//  Return timestamp of the message at the head of the queue, 0 if none
+int64_t
+    zmtp_msgq_first_stamp (zmtp_msgq_t *self);
+
+//  Return message at the given position from the head, or NULL
+zmtp_msg_t *
+    zmtp_msgq_at (zmtp_msgq_t *self, size_t index);
+
+//  Remove and return message at the given position from the head
+zmtp_msg_t *
+    zmtp_msgq_remove (zmtp_msgq_t *self, size_t index);
+
+//  Return number of queued messages
+size_t
+    zmtp_msgq_size (zmtp_msgq_t *self);
+
+//  Self test of this class
+void
+    zmtp_msgq_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
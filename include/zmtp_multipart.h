@@ -0,0 +1,94 @@
+/*  =========================================================================
+    zmtp_multipart - multipart message class
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_MULTIPART_H_INCLUDED__
+#define __ZMTP_MULTIPART_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Structure of our class. The bodies of all parts lie back to back in
+//  one buffer; part i runs from offsets [i] to offsets [i + 1].
+
+struct _zmtp_multipart_t {
+    byte *data;                 //  Bodies of all parts
+    size_t size;                //  Bytes of data in use
+    size_t capacity;            //  Bytes of data allocated
+    size_t *offsets;            //  Start of each part, then end of last
+    size_t parts;               //  Number of parts
+    size_t max_parts;           //  Parts offsets has room for
+};
+
+//  Opaque class structure
+typedef struct _zmtp_multipart_t zmtp_multipart_t;
+
+//  @interface
+//  Constructor; creates a message with no parts
+zmtp_multipart_t *
+    zmtp_multipart_new (void);
+
+//  Destructor
+void
+    zmtp_multipart_destroy (zmtp_multipart_t **self_p);
+
+//  Append a part holding a copy of size bytes of data. Returns 0, or -1
+//  with errno ENOMEM.
+int
+    zmtp_multipart_append (zmtp_multipart_t *self,
+                           const void *data, size_t size);
+
+//  Append a part of size bytes and return where to write its body, which
+//  stays valid until the next part is added. Returns NULL with errno
+//  ENOMEM if the message cannot grow.
+byte *
+    zmtp_multipart_add (zmtp_multipart_t *self, size_t size);
+
+//  Remove all parts, keeping the memory for the next message
+void
+    zmtp_multipart_reset (zmtp_multipart_t *self);
+
+//  Return number of parts
+size_t
+    zmtp_multipart_parts (zmtp_multipart_t *self);
+
+//  Return body of part index
+byte *
+    zmtp_multipart_part_data (zmtp_multipart_t *self, size_t index);
+
+//  Return size of part index
+size_t
+    zmtp_multipart_part_size (zmtp_multipart_t *self, size_t index);
+
+//  Return the bodies of all parts, back to back
+byte *
+    zmtp_multipart_data (zmtp_multipart_t *self);
+
+//  Return the total size of all parts
+size_t
+    zmtp_multipart_size (zmtp_multipart_t *self);
+
+//  Return where each part starts in zmtp_multipart_data, followed by the
+//  total size: parts + 1 entries
+const size_t *
+    zmtp_multipart_offsets (zmtp_multipart_t *self);
+
+//  Self test of this class
+void
+    zmtp_multipart_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
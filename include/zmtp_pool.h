@@ -0,0 +1,84 @@
+/*  =========================================================================
+    zmtp_pool - pool of connected channels
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_POOL_H_INCLUDED__
+#define __ZMTP_POOL_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure. A background thread keeps the pool full,
+//  connecting and handshaking channels ahead of need and replacing any
+//  that break while idle, so a lease costs no connection setup.
+typedef struct _zmtp_pool_t zmtp_pool_t;
+
+//  @interface
+//  Create a pool of size channels
+zmtp_pool_t *
+    zmtp_pool_new (size_t size);
+
+//  Destructor; closes the idle channels. Every leased channel must have
+//  been returned.
+void
+    zmtp_pool_destroy (zmtp_pool_t **self_p);
+
+//  Set connect deadline of pooled channels in msecs; default 5000
+void
+    zmtp_pool_set_connect_timeout (zmtp_pool_t *self, int timeout);
+
+//  Set initial reconnect interval in msecs; default 100
+void
+    zmtp_pool_set_reconnect_ivl (zmtp_pool_t *self, int ivl);
+
+//  Set maximum reconnect interval in msecs; default 30000
+void
+    zmtp_pool_set_reconnect_ivl_max (zmtp_pool_t *self, int ivl_max);
+
+//  Set msecs between health checks of idle channels; default 1000
+void
+    zmtp_pool_set_check_ivl (zmtp_pool_t *self, int ivl);
+
+//  Start filling the pool with channels connected to endpoint_str. Set
+//  options first. Returns 0, or -1 with errno EINVAL if the endpoint is
+//  not valid, EALREADY if the pool is already connected.
+int
+    zmtp_pool_connect (zmtp_pool_t *self, const char *endpoint_str);
+
+//  Take a connected, handshaken channel out of the pool, waiting up to
+//  timeout msecs (-1 means no deadline) for one if all are in use or
+//  still connecting. Never connects on the calling thread. Returns NULL
+//  with errno EAGAIN if timeout is 0 and none is ready, ETIMEDOUT if
+//  none became ready in time.
+zmtp_channel_t *
+    zmtp_pool_lease (zmtp_pool_t *self, int timeout);
+
+//  Give a leased channel back and nullify the reference. A channel left
+//  in the middle of a message, or that the peer closed, is destroyed and
+//  replaced in the background.
+void
+    zmtp_pool_return (zmtp_pool_t *self, zmtp_channel_t **channel_p);
+
+//  Return number of channels ready to lease
+size_t
+    zmtp_pool_ready (zmtp_pool_t *self);
+
+//  Self test of this class
+void
+    zmtp_pool_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
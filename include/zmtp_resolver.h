@@ -0,0 +1,73 @@
+/*  =========================================================================
+    zmtp_resolver - asynchronous hostname resolver with a cache
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_RESOLVER_H_INCLUDED__
+#define __ZMTP_RESOLVER_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Most addresses kept for one name
+#define ZMTP_RESOLVER_MAX_ADDRS     16
+
+//  Default msecs answers are reused for, and failures remembered for
+#define ZMTP_RESOLVER_TTL           30000
+#define ZMTP_RESOLVER_NEGATIVE_TTL  5000
+
+//  Addresses of a name, linked as a getaddrinfo result so connect code
+//  can take either; addrinfo is NULL if there are none
+typedef struct {
+    struct addrinfo *addrinfo;
+    struct addrinfo ai [ZMTP_RESOLVER_MAX_ADDRS];
+    struct sockaddr_storage addr [ZMTP_RESOLVER_MAX_ADDRS];
+} zmtp_resolved_t;
+
+//  Looks up a name; same contract as getaddrinfo, and the result is
+//  released with freeaddrinfo
+typedef int (zmtp_resolver_fn) (const char *node, const char *service,
+                                const struct addrinfo *hints,
+                                struct addrinfo **res);
+
+//  Get the addresses of host with port filled in, waiting up to timeout
+//  msecs (-1 means no deadline) for a lookup in progress. Never calls the
+//  resolver on this thread. Returns 0, or -1 with errno set: EAGAIN if
+//  timeout is 0 and the name is still being looked up, ETIMEDOUT if the
+//  lookup did not finish in time, EHOSTUNREACH if the name does not
+//  resolve.
+int
+    zmtp_resolver_resolve (const char *host, unsigned short port,
+                           int timeout, zmtp_resolved_t *resolved);
+
+//  Start looking up host in the background unless its answer is cached
+void
+    zmtp_resolver_prefetch (const char *host);
+
+//  Set msecs answers and failures are cached for; applies to lookups
+//  that finish from now on
+void
+    zmtp_resolver_set_ttl (int ttl, int negative_ttl);
+
+//  Use fn to look up names, or getaddrinfo if NULL, and forget every
+//  answer cached so far
+void
+    zmtp_resolver_set_fn (zmtp_resolver_fn *fn);
+
+//  Forget every cached answer; lookups in progress are not waited for
+void
+    zmtp_resolver_purge (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
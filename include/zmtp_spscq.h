@@ -0,0 +1,55 @@
+/*  =========================================================================
+    zmtp_spscq - bounded lock-free single-producer, single-consumer ring
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_SPSCQ_H_INCLUDED__
+#define __ZMTP_SPSCQ_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+typedef struct _zmtp_spscq_t zmtp_spscq_t;
+
+//  @interface
+//  Constructor; ring of at least capacity items of item_size bytes each
+zmtp_spscq_t *
+    zmtp_spscq_new (size_t item_size, size_t capacity);
+
+//  Destructor; items still queued are discarded
+void
+    zmtp_spscq_destroy (zmtp_spscq_t **self_p);
+
+//  Copy item into the ring; returns -1 if the ring is full. Only one
+//  thread may push.
+int
+    zmtp_spscq_push (zmtp_spscq_t *self, const void *item);
+
+//  Copy the oldest item out of the ring; returns -1 if the ring is empty.
+//  Only one thread may pop.
+int
+    zmtp_spscq_pop (zmtp_spscq_t *self, void *item);
+
+//  Return number of items queued; exact only on the consumer thread
+size_t
+    zmtp_spscq_size (zmtp_spscq_t *self);
+
+//  Self test of this class
+void
+    zmtp_spscq_test (bool verbose);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+/*  =========================================================================
+    zmtp_stats - traffic counters of a channel or dealer
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_STATS_H_INCLUDED__
+#define __ZMTP_STATS_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Counters since the channel or dealer was created. Every field is a
+//  uint64_t, so snapshots can be taken field by field.
+typedef struct {
+    uint64_t frames_out;        //  Frames written, commands included
+    uint64_t bytes_out;         //  Frame body bytes written
+    uint64_t commands_out;      //  Command frames written
+    uint64_t frames_in;         //  Frames read, commands included
+    uint64_t bytes_in;          //  Frame body bytes read
+    uint64_t commands_in;       //  Command frames read
+    uint64_t send_calls;        //  Send system calls
+    uint64_t recv_calls;        //  Receive system calls
+    uint64_t partial_writes;    //  Sends that wrote part of what was asked
+    uint64_t eagains;           //  Sends and receives that would block
+    uint64_t allocations;       //  Messages allocated for received frames
+    uint64_t handshakes;        //  Handshakes completed
+    uint64_t handshake_usecs;   //  Duration of the last handshake
+} zmtp_stats_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,6 +30,9 @@ void
 int
     zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self);
 
+int
+    zmtp_tcp_endpoint_connect_timeout (zmtp_tcp_endpoint_t *self, int timeout);
+
 int
     zmtp_tcp_endpoint_listen (zmtp_tcp_endpoint_t *self);
 
@@ -0,0 +1,53 @@
+/*  =========================================================================
+    zmtp_trace - USDT tracepoints
+
+    When the library is built with systemtap's sys/sdt.h, each probe is a
+    single nop plus an ELF note; tools such as bpftrace and perf attach to
+    them at run time, and the process pays nothing while nobody does.
+    Without sys/sdt.h the probes compile to nothing and their arguments
+    are not evaluated.
+
+    Probes, all under provider zmtp:
+
+        frame_encode    (channel, msg flags, body size)
+        frame_sent      (channel, msg flags, body size)
+        frame_decode    (channel, msg flags, body size)
+        handshake_start (channel, fd)
+        handshake_done  (channel, fd, nsecs)
+        handshake_fail  (channel, fd, errno)
+        tcp_connect     (fd or -1, errno)
+        tcp_accept      (fd or -1, errno)
+        resolve         (getaddrinfo result, errno, host)
+        ipc_connect     (fd or -1, errno, path less any '@')
+        ipc_accept      (fd or -1, errno, path less any '@')
+        msg_destroy     (msg, size)
+
+    For example, the sizes of frames written:
+
+        bpftrace -e 'usdt:./libzmtp.so:zmtp:frame_sent
+            { @bytes = hist (arg2); }'
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __ZMTP_TRACE_H_INCLUDED__
+#define __ZMTP_TRACE_H_INCLUDED__
+
+#if defined (ZMTP_HAVE_SDT)
+#   include <sys/sdt.h>
+#   define ZMTP_TRACE2(name, a, b) \
+        DTRACE_PROBE2 (zmtp, name, a, b)
+#   define ZMTP_TRACE3(name, a, b, c) \
+        DTRACE_PROBE3 (zmtp, name, a, b, c)
+#else
+#   define ZMTP_TRACE2(name, a, b)          ((void) 0)
+#   define ZMTP_TRACE3(name, a, b, c)       ((void) 0)
+#endif
+
+#endif
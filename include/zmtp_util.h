@@ -1,8 +1,58 @@
+/*  =========================================================================
+    zmtp_util - internal helpers
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
 #ifndef __ZMTP_UTIL_H__
 #define __ZMTP_UTIL_H__
 
 #include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Return current monotonic time in milliseconds
+int64_t
+    zmtp_clock_mono (void);
+
+//  Return current monotonic time in microseconds
+int64_t
+    zmtp_clock_usecs (void);
+
+//  Return current monotonic time in nanoseconds
+int64_t
+    zmtp_clock_nsecs (void);
+
+//  Add n to a counter that only the calling thread writes; other threads
+//  may read it at any time with zmtp_stats_copy. Costs no locked
+//  instruction.
+#define ZMTP_STAT_ADD(counter, n) \
+    __atomic_store_n (&(counter), \
+        __atomic_load_n (&(counter), __ATOMIC_RELAXED) + (n), \
+        __ATOMIC_RELAXED)
+
+//  Take n from such a counter, for gauges that go down as well as up;
+//  n must not exceed the counter
+#define ZMTP_STAT_SUB(counter, n) \
+    __atomic_store_n (&(counter), \
+        __atomic_load_n (&(counter), __ATOMIC_RELAXED) - (n), \
+        __ATOMIC_RELAXED)
+
+//  Take a snapshot of counters that another thread may be updating
+void
+    zmtp_stats_copy (zmtp_stats_t *dest, const zmtp_stats_t *src);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -10,6 +10,7 @@
 #include "zmtp_msg.h"  
 
 #include "zmtp_util.h"
+#include "zmtp_identity.h"
 #include "zmtp_channel.h"
 #include "zmtpnet.h"
 
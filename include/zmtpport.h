@@ -2,11 +2,32 @@
 #define __ZMTPPORT_H__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
-void * zmtp_malloc(int size);
-void zmtp_free(void * tmp);
+//  Every allocation the library makes goes through these, and so through
+//  the allocator installed with zmtp_set_allocator. They return NULL when
+//  out of memory, like malloc.
 
+//  Allocate size bytes
+void *
+    zmtp_malloc (size_t size);
+
+//  Allocate size bytes set to zero, in place of zmalloc
+void *
+    zmtp_zmalloc (size_t size);
+
+//  Resize a block, moving it if needed; NULL ptr allocates
+void *
+    zmtp_realloc (void *ptr, size_t size);
+
+//  Release a block; NULL is ignored
+void
+    zmtp_free (void *ptr);
+
+//  Return a copy of string
+char *
+    zmtp_strdup (const char *string);
 
 #endif
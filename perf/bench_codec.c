@@ -0,0 +1,154 @@
+/*  =========================================================================
+    bench_codec - frame codec microbenchmark
+
+    Measures nanoseconds per frame to encode frames into a buffer, to walk
+    their headers one at a time, to scan them in batches, and to decode
+    them into messages, for several frame size distributions. No sockets
+    are involved.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtpinc.h"
+#include "zmtp_classes.h"
+#include "perf.h"
+
+//  Most frames and bytes per pass, and minimum time spent on each
+//  measurement
+
+#define FRAMES      4096
+#define PASS_BYTES  (16 * 1024 * 1024)
+#define MIN_NSECS   200000000
+#define SCAN_MAX    256
+
+typedef struct {
+    const char *name;
+    //  Frame sizes and the share of frames, in percent, of each
+    size_t sizes [3];
+    int shares [3];
+} distribution_t;
+
+static const distribution_t s_distributions [] = {
+    { "8 B",            { 8 },               { 100 } },
+    { "20 B",           { 20 },              { 100 } },
+    { "64 B",           { 64 },              { 100 } },
+    { "1 KB",           { 1024 },            { 100 } },
+    { "mixed",          { 32, 512, 8192 },   { 80, 15, 5 } },
+    { "64 KB",          { 65536 },           { 100 } },
+};
+
+static volatile size_t s_sink;
+
+int main (int argc, char *argv [])
+{
+    printf ("%-8s %12s %12s %12s %12s\n",
+        "frames", "encode", "headers", "scan", "decode");
+    for (size_t d = 0; d < sizeof s_distributions / sizeof *s_distributions;
+         d++) {
+        const distribution_t *distribution = &s_distributions [d];
+
+        //  Build the frames, sizes picked with a fixed seed
+        zmtp_msg_t *msgs [FRAMES];
+        size_t largest = 0;
+        for (size_t i = 0; i < 3; i++)
+            if (distribution->sizes [i] > largest)
+                largest = distribution->sizes [i];
+        size_t nframes = PASS_BYTES / largest;
+        if (nframes > FRAMES)
+            nframes = FRAMES;
+        uint32_t seed = 1;
+        size_t total = 0;
+        for (size_t i = 0; i < nframes; i++) {
+            seed = seed * 1103515245 + 12345;
+            int pick = (int) ((seed >> 16) % 100);
+            size_t which = 0;
+            while (pick >= distribution->shares [which]) {
+                pick -= distribution->shares [which];
+                which++;
+            }
+            msgs [i] = perf_msg_new (distribution->sizes [which]);
+            total += ZMTP_CODEC_HEADER_MAX + distribution->sizes [which];
+        }
+        byte *buffer = (byte *) malloc (total);
+        assert (buffer);
+
+        //  Encode
+        size_t frames = 0;
+        size_t used = 0;
+        uint64_t start = perf_clock_ns ();
+        uint64_t elapsed;
+        do {
+            used = 0;
+            for (size_t i = 0; i < nframes; i++)
+                used += zmtp_codec_encode (
+                    msgs [i], buffer + used, total - used);
+            frames += nframes;
+        } while ((elapsed = perf_clock_ns () - start) < MIN_NSECS);
+        const double encode = (double) elapsed / (double) frames;
+
+        //  Walk headers only, as a parser skipping bodies would
+        frames = 0;
+        start = perf_clock_ns ();
+        do {
+            size_t offset = 0;
+            while (offset < used) {
+                byte msg_flags;
+                uint64_t body_size;
+                offset += zmtp_codec_decode_header (buffer + offset,
+                    used - offset, &msg_flags, &body_size);
+                offset += (size_t) body_size;
+                s_sink += msg_flags;
+            }
+            frames += nframes;
+        } while ((elapsed = perf_clock_ns () - start) < MIN_NSECS);
+        const double headers = (double) elapsed / (double) frames;
+
+        //  Scan in batches, as the channel does
+        zmtp_frame_t descriptors [SCAN_MAX];
+        frames = 0;
+        start = perf_clock_ns ();
+        do {
+            size_t offset = 0;
+            while (offset < used) {
+                size_t consumed;
+                const size_t count = zmtp_codec_scan (buffer + offset,
+                    used - offset, descriptors, SCAN_MAX, &consumed);
+                offset += consumed;
+                s_sink += descriptors [count - 1].size;
+            }
+            frames += nframes;
+        } while ((elapsed = perf_clock_ns () - start) < MIN_NSECS);
+        const double scan = (double) elapsed / (double) frames;
+
+        //  Decode into messages
+        frames = 0;
+        start = perf_clock_ns ();
+        do {
+            size_t offset = 0;
+            while (offset < used) {
+                size_t consumed;
+                zmtp_msg_t *msg = zmtp_codec_decode (
+                    buffer + offset, used - offset, &consumed);
+                assert (msg);
+                offset += consumed;
+                s_sink += zmtp_msg_size (msg);
+                zmtp_msg_destroy (&msg);
+            }
+            frames += nframes;
+        } while ((elapsed = perf_clock_ns () - start) < MIN_NSECS);
+        const double decode = (double) elapsed / (double) frames;
+
+        printf ("%-8s %9.1f ns %9.1f ns %9.1f ns %9.1f ns\n",
+            distribution->name, encode, headers, scan, decode);
+        for (size_t i = 0; i < nframes; i++)
+            zmtp_msg_destroy (&msgs [i]);
+        free (buffer);
+    }
+    return 0;
+}
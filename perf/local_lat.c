@@ -0,0 +1,54 @@
+/*  =========================================================================
+    local_lat - echoing side of the latency test
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp.h"
+#include "perf.h"
+
+int main (int argc, char *argv [])
+{
+    if (argc != 4 && argc != 5) {
+        printf ("usage: local_lat <bind-to> <message-size> "
+                "<roundtrip-count> [io-threads]\n");
+        return 1;
+    }
+    const char *bind_to = argv [1];
+    const size_t message_size = (size_t) atol (argv [2]);
+    const size_t roundtrip_count = (size_t) atol (argv [3]);
+    if (argc == 5 && !zmtp_init_io_threads ((size_t) atoi (argv [4]))) {
+        printf ("error in zmtp_init_io_threads: %s\n", strerror (errno));
+        return -1;
+    }
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    if (zmtp_dealer_listen (dealer, bind_to) == -1) {
+        printf ("error in zmtp_dealer_listen: %s\n", strerror (errno));
+        return -1;
+    }
+    for (size_t count = 0; count < roundtrip_count; count++) {
+        zmtp_msg_t *msg = zmtp_dealer_recv (dealer);
+        if (!msg) {
+            printf ("error in zmtp_dealer_recv: %s\n", strerror (errno));
+            return -1;
+        }
+        assert (zmtp_msg_size (msg) == message_size);
+        if (zmtp_dealer_send (dealer, msg) == -1) {
+            printf ("error in zmtp_dealer_send: %s\n", strerror (errno));
+            return -1;
+        }
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_dealer_destroy (&dealer);
+    if (argc == 5)
+        zmtp_deinit ();
+    return 0;
+}
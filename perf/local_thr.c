@@ -0,0 +1,70 @@
+/*  =========================================================================
+    local_thr - receiving side of the throughput test
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp.h"
+#include "perf.h"
+
+int main (int argc, char *argv [])
+{
+    if (argc != 4 && argc != 5) {
+        printf ("usage: local_thr <bind-to> <message-size> "
+                "<message-count> [io-threads]\n");
+        return 1;
+    }
+    const char *bind_to = argv [1];
+    const size_t message_size = (size_t) atol (argv [2]);
+    const size_t message_count = (size_t) atol (argv [3]);
+    if (argc == 5 && !zmtp_init_io_threads ((size_t) atoi (argv [4]))) {
+        printf ("error in zmtp_init_io_threads: %s\n", strerror (errno));
+        return -1;
+    }
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    if (zmtp_dealer_listen (dealer, bind_to) == -1) {
+        printf ("error in zmtp_dealer_listen: %s\n", strerror (errno));
+        return -1;
+    }
+
+    //  Start timing from the first message, so connect time is not counted
+    zmtp_msg_t *msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == message_size);
+    zmtp_msg_destroy (&msg);
+    const uint64_t start = perf_clock_ns ();
+    for (size_t count = 1; count < message_count; count++) {
+        msg = zmtp_dealer_recv (dealer);
+        if (!msg) {
+            printf ("error in zmtp_dealer_recv: %s\n", strerror (errno));
+            return -1;
+        }
+        assert (zmtp_msg_size (msg) == message_size);
+        zmtp_msg_destroy (&msg);
+    }
+    uint64_t elapsed = perf_clock_ns () - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    const double seconds = (double) elapsed / 1e9;
+    const double throughput = (double) (message_count - 1) / seconds;
+    const double megabytes =
+        throughput * (double) message_size / (1024.0 * 1024.0);
+    printf ("message size: %zu [B]\n", message_size);
+    printf ("message count: %zu\n", message_count);
+    printf ("mean throughput: %.0f [msg/s]\n", throughput);
+    printf ("mean throughput: %.3f [MB/s]\n", megabytes);
+
+    zmtp_dealer_destroy (&dealer);
+    if (argc == 5)
+        zmtp_deinit ();
+    return 0;
+}
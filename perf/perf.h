@@ -0,0 +1,37 @@
+/*  =========================================================================
+    perf - helpers shared by the performance tests
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef __PERF_H_INCLUDED__
+#define __PERF_H_INCLUDED__
+
+//  Return monotonic time in nanoseconds
+
+static inline uint64_t
+perf_clock_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+//  Message body of the given size; contents do not matter to the tests
+
+static inline zmtp_msg_t *
+perf_msg_new (size_t size)
+{
+    zmtp_msg_t *msg = zmtp_msg_new (0, size);
+    assert (msg);
+    memset (zmtp_msg_data (msg), 'x', size);
+    return msg;
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*  =========================================================================
+    remote_lat - measuring side of the latency test
+
+    Sends a message, waits for it to come back, and records every round
+    trip so the report shows the tail as well as the mean.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp.h"
+#include "perf.h"
+
+static int
+s_compare (const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return x < y? -1: x > y;
+}
+
+//  Return the given percentile of sorted samples, in microseconds
+
+static double
+s_percentile (const uint64_t *samples, size_t count, double percentile)
+{
+    size_t index = (size_t) (percentile / 100.0 * (double) count);
+    if (index >= count)
+        index = count - 1;
+    return (double) samples [index] / 1000.0;
+}
+
+int main (int argc, char *argv [])
+{
+    if (argc != 4 && argc != 5) {
+        printf ("usage: remote_lat <connect-to> <message-size> "
+                "<roundtrip-count> [io-threads]\n");
+        return 1;
+    }
+    const char *connect_to = argv [1];
+    const size_t message_size = (size_t) atol (argv [2]);
+    const size_t roundtrip_count = (size_t) atol (argv [3]);
+    if (roundtrip_count == 0) {
+        printf ("roundtrip-count must be at least 1\n");
+        return 1;
+    }
+    if (argc == 5 && !zmtp_init_io_threads ((size_t) atoi (argv [4]))) {
+        printf ("error in zmtp_init_io_threads: %s\n", strerror (errno));
+        return -1;
+    }
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    //  Give the local side time to bind
+    int attempts = 0;
+    while (zmtp_dealer_connect (dealer, connect_to) == -1) {
+        if (++attempts == 100) {
+            printf ("error in zmtp_dealer_connect: %s\n", strerror (errno));
+            return -1;
+        }
+        usleep (100 * 1000);
+    }
+
+    uint64_t *samples =
+        (uint64_t *) malloc (roundtrip_count * sizeof *samples);
+    assert (samples);
+    zmtp_msg_t *msg = perf_msg_new (message_size);
+    const uint64_t start = perf_clock_ns ();
+    for (size_t count = 0; count < roundtrip_count; count++) {
+        const uint64_t sent = perf_clock_ns ();
+        if (zmtp_dealer_send (dealer, msg) == -1) {
+            printf ("error in zmtp_dealer_send: %s\n", strerror (errno));
+            return -1;
+        }
+        zmtp_msg_t *reply = zmtp_dealer_recv (dealer);
+        if (!reply) {
+            printf ("error in zmtp_dealer_recv: %s\n", strerror (errno));
+            return -1;
+        }
+        samples [count] = perf_clock_ns () - sent;
+        assert (zmtp_msg_size (reply) == message_size);
+        zmtp_msg_destroy (&reply);
+    }
+    const uint64_t elapsed = perf_clock_ns () - start;
+    zmtp_msg_destroy (&msg);
+
+    qsort (samples, roundtrip_count, sizeof *samples, s_compare);
+    printf ("message size: %zu [B]\n", message_size);
+    printf ("roundtrip count: %zu\n", roundtrip_count);
+    printf ("average latency: %.3f [us]\n",
+        (double) elapsed / (double) (roundtrip_count * 2) / 1000.0);
+    printf ("roundtrip p50: %.3f [us]\n",
+        s_percentile (samples, roundtrip_count, 50.0));
+    printf ("roundtrip p99: %.3f [us]\n",
+        s_percentile (samples, roundtrip_count, 99.0));
+    printf ("roundtrip p99.9: %.3f [us]\n",
+        s_percentile (samples, roundtrip_count, 99.9));
+    printf ("roundtrip max: %.3f [us]\n",
+        (double) samples [roundtrip_count - 1] / 1000.0);
+    free (samples);
+
+    zmtp_dealer_destroy (&dealer);
+    if (argc == 5)
+        zmtp_deinit ();
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*  =========================================================================
+    remote_thr - sending side of the throughput test
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp.h"
+#include "perf.h"
+
+int main (int argc, char *argv [])
+{
+    if (argc != 4 && argc != 5) {
+        printf ("usage: remote_thr <connect-to> <message-size> "
+                "<message-count> [io-threads]\n");
+        return 1;
+    }
+    const char *connect_to = argv [1];
+    const size_t message_size = (size_t) atol (argv [2]);
+    const size_t message_count = (size_t) atol (argv [3]);
+    if (argc == 5 && !zmtp_init_io_threads ((size_t) atoi (argv [4]))) {
+        printf ("error in zmtp_init_io_threads: %s\n", strerror (errno));
+        return -1;
+    }
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    //  Give the local side time to bind
+    int attempts = 0;
+    while (zmtp_dealer_connect (dealer, connect_to) == -1) {
+        if (++attempts == 100) {
+            printf ("error in zmtp_dealer_connect: %s\n", strerror (errno));
+            return -1;
+        }
+        usleep (100 * 1000);
+    }
+
+    zmtp_msg_t *msg = perf_msg_new (message_size);
+    for (size_t count = 0; count < message_count; count++)
+        if (zmtp_dealer_send (dealer, msg) == -1) {
+            printf ("error in zmtp_dealer_send: %s\n", strerror (errno));
+            return -1;
+        }
+    zmtp_msg_destroy (&msg);
+
+    //  Lingers until everything queued is written
+    zmtp_dealer_destroy (&dealer);
+    if (argc == 5)
+        zmtp_deinit ();
+    return 0;
+}
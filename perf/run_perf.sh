@@ -0,0 +1,43 @@
+#!/bin/sh
+#   Run the throughput and latency tests over tcp:// and ipc:// for message
+#   sizes from 1 B to 16 MB, on this host.
+#
+#   Usage: run_perf.sh [build-dir] [io-threads]
+#
+#   The build directory defaults to the current directory. With io-threads
+#   the tests run with that many background I/O threads on each side.
+
+BUILD=${1:-.}
+IO_THREADS=$2
+ENDPOINTS="tcp://127.0.0.1:5555 ipc://@zmtp-perf"
+SIZES="1 64 1024 16384 262144 1048576 16777216"
+
+#   Keep each run to about 256 MB, and the message count within reason
+count_for () {
+    count=$((268435456 / $1))
+    [ $count -gt 1000000 ] && count=1000000
+    [ $count -lt 64 ] && count=64
+    echo $count
+}
+
+run_pair () {
+    "$BUILD/$1" "$3" "$4" "$5" $IO_THREADS > /tmp/zmtp-perf-$$.out &
+    local_pid=$!
+    "$BUILD/$2" "$3" "$4" "$5" $IO_THREADS
+    wait $local_pid
+    cat /tmp/zmtp-perf-$$.out
+    rm -f /tmp/zmtp-perf-$$.out
+}
+
+for endpoint in $ENDPOINTS; do
+    for size in $SIZES; do
+        count=$(count_for $size)
+        echo "== $endpoint, $size B, throughput"
+        run_pair local_thr remote_thr $endpoint $size $count
+        count=$((count / 10))
+        [ $count -gt 100000 ] && count=100000
+        [ $count -lt 16 ] && count=16
+        echo "== $endpoint, $size B, latency"
+        run_pair local_lat remote_lat $endpoint $size $count
+    done
+done
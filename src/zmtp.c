@@ -1,18 +1,160 @@
-#include "zmtp.h"
+/*  =========================================================================
+    zmtp - library setup
 
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Default number of background I/O threads
+
+#define ZMTP_IO_THREADS 1
+
+//  Context started by zmtp_init, if any
+static zmtp_ctx_t *s_default_ctx = NULL;
+
+
+//  --------------------------------------------------------------------------
+//  Start the default context with one background I/O thread, or on a NUMA
+//  machine one bound to each node, so every socket can be served from the
+//  node its packets arrive on
 
 bool zmtp_init()
 {
-    bool ret = false;
+    if (!s_default_ctx && zmtp_ctx_numa_nodes () > 1) {
+        s_default_ctx = zmtp_ctx_new_numa (ZMTP_IO_THREADS);
+        if (s_default_ctx)
+            return true;
+    }
+    return zmtp_init_io_threads (ZMTP_IO_THREADS);
+}
+
 
+//  --------------------------------------------------------------------------
+//  Start the default context with the given number of I/O threads. Dealers
+//  created afterwards hand their socket to one of these threads: sends only
+//  queue the message, and receives take messages the thread already read.
+//  Returns false if the context is already running or cannot start.
 
-    return ret;
+bool zmtp_init_io_threads (size_t io_threads)
+{
+    if (s_default_ctx || io_threads == 0)
+        return false;
+    s_default_ctx = zmtp_ctx_new (io_threads);
+    return s_default_ctx != NULL;
 }
 
+
+//  --------------------------------------------------------------------------
+//  Start the default context with one I/O thread pinned to each of the
+//  ncpus CPUs in cpus, or to each CPU the process may run on if cpus is
+//  NULL. Each dealer's socket is served by the thread its connection
+//  hashes to, so it never moves between cores. Returns false if the
+//  context is already running or a thread cannot be pinned.
+
+bool zmtp_init_cores (const int *cpus, size_t ncpus)
+{
+    if (s_default_ctx || (cpus && ncpus == 0))
+        return false;
+    s_default_ctx = zmtp_ctx_new_cores (cpus, ncpus);
+    return s_default_ctx != NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop the default context. All dealers created while it was running must
+//  have been destroyed. Returns false if it was not running.
+
 bool zmtp_deinit()
 {
-    bool ret = false;
+    if (!s_default_ctx)
+        return false;
+    zmtp_ctx_destroy (&s_default_ctx);
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set how long channels reuse a parsed endpoint
+
+void zmtp_set_endpoint_ttl (int ttl)
+{
+    zmtp_endpoint_cache_set_ttl (ttl);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set how long hostname lookups and their failures are cached
+
+void zmtp_set_resolver_ttl (int ttl, int negative_ttl)
+{
+    zmtp_resolver_set_ttl (ttl, negative_ttl);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pick up sockets passed by socket activation. The supervisor sets
+//  LISTEN_PID to our pid, so a child that inherited the environment does
+//  not mistake them for its own, and LISTEN_FDS to their number. They are
+//  marked close-on-exec so programs we run do not hold the port open.
+
+int zmtp_listen_fds ()
+{
+    const char *pid = getenv ("LISTEN_PID");
+    const char *fds = getenv ("LISTEN_FDS");
+    int count = 0;
+    if (pid && fds && strtol (pid, NULL, 10) == (long) getpid ()) {
+        const long value = strtol (fds, NULL, 10);
+        if (value > 0 && value <= INT_MAX - ZMTP_LISTEN_FDS_START)
+            count = (int) value;
+    }
+    for (int fd = ZMTP_LISTEN_FDS_START;
+         fd < ZMTP_LISTEN_FDS_START + count; fd++) {
+        const int flags = fcntl (fd, F_GETFD);
+        if (flags != -1)
+            fcntl (fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+    unsetenv ("LISTEN_PID");
+    unsetenv ("LISTEN_FDS");
+    unsetenv ("LISTEN_FDNAMES");
+    return count;
+}
+
 
+//  --------------------------------------------------------------------------
+//  Publish the counters of every dealer created afterwards in shared
+//  memory segment name every interval msecs; NULL names it "/zmtp-<pid>".
+//  Returns false if already publishing or the segment cannot be created.
 
-    return ret;
-}
\ No newline at end of file
+bool zmtp_init_metrics (const char *name, int interval)
+{
+    if (interval <= 0)
+        return false;
+    return zmtp_metrics_start (name, interval) == 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop publishing and remove the segment. Returns false if not
+//  publishing.
+
+bool zmtp_deinit_metrics ()
+{
+    return zmtp_metrics_stop () == 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the context started by zmtp_init, or NULL if none
+
+zmtp_ctx_t *
+zmtp_ctx_default (void)
+{
+    return s_default_ctx;
+}
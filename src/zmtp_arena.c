@@ -0,0 +1,528 @@
+/*  =========================================================================
+    zmtp_arena - hugepage-backed allocator for buffers and payloads
+
+    One contiguous mapping, 2 MB aligned. Receive buffers and message
+    bodies that come from it share a handful of TLB entries instead of one
+    per 4 KB page of scattered malloc memory, which shows at multi-GB/s.
+
+    Blocks from 64 bytes to 1 MB are powers of two, carved from the bottom
+    of the arena: those under 4 KB from pages cut into blocks of one size,
+    larger ones from runs of whole pages. Anything bigger takes a run of
+    whole huge pages from the top, so it spans as few TLB entries as it
+    can. A table with an entry per 4 KB page says what its blocks are, so
+    blocks carry no header and a power-of-two request fits its class
+    exactly. Freed blocks go on a free list per size, and freed runs on a
+    first-fit list, to be reused; the arena never shrinks.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+#include <sys/mman.h>
+#if defined (__UTYPE_LINUX)
+#   include <sys/syscall.h>
+#endif
+
+//  Huge page size, the page the class table tracks, and the smallest and
+//  largest blocks as powers of two
+
+#define ZMTP_ARENA_HUGEPAGE     (2 * 1024 * 1024)
+#define ZMTP_ARENA_PAGE         4096
+#define ZMTP_ARENA_MIN_SHIFT    6
+#define ZMTP_ARENA_MAX_SHIFT    20
+#define ZMTP_ARENA_CLASSES \
+    (ZMTP_ARENA_MAX_SHIFT - ZMTP_ARENA_MIN_SHIFT + 1)
+
+//  NUMA memory policy, as in numaif.h, which needs libnuma's headers
+
+#define ZMTP_ARENA_MPOL_PREFERRED   1
+#define ZMTP_ARENA_MPOL_MF_MOVE     (1 << 1)
+
+//  A page's entry in the class table is the shift of its blocks, or for
+//  the first page of a run, this flag and the run's length in huge pages
+
+#define ZMTP_ARENA_RUN          0x80000000u
+
+//  Freed block, linked through its data
+
+typedef struct s_free_block {
+    struct s_free_block *next;
+} s_free_block_t;
+
+//  Freed run of huge pages, likewise
+
+typedef struct s_free_run {
+    struct s_free_run *next;
+    size_t hugepages;           //  Length of the run
+} s_free_run_t;
+
+//  Blocks of one size
+
+typedef struct {
+    pthread_mutex_t mutex;
+    s_free_block_t *free;       //  Freed blocks ready for reuse
+} s_class_t;
+
+//  Structure of our class
+
+struct _zmtp_arena_t {
+    byte *base;                 //  Start of the mapping
+    size_t size;                //  Size of the mapping
+    zmtp_arena_pages_t pages;   //  What backs it
+    uint32_t *table;            //  Class table, an entry per page
+    pthread_mutex_t mutex;      //  Guards the carving
+    size_t low;                 //  Blocks are carved up to here
+    size_t high;                //  Runs are carved down to here
+    size_t used;                //  Bytes carved so far
+    s_class_t classes [ZMTP_ARENA_CLASSES];
+    pthread_mutex_t runs_mutex; //  Guards the list of runs
+    s_free_run_t *runs;         //  Freed runs ready for reuse
+    zmtp_allocator_t allocator; //  Allocator handing out our blocks
+};
+
+static void *
+    s_alloc (void *hint, size_t size);
+static void *
+    s_realloc (void *hint, void *ptr, size_t size);
+static void
+    s_free (void *hint, void *ptr);
+static byte *
+    s_map (size_t size, zmtp_arena_pages_t *pages);
+static void *
+    s_alloc_run (zmtp_arena_t *self, size_t size);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_arena_t *
+zmtp_arena_new (size_t size)
+{
+    if (size == 0 || size > SIZE_MAX - ZMTP_ARENA_HUGEPAGE) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size = (size + ZMTP_ARENA_HUGEPAGE - 1)
+         & ~(size_t) (ZMTP_ARENA_HUGEPAGE - 1);
+    zmtp_arena_pages_t pages;
+    byte *base = s_map (size, &pages);
+    if (!base)
+        return NULL;
+
+    zmtp_arena_t *self = (zmtp_arena_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->base = base;
+    self->size = size;
+    self->pages = pages;
+    self->table = (uint32_t *) zmtp_zmalloc (
+        size / ZMTP_ARENA_PAGE * sizeof (uint32_t));
+    assert (self->table);
+    self->high = size;
+    pthread_mutex_init (&self->mutex, NULL);
+    for (size_t i = 0; i < ZMTP_ARENA_CLASSES; i++)
+        pthread_mutex_init (&self->classes [i].mutex, NULL);
+    pthread_mutex_init (&self->runs_mutex, NULL);
+    self->allocator = (zmtp_allocator_t) {
+        .alloc = s_alloc,
+        .realloc = s_realloc,
+        .free = s_free,
+        .hint = self
+    };
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zmtp_arena_destroy (zmtp_arena_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_arena_t *self = *self_p;
+        munmap (self->base, self->size);
+        zmtp_free (self->table);
+        pthread_mutex_destroy (&self->mutex);
+        for (size_t i = 0; i < ZMTP_ARENA_CLASSES; i++)
+            pthread_mutex_destroy (&self->classes [i].mutex);
+        pthread_mutex_destroy (&self->runs_mutex);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return an allocator taking memory from the arena
+
+const zmtp_allocator_t *
+zmtp_arena_allocator (zmtp_arena_t *self)
+{
+    assert (self);
+    return &self->allocator;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Place the arena's pages on a NUMA node, moving those already touched
+
+int
+zmtp_arena_set_node (zmtp_arena_t *self, int node)
+{
+    assert (self);
+#if defined (SYS_mbind)
+    unsigned long mask [16] = { 0 };
+    const int word_bits = (int) (sizeof mask [0] * 8);
+    const int bits = (int) (sizeof mask / sizeof mask [0]) * word_bits;
+    if (node < 0 || node >= bits) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask [node / word_bits] |= 1UL << (node % word_bits);
+    //  The kernel counts one more bit than it reads
+    return (int) syscall (SYS_mbind, self->base, self->size,
+        ZMTP_ARENA_MPOL_PREFERRED, mask, bits + 1, ZMTP_ARENA_MPOL_MF_MOVE);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return what backs the arena's memory
+
+zmtp_arena_pages_t
+zmtp_arena_pages (zmtp_arena_t *self)
+{
+    assert (self);
+    return self->pages;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return bytes of the arena handed out so far
+
+size_t
+zmtp_arena_used (zmtp_arena_t *self)
+{
+    assert (self);
+    return __atomic_load_n (&self->used, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Map size bytes, 2 MB aligned, preferring huge pages
+
+static byte *
+s_map (size_t size, zmtp_arena_pages_t *pages)
+{
+#if defined (MAP_HUGETLB)
+    void *base = mmap (NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED) {
+        *pages = ZMTP_ARENA_HUGETLB;
+        return (byte *) base;
+    }
+#endif
+    //  No huge pages reserved; map one more than needed and trim to a 2 MB
+    //  boundary, so the kernel can back it with transparent huge pages
+    byte *mapping = (byte *) mmap (NULL, size + ZMTP_ARENA_HUGEPAGE,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == (byte *) MAP_FAILED)
+        return NULL;
+    byte *aligned = (byte *) (((uintptr_t) mapping + ZMTP_ARENA_HUGEPAGE - 1)
+                  & ~(uintptr_t) (ZMTP_ARENA_HUGEPAGE - 1));
+    if (aligned > mapping)
+        munmap (mapping, aligned - mapping);
+    if (aligned + size < mapping + size + ZMTP_ARENA_HUGEPAGE)
+        munmap (aligned + size,
+            mapping + size + ZMTP_ARENA_HUGEPAGE - (aligned + size));
+    *pages = ZMTP_ARENA_SMALL;
+#if defined (MADV_HUGEPAGE)
+    if (madvise (aligned, size, MADV_HUGEPAGE) == 0)
+        *pages = ZMTP_ARENA_THP;
+#endif
+    return aligned;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take size bytes from the untouched middle of the arena: from the
+//  bottom for blocks, from the top for runs, which keeps those aligned
+//  to huge pages. Returns NULL if the arena is full.
+
+static byte *
+s_carve (zmtp_arena_t *self, size_t size, bool from_top)
+{
+    byte *data = NULL;
+    pthread_mutex_lock (&self->mutex);
+    if (size <= self->high - self->low) {
+        if (from_top) {
+            self->high -= size;
+            data = self->base + self->high;
+        }
+        else {
+            data = self->base + self->low;
+            self->low += size;
+        }
+        __atomic_store_n (&self->used, self->low + self->size - self->high,
+            __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock (&self->mutex);
+    return data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate a block of at least size bytes, from the free list of its
+//  class or else from a fresh page or run of pages
+
+static void *
+s_alloc (void *hint, size_t size)
+{
+    zmtp_arena_t *self = (zmtp_arena_t *) hint;
+    if (size > ((size_t) 1 << ZMTP_ARENA_MAX_SHIFT))
+        return s_alloc_run (self, size);
+    int shift = ZMTP_ARENA_MIN_SHIFT;
+    if (size > ((size_t) 1 << ZMTP_ARENA_MIN_SHIFT))
+        shift = 64 - __builtin_clzll ((unsigned long long) size - 1);
+    s_class_t *bin = &self->classes [shift - ZMTP_ARENA_MIN_SHIFT];
+
+    pthread_mutex_lock (&bin->mutex);
+    s_free_block_t *block = bin->free;
+    if (block)
+        bin->free = block->next;
+    pthread_mutex_unlock (&bin->mutex);
+    if (block)
+        return block;
+
+    const size_t block_size = (size_t) 1 << shift;
+    byte *page = s_carve (self,
+        block_size < ZMTP_ARENA_PAGE? ZMTP_ARENA_PAGE: block_size, false);
+    if (!page)
+        return malloc (size);           //  Arena is full
+    self->table [(page - self->base) / ZMTP_ARENA_PAGE] = (uint32_t) shift;
+    if (block_size < ZMTP_ARENA_PAGE) {
+        //  Keep the rest of the page for the next blocks of this size
+        pthread_mutex_lock (&bin->mutex);
+        for (size_t offset = ZMTP_ARENA_PAGE - block_size; offset > 0;
+             offset -= block_size) {
+            block = (s_free_block_t *) (page + offset);
+            block->next = bin->free;
+            bin->free = block;
+        }
+        pthread_mutex_unlock (&bin->mutex);
+    }
+    return page;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate a run of whole huge pages, from the first freed run long
+//  enough, splitting off what is not needed, or else from the top of the
+//  arena
+
+static void *
+s_alloc_run (zmtp_arena_t *self, size_t size)
+{
+    if (size > self->size)
+        return malloc (size);           //  Larger than the arena
+    const size_t hugepages =
+        (size + ZMTP_ARENA_HUGEPAGE - 1) / ZMTP_ARENA_HUGEPAGE;
+
+    pthread_mutex_lock (&self->runs_mutex);
+    s_free_run_t **run_p = &self->runs;
+    while (*run_p && (*run_p)->hugepages < hugepages)
+        run_p = &(*run_p)->next;
+    s_free_run_t *run = *run_p;
+    if (run) {
+        *run_p = run->next;
+        if (run->hugepages > hugepages) {
+            s_free_run_t *rest = (s_free_run_t *)
+                ((byte *) run + hugepages * ZMTP_ARENA_HUGEPAGE);
+            rest->hugepages = run->hugepages - hugepages;
+            rest->next = self->runs;
+            self->runs = rest;
+        }
+    }
+    pthread_mutex_unlock (&self->runs_mutex);
+
+    byte *data = run? (byte *) run:
+        s_carve (self, hugepages * ZMTP_ARENA_HUGEPAGE, true);
+    if (!data)
+        return malloc (size);           //  Arena is full
+    self->table [(data - self->base) / ZMTP_ARENA_PAGE] =
+        ZMTP_ARENA_RUN | (uint32_t) hugepages;
+    return data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Resize a block; it stays put while the new size fits
+
+static void *
+s_realloc (void *hint, void *ptr, size_t size)
+{
+    zmtp_arena_t *self = (zmtp_arena_t *) hint;
+    if (!ptr)
+        return s_alloc (hint, size);
+    if ((byte *) ptr < self->base || (byte *) ptr >= self->base + self->size)
+        return realloc (ptr, size);
+
+    const uint32_t entry =
+        self->table [((byte *) ptr - self->base) / ZMTP_ARENA_PAGE];
+    const size_t capacity = (entry & ZMTP_ARENA_RUN)?
+        (entry & ~ZMTP_ARENA_RUN) * (size_t) ZMTP_ARENA_HUGEPAGE:
+        (size_t) 1 << entry;
+    if (size <= capacity)
+        return ptr;
+    void *moved = s_alloc (hint, size);
+    if (moved) {
+        memcpy (moved, ptr, capacity);
+        s_free (hint, ptr);
+    }
+    return moved;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put a block on the free list of its class, or a run on the list of
+//  runs, or give it back to malloc if it came from there
+
+static void
+s_free (void *hint, void *ptr)
+{
+    zmtp_arena_t *self = (zmtp_arena_t *) hint;
+    if ((byte *) ptr < self->base || (byte *) ptr >= self->base + self->size) {
+        free (ptr);
+        return;
+    }
+    const uint32_t entry =
+        self->table [((byte *) ptr - self->base) / ZMTP_ARENA_PAGE];
+    if (entry & ZMTP_ARENA_RUN) {
+        s_free_run_t *run = (s_free_run_t *) ptr;
+        run->hugepages = entry & ~ZMTP_ARENA_RUN;
+        pthread_mutex_lock (&self->runs_mutex);
+        run->next = self->runs;
+        self->runs = run;
+        pthread_mutex_unlock (&self->runs_mutex);
+        return;
+    }
+    s_class_t *bin = &self->classes [entry - ZMTP_ARENA_MIN_SHIFT];
+    s_free_block_t *block = (s_free_block_t *) ptr;
+    pthread_mutex_lock (&bin->mutex);
+    block->next = bin->free;
+    bin->free = block;
+    pthread_mutex_unlock (&bin->mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_arena_test (bool verbose)
+{
+    printf (" * zmtp_arena: ");
+    //  @selftest
+    zmtp_arena_t *arena = zmtp_arena_new (6 * 1024 * 1024);
+    int rc;
+    assert (arena);
+    assert (zmtp_arena_pages (arena) <= ZMTP_ARENA_SMALL);
+    assert (zmtp_arena_used (arena) == 0);
+    const zmtp_allocator_t *allocator = zmtp_arena_allocator (arena);
+    rc = zmtp_arena_set_node (arena, -1);
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_arena_set_node (arena, 0);
+    assert (rc == 0 || errno == ENOSYS || errno == EPERM || errno == ENOTSUP);
+
+    //  Small blocks are cut from a page of their own size, larger ones
+    //  take whole pages, and power-of-two sizes fit their class exactly
+    byte *small = (byte *) allocator->alloc (allocator->hint, 10);
+    assert (small && ((uintptr_t) small & 63) == 0);
+    assert (zmtp_arena_used (arena) == 4096);
+    byte *page = (byte *) allocator->alloc (allocator->hint, 4096);
+    assert (page && ((uintptr_t) page & 4095) == 0);
+    assert (zmtp_arena_used (arena) == 2 * 4096);
+    byte *large = (byte *) allocator->alloc (allocator->hint, 100000);
+    assert (large && large > small);
+    assert (zmtp_arena_used (arena) == 2 * 4096 + 128 * 1024);
+    memset (large, 1, 100000);
+    byte *next = (byte *) allocator->alloc (allocator->hint, 64);
+    assert (next == small + 64);
+    assert (zmtp_arena_used (arena) == 2 * 4096 + 128 * 1024);
+
+    //  Freed blocks are reused, and grow in place while they fit
+    allocator->free (allocator->hint, small);
+    byte *again = (byte *) allocator->alloc (allocator->hint, 48);
+    assert (again == small);
+    again = (byte *) allocator->realloc (allocator->hint, again, 64);
+    assert (again == small);
+    memcpy (again, "arena", 6);
+    byte *moved = (byte *) allocator->realloc (allocator->hint, again, 1000);
+    assert (moved != small);
+    assert (memcmp (moved, "arena", 6) == 0);
+    assert (zmtp_arena_used (arena) == 3 * 4096 + 128 * 1024);
+    const size_t carved = zmtp_arena_used (arena);
+
+    //  Beyond 1 MB, blocks are runs of whole huge pages from the top of
+    //  the arena; freed runs are split to serve shorter ones
+    byte *run = (byte *) allocator->alloc (allocator->hint, 3 * 1024 * 1024);
+    assert (run == arena->base + arena->size - 4 * 1024 * 1024);
+    assert (zmtp_arena_used (arena) == carved + 4 * 1024 * 1024);
+    memset (run, 2, 3 * 1024 * 1024);
+    allocator->free (allocator->hint, run);
+    byte *hugepage =
+        (byte *) allocator->alloc (allocator->hint, 2 * 1024 * 1024);
+    assert (hugepage == run);
+    byte *rest = (byte *) allocator->alloc (allocator->hint, 1536 * 1024);
+    assert (rest == run + 2 * 1024 * 1024);
+    assert (zmtp_arena_used (arena) == carved + 4 * 1024 * 1024);
+    rest = (byte *) allocator->realloc (allocator->hint, rest, 2000000);
+    assert (rest == run + 2 * 1024 * 1024);
+    allocator->free (allocator->hint, hugepage);
+    allocator->free (allocator->hint, rest);
+
+    //  Too large for the arena, or no room left: malloc takes over
+    byte *huge = (byte *) allocator->alloc (allocator->hint, 16 * 1024 * 1024);
+    assert (huge);
+    assert (huge < arena->base || huge >= arena->base + arena->size);
+    assert (zmtp_arena_used (arena) == carved + 4 * 1024 * 1024);
+    allocator->free (allocator->hint, huge);
+    byte *fill [64];
+    for (size_t i = 0; i < 64; i++) {
+        fill [i] = (byte *) allocator->alloc (allocator->hint, 64 * 1024);
+        assert (fill [i]);
+    }
+    assert (fill [0] < arena->base + arena->size);
+    assert (fill [63] < arena->base || fill [63] >= arena->base + arena->size);
+    assert (zmtp_arena_used (arena) <= arena->size);
+    for (size_t i = 0; i < 64; i++)
+        allocator->free (allocator->hint, fill [i]);
+    allocator->free (allocator->hint, moved);
+    allocator->free (allocator->hint, next);
+    allocator->free (allocator->hint, large);
+    allocator->free (allocator->hint, page);
+
+    //  Installed, it backs messages and their bodies
+    assert (zmtp_set_allocator (allocator));
+    zmtp_msg_t *msg = zmtp_msg_new (0, 4000);
+    assert (msg);
+    memset (zmtp_msg_data (msg), 0, 4000);
+    zmtp_msg_destroy (&msg);
+    zmtp_set_allocator (NULL);
+    zmtp_arena_destroy (&arena);
+    assert (arena == NULL);
+
+    assert (zmtp_arena_new (0) == NULL && errno == EINVAL);
+    //  @end
+    printf ("OK\n");
+}
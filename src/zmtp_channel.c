@@ -13,6 +13,106 @@
 #include "zmtp_classes.h"
 #include "zmtpnet.h"
 
+#include <poll.h>
+#if defined (__UTYPE_LINUX)
+#   include <sys/mman.h>
+#   include <sys/sendfile.h>
+#   include <linux/errqueue.h>
+#   include <linux/net_tstamp.h>
+#   include <linux/sockios.h>
+#endif
+
+//  Size of the receive buffer; frames that fit are read in batches, larger
+//  frame bodies are read straight into the message
+
+#define ZMTP_CHANNEL_BUFSIZE 8192
+
+//  Most frames found in the receive buffer by one scan
+
+#define ZMTP_CHANNEL_SCAN_MAX 256
+
+//  Most parts of a multipart message gathered into one write
+
+#define ZMTP_CHANNEL_IOV_PARTS 64
+
+//  Sent frames whose transmit time is kept until the caller reads it
+
+#define ZMTP_CHANNEL_TX_STAMPS 64
+
+//  Count TCP timestamp keys from the last byte written, not the last byte
+//  acknowledged (Linux 6.2); older kernels refuse it and we make up the
+//  difference with SIOCOUTQ
+#if defined (SO_TIMESTAMPING) && !defined (SOF_TIMESTAMPING_OPT_ID_TCP)
+#   define SOF_TIMESTAMPING_OPT_ID_TCP (1 << 16)
+#endif
+
+//  Tell the kernel more of the frame follows, so it holds back a packet
+#if defined (MSG_MORE)
+#   define ZMTP_CHANNEL_SEND_MORE MSG_MORE
+#else
+#   define ZMTP_CHANNEL_SEND_MORE 0
+#endif
+
+//  Msecs destroy waits for the kernel to finish with zerocopy bodies
+
+#define ZMTP_CHANNEL_ZEROCOPY_LINGER 1000
+
+//  Sends that transmit straight from the message's pages
+#if defined (SO_TIMESTAMPING) && defined (SO_ZEROCOPY) && defined (MSG_ZEROCOPY)
+#   define ZMTP_CHANNEL_ZEROCOPY
+#endif
+
+//  Large bodies passed to a local peer as sealed memfds (Linux)
+#if defined (SO_TIMESTAMPING) && defined (MFD_ALLOW_SEALING) \
+ && defined (F_ADD_SEALS)
+#   define ZMTP_CHANNEL_MEMFD
+#endif
+
+//  Memfds received ahead of the commands that refer to them
+
+#define ZMTP_CHANNEL_FDS 16
+
+//  Size of the MEMFD command sent in place of a frame: name, body size
+//  and the frame's flags
+
+#define ZMTP_CHANNEL_MEMFD_CMD (1 + 5 + 8 + 1)
+
+//  Writes to a peer that went away must fail with EPIPE, not SIGPIPE
+#if defined (MSG_NOSIGNAL)
+#   define ZMTP_CHANNEL_SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+#   define ZMTP_CHANNEL_SEND_FLAGS MSG_DONTWAIT
+#endif
+
+//  Room for our READY: name, Socket-Type and the longest Identity
+
+#define ZMTP_CHANNEL_READY_MAX (6 + 22 + 13 + ZMTP_IDENTITY_MAX)
+
+//  Socket types as READY names them, in enum zmtp_socket_type order, and
+//  the types each may talk to as a bit mask
+
+#define ZMTP_CHANNEL_SOCKET_TYPES (ZMTP_STREAM + 1)
+
+static const char *s_socket_type_names [ZMTP_CHANNEL_SOCKET_TYPES] = {
+    "PAIR", "PUB", "SUB", "REQ", "REP", "DEALER",
+    "ROUTER", "PULL", "PUSH", "XPUB", "XSUB", "STREAM"
+};
+
+static const uint16_t s_socket_type_peers [ZMTP_CHANNEL_SOCKET_TYPES] = {
+    [ZMTP_PAIR]   = 1 << ZMTP_PAIR,
+    [ZMTP_PUB]    = 1 << ZMTP_SUB | 1 << ZMTP_XSUB,
+    [ZMTP_SUB]    = 1 << ZMTP_PUB | 1 << ZMTP_XPUB,
+    [ZMTP_REQ]    = 1 << ZMTP_REP | 1 << ZMTP_ROUTER,
+    [ZMTP_REP]    = 1 << ZMTP_REQ | 1 << ZMTP_DEALER,
+    [ZMTP_DEALER] = 1 << ZMTP_REP | 1 << ZMTP_DEALER | 1 << ZMTP_ROUTER,
+    [ZMTP_ROUTER] = 1 << ZMTP_REQ | 1 << ZMTP_DEALER | 1 << ZMTP_ROUTER,
+    [ZMTP_PULL]   = 1 << ZMTP_PUSH,
+    [ZMTP_PUSH]   = 1 << ZMTP_PULL,
+    [ZMTP_XPUB]   = 1 << ZMTP_SUB | 1 << ZMTP_XSUB,
+    [ZMTP_XSUB]   = 1 << ZMTP_PUB | 1 << ZMTP_XPUB,
+    [ZMTP_STREAM] = 0
+};
+
 //  ZMTP greeting (64 bytes)
 
 struct zmtp_greeting {
@@ -23,16 +123,114 @@ struct zmtp_greeting {
     byte filler [31];
 };
 
+//  A sent frame waiting for its transmit time
+
+typedef struct {
+    uint32_t end;       //  Stream offset just past its last byte
+    uint64_t frame;     //  Frame number
+    int64_t stamp;      //  Transmit time, 0 until known
+} s_tx_stamp_t;
+
 //  Structure of our class
 
 struct _zmtp_channel_t {
     int fd;             //  BSD socket handle
+    int connect_timeout;    //  Connect deadline in msecs, -1 = none
+    byte out_header [9];    //  Header of the frame being written
+    size_t out_header_size; //  Size of that header, 0 if none
+    size_t out_sent;        //  Bytes of that frame already written
+    byte *in_buf;           //  Receive buffer
+    size_t in_head;         //  Start of unread data in the buffer
+    size_t in_tail;         //  End of unread data in the buffer
+    zmtp_msg_t *in_msg;     //  Frame whose body is still arriving
+    size_t in_received;     //  Bytes of that body received so far
+    zmtp_frame_t *in_frames;    //  Complete frames found in the buffer
+    size_t in_nframes;      //  Number of frames found
+    size_t in_next;         //  Next frame to deliver
+    size_t in_base;         //  Buffer offset the frame offsets start at
+    zmtp_stats_t *stats;    //  Where traffic is counted
+    zmtp_stats_t own_stats; //  Counters unless the owner provides some
+    zmtp_histogram_t *latency [ZMTP_LATENCY_KINDS];    //  NULL = untimed
+    int64_t out_started;    //  When writing the frame began, if timed
+    int timestamping;       //  ZMTP_TIMESTAMP_* modes asked for
+    int ts_flags;           //  SO_TIMESTAMPING flags set on the socket
+    int64_t in_stamp;       //  Kernel time the last bytes arrived
+    uint32_t out_offset;    //  Bytes written since TX stamps began
+    uint64_t out_frames;    //  Frames written since TX stamps began
+    s_tx_stamp_t out_stamps [ZMTP_CHANNEL_TX_STAMPS];
+    size_t out_stamps_head; //  Oldest frame not yet reported
+    size_t out_stamps_size; //  Frames kept
+    size_t zerocopy;        //  Smallest body sent with MSG_ZEROCOPY, 0 = off
+    bool zc_enabled;        //  SO_ZEROCOPY is set on the socket
+    zmtp_msg_t *out_zc;     //  Message being sent, if zerocopy
+    uint32_t out_zc_first;  //  Id of that frame's first zerocopy send
+    uint32_t zc_next;       //  Id the kernel gives the next zerocopy send
+    zmtp_msgq_t *zc_held;   //  Bodies the kernel may still be reading
+    size_t memfd;           //  Smallest body passed as a memfd, 0 = off
+    bool unix_socket;       //  Peer is on this host (ipc://)
+    int out_fd;             //  Memfd holding the frame being sent, or -1
+    byte out_cmd [ZMTP_CHANNEL_MEMFD_CMD];  //  Command sent in its place
+    int in_fds [ZMTP_CHANNEL_FDS];  //  Memfds received, not yet matched
+    size_t in_fds_head;     //  Oldest of them
+    size_t in_fds_size;     //  Number of them
+    bool in_fds_lost;       //  Some did not fit, so matching is off
+    int socket_type;        //  Socket type our READY names, -1 = none
+    zmtp_identity_t *identity;  //  Identity our READY gives, if any
+    zmtp_msg_t *peer_ready; //  READY the peer sent, kept for its metadata
+    zmtp_command_t peer_command;    //  Its metadata, pointing into it
+    int peer_socket_type;   //  Socket type the peer named, -1 = none
+    zmtp_identity_t *peer_identity; //  Identity the peer gave, if any
 };
 
-static zmtp_endpoint_t *
-    s_endpoint_from_str (const char *endpoint_str);
 static int
     s_negotiate (zmtp_channel_t *self);
+static int
+    s_peer_ready (zmtp_channel_t *self, zmtp_msg_t *ready);
+static int
+    s_fill (zmtp_channel_t *self);
+static zmtp_msg_t *
+    s_received (zmtp_channel_t *self, zmtp_msg_t *msg);
+static int
+    s_wait (zmtp_channel_t *self, short events);
+static int
+    s_send_all (zmtp_channel_t *self, const byte *data, size_t size,
+                int flags);
+static ssize_t
+    s_send_file (zmtp_channel_t *self, int fd, off_t *offset, size_t size);
+static int
+    s_send_iov (zmtp_channel_t *self, struct iovec *iov, size_t iovcnt,
+                int flags);
+static int
+    s_recv_body (zmtp_channel_t *self, byte *body, size_t size);
+static int
+    s_part_received (zmtp_channel_t *self, zmtp_multipart_t *multipart,
+                     byte flags, const byte *body, size_t size);
+static int
+    s_set_timestamping (zmtp_channel_t *self);
+static ssize_t
+    s_recv (zmtp_channel_t *self, void *buffer, size_t size);
+static void
+    s_sent_frame (zmtp_channel_t *self);
+static int
+    s_read_errqueue (zmtp_channel_t *self);
+static void
+    s_set_zerocopy (zmtp_channel_t *self);
+static void
+    s_zerocopy_take (zmtp_channel_t *self, zmtp_msg_t *msg);
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+static void
+    s_zerocopy_done (zmtp_channel_t *self, uint32_t last);
+#endif
+static void
+    s_zerocopy_drain (zmtp_channel_t *self, int timeout);
+static void
+    s_memfd_wrap (zmtp_channel_t *self, zmtp_msg_t *msg);
+static zmtp_msg_t *
+    s_memfd_unwrap (zmtp_channel_t *self, zmtp_msg_t *command);
+#if defined (ZMTP_CHANNEL_MEMFD)
+static void
+    s_memfd_received (zmtp_channel_t *self, const int *fds, size_t count);
+#endif
 
 /*
 static int
@@ -47,9 +245,19 @@ static int
 zmtp_channel_t *
 zmtp_channel_new ()
 {
-    zmtp_channel_t *self = (zmtp_channel_t *) zmalloc (sizeof *self);
+    zmtp_channel_t *self = (zmtp_channel_t *) zmtp_zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
     self->fd = -1;
+    self->connect_timeout = -1;
+    self->out_fd = -1;
+    self->socket_type = -1;
+    self->peer_socket_type = -1;
+    self->stats = &self->own_stats;
+    self->in_buf = (byte *) zmtp_malloc (ZMTP_CHANNEL_BUFSIZE);
+    assert (self->in_buf);
+    self->in_frames = (zmtp_frame_t *)
+        zmtp_malloc (ZMTP_CHANNEL_SCAN_MAX * sizeof *self->in_frames);
+    assert (self->in_frames);
     return self;
 }
 
@@ -63,14 +271,249 @@ zmtp_channel_destroy (zmtp_channel_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_channel_t *self = *self_p;
-        if (self->fd != -1)
+        if (self->fd != -1) {
+            s_zerocopy_drain (self, ZMTP_CHANNEL_ZEROCOPY_LINGER);
             close (self->fd);
-        free (self);
+        }
+        zmtp_msg_destroy (&self->in_msg);
+        zmtp_msg_destroy (&self->out_zc);
+        zmtp_msgq_destroy (&self->zc_held);
+        zmtp_msg_destroy (&self->peer_ready);
+        zmtp_identity_destroy (&self->identity);
+        zmtp_identity_destroy (&self->peer_identity);
+        if (self->out_fd != -1)
+            close (self->out_fd);
+        while (self->in_fds_size--)
+            close (self->in_fds [
+                (self->in_fds_head + self->in_fds_size) % ZMTP_CHANNEL_FDS]);
+        zmtp_free (self->in_buf);
+        zmtp_free (self->in_frames);
+        zmtp_free (self);
         *self_p = NULL;
     }
 }
 
 
+//  --------------------------------------------------------------------------
+//  Set the deadline for establishing connections, in milliseconds. Resolved
+//  addresses are tried in parallel and the connect fails with ETIMEDOUT
+//  if none answers in time. Default is -1, no deadline.
+
+void
+zmtp_channel_set_connect_timeout (zmtp_channel_t *self, int timeout)
+{
+    assert (self);
+    self->connect_timeout = timeout;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return socket handle of the channel, or -1 if not connected
+
+int
+zmtp_channel_fd (zmtp_channel_t *self)
+{
+    assert (self);
+    return self->fd;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Count traffic in stats instead of the channel's own counters, so an
+//  owner can keep totals across channels. Set before connecting.
+
+void
+zmtp_channel_set_stats (zmtp_channel_t *self, zmtp_stats_t *stats)
+{
+    assert (self);
+    assert (stats);
+    self->stats = stats;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take a snapshot of the traffic counters; safe from any thread
+
+void
+zmtp_channel_stats (zmtp_channel_t *self, zmtp_stats_t *stats)
+{
+    assert (self);
+    assert (stats);
+    zmtp_stats_copy (stats, self->stats);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Record latencies of the given kind in histogram, which the caller owns
+//  and must keep until the channel is destroyed; NULL, the default, stops
+//  timing them. The channel times sends, blocking receives and the
+//  handshake. Set before connecting.
+
+void
+zmtp_channel_set_histogram (zmtp_channel_t *self, zmtp_latency_t kind,
+                            zmtp_histogram_t *histogram)
+{
+    assert (self);
+    assert (kind < ZMTP_LATENCY_KINDS);
+    self->latency [kind] = histogram;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Ask the kernel for software timestamps on received bytes and/or sent
+//  frames. They come from the socket layer on the way in and from the
+//  device queue on the way out, so comparing them with the library's own
+//  clock splits latency into time on the wire and in the kernel versus
+//  time in the library and application. Works over loopback. Sockets
+//  without kernel support, such as ipc://, simply report nothing.
+
+int
+zmtp_channel_set_timestamping (zmtp_channel_t *self, int modes)
+{
+    assert (self);
+    if (modes & ~(ZMTP_TIMESTAMP_RX | ZMTP_TIMESTAMP_TX)) {
+        errno = EINVAL;
+        return -1;
+    }
+#if defined (SO_TIMESTAMPING)
+    self->timestamping = modes;
+    return self->fd == -1? 0: s_set_timestamping (self);
+#else
+    if (modes) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the kernel transmit time of the oldest sent frame not reported
+//  yet. Frames that went out in the same packet as a later one share its
+//  time.
+
+int
+zmtp_channel_send_timestamp (zmtp_channel_t *self,
+                             uint64_t *frame, int64_t *timestamp)
+{
+    assert (self);
+    assert (frame);
+    assert (timestamp);
+
+    if (self->fd != -1)
+        s_read_errqueue (self);
+    if (self->out_stamps_size == 0
+    ||  self->out_stamps [self->out_stamps_head].stamp == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    const s_tx_stamp_t *oldest = &self->out_stamps [self->out_stamps_head];
+    *frame = oldest->frame;
+    *timestamp = oldest->stamp;
+    self->out_stamps_head =
+        (self->out_stamps_head + 1) % ZMTP_CHANNEL_TX_STAMPS;
+    self->out_stamps_size--;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Have the kernel transmit bodies of threshold bytes or more straight
+//  from the message's pages instead of copying them into the socket.
+//  Pinning pages and taking the completion costs more than copying small
+//  bodies; it pays off from a few tens of KB. The channel holds the
+//  messages of such bodies (see zmtp_channel_send_nowait) until the
+//  kernel reports it is done. Sockets that cannot, such as ipc://, copy
+//  as before.
+
+int
+zmtp_channel_set_zerocopy (zmtp_channel_t *self, size_t threshold)
+{
+    assert (self);
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+    self->zerocopy = threshold;
+    if (self->fd != -1)
+        s_set_zerocopy (self);
+    return 0;
+#else
+    if (threshold) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the number of sent bodies the kernel may still be reading. They
+//  are released as completions arrive, which the channel picks up while
+//  sending and receiving.
+
+size_t
+zmtp_channel_zerocopy_pending (zmtp_channel_t *self)
+{
+    assert (self);
+    if (self->fd != -1)
+        s_zerocopy_drain (self, 0);
+    return self->zc_held? zmtp_msgq_size (self->zc_held): 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pass bodies of threshold bytes or more to a peer on the same host as a
+//  sealed memfd instead of streaming them through the socket. The sender
+//  writes the body once into the memfd and sends a small MEMFD command
+//  carrying it with SCM_RIGHTS; the receiver maps it as the message body,
+//  so a large message costs one copy instead of two and the receiver's
+//  copy is a page mapping. This is not part of ZMTP, so both peers must
+//  turn it on; any threshold accepts memfds, SIZE_MAX only accepts. Only
+//  ipc:// channels use it.
+
+int
+zmtp_channel_set_memfd (zmtp_channel_t *self, size_t threshold)
+{
+    assert (self);
+#if defined (ZMTP_CHANNEL_MEMFD)
+    self->memfd = threshold;
+    return 0;
+#else
+    if (threshold) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Move the receive buffers to fresh memory first touched by the calling
+//  thread. Linux places a page on the node of the CPU that first writes
+//  it, so a channel set up on one thread and read on another otherwise
+//  reads every frame across the interconnect.
+
+void
+zmtp_channel_relocate (zmtp_channel_t *self)
+{
+    assert (self);
+    byte *in_buf = (byte *) zmtp_malloc (ZMTP_CHANNEL_BUFSIZE);
+    zmtp_frame_t *in_frames = (zmtp_frame_t *)
+        zmtp_malloc (ZMTP_CHANNEL_SCAN_MAX * sizeof *in_frames);
+    assert (in_buf && in_frames);
+    memset (in_buf, 0, ZMTP_CHANNEL_BUFSIZE);
+    memcpy (in_buf, self->in_buf, self->in_tail);
+    memset (in_frames, 0, ZMTP_CHANNEL_SCAN_MAX * sizeof *in_frames);
+    memcpy (in_frames, self->in_frames,
+        self->in_nframes * sizeof *in_frames);
+    zmtp_free (self->in_buf);
+    zmtp_free (self->in_frames);
+    self->in_buf = in_buf;
+    self->in_frames = in_frames;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Connect channel to local endpoint
 
@@ -87,7 +530,7 @@ zmtp_channel_ipc_connect (zmtp_channel_t *self, const char *path)
     if (endpoint == NULL)
         return -1;
 
-    self->fd = zmtp_endpoint_connect (endpoint);
+    self->fd = zmtp_endpoint_connect_timeout (endpoint, self->connect_timeout);
     zmtp_endpoint_destroy (&endpoint);
     if (self->fd == -1)
         return -1;
@@ -119,7 +562,7 @@ zmtp_channel_tcp_connect (zmtp_channel_t *self,
     if (endpoint == NULL)
         return -1;
 
-    self->fd = zmtp_endpoint_connect (endpoint);
+    self->fd = zmtp_endpoint_connect_timeout (endpoint, self->connect_timeout);
     zmtp_endpoint_destroy (&endpoint);
     if (self->fd == -1)
         return -1;
@@ -145,11 +588,11 @@ zmtp_channel_connect (zmtp_channel_t *self, const char *endpoint_str)
     if (self->fd != -1)
         return -1;
 
-    zmtp_endpoint_t *endpoint = s_endpoint_from_str (endpoint_str);
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_lookup (endpoint_str);
     if (endpoint == NULL)
         return -1;
 
-    self->fd = zmtp_endpoint_connect (endpoint);
+    self->fd = zmtp_endpoint_connect_timeout (endpoint, self->connect_timeout);
     zmtp_endpoint_destroy (&endpoint);
     if (self->fd == -1)
         return -1;
@@ -175,7 +618,7 @@ zmtp_channel_listen (zmtp_channel_t *self, const char *endpoint_str)
     if (self->fd != -1)
         return -1;
 
-    zmtp_endpoint_t *endpoint = s_endpoint_from_str (endpoint_str);
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_lookup (endpoint_str);
     if (endpoint == NULL)
         return -1;
 
@@ -193,36 +636,56 @@ zmtp_channel_listen (zmtp_channel_t *self, const char *endpoint_str)
     return 0;
 }
 
-static zmtp_endpoint_t *
-s_endpoint_from_str (const char *endpoint_str)
+//  --------------------------------------------------------------------------
+//  Run the channel over a socket we did not open ourselves: a socketpair
+//  for in-process peers, or a listener handed over by a supervisor so a
+//  restarted process picks up where the old one stopped without closing
+//  the port. No address is parsed or resolved.
+
+int
+zmtp_channel_adopt (zmtp_channel_t *self, int fd)
 {
-    if (strncmp (endpoint_str, "ipc://", 6) == 0)
-        return (zmtp_endpoint_t *)
-            zmtp_ipc_endpoint_new (endpoint_str + 6);
-    else
-    if (strncmp (endpoint_str, "tcp://", 6) == 0) {
-        char *colon = strrchr (endpoint_str + 6, ':');
-        if (colon == NULL)
-            return NULL;
-        else {
-            const size_t addr_len = colon - endpoint_str - 6;
-            char addr [addr_len + 1];
-            memcpy (addr, endpoint_str + 6, addr_len);
-            addr [addr_len] = '\0';
-            const unsigned short port = atoi (colon + 1);
-            return (zmtp_endpoint_t *)
-                zmtp_tcp_endpoint_new (addr, port);
+    assert (self);
+
+    if (self->fd != -1) {
+        errno = EISCONN;
+        return -1;
+    }
+    int listening = 0;
+    socklen_t size = sizeof listening;
+    if (getsockopt (fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) == -1)
+        return -1;
+    int s = fd;
+    if (listening) {
+        //  Supervisors often pass listeners in non-blocking mode
+        struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+        while ((s = accept (fd, NULL, NULL)) == -1) {
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (errno != EINTR && poll (&pollfd, 1, -1) == -1
+            &&  errno != EINTR)
+                return -1;
         }
     }
-    else
-        return NULL;
+
+    //  The handshake runs in blocking mode, as on sockets we open
+    self->fd = s;
+    const int flags = fcntl (s, F_GETFL, 0);
+    if (flags == -1
+    ||  fcntl (s, F_SETFL, flags & ~O_NONBLOCK) == -1
+    ||  s_negotiate (self) == -1) {
+        close (self->fd);
+        self->fd = -1;
+        return -1;
+    }
+    return 0;
 }
 
 
 //  --------------------------------------------------------------------------
 //  Negotiate a ZMTP channel
 //  This currently does only ZMTP v3, and will reject older protocols.
-//  TODO: test sending random/wrong data to this handler.
+//  A peer that does not speak it fails with EPROTO.
 
 static int
 s_negotiate (zmtp_channel_t *self)
@@ -231,6 +694,16 @@ s_negotiate (zmtp_channel_t *self)
     assert (self->fd != -1);
 
     const int s = self->fd;
+    const int64_t started = zmtp_clock_nsecs ();
+    ZMTP_TRACE2 (handshake_start, self, s);
+
+    //  A local peer may pass memfds right after its READY, so we must
+    //  look for them from the first read
+    struct sockaddr_storage address;
+    socklen_t address_size = sizeof address;
+    self->unix_socket =
+        getsockname (s, (struct sockaddr *) &address, &address_size) == 0
+        && address.ss_family == AF_UNIX;
 
     //  This is our greeting (64 octets)
     const struct zmtp_greeting outgoing = {
@@ -246,20 +719,28 @@ s_negotiate (zmtp_channel_t *self)
     struct zmtp_greeting incoming;
     if (zmtp_tcp_recv (s, incoming.signature, 1) == -1)
         goto io_error;
-    assert (incoming.signature [0] == 0xff);
+    if (incoming.signature [0] != 0xff) {
+        errno = EPROTO;
+        goto io_error;
+    }
 
     //  Read the rest of signature
     if (zmtp_tcp_recv (s, incoming.signature + 1, 9) == -1)
         goto io_error;
-    assert ((incoming.signature [9] & 1) == 1);
+    if ((incoming.signature [9] & 1) != 1) {
+        errno = EPROTO;
+        goto io_error;
+    }
 
     //  Exchange major version numbers
     if (zmtp_tcp_send (s, outgoing.version, 1) == -1)
         goto io_error;
     if (zmtp_tcp_recv (s, incoming.version, 1) == -1)
         goto io_error;
-
-    assert (incoming.version [0] == 3);
+    if (incoming.version [0] != 3) {
+        errno = EPROTO;
+        goto io_error;
+    }
 
     //  Send the rest of greeting to the peer.
     if (zmtp_tcp_send (s, outgoing.version + 1, 1) == -1)
@@ -281,26 +762,182 @@ s_negotiate (zmtp_channel_t *self)
     if (zmtp_tcp_recv (s, incoming.filler, sizeof incoming.filler) == -1)
         goto io_error;
 
-    //  Send READY command
-    zmtp_msg_t *ready = zmtp_msg_from_const_data (0x04, "\5READY", 6);
+    //  Send READY command with our socket type and identity, if set
+    zmtp_property_t properties [2];
+    size_t count = 0;
+    if (self->socket_type != -1) {
+        const char *name = s_socket_type_names [self->socket_type];
+        properties [count++] = (zmtp_property_t) {
+            "Socket-Type", 11, (const byte *) name, strlen (name)
+        };
+    }
+    if (self->identity)
+        properties [count++] = (zmtp_property_t) {
+            "Identity", 8, zmtp_identity_data (self->identity),
+            zmtp_identity_size (self->identity)
+        };
+    byte ready_body [ZMTP_CHANNEL_READY_MAX];
+    const size_t ready_size = zmtp_codec_encode_command (
+        ready_body, sizeof ready_body, "READY", properties, count);
+    assert (ready_size);
+    zmtp_msg_t *ready =
+        zmtp_msg_from_const_data (ZMTP_MSG_COMMAND, ready_body, ready_size);
     assert (ready);
-    zmtp_channel_send (self, ready);
+    const int rc = zmtp_channel_send (self, ready);
     zmtp_msg_destroy (&ready);
+    if (rc == -1)
+        goto io_error;
 
-    //  Receive READY command
+    //  Receive READY command, and keep it for its metadata
     ready = zmtp_channel_recv (self);
-    if (!ready)
+    if (!ready || s_peer_ready (self, ready) == -1)
         goto io_error;
-    assert ((zmtp_msg_flags (ready) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND);
-    zmtp_msg_destroy (&ready);
 
+    if (self->timestamping && s_set_timestamping (self) == -1)
+        goto io_error;
+    s_set_zerocopy (self);
+
+    const int64_t elapsed = zmtp_clock_nsecs () - started;
+    ZMTP_STAT_ADD (self->stats->handshakes, 1);
+    __atomic_store_n (&self->stats->handshake_usecs,
+        (uint64_t) elapsed / 1000, __ATOMIC_RELAXED);
+    if (self->latency [ZMTP_LATENCY_HANDSHAKE])
+        zmtp_histogram_record (
+            self->latency [ZMTP_LATENCY_HANDSHAKE], (uint64_t) elapsed);
+    ZMTP_TRACE3 (handshake_done, self, s, elapsed);
     return 0;
 
 io_error:
+    ZMTP_TRACE3 (handshake_fail, self, s, errno);
     return -1;
 }
 
 
+//  --------------------------------------------------------------------------
+//  Take the peer's READY, checking it and its socket type, and keep it so
+//  its properties can be read in place. A peer that names no socket type
+//  is taken at its word. Returns 0, or -1 with errno EPROTO.
+
+static int
+s_peer_ready (zmtp_channel_t *self, zmtp_msg_t *ready)
+{
+    zmtp_msg_destroy (&self->peer_ready);
+    zmtp_identity_destroy (&self->peer_identity);
+    self->peer_socket_type = -1;
+    self->peer_ready = ready;
+    if ((zmtp_msg_flags (ready) & ZMTP_MSG_COMMAND) != ZMTP_MSG_COMMAND
+    ||  zmtp_codec_parse_command (zmtp_msg_data (ready),
+            zmtp_msg_size (ready), &self->peer_command) == -1
+    ||  !zmtp_codec_command_is (&self->peer_command, "READY"))
+        goto protocol_error;
+
+    size_t size;
+    const byte *value = zmtp_codec_find_property (
+        &self->peer_command, "Socket-Type", &size);
+    if (value) {
+        for (int type = 0; type < ZMTP_CHANNEL_SOCKET_TYPES; type++)
+            if (strlen (s_socket_type_names [type]) == size
+            &&  memcmp (s_socket_type_names [type], value, size) == 0)
+                self->peer_socket_type = type;
+        if (self->socket_type != -1
+        &&  (self->peer_socket_type == -1
+        ||  !(s_socket_type_peers [self->socket_type]
+              & 1 << self->peer_socket_type)))
+            goto protocol_error;
+    }
+    value = zmtp_codec_find_property (&self->peer_command, "Identity", &size);
+    if (value && size) {
+        self->peer_identity = zmtp_identity_intern (value, size);
+        if (!self->peer_identity)
+            goto protocol_error;
+    }
+    return 0;
+
+protocol_error:
+    zmtp_msg_destroy (&self->peer_ready);
+    self->peer_socket_type = -1;
+    errno = EPROTO;
+    return -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the socket type our READY names, one of enum zmtp_socket_type, or
+//  -1 for none. With a type set, a peer that names a type it may not
+//  talk to is refused with EPROTO. Returns 0, or -1 with errno EINVAL.
+
+int
+zmtp_channel_set_socket_type (zmtp_channel_t *self, int type)
+{
+    assert (self);
+    if (type < -1 || type >= ZMTP_CHANNEL_SOCKET_TYPES) {
+        errno = EINVAL;
+        return -1;
+    }
+    self->socket_type = type;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the identity our READY gives the peer; size 0 gives none. Returns
+//  0, or -1 with errno EINVAL if it is longer than ZMTP_IDENTITY_MAX.
+
+int
+zmtp_channel_set_identity (zmtp_channel_t *self,
+                           const void *data, size_t size)
+{
+    assert (self);
+    zmtp_identity_t *identity = NULL;
+    if (size && !(identity = zmtp_identity_intern (data, size)))
+        return -1;
+    zmtp_identity_destroy (&self->identity);
+    self->identity = identity;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the socket type the peer named in its READY, or -1 if it named
+//  none or is not connected
+
+int
+zmtp_channel_peer_socket_type (zmtp_channel_t *self)
+{
+    assert (self);
+    return self->peer_socket_type;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the interned identity the peer gave, or NULL if none
+
+zmtp_identity_t *
+zmtp_channel_peer_identity (zmtp_channel_t *self)
+{
+    assert (self);
+    return self->peer_identity;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the value of a property of the peer's READY, looked up by name
+//  ignoring case, and set size to its size. The value points into the
+//  READY itself and lasts as long as the connection.
+
+const byte *
+zmtp_channel_peer_property (zmtp_channel_t *self, const char *name,
+                            size_t *size)
+{
+    assert (self);
+    assert (name);
+    assert (size);
+    if (!self->peer_ready)
+        return NULL;
+    return zmtp_codec_find_property (&self->peer_command, name, size);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Send a ZMTP message to the channel
 
@@ -310,85 +947,1281 @@ zmtp_channel_send (zmtp_channel_t *self, zmtp_msg_t *msg)
     assert (self);
     assert (msg);
 
-    byte frame_flags = 0;
-    if ((zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE)
-        frame_flags |= ZMTP_MORE_FLAG;
-    if ((zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
-        frame_flags |= ZMTP_COMMAND_FLAG;
-    if (zmtp_msg_size (msg) > 255)
-        frame_flags |= ZMTP_LARGE_FLAG;
-    if (zmtp_tcp_send (self->fd, &frame_flags, sizeof frame_flags) == -1)
-        return -1;
-
-    if (zmtp_msg_size (msg) <= 255) {
-        const byte msg_size = zmtp_msg_size (msg);
-        if (zmtp_tcp_send (self->fd, &msg_size, sizeof msg_size) == -1)
-            return -1;
-    }
-    else {
-        byte buffer [8];
-        const uint64_t msg_size = (uint64_t) zmtp_msg_size (msg);
-        buffer [0] = msg_size >> 56;
-        buffer [1] = msg_size >> 48;
-        buffer [2] = msg_size >> 40;
-        buffer [3] = msg_size >> 32;
-        buffer [4] = msg_size >> 24;
-        buffer [5] = msg_size >> 16;
-        buffer [6] = msg_size >> 8;
-        buffer [7] = msg_size;
-        if (zmtp_tcp_send (self->fd, buffer, sizeof buffer) == -1)
+    while (zmtp_channel_send_nowait (self, msg) == -1) {
+        if (errno != EAGAIN || s_wait (self, POLLOUT) == -1)
             return -1;
     }
-    if (zmtp_tcp_send (self->fd, zmtp_msg_data (msg), zmtp_msg_size (msg)) == -1)
-        return -1;
     return 0;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Receive a ZMTP message off the channel
+//  Write as much of the frame as the socket accepts without blocking.
+//  Returns 0 once the whole frame is written. Returns -1 with errno set to
+//  EAGAIN if the socket is full; the channel remembers how far it got and
+//  the caller must pass the same message (or a copy) again before sending
+//  anything else. Any other error means the connection is broken.
+//  With zerocopy on, when the frame of a msg that owns a body of at least
+//  the threshold starts, the channel holds msg until the kernel is done
+//  with the body. The caller may read and destroy msg as usual, but must
+//  not change the body while zmtp_channel_zerocopy_pending counts it.
+//  Copies passed again after EAGAIN are not read.
 
-zmtp_msg_t *
-zmtp_channel_recv (zmtp_channel_t *self)
+int
+zmtp_channel_send_nowait (zmtp_channel_t *self, zmtp_msg_t *msg)
 {
     assert (self);
+    assert (msg);
 
-    byte frame_flags;
-    size_t size;
+    const size_t size = zmtp_msg_size (msg);
+    if (self->out_header_size == 0) {
+        //  A large body for a local peer goes in a memfd if we can make
+        //  one, else down the socket as usual
+        if (self->memfd && self->unix_socket && size >= self->memfd
+        && (zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) != ZMTP_MSG_COMMAND)
+            s_memfd_wrap (self, msg);
+        self->out_header_size = self->out_fd == -1
+            ? zmtp_codec_encode_header (
+                self->out_header, zmtp_msg_flags (msg), size)
+            : zmtp_codec_encode_header (
+                self->out_header, ZMTP_MSG_COMMAND, ZMTP_CHANNEL_MEMFD_CMD);
+        self->out_sent = 0;
+        if (self->latency [ZMTP_LATENCY_SEND])
+            self->out_started = zmtp_clock_nsecs ();
+        if (self->zc_enabled && self->zerocopy && size >= self->zerocopy
+        &&  msg->greedy) {
+            s_zerocopy_drain (self, 0);
+            s_zerocopy_take (self, msg);
+        }
+        ZMTP_TRACE3 (frame_encode, self, zmtp_msg_flags (msg), size);
+    }
+    const byte *body = self->out_zc
+        ? zmtp_msg_data (self->out_zc): zmtp_msg_data (msg);
+    size_t body_size = size;
+    if (self->out_fd != -1) {
+        body = self->out_cmd;
+        body_size = ZMTP_CHANNEL_MEMFD_CMD;
+    }
 
-    if (zmtp_tcp_recv (self->fd, &frame_flags, 1) == -1)
-        return NULL;
-    //  Check large flag
-    if ((frame_flags & ZMTP_LARGE_FLAG) == 0) {
-        byte buffer [1];
-        if (zmtp_tcp_recv (self->fd, buffer, 1) == -1)
-            return NULL;
-        size = (size_t) buffer [0];
+    //  Write header and body with a single system call. The kernel reads
+    //  a zerocopy body after we return, so its header, which the next
+    //  frame overwrites, goes in a copying call of its own.
+    const size_t frame_size = self->out_header_size + body_size;
+    while (self->out_sent < frame_size) {
+        struct iovec iov [2];
+        int iovcnt = 0;
+        int flags = ZMTP_CHANNEL_SEND_FLAGS;
+        if (self->out_sent < self->out_header_size)
+            iov [iovcnt++] = (struct iovec) {
+                .iov_base = self->out_header + self->out_sent,
+                .iov_len = self->out_header_size - self->out_sent
+            };
+        const size_t body_sent = self->out_sent < self->out_header_size
+            ? 0: self->out_sent - self->out_header_size;
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+        if (self->out_zc && iovcnt)
+            flags |= ZMTP_CHANNEL_SEND_MORE;
+        else
+        if (self->out_zc)
+            flags |= MSG_ZEROCOPY;
+#endif
+        if (body_sent < body_size && !(iovcnt && self->out_zc))
+            iov [iovcnt++] = (struct iovec) {
+                .iov_base = (byte *) body + body_sent,
+                .iov_len = body_size - body_sent
+            };
+        struct msghdr msghdr = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        //  The memfd travels with the first byte of the MEMFD command
+        union {
+            char buf [CMSG_SPACE (sizeof (int))];
+            struct cmsghdr align;
+        } control;
+        if (self->out_fd != -1 && self->out_sent == 0) {
+            msghdr.msg_control = control.buf;
+            msghdr.msg_controllen = sizeof control.buf;
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msghdr);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+            memcpy (CMSG_DATA (cmsg), &self->out_fd, sizeof (int));
+        }
+        const ssize_t rc = sendmsg (self->fd, &msghdr, flags);
+        ZMTP_STAT_ADD (self->stats->send_calls, 1);
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+        if (rc != -1 && (flags & MSG_ZEROCOPY))
+            self->zc_next++;
+#endif
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+            //  Out of memory to pin pages; this write copies instead
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                flags &= ~MSG_ZEROCOPY;
+                const ssize_t copied = sendmsg (self->fd, &msghdr, flags);
+                ZMTP_STAT_ADD (self->stats->send_calls, 1);
+                if (copied != -1) {
+                    self->out_sent += copied;
+                    self->out_offset += (uint32_t) copied;
+                    continue;
+                }
+            }
+#endif
+            if (errno == EWOULDBLOCK)
+                errno = EAGAIN;
+            if (errno == EAGAIN)
+                ZMTP_STAT_ADD (self->stats->eagains, 1);
+            return -1;
+        }
+        self->out_sent += rc;
+        self->out_offset += (uint32_t) rc;
+        if (self->out_sent < frame_size)
+            ZMTP_STAT_ADD (self->stats->partial_writes, 1);
     }
-    else {
-        byte buffer [8];
-        if (zmtp_tcp_recv (self->fd, buffer, sizeof buffer) == -1)
-            return NULL;
-        size = (uint64_t) buffer [0] << 56 |
-               (uint64_t) buffer [1] << 48 |
-               (uint64_t) buffer [2] << 40 |
-               (uint64_t) buffer [3] << 32 |
-               (uint64_t) buffer [4] << 24 |
-               (uint64_t) buffer [5] << 16 |
-               (uint64_t) buffer [6] << 8  |
-               (uint64_t) buffer [7];
-    }
-    byte *data = zmalloc (size);
-    assert (data);
-    if (zmtp_tcp_recv (self->fd, data, size) == -1) {
-        free (data);
-        return NULL;
+    self->out_header_size = 0;
+    self->out_sent = 0;
+    if (self->out_fd != -1) {
+        close (self->out_fd);
+        self->out_fd = -1;
     }
-    byte msg_flags = 0;
-    if ((frame_flags & ZMTP_MORE_FLAG) == ZMTP_MORE_FLAG)
-        msg_flags |= ZMTP_MSG_MORE;
-    if ((frame_flags & ZMTP_COMMAND_FLAG) == ZMTP_COMMAND_FLAG)
-        msg_flags |= ZMTP_MSG_COMMAND;
-    return zmtp_msg_from_data (msg_flags, &data, size);
+    if (self->out_zc) {
+        //  Keep the body until the kernel has sent its last piece
+        if (self->zc_next != self->out_zc_first)
+            zmtp_msgq_push_stamped (self->zc_held, &self->out_zc,
+                (int64_t) (uint32_t) (self->zc_next - 1));
+        else
+            zmtp_msg_destroy (&self->out_zc);
+    }
+    s_sent_frame (self);
+    if (self->latency [ZMTP_LATENCY_SEND])
+        zmtp_histogram_record (self->latency [ZMTP_LATENCY_SEND],
+            (uint64_t) (zmtp_clock_nsecs () - self->out_started));
+    ZMTP_TRACE3 (frame_sent, self, zmtp_msg_flags (msg), size);
+    ZMTP_STAT_ADD (self->stats->frames_out, 1);
+    ZMTP_STAT_ADD (self->stats->bytes_out, size);
+    if ((zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
+        ZMTP_STAT_ADD (self->stats->commands_out, 1);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send part of a file as one frame. The header is written first, then
+//  sendfile moves the body from the page cache to the socket, so a large
+//  cached blob is served without being read into a buffer. Once the
+//  header is out the peer expects the whole body, so a file that shrinks
+//  under us breaks the connection (EIO).
+
+int
+zmtp_channel_send_file (zmtp_channel_t *self, int fd, off_t offset,
+                        size_t size, byte flags)
+{
+    assert (self);
+
+    if (flags & ~ZMTP_MSG_MORE) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (self->out_header_size) {
+        errno = EBUSY;
+        return -1;
+    }
+    struct stat info;
+    if (fstat (fd, &info) == -1)
+        return -1;
+    if (!S_ISREG (info.st_mode) || offset < 0
+    ||  (uint64_t) offset + size > (uint64_t) info.st_size) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const int64_t started =
+        self->latency [ZMTP_LATENCY_SEND]? zmtp_clock_nsecs (): 0;
+    ZMTP_TRACE3 (frame_encode, self, flags, size);
+    byte header [9];
+    const size_t header_size =
+        zmtp_codec_encode_header (header, flags, size);
+    if (s_send_all (self, header, header_size,
+            size? ZMTP_CHANNEL_SEND_MORE: 0) == -1)
+        return -1;
+
+    size_t sent = 0;
+    while (sent < size) {
+        const ssize_t rc = s_send_file (self, fd, &offset, size - sent);
+        ZMTP_STAT_ADD (self->stats->send_calls, 1);
+        if (rc > 0) {
+            sent += rc;
+            self->out_offset += (uint32_t) rc;
+        }
+        else
+        if (rc == 0) {
+            errno = EIO;
+            return -1;
+        }
+        else
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            ZMTP_STAT_ADD (self->stats->eagains, 1);
+            if (s_wait (self, POLLOUT) == -1)
+                return -1;
+        }
+        else
+        if (errno != EINTR)
+            return -1;
+    }
+    s_sent_frame (self);
+    if (self->latency [ZMTP_LATENCY_SEND])
+        zmtp_histogram_record (self->latency [ZMTP_LATENCY_SEND],
+            (uint64_t) (zmtp_clock_nsecs () - started));
+    ZMTP_TRACE3 (frame_sent, self, flags, size);
+    ZMTP_STAT_ADD (self->stats->frames_out, 1);
+    ZMTP_STAT_ADD (self->stats->bytes_out, size);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send all parts of a multipart message, each but the last with the
+//  MORE flag. Headers and bodies are gathered into one write for up to
+//  ZMTP_CHANNEL_IOV_PARTS parts, so an envelope and its body cost one
+//  system call instead of one per frame. Blocks until all is written.
+//  Returns 0, or -1 with errno set: EINVAL if there are no parts, EBUSY
+//  if a frame is partly written; other errors mean the connection is
+//  broken.
+
+int
+zmtp_channel_send_multipart (zmtp_channel_t *self,
+                             zmtp_multipart_t *multipart)
+{
+    assert (self);
+    assert (multipart);
+
+    const size_t parts = zmtp_multipart_parts (multipart);
+    if (parts == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (self->out_header_size) {
+        errno = EBUSY;
+        return -1;
+    }
+    const int64_t started =
+        self->latency [ZMTP_LATENCY_SEND]? zmtp_clock_nsecs (): 0;
+    byte *data = zmtp_multipart_data (multipart);
+    const size_t *offsets = zmtp_multipart_offsets (multipart);
+    byte headers [ZMTP_CHANNEL_IOV_PARTS][ZMTP_CODEC_HEADER_MAX];
+    size_t header_sizes [ZMTP_CHANNEL_IOV_PARTS];
+    struct iovec iov [2 * ZMTP_CHANNEL_IOV_PARTS];
+
+    for (size_t first = 0; first < parts; first += ZMTP_CHANNEL_IOV_PARTS) {
+        const size_t count = parts - first < ZMTP_CHANNEL_IOV_PARTS
+            ? parts - first: ZMTP_CHANNEL_IOV_PARTS;
+        size_t iovcnt = 0;
+        for (size_t i = 0; i < count; i++) {
+            const size_t part = first + i;
+            const size_t size = offsets [part + 1] - offsets [part];
+            const byte flags = part + 1 < parts? ZMTP_MSG_MORE: 0;
+            header_sizes [i] =
+                zmtp_codec_encode_header (headers [i], flags, size);
+            iov [iovcnt++] = (struct iovec) {
+                .iov_base = headers [i], .iov_len = header_sizes [i]
+            };
+            if (size)
+                iov [iovcnt++] = (struct iovec) {
+                    .iov_base = data + offsets [part], .iov_len = size
+                };
+            ZMTP_TRACE3 (frame_encode, self, flags, size);
+        }
+        if (s_send_iov (self, iov, iovcnt,
+                first + count < parts? ZMTP_CHANNEL_SEND_MORE: 0) == -1)
+            return -1;
+
+        //  Account for each frame as if it went alone
+        for (size_t i = 0; i < count; i++) {
+            const size_t part = first + i;
+            const size_t size = offsets [part + 1] - offsets [part];
+            self->out_offset += (uint32_t) (header_sizes [i] + size);
+            s_sent_frame (self);
+            ZMTP_TRACE3 (frame_sent,
+                self, part + 1 < parts? ZMTP_MSG_MORE: 0, size);
+        }
+    }
+    if (self->latency [ZMTP_LATENCY_SEND])
+        zmtp_histogram_record (self->latency [ZMTP_LATENCY_SEND],
+            (uint64_t) (zmtp_clock_nsecs () - started));
+    ZMTP_STAT_ADD (self->stats->frames_out, parts);
+    ZMTP_STAT_ADD (self->stats->bytes_out, zmtp_multipart_size (multipart));
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write an I/O vector to the socket, waiting while it is full; iov is
+//  used up on the way. Returns 0, or -1 with errno set.
+
+static int
+s_send_iov (zmtp_channel_t *self, struct iovec *iov, size_t iovcnt,
+            int flags)
+{
+    while (iovcnt > 0) {
+        struct msghdr msghdr = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        const ssize_t rc =
+            sendmsg (self->fd, &msghdr, ZMTP_CHANNEL_SEND_FLAGS | flags);
+        ZMTP_STAT_ADD (self->stats->send_calls, 1);
+        if (rc >= 0) {
+            size_t sent = (size_t) rc;
+            while (iovcnt > 0 && sent >= iov->iov_len) {
+                sent -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = (byte *) iov->iov_base + sent;
+                iov->iov_len -= sent;
+                ZMTP_STAT_ADD (self->stats->partial_writes, 1);
+            }
+        }
+        else
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            ZMTP_STAT_ADD (self->stats->eagains, 1);
+            if (s_wait (self, POLLOUT) == -1)
+                return -1;
+        }
+        else
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write a buffer to the socket, waiting while it is full. Returns 0, or
+//  -1 with errno set.
+
+static int
+s_send_all (zmtp_channel_t *self, const byte *data, size_t size, int flags)
+{
+    while (size > 0) {
+        const ssize_t rc =
+            send (self->fd, data, size, ZMTP_CHANNEL_SEND_FLAGS | flags);
+        ZMTP_STAT_ADD (self->stats->send_calls, 1);
+        if (rc > 0) {
+            data += rc;
+            size -= rc;
+            self->out_offset += (uint32_t) rc;
+        }
+        else
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            ZMTP_STAT_ADD (self->stats->eagains, 1);
+            if (s_wait (self, POLLOUT) == -1)
+                return -1;
+        }
+        else
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Move up to size bytes of the file at *offset to the socket without
+//  blocking, advancing *offset. Without sendfile we read through a
+//  buffer and write what the socket takes. Returns bytes sent, 0 at end
+//  of file, or -1 with errno set.
+
+static ssize_t
+s_send_file (zmtp_channel_t *self, int fd, off_t *offset, size_t size)
+{
+#if defined (__UTYPE_LINUX)
+    //  sendfile takes no MSG_DONTWAIT or MSG_NOSIGNAL, so make the socket
+    //  non-blocking and hold SIGPIPE back for the length of the call; if
+    //  the peer went away, take the signal we caused before unblocking
+    const int socket_flags = fcntl (self->fd, F_GETFL, 0);
+    fcntl (self->fd, F_SETFL, socket_flags | O_NONBLOCK);
+    sigset_t sigpipe, saved, pending;
+    sigemptyset (&sigpipe);
+    sigaddset (&sigpipe, SIGPIPE);
+    pthread_sigmask (SIG_BLOCK, &sigpipe, &saved);
+    sigpending (&pending);
+    const bool was_pending = sigismember (&pending, SIGPIPE);
+    const ssize_t rc = sendfile (self->fd, fd, offset, size);
+    const int error = errno;
+    if (rc == -1 && error == EPIPE && !was_pending) {
+        const struct timespec now = { 0, 0 };
+        while (sigtimedwait (&sigpipe, NULL, &now) == -1 && errno == EINTR);
+    }
+    pthread_sigmask (SIG_SETMASK, &saved, NULL);
+    fcntl (self->fd, F_SETFL, socket_flags);
+    errno = error;
+    return rc;
+#else
+    byte buffer [ZMTP_CHANNEL_BUFSIZE];
+    const ssize_t rc = pread (fd, buffer,
+        size < sizeof buffer? size: sizeof buffer, *offset);
+    if (rc <= 0)
+        return rc;
+    const ssize_t sent =
+        send (self->fd, buffer, (size_t) rc, ZMTP_CHANNEL_SEND_FLAGS);
+    if (sent > 0)
+        *offset += sent;
+    return sent;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if a frame has been partly written and the rest is pending
+
+bool
+zmtp_channel_sending (zmtp_channel_t *self)
+{
+    assert (self);
+    return self->out_header_size > 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if the channel is connected and between messages: nothing
+//  partly written, nothing received that was not read, and the peer has
+//  neither sent more nor hung up. Does not block.
+
+bool
+zmtp_channel_idle (zmtp_channel_t *self)
+{
+    assert (self);
+    if (self->fd == -1 || self->out_header_size > 0 || self->in_msg
+    ||  self->in_next < self->in_nframes || self->in_head < self->in_tail
+    ||  self->in_fds_size > 0)
+        return false;
+    //  Transmit timestamps and zerocopy completions raise POLLERR too;
+    //  read them off so that only a socket error counts
+    s_read_errqueue (self);
+    struct pollfd item = { .fd = self->fd, .events = POLLIN };
+    return poll (&item, 1, 0) == 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a ZMTP message off the channel
+
+zmtp_msg_t *
+zmtp_channel_recv (zmtp_channel_t *self)
+{
+    assert (self);
+
+    zmtp_histogram_t *latency = self->latency [ZMTP_LATENCY_RECV];
+    const int64_t started = latency? zmtp_clock_nsecs (): 0;
+    while (true) {
+        zmtp_msg_t *msg = zmtp_channel_recv_nowait (self);
+        if (msg) {
+            if (latency)
+                zmtp_histogram_record (
+                    latency, (uint64_t) (zmtp_clock_nsecs () - started));
+            return msg;
+        }
+        if (errno != EAGAIN || s_wait (self, POLLIN) == -1)
+            return NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a ZMTP message if a whole frame is available without blocking.
+//  Returns NULL with errno set to EAGAIN if the frame is not complete yet;
+//  the bytes received so far are kept for the next call. Any other error,
+//  including ECONNRESET when the peer closed, means the connection is
+//  broken.
+
+zmtp_msg_t *
+zmtp_channel_recv_nowait (zmtp_channel_t *self)
+{
+    assert (self);
+
+    //  Zerocopy completions wake poll; take them so it sleeps again
+    s_zerocopy_drain (self, 0);
+
+    while (true) {
+        const size_t available = self->in_tail - self->in_head;
+        if (self->in_msg) {
+            //  Complete the body, first from the buffer
+            byte *body = zmtp_msg_data (self->in_msg);
+            const size_t missing =
+                zmtp_msg_size (self->in_msg) - self->in_received;
+            const size_t n = available < missing? available: missing;
+            memcpy (body + self->in_received, self->in_buf + self->in_head, n);
+            self->in_head += n;
+            self->in_received += n;
+            if (self->in_received == zmtp_msg_size (self->in_msg)) {
+                zmtp_msg_t *msg = self->in_msg;
+                self->in_msg = NULL;
+                return s_received (self, msg);
+            }
+            //  Buffer is drained; read large bodies straight into place
+            if (missing - n >= ZMTP_CHANNEL_BUFSIZE) {
+                const ssize_t rc = s_recv (self,
+                    body + self->in_received, missing - n);
+                ZMTP_STAT_ADD (self->stats->recv_calls, 1);
+                if (rc > 0)
+                    self->in_received += rc;
+                else
+                if (rc == 0) {
+                    errno = ECONNRESET;
+                    return NULL;
+                }
+                else
+                if (errno != EINTR) {
+                    if (errno == EWOULDBLOCK)
+                        errno = EAGAIN;
+                    if (errno == EAGAIN)
+                        ZMTP_STAT_ADD (self->stats->eagains, 1);
+                    return NULL;
+                }
+                continue;
+            }
+        }
+        else
+        if (self->in_next < self->in_nframes) {
+            //  Deliver the next frame found by the last scan
+            const zmtp_frame_t *frame = &self->in_frames [self->in_next++];
+            const byte *body = self->in_buf + self->in_base + frame->offset;
+            zmtp_msg_t *msg = zmtp_msg_new (frame->flags, frame->size);
+            memcpy (zmtp_msg_data (msg), body, frame->size);
+            self->in_head = body + frame->size - self->in_buf;
+            ZMTP_STAT_ADD (self->stats->allocations, 1);
+            return s_received (self, msg);
+        }
+        else {
+            //  Find all complete frames in the buffer in one pass
+            size_t consumed;
+            self->in_nframes = zmtp_codec_scan (
+                self->in_buf + self->in_head, available,
+                self->in_frames, ZMTP_CHANNEL_SCAN_MAX, &consumed);
+            self->in_next = 0;
+            self->in_base = self->in_head;
+            if (self->in_nframes)
+                continue;
+
+            //  Decode the header of a frame whose body is not all here
+            byte msg_flags;
+            uint64_t size;
+            const size_t header_size = zmtp_codec_decode_header (
+                self->in_buf + self->in_head, available, &msg_flags, &size);
+            if (header_size) {
+                if (size > SIZE_MAX) {
+                    errno = EMSGSIZE;
+                    return NULL;
+                }
+                self->in_head += header_size;
+                self->in_msg = zmtp_msg_new (msg_flags, (size_t) size);
+                self->in_received = 0;
+                ZMTP_STAT_ADD (self->stats->allocations, 1);
+                continue;
+            }
+        }
+        if (s_fill (self) == -1)
+            return NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a whole multipart message: every frame up to the first without
+//  the MORE flag. Bodies go into the message's one buffer, copied from
+//  the receive buffer or read straight into place if large, with no
+//  message object per frame. Blocks until the last part is in, so a
+//  partial message is never returned. Returns NULL with errno set: EBUSY
+//  if zmtp_channel_recv_nowait left a frame half read, EPROTO if a
+//  command arrives inside the message; other errors mean the connection
+//  is broken.
+
+zmtp_multipart_t *
+zmtp_channel_recv_multipart (zmtp_channel_t *self)
+{
+    assert (self);
+
+    if (self->in_msg) {
+        errno = EBUSY;
+        return NULL;
+    }
+    zmtp_histogram_t *latency = self->latency [ZMTP_LATENCY_RECV];
+    const int64_t started = latency? zmtp_clock_nsecs (): 0;
+    s_zerocopy_drain (self, 0);
+    zmtp_multipart_t *multipart = zmtp_multipart_new ();
+    bool more = true;
+    while (more) {
+        if (self->in_next < self->in_nframes) {
+            //  Take the next frame found by the last scan
+            const zmtp_frame_t *frame = &self->in_frames [self->in_next++];
+            const byte *body = self->in_buf + self->in_base + frame->offset;
+            self->in_head = body + frame->size - self->in_buf;
+            const int flags = s_part_received (
+                self, multipart, frame->flags, body, frame->size);
+            if (flags == -1)
+                break;
+            more = (flags & ZMTP_MSG_MORE) != 0;
+            continue;
+        }
+        const size_t available = self->in_tail - self->in_head;
+        size_t consumed;
+        self->in_nframes = zmtp_codec_scan (
+            self->in_buf + self->in_head, available,
+            self->in_frames, ZMTP_CHANNEL_SCAN_MAX, &consumed);
+        self->in_next = 0;
+        self->in_base = self->in_head;
+        if (self->in_nframes)
+            continue;
+
+        //  A data frame whose body is not all here goes straight into
+        //  the message; commands must fit the buffer to be scanned
+        byte flags;
+        uint64_t size;
+        const size_t header_size = zmtp_codec_decode_header (
+            self->in_buf + self->in_head, available, &flags, &size);
+        const bool command =
+            (flags & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND;
+        if (header_size && command
+        &&  size > ZMTP_CHANNEL_BUFSIZE - header_size) {
+            errno = EPROTO;
+            break;
+        }
+        if (header_size && !command) {
+            if (size > SIZE_MAX) {
+                errno = EMSGSIZE;
+                break;
+            }
+            byte *body = zmtp_multipart_add (multipart, (size_t) size);
+            if (!body)
+                break;
+            self->in_head += header_size;
+            if (s_recv_body (self, body, (size_t) size) == -1)
+                break;
+            ZMTP_TRACE3 (frame_decode, self, flags, size);
+            ZMTP_STAT_ADD (self->stats->frames_in, 1);
+            ZMTP_STAT_ADD (self->stats->bytes_in, size);
+            more = (flags & ZMTP_MSG_MORE) != 0;
+            continue;
+        }
+        if (s_fill (self) == -1
+        &&  (errno != EAGAIN || s_wait (self, POLLIN) == -1))
+            break;
+    }
+    if (more) {
+        zmtp_multipart_destroy (&multipart);
+        return NULL;
+    }
+    if (latency)
+        zmtp_histogram_record (
+            latency, (uint64_t) (zmtp_clock_nsecs () - started));
+    return multipart;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add a frame found in the receive buffer to a multipart message. A
+//  MEMFD command stands for the part it carries; any other command fails
+//  with EPROTO. Returns the flags of the part added, or -1 with errno
+//  set.
+
+static int
+s_part_received (zmtp_channel_t *self, zmtp_multipart_t *multipart,
+                 byte flags, const byte *body, size_t size)
+{
+    if ((flags & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND) {
+        zmtp_msg_t *msg = zmtp_msg_new (flags, size);
+        memcpy (zmtp_msg_data (msg), body, size);
+        msg = s_received (self, msg);
+        if (!msg)
+            return -1;
+        flags = zmtp_msg_flags (msg);
+        int rc = -1;
+        if ((flags & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
+            errno = EPROTO;
+        else
+        if (zmtp_multipart_append (multipart,
+                zmtp_msg_data (msg), zmtp_msg_size (msg)) == 0)
+            rc = flags;
+        zmtp_msg_destroy (&msg);
+        return rc;
+    }
+    byte *part = zmtp_multipart_add (multipart, size);
+    if (!part)
+        return -1;
+    if (size)
+        memcpy (part, body, size);
+    ZMTP_TRACE3 (frame_decode, self, flags, size);
+    ZMTP_STAT_ADD (self->stats->frames_in, 1);
+    ZMTP_STAT_ADD (self->stats->bytes_in, size);
+    return flags;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Fill in a body whose header was just taken off the receive buffer,
+//  first from the buffer, then reading large remainders straight into
+//  place. Waits for the bytes. Returns 0, or -1 with errno set.
+
+static int
+s_recv_body (zmtp_channel_t *self, byte *body, size_t size)
+{
+    size_t received = 0;
+    while (true) {
+        const size_t available = self->in_tail - self->in_head;
+        const size_t missing = size - received;
+        const size_t n = available < missing? available: missing;
+        memcpy (body + received, self->in_buf + self->in_head, n);
+        self->in_head += n;
+        received += n;
+        if (received == size)
+            return 0;
+        if (missing - n >= ZMTP_CHANNEL_BUFSIZE) {
+            const ssize_t rc = s_recv (self, body + received, missing - n);
+            ZMTP_STAT_ADD (self->stats->recv_calls, 1);
+            if (rc > 0) {
+                received += rc;
+                continue;
+            }
+            if (rc == 0) {
+                errno = ECONNRESET;
+                return -1;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno != EWOULDBLOCK && errno != EAGAIN)
+                return -1;
+            ZMTP_STAT_ADD (self->stats->eagains, 1);
+            if (s_wait (self, POLLIN) == -1)
+                return -1;
+        }
+        else
+        if (s_fill (self) == -1
+        &&  (errno != EAGAIN || s_wait (self, POLLIN) == -1))
+            return -1;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read whatever the socket has into the receive buffer without blocking.
+//  Returns 0 if some bytes arrived, else -1 with errno set.
+
+static int
+s_fill (zmtp_channel_t *self)
+{
+    //  Move unread bytes to the start of the buffer
+    if (self->in_head > 0) {
+        memmove (self->in_buf, self->in_buf + self->in_head,
+            self->in_tail - self->in_head);
+        self->in_tail -= self->in_head;
+        self->in_head = 0;
+    }
+    while (true) {
+        const ssize_t rc = s_recv (self, self->in_buf + self->in_tail,
+            ZMTP_CHANNEL_BUFSIZE - self->in_tail);
+        ZMTP_STAT_ADD (self->stats->recv_calls, 1);
+        if (rc > 0) {
+            self->in_tail += rc;
+            return 0;
+        }
+        if (rc == 0)
+            errno = ECONNRESET;
+        else
+        if (errno == EINTR)
+            continue;
+        else
+        if (errno == EWOULDBLOCK)
+            errno = EAGAIN;
+        if (errno == EAGAIN)
+            ZMTP_STAT_ADD (self->stats->eagains, 1);
+        return -1;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Count a frame delivered to the caller, first swapping a MEMFD command
+//  for the message it carries. Returns the message to deliver, or NULL
+//  with errno set if the command is bad.
+
+static zmtp_msg_t *
+s_received (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+    if (self->memfd
+    &&  (zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND
+    &&  zmtp_msg_size (msg) == ZMTP_CHANNEL_MEMFD_CMD
+    &&  memcmp (zmtp_msg_data (msg), "\5MEMFD", 6) == 0) {
+        msg = s_memfd_unwrap (self, msg);
+        if (!msg)
+            return NULL;
+    }
+    ZMTP_TRACE3 (frame_decode,
+        self, zmtp_msg_flags (msg), zmtp_msg_size (msg));
+    msg->timestamp = self->in_stamp;
+    ZMTP_STAT_ADD (self->stats->frames_in, 1);
+    ZMTP_STAT_ADD (self->stats->bytes_in, zmtp_msg_size (msg));
+    if ((zmtp_msg_flags (msg) & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
+        ZMTP_STAT_ADD (self->stats->commands_in, 1);
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Block until the socket is ready for the given poll events. Transmit
+//  timestamps and zerocopy completions waiting in the error queue also
+//  wake poll; they are moved aside and we wait again.
+
+static int
+s_wait (zmtp_channel_t *self, short events)
+{
+    struct pollfd pollfd = { .fd = self->fd, .events = events };
+    while (true) {
+        if (poll (&pollfd, 1, -1) == -1) {
+            if (errno != EINTR)
+                return -1;
+        }
+        else
+        if ((pollfd.revents & (POLLERR | events)) == POLLERR
+        &&  s_read_errqueue (self) > 0)
+            continue;
+        else
+            return 0;
+    }
+}
+
+
+#if defined (SO_TIMESTAMPING)
+
+//  --------------------------------------------------------------------------
+//  Set the socket's SO_TIMESTAMPING flags to the modes asked for. Turning
+//  transmit stamps on starts counting frames and stream offsets afresh.
+
+static int
+s_set_timestamping (zmtp_channel_t *self)
+{
+    int flags = 0;
+    if (self->timestamping & ZMTP_TIMESTAMP_RX)
+        flags |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (self->timestamping & ZMTP_TIMESTAMP_TX)
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+              |  SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY
+              |  (self->ts_flags & SOF_TIMESTAMPING_OPT_ID
+                  ? self->ts_flags & SOF_TIMESTAMPING_OPT_ID_TCP
+                  : SOF_TIMESTAMPING_OPT_ID_TCP);
+    int rc = setsockopt (self->fd, SOL_SOCKET, SO_TIMESTAMPING,
+        &flags, sizeof flags);
+    if (rc == -1 && errno == EINVAL && (flags & SOF_TIMESTAMPING_OPT_ID_TCP)) {
+        flags &= ~SOF_TIMESTAMPING_OPT_ID_TCP;
+        rc = setsockopt (self->fd, SOL_SOCKET, SO_TIMESTAMPING,
+            &flags, sizeof flags);
+    }
+    if (rc == -1)
+        return -1;
+
+    if ((flags & SOF_TIMESTAMPING_OPT_ID)
+    && !(self->ts_flags & SOF_TIMESTAMPING_OPT_ID)) {
+        //  Keys now count from the last byte written, or without
+        //  OPT_ID_TCP from the last byte acknowledged
+        self->out_offset = 0;
+        int unacked;
+        if (!(flags & SOF_TIMESTAMPING_OPT_ID_TCP)
+        &&  ioctl (self->fd, SIOCOUTQ, &unacked) == 0)
+            self->out_offset = (uint32_t) unacked;
+        self->out_frames = 0;
+        self->out_stamps_head = 0;
+        self->out_stamps_size = 0;
+    }
+    if (!(flags & SOF_TIMESTAMPING_RX_SOFTWARE))
+        self->in_stamp = 0;
+    self->ts_flags = flags;
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read from the socket without blocking, picking up the receive timestamp
+//  if we asked for them and memfds if we accept them
+
+static ssize_t
+s_recv (zmtp_channel_t *self, void *buffer, size_t size)
+{
+    const bool fds = self->memfd && self->unix_socket;
+    if (!(self->ts_flags & SOF_TIMESTAMPING_RX_SOFTWARE) && !fds)
+        return recv (self->fd, buffer, size, MSG_DONTWAIT);
+
+    struct iovec iov = { .iov_base = buffer, .iov_len = size };
+    union {
+        char buf [CMSG_SPACE (sizeof (struct scm_timestamping))
+                + CMSG_SPACE (sizeof (int) * ZMTP_CHANNEL_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msghdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+    const ssize_t rc = recvmsg (self->fd, &msghdr,
+        MSG_DONTWAIT | (fds? MSG_CMSG_CLOEXEC: 0));
+    if (rc > 0) {
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msghdr); cmsg;
+             cmsg = CMSG_NXTHDR (&msghdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET
+            &&  cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping stamps;
+                memcpy (&stamps, CMSG_DATA (cmsg), sizeof stamps);
+                self->in_stamp = (int64_t) stamps.ts [0].tv_sec * 1000000000
+                               + stamps.ts [0].tv_nsec;
+            }
+#if defined (ZMTP_CHANNEL_MEMFD)
+            else
+            if (cmsg->cmsg_level == SOL_SOCKET
+            &&  cmsg->cmsg_type == SCM_RIGHTS) {
+                //  The peer decides how many there are; take them one
+                //  at a time so none can overrun our buffers
+                const size_t count =
+                    (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+                for (size_t i = 0; i < count; i++) {
+                    int received;
+                    memcpy (&received, CMSG_DATA (cmsg) + i * sizeof (int),
+                        sizeof (int));
+                    s_memfd_received (self, &received, 1);
+                }
+            }
+#endif
+        }
+    }
+    //  Descriptors that did not fit were closed by the kernel
+    if (rc > 0 && (msghdr.msg_flags & MSG_CTRUNC))
+        self->in_fds_lost = true;
+    return rc;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remember a frame just written, if stamping them, so its transmit time
+//  can be matched to it. If the caller does not keep up, the oldest frame
+//  is forgotten.
+
+static void
+s_sent_frame (zmtp_channel_t *self)
+{
+    if (!(self->ts_flags & SOF_TIMESTAMPING_TX_SOFTWARE))
+        return;
+    if (self->out_stamps_size == ZMTP_CHANNEL_TX_STAMPS) {
+        self->out_stamps_head =
+            (self->out_stamps_head + 1) % ZMTP_CHANNEL_TX_STAMPS;
+        self->out_stamps_size--;
+    }
+    const size_t tail = (self->out_stamps_head + self->out_stamps_size)
+                      % ZMTP_CHANNEL_TX_STAMPS;
+    self->out_stamps [tail] = (s_tx_stamp_t) {
+        .end = self->out_offset,
+        .frame = self->out_frames++
+    };
+    self->out_stamps_size++;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Move transmit timestamps from the socket's error queue to the frames
+//  they belong to. Each stamp is keyed by the stream offset of the last
+//  byte of a write; it covers every frame ending at or before that byte.
+//  Zerocopy completions found on the way release the bodies they cover.
+//  Returns the number of entries read.
+
+static int
+s_read_errqueue (zmtp_channel_t *self)
+{
+    if (!(self->ts_flags & SOF_TIMESTAMPING_TX_SOFTWARE)
+    &&  !(self->zc_held && zmtp_msgq_size (self->zc_held)))
+        return 0;
+    int count = 0;
+    while (true) {
+        union {
+            char buf [CMSG_SPACE (sizeof (struct scm_timestamping))
+                    + CMSG_SPACE (sizeof (struct sock_extended_err) + 64)];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msghdr = {
+            .msg_control = control.buf,
+            .msg_controllen = sizeof control.buf
+        };
+        if (recvmsg (self->fd, &msghdr, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        int64_t stamp = 0;
+        const struct sock_extended_err *error = NULL;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msghdr); cmsg;
+             cmsg = CMSG_NXTHDR (&msghdr, cmsg))
+            if (cmsg->cmsg_level == SOL_SOCKET
+            &&  cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                struct scm_timestamping stamps;
+                memcpy (&stamps, CMSG_DATA (cmsg), sizeof stamps);
+                stamp = (int64_t) stamps.ts [0].tv_sec * 1000000000
+                      + stamps.ts [0].tv_nsec;
+            }
+            else
+            if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+            ||  (cmsg->cmsg_level == SOL_IPV6
+            &&   cmsg->cmsg_type == IPV6_RECVERR))
+                error = (const struct sock_extended_err *) CMSG_DATA (cmsg);
+        count++;
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+        if (error && error->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+            s_zerocopy_done (self, error->ee_data);
+            continue;
+        }
+#endif
+        if (!stamp || !error
+        ||  error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING
+        ||  error->ee_info != SCM_TSTAMP_SND)
+            continue;
+
+        //  Give the time to every waiting frame ending at or before the
+        //  stamped byte; offsets wrap, so compare differences
+        for (size_t i = 0; i < self->out_stamps_size; i++) {
+            s_tx_stamp_t *sent = &self->out_stamps [
+                (self->out_stamps_head + i) % ZMTP_CHANNEL_TX_STAMPS];
+            if ((int32_t) (error->ee_data - (sent->end - 1)) < 0)
+                break;
+            if (sent->stamp == 0)
+                sent->stamp = stamp;
+        }
+    }
+    return count;
+}
+
+#else
+
+static int
+s_set_timestamping (zmtp_channel_t *self)
+{
+    return 0;
+}
+
+static ssize_t
+s_recv (zmtp_channel_t *self, void *buffer, size_t size)
+{
+    return recv (self->fd, buffer, size, MSG_DONTWAIT);
+}
+
+static void
+s_sent_frame (zmtp_channel_t *self)
+{
+}
+
+static int
+s_read_errqueue (zmtp_channel_t *self)
+{
+    return 0;
+}
+
+#endif
+
+
+#if defined (ZMTP_CHANNEL_ZEROCOPY)
+
+//  --------------------------------------------------------------------------
+//  Turn SO_ZEROCOPY on if a threshold is set. Sockets that refuse it keep
+//  copying.
+
+static void
+s_set_zerocopy (zmtp_channel_t *self)
+{
+    if (!self->zerocopy || self->zc_enabled)
+        return;
+    const int on = 1;
+    if (setsockopt (self->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on) == 0)
+        self->zc_enabled = true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Hold the message whose frame is about to be sent, so its body outlives
+//  the caller's hold on it
+
+static void
+s_zerocopy_take (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+    if (!self->zc_held)
+        self->zc_held = zmtp_msgq_new ();
+    __atomic_fetch_add (&msg->refs, 1, __ATOMIC_RELAXED);
+    self->out_zc = msg;
+    self->out_zc_first = self->zc_next;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Free the bodies whose zerocopy sends up to id last have completed. TCP
+//  completes sends in order, so they are at the head of the queue; ids
+//  wrap, so compare differences.
+
+static void
+s_zerocopy_done (zmtp_channel_t *self, uint32_t last)
+{
+    while (self->zc_held && zmtp_msgq_size (self->zc_held)) {
+        const uint32_t id = (uint32_t) zmtp_msgq_first_stamp (self->zc_held);
+        if ((int32_t) (last - id) < 0)
+            break;
+        zmtp_msg_t *msg = zmtp_msgq_pop (self->zc_held);
+        zmtp_msg_destroy (&msg);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read completions of zerocopy sends, waiting up to timeout msecs for the
+//  kernel to finish with every held body. Keeps errno.
+
+static void
+s_zerocopy_drain (zmtp_channel_t *self, int timeout)
+{
+    if (!self->zc_held || zmtp_msgq_size (self->zc_held) == 0)
+        return;
+    const int saved_errno = errno;
+    const int64_t deadline = zmtp_clock_usecs () / 1000 + timeout;
+    s_read_errqueue (self);
+    while (zmtp_msgq_size (self->zc_held)) {
+        const int64_t left = deadline - zmtp_clock_usecs () / 1000;
+        struct pollfd pollfd = { .fd = self->fd };
+        if (left <= 0 || poll (&pollfd, 1, (int) left) <= 0
+        ||  s_read_errqueue (self) == 0)
+            break;
+    }
+    errno = saved_errno;
+}
+
+#else
+
+static void
+s_set_zerocopy (zmtp_channel_t *self)
+{
+}
+
+static void
+s_zerocopy_take (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+}
+
+static void
+s_zerocopy_drain (zmtp_channel_t *self, int timeout)
+{
+}
+
+#endif
+
+
+#if defined (ZMTP_CHANNEL_MEMFD)
+
+//  --------------------------------------------------------------------------
+//  Copy the body of the frame about to be sent into a sealed memfd and
+//  prepare the MEMFD command that carries it. Leaves out_fd at -1 if that
+//  fails, and the body is streamed instead.
+
+static void
+s_memfd_wrap (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+    const int fd = memfd_create ("zmtp", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        return;
+    const byte *data = zmtp_msg_data (msg);
+    const size_t size = zmtp_msg_size (msg);
+    size_t written = 0;
+    while (written < size) {
+        const ssize_t rc =
+            pwrite (fd, data + written, size - written, (off_t) written);
+        if (rc == -1 && errno != EINTR)
+            break;
+        if (rc > 0)
+            written += rc;
+    }
+    //  Sealed, the receiver can map it knowing it will not change
+    if (written < size
+    ||  fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW
+                              | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        close (fd);
+        return;
+    }
+    byte *command = self->out_cmd;
+    memcpy (command, "\5MEMFD", 6);
+    for (int shift = 56, i = 6; shift >= 0; shift -= 8)
+        command [i++] = (byte) ((uint64_t) size >> shift);
+    command [14] = zmtp_msg_flags (msg);
+    self->out_fd = fd;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Replace a MEMFD command with the message it carries, mapping the memfd
+//  that came with it. Destroys the command. Returns NULL with errno
+//  EPROTO if the memfd is missing, unsealed or too small.
+
+static zmtp_msg_t *
+s_memfd_unwrap (zmtp_channel_t *self, zmtp_msg_t *command)
+{
+    const byte *data = zmtp_msg_data (command);
+    uint64_t size = 0;
+    for (int i = 6; i < 14; i++)
+        size = size << 8 | data [i];
+    const byte flags = data [14];
+    zmtp_msg_destroy (&command);
+    if (self->in_fds_lost || self->in_fds_size == 0) {
+        errno = EPROTO;
+        return NULL;
+    }
+    const int fd = self->in_fds [self->in_fds_head];
+    self->in_fds_head = (self->in_fds_head + 1) % ZMTP_CHANNEL_FDS;
+    self->in_fds_size--;
+
+    const int seals = fcntl (fd, F_GET_SEALS);
+    struct stat info;
+    zmtp_msg_t *msg = NULL;
+    if (seals != -1
+    &&  (seals & (F_SEAL_SHRINK | F_SEAL_WRITE))
+             == (F_SEAL_SHRINK | F_SEAL_WRITE)
+    &&  fstat (fd, &info) == 0
+    &&  size <= (uint64_t) info.st_size
+    &&  !(flags & ~ZMTP_MSG_MORE))
+        msg = zmtp_msg_from_file (flags, fd, 0, (size_t) size);
+    close (fd);
+    if (!msg)
+        errno = EPROTO;
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Keep memfds received from the socket until their commands are decoded.
+//  If they do not fit, they are closed and matching gives up.
+
+static void
+s_memfd_received (zmtp_channel_t *self, const int *fds, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        if (self->in_fds_size < ZMTP_CHANNEL_FDS)
+            self->in_fds [(self->in_fds_head + self->in_fds_size++)
+                          % ZMTP_CHANNEL_FDS] = fds [i];
+        else {
+            close (fds [i]);
+            self->in_fds_lost = true;
+        }
+}
+
+#else
+
+static void
+s_memfd_wrap (zmtp_channel_t *self, zmtp_msg_t *msg)
+{
+}
+
+static zmtp_msg_t *
+s_memfd_unwrap (zmtp_channel_t *self, zmtp_msg_t *command)
+{
+    zmtp_msg_destroy (&command);
+    errno = EPROTO;
+    return NULL;
 }
 
+#endif
@@ -0,0 +1,492 @@
+/*  =========================================================================
+    zmtp_codec - ZMTP frame encoding and decoding on memory buffers
+
+    The codec does no I/O: channels use it to build and parse frames in
+    their own buffers, and other transports or tests can use it on any
+    memory they like.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Message flags have the same bits as the frame flags they come from
+#define ZMTP_CODEC_MSG_FLAGS (ZMTP_MORE_FLAG | ZMTP_COMMAND_FLAG)
+
+//  Read a big-endian 64-bit size from unaligned memory
+static inline uint64_t
+s_get_size (const byte *data)
+{
+#if defined (__GNUC__) && defined (__BYTE_ORDER__) \
+ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t size;
+    memcpy (&size, data, sizeof size);
+    return __builtin_bswap64 (size);
+#else
+    return (uint64_t) data [0] << 56 |
+           (uint64_t) data [1] << 48 |
+           (uint64_t) data [2] << 40 |
+           (uint64_t) data [3] << 32 |
+           (uint64_t) data [4] << 24 |
+           (uint64_t) data [5] << 16 |
+           (uint64_t) data [6] << 8  |
+           (uint64_t) data [7];
+#endif
+}
+
+//  Read a big-endian 32-bit property value size
+static inline size_t
+s_get_value_size (const byte *data)
+{
+    return (size_t) data [0] << 24 | (size_t) data [1] << 16
+         | (size_t) data [2] << 8  | (size_t) data [3];
+}
+
+//  Compare names of size octets ignoring ASCII case, as ZMTP asks
+static bool
+s_same_name (const char *name, const char *other, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        if (tolower ((byte) name [i]) != tolower ((byte) other [i]))
+            return false;
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Encode the header of a frame carrying size bytes with the given message
+//  flags into buffer, which must hold ZMTP_CODEC_HEADER_MAX bytes. Returns
+//  the header size.
+
+size_t
+zmtp_codec_encode_header (byte *buffer, byte msg_flags, size_t size)
+{
+    assert (buffer);
+    byte frame_flags = 0;
+    if ((msg_flags & ZMTP_MSG_MORE) == ZMTP_MSG_MORE)
+        frame_flags |= ZMTP_MORE_FLAG;
+    if ((msg_flags & ZMTP_MSG_COMMAND) == ZMTP_MSG_COMMAND)
+        frame_flags |= ZMTP_COMMAND_FLAG;
+    if (size <= 255) {
+        buffer [0] = frame_flags;
+        buffer [1] = (byte) size;
+        return 2;
+    }
+    const uint64_t msg_size = (uint64_t) size;
+    buffer [0] = frame_flags | ZMTP_LARGE_FLAG;
+    buffer [1] = msg_size >> 56;
+    buffer [2] = msg_size >> 48;
+    buffer [3] = msg_size >> 40;
+    buffer [4] = msg_size >> 32;
+    buffer [5] = msg_size >> 24;
+    buffer [6] = msg_size >> 16;
+    buffer [7] = msg_size >> 8;
+    buffer [8] = msg_size;
+    return 9;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Encode msg as a whole frame into buffer. Returns the frame size, or 0
+//  if it does not fit in capacity bytes.
+
+size_t
+zmtp_codec_encode (zmtp_msg_t *msg, byte *buffer, size_t capacity)
+{
+    assert (msg);
+    assert (buffer);
+    const size_t size = zmtp_msg_size (msg);
+    const size_t header_size = size <= 255? 2: 9;
+    if (capacity < header_size || capacity - header_size < size)
+        return 0;
+    zmtp_codec_encode_header (buffer, zmtp_msg_flags (msg), size);
+    memcpy (buffer + header_size, zmtp_msg_data (msg), size);
+    return header_size + size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Decode a frame header from the first size bytes of data. Returns the
+//  header size and sets the message flags and body size, or returns 0 if
+//  more bytes are needed.
+
+size_t
+zmtp_codec_decode_header (const byte *data, size_t size,
+                          byte *msg_flags, uint64_t *body_size)
+{
+    assert (data);
+    assert (msg_flags);
+    assert (body_size);
+    if (size < 2)
+        return 0;
+    const byte frame_flags = data [0];
+    size_t header_size;
+    //  Check large flag
+    if ((frame_flags & ZMTP_LARGE_FLAG) == 0) {
+        *body_size = (uint64_t) data [1];
+        header_size = 2;
+    }
+    else
+    if (size >= 9) {
+        *body_size = s_get_size (data + 1);
+        header_size = 9;
+    }
+    else
+        return 0;
+
+    *msg_flags = frame_flags & ZMTP_CODEC_MSG_FLAGS;
+    return header_size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Decode a whole frame from the first size bytes of data into a new
+//  message, and set consumed to the frame size. Returns NULL with errno
+//  set to EAGAIN if the frame is not complete, or EMSGSIZE if the body
+//  is too large for this platform.
+
+zmtp_msg_t *
+zmtp_codec_decode (const byte *data, size_t size, size_t *consumed)
+{
+    assert (data);
+    assert (consumed);
+    byte msg_flags;
+    uint64_t body_size;
+    const size_t header_size =
+        zmtp_codec_decode_header (data, size, &msg_flags, &body_size);
+    if (header_size == 0) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    if (body_size > SIZE_MAX - header_size) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+    if (size - header_size < body_size) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    zmtp_msg_t *msg = zmtp_msg_new (msg_flags, (size_t) body_size);
+    memcpy (zmtp_msg_data (msg), data + header_size, (size_t) body_size);
+    *consumed = header_size + (size_t) body_size;
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Find the complete frames at the start of the first size bytes of data,
+//  up to max_frames of them, in one pass. Fills in frames, sets consumed
+//  to the bytes they cover, and returns how many were found. Stops early
+//  at a frame that is not complete.
+//
+//  Each frame's position depends on the size of the one before, so the
+//  walk is serial; what makes it fast is that short frames, the common
+//  case, take no branch beyond the bounds checks, and flags need no
+//  translation.
+
+size_t
+zmtp_codec_scan (const byte *data, size_t size,
+                 zmtp_frame_t *frames, size_t max_frames, size_t *consumed)
+{
+    assert (data);
+    assert (frames);
+    assert (consumed);
+    size_t offset = 0;
+    size_t count = 0;
+    while (count < max_frames && size - offset >= 2) {
+        const byte frame_flags = data [offset];
+        uint64_t body_size;
+        size_t header_size;
+        if ((frame_flags & ZMTP_LARGE_FLAG) == 0) {
+            body_size = data [offset + 1];
+            header_size = 2;
+        }
+        else {
+            if (size - offset < 9)
+                break;
+            body_size = s_get_size (data + offset + 1);
+            header_size = 9;
+        }
+        if (body_size > size - offset - header_size)
+            break;
+        frames [count].flags = frame_flags & ZMTP_CODEC_MSG_FLAGS;
+        frames [count].offset = offset + header_size;
+        frames [count].size = (size_t) body_size;
+        offset += header_size + (size_t) body_size;
+        count++;
+    }
+    *consumed = offset;
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Encode the body of a command with the given name and count metadata
+//  properties into buffer. Returns the body size, or 0 if it does not fit
+//  in capacity bytes or a name is longer than 255.
+
+size_t
+zmtp_codec_encode_command (byte *buffer, size_t capacity, const char *name,
+                           const zmtp_property_t *properties, size_t count)
+{
+    assert (buffer);
+    assert (name);
+    assert (properties || count == 0);
+    const size_t name_size = strlen (name);
+    if (name_size == 0 || name_size > 255 || capacity < 1 + name_size)
+        return 0;
+    buffer [0] = (byte) name_size;
+    memcpy (buffer + 1, name, name_size);
+    size_t size = 1 + name_size;
+    for (size_t i = 0; i < count; i++) {
+        const zmtp_property_t *property = &properties [i];
+        if (property->name_size == 0 || property->name_size > 255
+        ||  property->value_size > UINT32_MAX
+        ||  capacity - size < 5 + property->name_size
+        ||  capacity - size - 5 - property->name_size
+            < property->value_size)
+            return 0;
+        buffer [size++] = (byte) property->name_size;
+        memcpy (buffer + size, property->name, property->name_size);
+        size += property->name_size;
+        const uint32_t value_size = (uint32_t) property->value_size;
+        buffer [size++] = value_size >> 24;
+        buffer [size++] = value_size >> 16;
+        buffer [size++] = value_size >> 8;
+        buffer [size++] = value_size;
+        if (value_size)
+            memcpy (buffer + size, property->value, value_size);
+        size += value_size;
+    }
+    return size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Parse the body of a command made of a name and metadata properties
+//  into a view of that body. Every property is checked here, so stepping
+//  through them later needs no checks.
+
+int
+zmtp_codec_parse_command (const byte *data, size_t size,
+                          zmtp_command_t *command)
+{
+    assert (data || size == 0);
+    assert (command);
+    if (size < 1 || data [0] == 0 || size - 1 < data [0]) {
+        errno = EPROTO;
+        return -1;
+    }
+    command->name = (const char *) data + 1;
+    command->name_size = data [0];
+    command->properties = data + 1 + data [0];
+    command->properties_size = size - 1 - data [0];
+
+    const byte *at = command->properties;
+    size_t left = command->properties_size;
+    while (left > 0) {
+        const size_t name_size = at [0];
+        if (name_size == 0 || left < 5 + name_size) {
+            errno = EPROTO;
+            return -1;
+        }
+        const size_t value = s_get_value_size (at + 1 + name_size);
+        if (left - 5 - name_size < value) {
+            errno = EPROTO;
+            return -1;
+        }
+        at += 5 + name_size + value;
+        left -= 5 + name_size + value;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if the command name is name, ignoring case
+
+bool
+zmtp_codec_command_is (const zmtp_command_t *command, const char *name)
+{
+    assert (command);
+    assert (name);
+    return strlen (name) == command->name_size
+        && s_same_name (command->name, name, command->name_size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Step through the properties of a parsed command
+
+bool
+zmtp_codec_next_property (const zmtp_command_t *command, size_t *cursor,
+                          zmtp_property_t *property)
+{
+    assert (command);
+    assert (cursor);
+    assert (property);
+    if (*cursor >= command->properties_size)
+        return false;
+    const byte *at = command->properties + *cursor;
+    property->name = (const char *) at + 1;
+    property->name_size = at [0];
+    property->value = at + 5 + at [0];
+    property->value_size = s_get_value_size (at + 1 + at [0]);
+    *cursor += 5 + property->name_size + property->value_size;
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the value of a property of a parsed command and set size to its
+//  size, or NULL if the command does not have it
+
+const byte *
+zmtp_codec_find_property (const zmtp_command_t *command,
+                          const char *name, size_t *size)
+{
+    assert (command);
+    assert (name);
+    assert (size);
+    const size_t name_size = strlen (name);
+    size_t cursor = 0;
+    zmtp_property_t property;
+    while (zmtp_codec_next_property (command, &cursor, &property))
+        if (property.name_size == name_size
+        &&  s_same_name (property.name, name, name_size)) {
+            *size = property.value_size;
+            return property.value;
+        }
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_codec_test (bool verbose)
+{
+    printf (" * zmtp_codec: ");
+    //  @selftest
+    byte buffer [1024];
+    byte header [ZMTP_CODEC_HEADER_MAX];
+
+    //  Short frames have a one-octet size
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (ZMTP_MSG_MORE, "hello", 5);
+    size_t size = zmtp_codec_encode (msg, buffer, sizeof buffer);
+    assert (size == 7);
+    assert (buffer [0] == ZMTP_MORE_FLAG && buffer [1] == 5);
+    assert (memcmp (buffer + 2, "hello", 5) == 0);
+    assert (zmtp_codec_encode (msg, buffer, 6) == 0);
+    zmtp_msg_destroy (&msg);
+
+    //  Large frames have an eight-octet size
+    size = zmtp_codec_encode_header (header, ZMTP_MSG_COMMAND, 256);
+    assert (size == 9);
+    assert (header [0] == (ZMTP_COMMAND_FLAG | ZMTP_LARGE_FLAG));
+    assert (header [7] == 1 && header [8] == 0);
+
+    //  Decoding needs the whole header, then the whole body
+    byte msg_flags;
+    uint64_t body_size;
+    assert (zmtp_codec_decode_header (header, 8, &msg_flags, &body_size) == 0);
+    size = zmtp_codec_decode_header (header, 9, &msg_flags, &body_size);
+    assert (size == 9);
+    assert (msg_flags == ZMTP_MSG_COMMAND && body_size == 256);
+
+    msg = zmtp_msg_new (ZMTP_MSG_MORE, 300);
+    memset (zmtp_msg_data (msg), 'x', 300);
+    const size_t frame_size = zmtp_codec_encode (msg, buffer, sizeof buffer);
+    assert (frame_size == 309);
+    zmtp_msg_destroy (&msg);
+    size_t consumed = 0;
+    msg = zmtp_codec_decode (buffer, frame_size - 1, &consumed);
+    assert (msg == NULL && errno == EAGAIN);
+    msg = zmtp_codec_decode (buffer, frame_size, &consumed);
+    assert (msg);
+    assert (consumed == frame_size);
+    assert (zmtp_msg_flags (msg) == ZMTP_MSG_MORE);
+    assert (zmtp_msg_size (msg) == 300);
+    assert (zmtp_msg_data (msg) [299] == 'x');
+    zmtp_msg_destroy (&msg);
+
+    //  Scanning finds every complete frame and stops at a partial one
+    size_t offset = 0;
+    for (int i = 0; i < 10; i++) {
+        msg = zmtp_msg_new (i % 2? ZMTP_MSG_MORE: 0, i == 5? 600: i);
+        memset (zmtp_msg_data (msg), i, zmtp_msg_size (msg));
+        offset += zmtp_codec_encode (
+            msg, buffer + offset, sizeof buffer - offset);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_frame_t frames [16];
+    size_t count = zmtp_codec_scan (buffer, offset - 1, frames, 16, &consumed);
+    assert (count == 9);
+    assert (frames [0].offset == 2 && frames [0].size == 0);
+    assert (frames [5].flags == ZMTP_MSG_MORE && frames [5].size == 600);
+    assert (buffer [frames [5].offset + 599] == 5);
+    assert (frames [8].flags == 0 && frames [8].size == 8);
+    assert (consumed == frames [8].offset + 8);
+    count = zmtp_codec_scan (buffer, offset, frames, 16, &consumed);
+    assert (count == 10 && consumed == offset);
+    count = zmtp_codec_scan (buffer, offset, frames, 4, &consumed);
+    assert (count == 4 && consumed == frames [3].offset + 3);
+    count = zmtp_codec_scan (buffer, 1, frames, 16, &consumed);
+    assert (count == 0 && consumed == 0);
+
+    //  Sizes the platform cannot hold are refused
+    memset (header + 1, 0xff, 8);
+    msg = zmtp_codec_decode (header, 9, &consumed);
+    assert (msg == NULL && errno == EMSGSIZE);
+
+    //  Commands carry metadata properties, parsed in place
+    const zmtp_property_t properties [] = {
+        { "Socket-Type", 11, (const byte *) "DEALER", 6 },
+        { "Identity", 8, NULL, 0 },
+        { "X-Custom", 8, (const byte *) "value", 5 }
+    };
+    size = zmtp_codec_encode_command (buffer, sizeof buffer, "READY",
+        properties, 3);
+    assert (size == 6 + 5 + 11 + 6 + 5 + 8 + 5 + 8 + 5);
+    assert (memcmp (buffer, "\5READY\13Socket-Type\0\0\0\6DEALER", 28)
+        == 0);
+    assert (zmtp_codec_encode_command (buffer, size - 1, "READY",
+        properties, 3) == 0);
+    zmtp_command_t command;
+    int rc = zmtp_codec_parse_command (buffer, size, &command);
+    assert (rc == 0);
+    assert (zmtp_codec_command_is (&command, "ready"));
+    assert (!zmtp_codec_command_is (&command, "READ"));
+    size_t value_size;
+    const byte *value =
+        zmtp_codec_find_property (&command, "socket-type", &value_size);
+    assert (value == buffer + 22 && value_size == 6);
+    value = zmtp_codec_find_property (&command, "Identity", &value_size);
+    assert (value && value_size == 0);
+    assert (!zmtp_codec_find_property (&command, "Resource", &value_size));
+    size_t cursor = 0;
+    zmtp_property_t property;
+    for (count = 0; zmtp_codec_next_property (&command, &cursor, &property);
+         count++)
+        assert (property.name_size == properties [count].name_size);
+    assert (count == 3);
+
+    //  Truncated or overlong properties are refused
+    for (size_t cut = 0; cut < size; cut++)
+        if (cut != 6 && cut != 28 && cut != 41) {
+            rc = zmtp_codec_parse_command (buffer, cut, &command);
+            assert (rc == -1 && errno == EPROTO);
+        }
+    buffer [18] = 0xff;
+    rc = zmtp_codec_parse_command (buffer, size, &command);
+    assert (rc == -1 && errno == EPROTO);
+    //  @end
+    printf ("OK\n");
+}
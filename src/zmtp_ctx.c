@@ -0,0 +1,543 @@
+/*  =========================================================================
+    zmtp_ctx - context owning the background I/O threads
+
+    A plain context spreads sockets round-robin over its threads. A
+    sharded context runs one thread pinned to each of a set of CPUs and
+    places every socket on the thread its connection hashes to: its
+    endpoint and the socket itself, so many sockets to one busy endpoint
+    still share out the load. The thread then owns the socket, its
+    buffers and its queues outright, and the socket's owner reaches it
+    over a handoff ring of its own. A NUMA context runs threads bound to
+    each memory node.
+
+    Either way, once a socket has received data the kernel tells us the
+    CPU that processed it (SO_INCOMING_CPU, usually where the NIC queue's
+    interrupt lands). The socket then goes to a thread on that CPU, or
+    on its node, so the packets, the buffers and the thread reading them
+    stay in local memory.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Where sysfs describes the NUMA nodes, and the most CPUs or nodes we
+//  place threads on
+
+#define ZMTP_CTX_NODE_DIR   "/sys/devices/system/node"
+#define ZMTP_CTX_MAX_CPUS   1024
+
+//  Structure of our class
+
+struct _zmtp_ctx_t {
+    zmtp_io_thread_t **io_threads;  //  Background I/O threads
+    size_t nio_threads;             //  Number of I/O threads
+    size_t next;                    //  Round-robin cursor
+    bool sharded;                   //  Threads are pinned, placed by hash
+    int *thread_cpu;                //  CPU each thread is pinned to, or -1
+    int *thread_node;               //  Node each thread runs on, or -1
+    int *cpu_node;                  //  Node of each CPU, or -1
+    size_t ncpus;                   //  Entries in cpu_node
+};
+
+static size_t
+    s_read_list (const char *path, int *values, size_t max);
+static size_t
+    s_node_list (int *nodes);
+static size_t
+    s_node_cpus (int node, int *cpus);
+static void
+    s_load_topology (zmtp_ctx_t *self);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; starts io_threads I/O threads
+
+zmtp_ctx_t *
+zmtp_ctx_new (size_t io_threads)
+{
+    assert (io_threads > 0);
+    zmtp_ctx_t *self = (zmtp_ctx_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->io_threads = (zmtp_io_thread_t **)
+        zmtp_zmalloc (io_threads * sizeof *self->io_threads);
+    assert (self->io_threads);
+    self->thread_cpu = (int *) zmtp_malloc (io_threads * sizeof (int));
+    self->thread_node = (int *) zmtp_malloc (io_threads * sizeof (int));
+    assert (self->thread_cpu && self->thread_node);
+    for (size_t i = 0; i < io_threads; i++)
+        self->thread_cpu [i] = self->thread_node [i] = -1;
+    for (size_t i = 0; i < io_threads; i++) {
+        self->io_threads [i] = zmtp_io_thread_new ();
+        if (!self->io_threads [i]) {
+            zmtp_ctx_destroy (&self);
+            return NULL;
+        }
+        self->nio_threads++;
+    }
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; starts one I/O thread pinned to each of the ncpus CPUs
+//  listed in cpus, or to each CPU the process may run on if cpus is NULL.
+//  Returns NULL with errno set if a thread cannot be pinned.
+
+zmtp_ctx_t *
+zmtp_ctx_new_cores (const int *cpus, size_t ncpus)
+{
+    int *allowed = NULL;
+    if (!cpus) {
+#if defined (__UTYPE_LINUX)
+        cpu_set_t set;
+        if (sched_getaffinity (0, sizeof set, &set) == -1)
+            return NULL;
+        allowed = (int *) zmtp_malloc (CPU_COUNT (&set) * sizeof *allowed);
+        assert (allowed);
+        ncpus = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET (cpu, &set))
+                allowed [ncpus++] = cpu;
+        cpus = allowed;
+#else
+        errno = ENOTSUP;
+        return NULL;
+#endif
+    }
+    assert (ncpus > 0);
+    zmtp_ctx_t *self = zmtp_ctx_new (ncpus);
+    for (size_t i = 0; self && i < ncpus; i++)
+        if (zmtp_io_thread_set_cpu (self->io_threads [i], cpus [i]) == -1) {
+            const int error = errno;
+            zmtp_ctx_destroy (&self);
+            errno = error;
+        }
+        else
+            self->thread_cpu [i] = cpus [i];
+    zmtp_free (allowed);
+    if (self) {
+        self->sharded = true;
+        s_load_topology (self);
+        for (size_t i = 0; i < ncpus; i++)
+            if ((size_t) self->thread_cpu [i] < self->ncpus)
+                self->thread_node [i] = self->cpu_node [self->thread_cpu [i]];
+    }
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; starts threads_per_node I/O threads bound to the CPUs of
+//  each NUMA node. Returns NULL with errno ENOTSUP if the topology is
+//  unknown, or as zmtp_ctx_new_cores if a thread cannot be bound.
+
+zmtp_ctx_t *
+zmtp_ctx_new_numa (size_t threads_per_node)
+{
+    assert (threads_per_node > 0);
+    int nodes [ZMTP_CTX_MAX_CPUS];
+    const size_t nnodes = s_node_list (nodes);
+    if (nnodes == 0) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    zmtp_ctx_t *self = zmtp_ctx_new (nnodes * threads_per_node);
+    if (!self)
+        return NULL;
+    int cpus [ZMTP_CTX_MAX_CPUS];
+    for (size_t node = 0; node < nnodes; node++) {
+        const size_t ncpus = s_node_cpus (nodes [node], cpus);
+        for (size_t i = 0; i < threads_per_node; i++) {
+            const size_t thread = node * threads_per_node + i;
+            if (zmtp_io_thread_set_cpus (
+                self->io_threads [thread], cpus, ncpus) == -1) {
+                const int error = errno;
+                zmtp_ctx_destroy (&self);
+                errno = error;
+                return NULL;
+            }
+            self->thread_node [thread] = nodes [node];
+        }
+    }
+    s_load_topology (self);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of NUMA nodes, or 0 if the platform does not say
+
+size_t
+zmtp_ctx_numa_nodes (void)
+{
+    int nodes [ZMTP_CTX_MAX_CPUS];
+    return s_node_list (nodes);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; stops the I/O threads
+
+void
+zmtp_ctx_destroy (zmtp_ctx_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_ctx_t *self = *self_p;
+        for (size_t i = 0; i < self->nio_threads; i++)
+            zmtp_io_thread_destroy (&self->io_threads [i]);
+        zmtp_free (self->io_threads);
+        zmtp_free (self->thread_cpu);
+        zmtp_free (self->thread_node);
+        zmtp_free (self->cpu_node);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the I/O thread that will serve a new socket; sockets are spread
+//  round-robin over the threads
+
+zmtp_io_thread_t *
+zmtp_ctx_io_thread (zmtp_ctx_t *self)
+{
+    assert (self);
+    const size_t index =
+        __atomic_fetch_add (&self->next, 1, __ATOMIC_RELAXED);
+    return self->io_threads [index % self->nio_threads];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the I/O thread that will serve a socket connected to endpoint.
+//  A sharded context hashes the endpoint and the socket, so the same
+//  socket always maps to the same thread while sockets to one endpoint
+//  spread out; a plain one spreads sockets round-robin.
+
+zmtp_io_thread_t *
+zmtp_ctx_io_thread_for (zmtp_ctx_t *self, const char *endpoint, int fd)
+{
+    assert (self);
+    assert (endpoint);
+    if (!self->sharded)
+        return zmtp_ctx_io_thread (self);
+
+    //  FNV-1a over the endpoint, then the socket's inode, which no other
+    //  open socket shares
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = endpoint; *c; c++)
+        hash = (hash ^ (byte) *c) * 1099511628211ULL;
+    struct stat info;
+    if (fstat (fd, &info) == 0)
+        for (size_t i = 0; i < sizeof info.st_ino; i++)
+            hash = (hash ^ (byte) (info.st_ino >> (8 * i))) * 1099511628211ULL;
+    return self->io_threads [hash % self->nio_threads];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the I/O thread that will serve a connected socket. If the kernel
+//  knows which CPU processes the socket's packets, that is the thread
+//  pinned to that CPU, else one on the CPU's NUMA node; otherwise, or if
+//  no thread is near, as zmtp_ctx_io_thread_for.
+
+zmtp_io_thread_t *
+zmtp_ctx_io_thread_near (zmtp_ctx_t *self, const char *endpoint, int fd)
+{
+    assert (self);
+    assert (endpoint);
+#if defined (SO_INCOMING_CPU)
+    int cpu = -1;
+    socklen_t size = sizeof cpu;
+    if (self->ncpus
+    &&  getsockopt (fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &size) == 0
+    &&  cpu >= 0 && (size_t) cpu < self->ncpus) {
+        for (size_t i = 0; i < self->nio_threads; i++)
+            if (self->thread_cpu [i] == cpu)
+                return self->io_threads [i];
+        //  Count the node's threads, then take them in turn
+        const int node = self->cpu_node [cpu];
+        size_t nnear = 0;
+        for (size_t i = 0; node != -1 && i < self->nio_threads; i++)
+            if (self->thread_node [i] == node)
+                nnear++;
+        if (nnear) {
+            size_t index =
+                __atomic_fetch_add (&self->next, 1, __ATOMIC_RELAXED) % nnear;
+            for (size_t i = 0; i < self->nio_threads; i++)
+                if (self->thread_node [i] == node && index-- == 0)
+                    return self->io_threads [i];
+        }
+    }
+#endif
+    return zmtp_ctx_io_thread_for (self, endpoint, fd);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of I/O threads
+
+size_t
+zmtp_ctx_io_threads (zmtp_ctx_t *self)
+{
+    assert (self);
+    return self->nio_threads;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read a sysfs list such as "0-3,8-11" into values. Returns the number
+//  of values, 0 if the file does not exist.
+
+static size_t
+s_read_list (const char *path, int *values, size_t max)
+{
+    FILE *file = fopen (path, "r");
+    if (!file)
+        return 0;
+    char line [4096];
+    size_t count = 0;
+    if (fgets (line, sizeof line, file)) {
+        char *cursor = line;
+        while (*cursor >= '0' && *cursor <= '9') {
+            long first = strtol (cursor, &cursor, 10);
+            long last = first;
+            if (*cursor == '-')
+                last = strtol (cursor + 1, &cursor, 10);
+            for (long value = first; value <= last && count < max; value++)
+                values [count++] = (int) value;
+            if (*cursor == ',')
+                cursor++;
+        }
+    }
+    fclose (file);
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  List the NUMA nodes that have CPUs; nodes of memory only get no
+//  threads. Returns the number of nodes, 0 if the platform does not say.
+
+static size_t
+s_node_list (int *nodes)
+{
+    int online [ZMTP_CTX_MAX_CPUS];
+    const size_t nonline =
+        s_read_list (ZMTP_CTX_NODE_DIR "/online", online, ZMTP_CTX_MAX_CPUS);
+    int cpus [ZMTP_CTX_MAX_CPUS];
+    size_t nnodes = 0;
+    for (size_t i = 0; i < nonline; i++)
+        if (s_node_cpus (online [i], cpus))
+            nodes [nnodes++] = online [i];
+    return nnodes;
+}
+
+
+//  --------------------------------------------------------------------------
+//  List the CPUs of a node. Returns how many there are.
+
+static size_t
+s_node_cpus (int node, int *cpus)
+{
+    char path [256];
+    snprintf (path, sizeof path, ZMTP_CTX_NODE_DIR "/node%d/cpulist", node);
+    return s_read_list (path, cpus, ZMTP_CTX_MAX_CPUS);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Learn which node each CPU belongs to. CPUs of no node, and all CPUs
+//  when the platform does not say, are left at -1.
+
+static void
+s_load_topology (zmtp_ctx_t *self)
+{
+    int nodes [ZMTP_CTX_MAX_CPUS];
+    const size_t nnodes = s_node_list (nodes);
+    if (nnodes == 0)
+        return;
+    self->cpu_node = (int *) zmtp_malloc (ZMTP_CTX_MAX_CPUS * sizeof (int));
+    assert (self->cpu_node);
+    for (size_t cpu = 0; cpu < ZMTP_CTX_MAX_CPUS; cpu++)
+        self->cpu_node [cpu] = -1;
+    int cpus [ZMTP_CTX_MAX_CPUS];
+    for (size_t node = 0; node < nnodes; node++) {
+        const size_t ncpus = s_node_cpus (nodes [node], cpus);
+        for (size_t i = 0; i < ncpus; i++)
+            if (cpus [i] >= 0 && cpus [i] < ZMTP_CTX_MAX_CPUS) {
+                self->cpu_node [cpus [i]] = nodes [node];
+                if ((size_t) cpus [i] >= self->ncpus)
+                    self->ncpus = (size_t) cpus [i] + 1;
+            }
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#if defined (__UTYPE_LINUX)
+//  Connect a TCP pair over loopback and pass a byte, so the kernel knows
+//  which CPU processes the server end's packets. Returns that CPU, or -1
+//  if the kernel does not say.
+
+static int
+s_loopback_pair (int *client, int *server)
+{
+    const int listener = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl (INADDR_LOOPBACK)
+    };
+    socklen_t addr_len = sizeof addr;
+    int rc = bind (listener, (struct sockaddr *) &addr, sizeof addr);
+    assert (rc == 0);
+    rc = listen (listener, 1);
+    assert (rc == 0);
+    rc = getsockname (listener, (struct sockaddr *) &addr, &addr_len);
+    assert (rc == 0);
+    *client = socket (AF_INET, SOCK_STREAM, 0);
+    rc = connect (*client, (struct sockaddr *) &addr, sizeof addr);
+    assert (rc == 0);
+    *server = accept (listener, NULL, NULL);
+    assert (*server != -1);
+    close (listener);
+    rc = send (*client, "x", 1, 0);
+    assert (rc == 1);
+    char byte;
+    rc = recv (*server, &byte, 1, 0);
+    assert (rc == 1);
+    int cpu = -1;
+#if defined (SO_INCOMING_CPU)
+    socklen_t size = sizeof cpu;
+    if (getsockopt (*server, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &size))
+        cpu = -1;
+#endif
+    return cpu;
+}
+
+//  Check that a socket whose packets arrive on cpu is served by the
+//  thread pinned to that CPU if there is one, else by a thread on the
+//  CPU's node if there is one
+
+static void
+s_assert_near (zmtp_ctx_t *ctx, int fd, int cpu)
+{
+    zmtp_io_thread_t *thread =
+        zmtp_ctx_io_thread_near (ctx, "tcp://127.0.0.1:1", fd);
+    size_t index = 0;
+    while (index < ctx->nio_threads && ctx->io_threads [index] != thread)
+        index++;
+    assert (index < ctx->nio_threads);
+    if (cpu < 0 || (size_t) cpu >= ctx->ncpus)
+        return;                 //  Placed round-robin
+    const int node = ctx->cpu_node [cpu];
+    bool pinned = false;
+    bool local = false;
+    for (size_t i = 0; i < ctx->nio_threads; i++) {
+        pinned |= ctx->thread_cpu [i] == cpu;
+        local |= node != -1 && ctx->thread_node [i] == node;
+    }
+    if (pinned)
+        assert (ctx->thread_cpu [index] == cpu);
+    else
+    if (local)
+        assert (ctx->thread_node [index] == node);
+}
+#endif
+
+void
+zmtp_ctx_test (bool verbose)
+{
+    printf (" * zmtp_ctx: ");
+    //  @selftest
+    zmtp_ctx_t *ctx = zmtp_ctx_new (2);
+    assert (ctx);
+    zmtp_io_thread_t *first = zmtp_ctx_io_thread (ctx);
+    zmtp_io_thread_t *second = zmtp_ctx_io_thread (ctx);
+    assert (first && second && first != second);
+    assert (zmtp_ctx_io_thread (ctx) == first);
+    //  A socket the kernel says nothing about is placed round-robin too
+    assert (zmtp_ctx_io_thread_near (ctx, "ipc://@a", -1) == second);
+    zmtp_ctx_destroy (&ctx);
+    assert (ctx == NULL);
+
+    //  A sharded context keeps each socket on one thread for good, while
+    //  sockets to one endpoint spread over the threads
+    ctx = zmtp_ctx_new (4);
+    assert (ctx);
+    ctx->sharded = true;        //  As zmtp_ctx_new_cores, without pinning
+    int sockets [32];
+    zmtp_io_thread_t *shards [32];
+    size_t spread = 0;
+    for (size_t i = 0; i < 32; i++) {
+        sockets [i] = socket (AF_INET, SOCK_STREAM, 0);
+        assert (sockets [i] != -1);
+        shards [i] =
+            zmtp_ctx_io_thread_for (ctx, "tcp://1.2.3.4:5", sockets [i]);
+        spread += shards [i] != shards [0];
+    }
+    assert (spread > 0);
+    for (size_t i = 0; i < 32; i++) {
+        assert (zmtp_ctx_io_thread_for (ctx, "tcp://1.2.3.4:5", sockets [i])
+            == shards [i]);
+        close (sockets [i]);
+    }
+    zmtp_ctx_destroy (&ctx);
+
+#if defined (__UTYPE_LINUX)
+    ctx = zmtp_ctx_new_cores (NULL, 0);
+    assert (ctx);
+    assert (zmtp_ctx_io_threads (ctx) > 0);
+    zmtp_ctx_destroy (&ctx);
+    const int cpus [] = { CPU_SETSIZE };
+    ctx = zmtp_ctx_new_cores (cpus, 1);
+    assert (ctx == NULL && errno == EINVAL);
+
+    //  A pinned context serves a connected socket from the thread on the
+    //  CPU its packets arrive on
+    ctx = zmtp_ctx_new_cores (NULL, 0);
+    assert (ctx);
+    int client, server;
+    int cpu = s_loopback_pair (&client, &server);
+    s_assert_near (ctx, server, cpu);
+    close (client);
+    close (server);
+    zmtp_ctx_destroy (&ctx);
+
+    //  A NUMA context runs threads on every node, and serves a connected
+    //  socket from one on the node of the CPU its packets arrive on
+    if (zmtp_ctx_numa_nodes ()) {
+        ctx = zmtp_ctx_new_numa (2);
+        assert (ctx);
+        assert (zmtp_ctx_io_threads (ctx) == 2 * zmtp_ctx_numa_nodes ());
+        cpu = s_loopback_pair (&client, &server);
+        s_assert_near (ctx, server, cpu);
+        if (cpu >= 0 && (size_t) cpu < ctx->ncpus)
+            assert (ctx->cpu_node [cpu] != -1);
+        close (client);
+        close (server);
+        zmtp_ctx_destroy (&ctx);
+    }
+#endif
+
+    assert (zmtp_ctx_default () == NULL);
+    assert (zmtp_init ());
+    assert (zmtp_ctx_default ());
+    assert (!zmtp_init ());     //  Already started
+    assert (zmtp_deinit ());
+    assert (zmtp_ctx_default () == NULL);
+    assert (!zmtp_deinit ());
+    //  @end
+    printf ("OK\n");
+}
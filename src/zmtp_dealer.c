@@ -12,10 +12,112 @@
 
 #include "zmtp_classes.h"
 
+#include <poll.h>
+
+//  Default reconnect intervals, msecs, and queue limits
+
+#define ZMTP_DEALER_RECONNECT_IVL       100
+#define ZMTP_DEALER_RECONNECT_IVL_MAX   30000
+#define ZMTP_DEALER_SNDHWM              1000
+#define ZMTP_DEALER_RCVHWM              1000
+
+//  Connect deadline, msecs, for reconnects done by an I/O thread when no
+//  connect timeout is set, so one dead peer cannot stall the thread
+#define ZMTP_DEALER_IO_CONNECT_TIMEOUT  1000
+
 //  Structure of our class
 
 struct _zmtp_dealer_t {
     zmtp_channel_t *channel;    //  At most one channel per socket now
+    int connect_timeout;        //  Connect deadline in msecs, -1 = none
+    char *endpoint;             //  Where to reconnect to, NULL = never
+    zmtp_msgq_t *sndq;          //  Frames not yet written to the peer
+    zmtp_msgq_t *rcvq;          //  Frames read ahead from the peer
+    size_t sndhwm;              //  Limit on queued outbound frames
+    size_t rcvhwm;              //  Limit on frames read ahead
+    int sndhwm_policy;          //  What send does at the limit
+    int linger;                 //  Msecs to flush queue on destroy
+    size_t dropped;             //  Messages dropped by the policy
+    size_t sndq_depth;          //  Frames accepted but not yet written
+    size_t rcvq_depth;          //  Mirror of rcvq size, read lock-free
+    zmtp_stats_t stats;         //  Traffic of all our channels
+    zmtp_histogram_t *latency [ZMTP_LATENCY_KINDS];    //  NULL = untimed
+    int metrics_slot;           //  Where our counters are published, or -1
+    size_t zerocopy;            //  Smallest body sent zerocopy, 0 = off
+    size_t memfd;               //  Smallest body passed as memfd, 0 = off
+    int reconnect_ivl;          //  Initial reconnect interval, msecs
+    int reconnect_ivl_max;      //  Upper bound of the backoff, msecs
+    int backoff;                //  Current reconnect interval, msecs
+    int64_t reconnect_at;       //  When to try the next reconnect
+    uint64_t seed;              //  State of the jitter generator
+    bool more_sent;             //  Last frame sent had the MORE flag
+    bool discard_more;          //  Dropping rest of a broken multipart
+    bool in_multipart;          //  Last frame accepted by send had MORE
+    bool drop_more;             //  Dropping rest of a refused multipart
+
+    //  With a background I/O thread the thread owns the channel, sndq
+    //  and connection state above; the application thread owns the HWM
+    //  decisions and shares rcvq under the mutex
+    zmtp_ctx_t *ctx;            //  Context with I/O threads, NULL if none
+    zmtp_io_thread_t *io_thread;    //  Serves our socket once attached
+    zmtp_io_handoff_t *handoff; //  Our commands to io_thread, in order
+    pthread_mutex_t mutex;      //  Guards rcvq and the flags below
+    pthread_cond_t cond;        //  Signals messages, room and release
+    int room_waiters;           //  Senders blocked at sndhwm
+    bool attached;              //  Channel was handed to the thread
+    bool closed;                //  Peer is gone for good
+    bool released;              //  Thread no longer uses the dealer
+    bool lingering;             //  Thread is flushing before release
+    int64_t linger_deadline;    //  When to give up flushing, -1 never
+    zmtp_msgq_t *batch;         //  Frames read in one go by the thread
+};
+
+static void
+    s_setup (zmtp_dealer_t *self, zmtp_channel_t *channel);
+static int
+    s_dealer_connect (zmtp_dealer_t *self, const char *endpoint_str);
+static int
+    s_reconnect (zmtp_dealer_t *self);
+static void
+    s_disconnected (zmtp_dealer_t *self);
+static int
+    s_flush (zmtp_dealer_t *self);
+static int
+    s_wait (zmtp_dealer_t *self, int timeout);
+static int
+    s_make_room (zmtp_dealer_t *self);
+static int
+    s_drop_oldest (zmtp_dealer_t *self);
+static size_t
+    s_skip_message (zmtp_msgq_t *queue, size_t index);
+static int
+    s_jitter (zmtp_dealer_t *self, int ivl);
+static void
+    s_push (zmtp_dealer_t *self, zmtp_msg_t *msg, bool owned);
+static void
+    s_written (zmtp_dealer_t *self, size_t frames);
+static void
+    s_attach (zmtp_dealer_t *self, const char *endpoint_str);
+static void
+    s_sample (void *arg, zmtp_metrics_record_t *record);
+static int
+    s_io_poll (void *arg, short *events, int64_t *timer);
+static void
+    s_io_ready (void *arg, short revents);
+static void
+    s_io_attach (void *arg, zmtp_msg_t *msg);
+static void
+    s_io_send (void *arg, zmtp_msg_t *msg);
+static void
+    s_io_resume (void *arg, zmtp_msg_t *msg);
+static void
+    s_io_detach (void *arg, zmtp_msg_t *msg);
+static void
+    s_io_release (zmtp_dealer_t *self);
+
+static const zmtp_io_handler_t s_io_handler = {
+    .poll = s_io_poll,
+    .ready = s_io_ready
 };
 
 
@@ -25,10 +127,36 @@ struct _zmtp_dealer_t {
 zmtp_dealer_t *
 zmtp_dealer_new ()
 {
-    zmtp_dealer_t *self = (zmtp_dealer_t *) zmalloc (sizeof *self);
+    zmtp_dealer_t *self = (zmtp_dealer_t *) zmtp_zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
 
     self->channel = NULL;
+    self->connect_timeout = -1;
+    self->sndq = zmtp_msgq_new ();
+    self->rcvq = zmtp_msgq_new ();
+    self->sndhwm = ZMTP_DEALER_SNDHWM;
+    self->rcvhwm = ZMTP_DEALER_RCVHWM;
+    self->sndhwm_policy = ZMTP_HWM_BLOCK;
+    self->linger = -1;
+    self->metrics_slot = -1;
+    self->reconnect_ivl = ZMTP_DEALER_RECONNECT_IVL;
+    self->reconnect_ivl_max = ZMTP_DEALER_RECONNECT_IVL_MAX;
+
+    //  Every process must pick different delays, or a peer restart makes
+    //  all its clients reconnect in lockstep
+    self->seed = (uint64_t) getpid () << 32
+               ^ (uint64_t) zmtp_clock_mono ()
+               ^ (uint64_t) (uintptr_t) self;
+    if (self->seed == 0)
+        self->seed = 1;
+
+    //  Hand our I/O to the background threads if they are running
+    self->ctx = zmtp_ctx_default ();
+    if (self->ctx) {
+        pthread_mutex_init (&self->mutex, NULL);
+        pthread_cond_init (&self->cond, NULL);
+        self->batch = zmtp_msgq_new ();
+    }
     return self;
 }
 
@@ -43,13 +171,257 @@ zmtp_dealer_destroy (zmtp_dealer_t **self_p)
 
     if (*self_p) {
         zmtp_dealer_t *self = *self_p;
+        zmtp_metrics_remove (self->metrics_slot);
+        if (self->ctx) {
+            //  The thread lingers, then lets go of us
+            if (self->attached) {
+                zmtp_io_handoff_post (self->handoff, s_io_detach, self, NULL);
+                pthread_mutex_lock (&self->mutex);
+                while (!self->released)
+                    pthread_cond_wait (&self->cond, &self->mutex);
+                pthread_mutex_unlock (&self->mutex);
+                zmtp_io_handoff_destroy (&self->handoff);
+            }
+            pthread_mutex_destroy (&self->mutex);
+            pthread_cond_destroy (&self->cond);
+            zmtp_msgq_destroy (&self->batch);
+        }
+        //  Give the peer a chance to take what we still hold
+        const int64_t deadline = zmtp_clock_mono () + self->linger;
+        while (!self->ctx
+            && self->channel && zmtp_msgq_size (self->sndq)) {
+            int timeout = -1;
+            if (self->linger >= 0) {
+                timeout = (int) (deadline - zmtp_clock_mono ());
+                if (timeout <= 0)
+                    break;
+            }
+            s_wait (self, timeout);
+        }
         zmtp_channel_destroy (&self->channel);
-        free (self);
+        zmtp_msgq_destroy (&self->sndq);
+        zmtp_msgq_destroy (&self->rcvq);
+        for (int kind = 0; kind < ZMTP_LATENCY_KINDS; kind++)
+            zmtp_histogram_destroy (&self->latency [kind]);
+        zmtp_free (self->endpoint);
+        zmtp_free (self);
         *self_p = NULL;
     }
 }
 
 
+//  --------------------------------------------------------------------------
+//  Set deadline for connecting to a peer, in milliseconds. Default is -1,
+//  no deadline.
+
+void
+zmtp_dealer_set_connect_timeout (zmtp_dealer_t *self, int timeout)
+{
+    assert (self);
+    self->connect_timeout = timeout;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set initial reconnect interval in milliseconds. After a connected peer
+//  goes away, the dealer reconnects transparently, doubling the interval
+//  after each failed attempt up to the maximum. Each delay is randomized
+//  to between half and the full interval. Default is 100 msecs.
+
+void
+zmtp_dealer_set_reconnect_ivl (zmtp_dealer_t *self, int ivl)
+{
+    assert (self);
+    assert (ivl > 0);
+    self->reconnect_ivl = ivl;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set maximum reconnect interval in milliseconds. Default is 30 seconds.
+
+void
+zmtp_dealer_set_reconnect_ivl_max (zmtp_dealer_t *self, int ivl_max)
+{
+    assert (self);
+    assert (ivl_max > 0);
+    self->reconnect_ivl_max = ivl_max;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the maximum number of outbound frames queued in the library, while
+//  disconnected or while the peer is slower than we are. What happens at
+//  the limit is set by the send high-water mark policy. The limit is
+//  checked when a new message starts, so multipart messages are queued
+//  or refused whole. Default is 1000.
+
+void
+zmtp_dealer_set_sndhwm (zmtp_dealer_t *self, size_t sndhwm)
+{
+    assert (self);
+    assert (sndhwm > 0);
+    self->sndhwm = sndhwm;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set the maximum number of inbound frames read ahead of the application.
+//  At the limit the dealer stops reading, so the peer is slowed down by
+//  TCP flow control. Default is 1000.
+
+void
+zmtp_dealer_set_rcvhwm (zmtp_dealer_t *self, size_t rcvhwm)
+{
+    assert (self);
+    assert (rcvhwm > 0);
+    self->rcvhwm = rcvhwm;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set what zmtp_dealer_send does when the outbound queue is full; one of
+//  ZMTP_HWM_BLOCK (default), ZMTP_HWM_EAGAIN, ZMTP_HWM_DROP_OLDEST or
+//  ZMTP_HWM_DROP_NEWEST.
+
+void
+zmtp_dealer_set_sndhwm_policy (zmtp_dealer_t *self, int policy)
+{
+    assert (self);
+    assert (policy == ZMTP_HWM_BLOCK
+         || policy == ZMTP_HWM_EAGAIN
+         || policy == ZMTP_HWM_DROP_OLDEST
+         || policy == ZMTP_HWM_DROP_NEWEST);
+    self->sndhwm_policy = policy;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set how long, in msecs, destroying a connected dealer waits for queued
+//  frames to be written; -1 (default) waits until they are, 0 discards
+//  them.
+
+void
+zmtp_dealer_set_linger (zmtp_dealer_t *self, int linger)
+{
+    assert (self);
+    self->linger = linger;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of outbound frames queued in the library
+
+size_t
+zmtp_dealer_sndq_size (zmtp_dealer_t *self)
+{
+    assert (self);
+    if (self->ctx)
+        return __atomic_load_n (&self->sndq_depth, __ATOMIC_RELAXED);
+    return zmtp_msgq_size (self->sndq);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of inbound frames read but not yet received
+
+size_t
+zmtp_dealer_rcvq_size (zmtp_dealer_t *self)
+{
+    assert (self);
+    if (self->ctx)
+        return __atomic_load_n (&self->rcvq_depth, __ATOMIC_RELAXED);
+    return zmtp_msgq_size (self->rcvq);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of outbound messages dropped by the high-water mark policy
+
+size_t
+zmtp_dealer_dropped (zmtp_dealer_t *self)
+{
+    assert (self);
+    return __atomic_load_n (&self->dropped, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take a snapshot of the traffic counters, totalled over every connection
+//  the dealer made. Safe to call while an I/O thread serves the dealer.
+
+void
+zmtp_dealer_stats (zmtp_dealer_t *self, zmtp_stats_t *stats)
+{
+    assert (self);
+    assert (stats);
+    zmtp_stats_copy (stats, &self->stats);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Time sends, blocking receives, handshakes and the wait in the outbound
+//  queue, for every connection the dealer makes. Default is off. Set
+//  before connect or listen.
+
+void
+zmtp_dealer_set_histograms (zmtp_dealer_t *self, bool enabled)
+{
+    assert (self);
+    for (int kind = 0; kind < ZMTP_LATENCY_KINDS; kind++) {
+        if (enabled && !self->latency [kind])
+            self->latency [kind] = zmtp_histogram_new ();
+        else
+        if (!enabled)
+            zmtp_histogram_destroy (&self->latency [kind]);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Send bodies of threshold bytes or more with MSG_ZEROCOPY on every
+//  connection the dealer makes. A message sent straight to the socket
+//  is held by the channel until the kernel is done with its body; queued
+//  messages are copies anyway. Platforms without zerocopy
+//  copy as before. Set before connecting.
+
+void
+zmtp_dealer_set_zerocopy (zmtp_dealer_t *self, size_t threshold)
+{
+    assert (self);
+    self->zerocopy = threshold;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pass bodies of threshold bytes or more to an ipc:// peer as memfds it
+//  maps, for every connection the dealer makes. The peer must turn it on
+//  too. Platforms without memfds stream as before. Set before connecting.
+
+void
+zmtp_dealer_set_memfd (zmtp_dealer_t *self, size_t threshold)
+{
+    assert (self);
+    self->memfd = threshold;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a snapshot of the latencies of the given kind, which the caller
+//  must destroy, or NULL if the dealer does not time them. Safe to call
+//  while an I/O thread serves the dealer.
+
+zmtp_histogram_t *
+zmtp_dealer_histogram (zmtp_dealer_t *self, zmtp_latency_t kind)
+{
+    assert (self);
+    assert (kind < ZMTP_LATENCY_KINDS);
+    if (!self->latency [kind])
+        return NULL;
+    return zmtp_histogram_dup (self->latency [kind]);
+}
+
+
 //  --------------------------------------------------------------------------
 //
 
@@ -57,130 +429,1122 @@ int
 zmtp_dealer_ipc_connect (zmtp_dealer_t *self, const char *path)
 {
     assert (self);
-    if (self->channel)  //  At most one channel per socket now
+    assert (path);
+
+    char endpoint_str [6 + strlen (path) + 1];
+    snprintf (endpoint_str, sizeof endpoint_str, "ipc://%s", path);
+    return s_dealer_connect (self, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//
+
+int
+zmtp_dealer_tcp_connect (zmtp_dealer_t *self,
+                         const char *addr, unsigned short port)
+{
+    assert (self);
+    assert (addr);
+
+    //  IPv6 literals need brackets to separate them from the port
+    const bool ipv6 = strchr (addr, ':') != NULL;
+    char endpoint_str [6 + strlen (addr) + 2 + 1 + 5 + 1];
+    snprintf (endpoint_str, sizeof endpoint_str,
+        ipv6? "tcp://[%s]:%u": "tcp://%s:%u", addr, port);
+    return s_dealer_connect (self, endpoint_str);
+}
+
+
+//  --------------------------------------------------------------------------
+//
+
+int
+zmtp_dealer_connect (zmtp_dealer_t *self, const char *endpoint_str)
+{
+    assert (self);
+    assert (endpoint_str);
+    return s_dealer_connect (self, endpoint_str);
+}
+
+//  --------------------------------------------------------------------------
+//
+
+int
+zmtp_dealer_listen (zmtp_dealer_t *self, const char *endpoint_str)
+{
+    assert (self);
+    if (self->channel || self->endpoint)
         return -1;
 
     //  Create new channel if possible
     self->channel = zmtp_channel_new ();
     if (!self->channel)
-        return -1;   
+        return -1;
+    zmtp_channel_set_connect_timeout (self->channel, self->connect_timeout);
+    s_setup (self, self->channel);
 
     //  Try to connect channel to specified endpoint
-    if (zmtp_channel_ipc_connect (self->channel, path) == -1) {
+    if (zmtp_channel_listen (self->channel, endpoint_str) == -1) {
         zmtp_channel_destroy (&self->channel);
         return -1;
     }
+    s_attach (self, endpoint_str);
     return 0;
 }
 
-
 //  --------------------------------------------------------------------------
-//
+//  Talk over a socket someone else opened. There is no endpoint to go
+//  back to, so a broken connection stays broken, as with listen.
 
 int
-zmtp_dealer_tcp_connect (zmtp_dealer_t *self,
-                         const char *addr, unsigned short port)
+zmtp_dealer_adopt (zmtp_dealer_t *self, int fd)
 {
     assert (self);
-    if (self->channel)  //  At most one channel per socket now
+    if (self->channel || self->endpoint) {
+        errno = EISCONN;
         return -1;
-    
-    //  Create new channel if possible
+    }
+
     self->channel = zmtp_channel_new ();
     if (!self->channel)
         return -1;
-    
-    //  Try to connect channel to specified endpoint
-    if (zmtp_channel_tcp_connect (self->channel, addr, port) == -1) {
+    s_setup (self, self->channel);
+    if (zmtp_channel_adopt (self->channel, fd) == -1) {
         zmtp_channel_destroy (&self->channel);
         return -1;
     }
+    char endpoint_str [32];
+    snprintf (endpoint_str, sizeof endpoint_str, "fd://%d", fd);
+    s_attach (self, endpoint_str);
     return 0;
 }
 
-
 //  --------------------------------------------------------------------------
-//
+//  Send a message on a socket. The message is written without blocking
+//  where possible; what the socket does not take, or anything sent while
+//  the peer is unreachable, is copied to the outbound queue and written
+//  later, in order. At the queue limit the send high-water mark policy
+//  decides. If the connection breaks in the middle of a multipart
+//  message, the rest of that message is discarded so the peer never sees
+//  a partial message.
 
 int
-zmtp_dealer_connect (zmtp_dealer_t *self, const char *endpoint_str)
+zmtp_dealer_send (zmtp_dealer_t *self, zmtp_msg_t *msg)
 {
     assert (self);
-    if (self->channel)
+    assert (msg);
+    if (self->ctx) {
+        if (!self->attached
+        ||  __atomic_load_n (&self->closed, __ATOMIC_ACQUIRE)) {
+            errno = ENOTCONN;
+            return -1;
+        }
+    }
+    else
+    if (!self->channel && !self->endpoint)
+        return -1;
+
+    const bool more = (zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+    if (self->drop_more) {
+        self->drop_more = more;
+        self->in_multipart = more;
+        return 0;
+    }
+    if (!self->in_multipart && s_make_room (self) == -1) {
+        if (self->sndhwm_policy != ZMTP_HWM_DROP_NEWEST)
+            return -1;
+        __atomic_add_fetch (&self->dropped, 1, __ATOMIC_RELAXED);
+        self->drop_more = more;
+        self->in_multipart = more;
+        return 0;
+    }
+    self->in_multipart = more;
+
+    if (self->ctx) {
+        __atomic_add_fetch (&self->sndq_depth, 1, __ATOMIC_SEQ_CST);
+        zmtp_io_handoff_post (
+            self->handoff, s_io_send, self, zmtp_msg_dup (msg));
+    }
+    else {
+        //  Mirror for zmtp_metrics; only this thread writes it
+        ZMTP_STAT_ADD (self->sndq_depth, 1);
+        //  A dealer that only sends must come back to a restarted peer
+        if (!self->channel)
+            s_reconnect (self);
+        s_push (self, msg, false);
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a message from a socket. If the connection breaks, blocks while
+//  reconnecting.
+
+zmtp_msg_t *
+zmtp_dealer_recv (zmtp_dealer_t *self)
+{
+    assert (self);
+
+    if (self->ctx) {
+        if (!self->attached) {
+            errno = ENOTCONN;
+            return NULL;
+        }
+        pthread_mutex_lock (&self->mutex);
+        while (zmtp_msgq_size (self->rcvq) == 0 && !self->closed)
+            pthread_cond_wait (&self->cond, &self->mutex);
+        pthread_mutex_unlock (&self->mutex);
+        return zmtp_dealer_recv_nowait (self);
+    }
+    while (true) {
+        zmtp_msg_t *msg = zmtp_dealer_recv_nowait (self);
+        if (msg)
+            return msg;
+        if (errno != EAGAIN)
+            return NULL;
+        s_wait (self, -1);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Receive a message from a socket if one is available without blocking.
+//  Returns NULL with errno set to EAGAIN if there is nothing to receive
+//  yet.
+
+zmtp_msg_t *
+zmtp_dealer_recv_nowait (zmtp_dealer_t *self)
+{
+    assert (self);
+
+    if (self->ctx) {
+        pthread_mutex_lock (&self->mutex);
+        const size_t depth = zmtp_msgq_size (self->rcvq);
+        zmtp_msg_t *msg = zmtp_msgq_pop (self->rcvq);
+        __atomic_store_n (
+            &self->rcvq_depth, zmtp_msgq_size (self->rcvq), __ATOMIC_RELAXED);
+        if (!msg)
+            errno = self->closed? ENOTCONN: EAGAIN;
+        pthread_mutex_unlock (&self->mutex);
+        //  The thread stops reading at the limit; tell it there is room
+        if (depth == self->rcvhwm)
+            zmtp_io_handoff_post (self->handoff, s_io_resume, self, NULL);
+        return msg;
+    }
+    zmtp_msg_t *msg = zmtp_msgq_pop (self->rcvq);
+    if (msg) {
+        ZMTP_STAT_SUB (self->rcvq_depth, 1);
+        return msg;
+    }
+    if (!self->channel) {
+        if (!self->endpoint) {
+            errno = ENOTCONN;
+            return NULL;
+        }
+        s_reconnect (self);
+        errno = EAGAIN;
+        return NULL;
+    }
+    //  Keep outbound traffic moving while the application reads
+    if (zmtp_msgq_size (self->sndq) && s_flush (self) == -1) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    msg = zmtp_channel_recv_nowait (self->channel);
+    if (!msg && errno != EAGAIN) {
+        s_disconnected (self);
+        errno = EAGAIN;
+    }
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Make a new channel present itself as a DEALER and count its traffic
+//  and latencies in ours
+
+static void
+s_setup (zmtp_dealer_t *self, zmtp_channel_t *channel)
+{
+    zmtp_channel_set_socket_type (channel, ZMTP_DEALER);
+    zmtp_channel_set_stats (channel, &self->stats);
+    for (int kind = 0; kind < ZMTP_LATENCY_KINDS; kind++)
+        zmtp_channel_set_histogram (channel, kind, self->latency [kind]);
+    zmtp_channel_set_zerocopy (channel, self->zerocopy);
+    zmtp_channel_set_memfd (channel, self->memfd);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect channel to the endpoint and remember it for reconnecting
+
+static int
+s_dealer_connect (zmtp_dealer_t *self, const char *endpoint_str)
+{
+    if (self->channel || self->endpoint)
         return -1;
 
     //  Create new channel if possible
     self->channel = zmtp_channel_new ();
     if (!self->channel)
         return -1;
+    zmtp_channel_set_connect_timeout (self->channel, self->connect_timeout);
+    s_setup (self, self->channel);
 
     //  Try to connect channel to specified endpoint
     if (zmtp_channel_connect (self->channel, endpoint_str) == -1) {
         zmtp_channel_destroy (&self->channel);
         return -1;
     }
+    self->endpoint = zmtp_strdup (endpoint_str);
+    assert (self->endpoint);
+    self->backoff = self->reconnect_ivl;
+    s_attach (self, endpoint_str);
     return 0;
 }
 
+
 //  --------------------------------------------------------------------------
-//
+//  Try to reconnect if the next attempt is due, and flush queued messages
+//  on success. Returns 0 if connected, else -1.
 
-int
-zmtp_dealer_listen (zmtp_dealer_t *self, const char *endpoint_str)
+static int
+s_reconnect (zmtp_dealer_t *self)
 {
-    assert (self);
-    if (self->channel)
+    assert (!self->channel);
+    const int64_t now = zmtp_clock_mono ();
+    if (now < self->reconnect_at)
         return -1;
 
-    //  Create new channel if possible
-    self->channel = zmtp_channel_new ();
-    if (!self->channel)
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    zmtp_channel_set_connect_timeout (channel,
+        self->ctx && self->connect_timeout == -1
+        ? ZMTP_DEALER_IO_CONNECT_TIMEOUT: self->connect_timeout);
+    s_setup (self, channel);
+    if (zmtp_channel_connect (channel, self->endpoint) == -1) {
+        zmtp_channel_destroy (&channel);
+        self->backoff = self->backoff > self->reconnect_ivl_max / 2
+            ? self->reconnect_ivl_max
+            : self->backoff * 2;
+        self->reconnect_at = zmtp_clock_mono () + s_jitter (self, self->backoff);
         return -1;
+    }
+    self->channel = channel;
+    self->backoff = self->reconnect_ivl;
+    self->more_sent = false;
+    return s_flush (self);
+}
 
-    //  Try to connect channel to specified endpoint
-    if (zmtp_channel_listen (self->channel, endpoint_str) == -1) {
-        zmtp_channel_destroy (&self->channel);
+
+//  --------------------------------------------------------------------------
+//  Drop the broken channel and schedule the first reconnect attempt. If the
+//  peer may have seen the head of a multipart message, the rest of that
+//  message is dropped from the queue, or from the next sends if it is not
+//  queued yet. A message whose first frame was cut off is sent again whole.
+
+static void
+s_disconnected (zmtp_dealer_t *self)
+{
+    if (self->more_sent) {
+        self->discard_more = true;
+        zmtp_msg_t *msg;
+        while (self->discard_more && (msg = zmtp_msgq_pop (self->sndq))) {
+            self->discard_more =
+                (zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+            zmtp_msg_destroy (&msg);
+            s_written (self, 1);
+        }
+    }
+    zmtp_channel_destroy (&self->channel);
+    self->more_sent = false;
+    self->backoff = self->reconnect_ivl;
+    self->reconnect_at = zmtp_clock_mono () + s_jitter (self, self->backoff);
+
+    if (self->ctx && !self->endpoint) {
+        //  Nobody to reconnect to; wake blocked receivers and senders
+        pthread_mutex_lock (&self->mutex);
+        __atomic_store_n (&self->closed, true, __ATOMIC_RELEASE);
+        pthread_cond_broadcast (&self->cond);
+        pthread_mutex_unlock (&self->mutex);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write queued frames in order until the socket is full. Returns 0 if
+//  still connected, -1 if the connection broke; what was not sent stays
+//  queued.
+
+static int
+s_flush (zmtp_dealer_t *self)
+{
+    zmtp_msg_t *msg;
+    while ((msg = zmtp_msgq_first (self->sndq))) {
+        if (zmtp_channel_send_nowait (self->channel, msg) == -1) {
+            if (errno == EAGAIN)
+                return 0;
+            s_disconnected (self);
+            return -1;
+        }
+        self->more_sent =
+            (zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+        if (self->latency [ZMTP_LATENCY_QUEUE])
+            zmtp_histogram_record (self->latency [ZMTP_LATENCY_QUEUE],
+                (uint64_t) (zmtp_clock_nsecs ()
+                          - zmtp_msgq_first_stamp (self->sndq)));
+        msg = zmtp_msgq_pop (self->sndq);
+        zmtp_msg_destroy (&msg);
+        s_written (self, 1);
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait up to timeout msecs (-1 = forever) for the connection to make
+//  progress: queued frames written, frames read ahead into the receive
+//  queue, or a reconnect attempt. Returns 0 on progress or timeout, -1 if
+//  the dealer is disconnected for good.
+
+static int
+s_wait (zmtp_dealer_t *self, int timeout)
+{
+    if (!self->channel) {
+        if (!self->endpoint) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        int64_t wait = self->reconnect_at - zmtp_clock_mono ();
+        if (timeout >= 0 && wait > timeout)
+            wait = timeout;
+        if (wait > 0)
+            usleep (wait * 1000);
+        s_reconnect (self);
+        return 0;
+    }
+    struct pollfd pollfd = { .fd = zmtp_channel_fd (self->channel) };
+    if (zmtp_msgq_size (self->sndq))
+        pollfd.events |= POLLOUT;
+    if (zmtp_msgq_size (self->rcvq) < self->rcvhwm)
+        pollfd.events |= POLLIN;
+    if (poll (&pollfd, 1, timeout) == -1)
+        return errno == EINTR? 0: -1;
+
+    if (pollfd.revents & POLLOUT && s_flush (self) == -1)
+        return 0;
+    if (pollfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+        //  Read ahead up to the limit
+        while (zmtp_msgq_size (self->rcvq) < self->rcvhwm) {
+            zmtp_msg_t *msg = zmtp_channel_recv_nowait (self->channel);
+            if (!msg) {
+                if (errno != EAGAIN)
+                    s_disconnected (self);
+                break;
+            }
+            zmtp_msgq_push (self->rcvq, &msg);
+            ZMTP_STAT_ADD (self->rcvq_depth, 1);
+        }
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Make room in the outbound queue for a new message as the policy says.
+//  Returns 0 if the message may be queued, else -1 with errno EAGAIN.
+
+static int
+s_make_room (zmtp_dealer_t *self)
+{
+    if (self->ctx) {
+        if (__atomic_load_n (&self->sndq_depth, __ATOMIC_SEQ_CST) < self->sndhwm
+        ||  self->sndhwm_policy == ZMTP_HWM_DROP_OLDEST)
+            return 0;           //  Thread trims the queue itself
+        if (self->sndhwm_policy != ZMTP_HWM_BLOCK) {
+            errno = EAGAIN;
+            return -1;
+        }
+        pthread_mutex_lock (&self->mutex);
+        __atomic_add_fetch (&self->room_waiters, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n (&self->sndq_depth, __ATOMIC_SEQ_CST)
+               >= self->sndhwm && !self->closed)
+            pthread_cond_wait (&self->cond, &self->mutex);
+        __atomic_sub_fetch (&self->room_waiters, 1, __ATOMIC_SEQ_CST);
+        const bool closed = self->closed;
+        pthread_mutex_unlock (&self->mutex);
+        if (closed) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        return 0;
+    }
+    if (self->channel && zmtp_msgq_size (self->sndq))
+        s_flush (self);
+    while (zmtp_msgq_size (self->sndq) >= self->sndhwm) {
+        if (self->sndhwm_policy == ZMTP_HWM_BLOCK) {
+            if (s_wait (self, -1) == -1)
+                return -1;
+        }
+        else
+        if (self->sndhwm_policy == ZMTP_HWM_DROP_OLDEST) {
+            if (s_drop_oldest (self) == -1)
+                break;          //  Only the message being written is left
+        }
+        else {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Drop the oldest queued message that the peer has not started to
+//  receive. Returns -1 if there is no such message.
+
+static int
+s_drop_oldest (zmtp_dealer_t *self)
+{
+    size_t index = 0;
+    if (self->more_sent
+    || (self->channel && zmtp_channel_sending (self->channel)))
+        index = s_skip_message (self->sndq, 0);
+    if (index >= zmtp_msgq_size (self->sndq))
         return -1;
+    const size_t end = s_skip_message (self->sndq, index);
+    for (size_t i = index; i < end; i++) {
+        zmtp_msg_t *msg = zmtp_msgq_remove (self->sndq, index);
+        zmtp_msg_destroy (&msg);
     }
+    s_written (self, end - index);
+    __atomic_add_fetch (&self->dropped, 1, __ATOMIC_RELAXED);
     return 0;
 }
 
+
 //  --------------------------------------------------------------------------
-//  Send a message on a socket
+//  Return the position just past the message starting at index
 
-int
-zmtp_dealer_send (zmtp_dealer_t *self, zmtp_msg_t *msg)
+static size_t
+s_skip_message (zmtp_msgq_t *queue, size_t index)
 {
-    assert (self);
-    if (!self->channel)
+    zmtp_msg_t *msg;
+    while ((msg = zmtp_msgq_at (queue, index++)))
+        if ((zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == 0)
+            break;
+    return index;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a random delay between half and all of ivl (xorshift64*)
+
+static int
+s_jitter (zmtp_dealer_t *self, int ivl)
+{
+    self->seed ^= self->seed >> 12;
+    self->seed ^= self->seed << 25;
+    self->seed ^= self->seed >> 27;
+    const uint64_t random = self->seed * 0x2545F4914F6CDD1DULL;
+    return ivl / 2 + (int) ((random >> 33) % (uint64_t) (ivl - ivl / 2 + 1));
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write or queue an outbound frame, in order behind anything queued. Runs
+//  on the application thread, or on the I/O thread if there is one, in
+//  which case owned is set and the queue takes over the message.
+
+static void
+s_push (zmtp_dealer_t *self, zmtp_msg_t *msg, bool owned)
+{
+    const bool more = (zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+    if (!self->discard_more
+    &&  self->channel && zmtp_msgq_size (self->sndq) == 0) {
+        if (zmtp_channel_send_nowait (self->channel, msg) == 0) {
+            //  Written without waiting in the queue at all
+            if (self->latency [ZMTP_LATENCY_QUEUE])
+                zmtp_histogram_record (self->latency [ZMTP_LATENCY_QUEUE], 0);
+            self->more_sent = more;
+            if (owned)
+                zmtp_msg_destroy (&msg);
+            s_written (self, 1);
+            return;
+        }
+        if (errno != EAGAIN)
+            s_disconnected (self);
+        //  Else the copy at the head of the queue carries on from where
+        //  the channel stopped
+    }
+    if (self->discard_more) {
+        //  Rest of a multipart message the peer saw only part of
+        self->discard_more = more;
+        if (owned)
+            zmtp_msg_destroy (&msg);
+        s_written (self, 1);
+        return;
+    }
+    if (!owned)
+        msg = zmtp_msg_dup (msg);
+    zmtp_msgq_push_stamped (self->sndq, &msg,
+        self->latency [ZMTP_LATENCY_QUEUE]? zmtp_clock_nsecs (): 0);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Account for outbound frames that left the queue, written or dropped,
+//  and wake senders waiting for room
+
+static void
+s_written (zmtp_dealer_t *self, size_t frames)
+{
+    if (!self->ctx) {
+        ZMTP_STAT_SUB (self->sndq_depth, frames);
+        return;
+    }
+    const size_t depth =
+        __atomic_sub_fetch (&self->sndq_depth, frames, __ATOMIC_SEQ_CST);
+    if (depth < self->sndhwm
+    &&  __atomic_load_n (&self->room_waiters, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock (&self->mutex);
+        pthread_cond_broadcast (&self->cond);
+        pthread_mutex_unlock (&self->mutex);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Publish our counters if metrics are on, and hand the connected channel
+//  to the I/O thread nearest its packets, or else the one it hashes to,
+//  if we have I/O threads. From then on we talk to that thread over a
+//  handoff ring of our own.
+
+static void
+s_attach (zmtp_dealer_t *self, const char *endpoint_str)
+{
+    self->metrics_slot = zmtp_metrics_add (endpoint_str, s_sample, self);
+    if (self->ctx) {
+        self->io_thread = zmtp_ctx_io_thread_near (
+            self->ctx, endpoint_str, zmtp_channel_fd (self->channel));
+        self->handoff = zmtp_io_handoff_new (self->io_thread);
+        self->attached = true;
+        zmtp_io_handoff_post (self->handoff, s_io_attach, self, NULL);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Metrics thread: fill in our record from counters any thread may read
+
+static void
+s_sample (void *arg, zmtp_metrics_record_t *record)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    record->sndq = __atomic_load_n (&self->sndq_depth, __ATOMIC_RELAXED);
+    record->rcvq = __atomic_load_n (&self->rcvq_depth, __ATOMIC_RELAXED);
+    record->dropped = __atomic_load_n (&self->dropped, __ATOMIC_RELAXED);
+    zmtp_stats_copy (&record->stats, &self->stats);
+}
+
+
+//  --------------------------------------------------------------------------
+//  I/O thread: tell the thread what to wait for
+
+static int
+s_io_poll (void *arg, short *events, int64_t *timer)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    if (!self->channel) {
+        *timer = self->endpoint && !self->lingering? self->reconnect_at: -1;
         return -1;
-    
-    return zmtp_channel_send (self->channel, msg);
+    }
+    if (zmtp_msgq_size (self->sndq))
+        *events |= POLLOUT;
+    if (__atomic_load_n (&self->rcvq_depth, __ATOMIC_RELAXED) < self->rcvhwm)
+        *events |= POLLIN;
+    if (self->lingering)
+        *timer = self->linger_deadline;
+    return zmtp_channel_fd (self->channel);
 }
 
 
 //  --------------------------------------------------------------------------
-//  Receive a message from a socket
+//  I/O thread: move frames between the socket and the queues, reconnect
+//  when due, and finish lingering
 
-zmtp_msg_t *
-zmtp_dealer_recv (zmtp_dealer_t *self)
+static void
+s_io_ready (void *arg, short revents)
 {
-    assert (self);
-    if (!self->channel)
-        return NULL;
-    
-    return zmtp_channel_recv (self->channel);
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    if (!self->channel) {
+        if (self->endpoint && !self->lingering)
+            s_reconnect (self);
+        return;
+    }
+    if (revents & POLLOUT)
+        s_flush (self);
+    if (self->channel && revents & (POLLIN | POLLERR | POLLHUP)) {
+        //  Read what is there up to the limit, then publish it at once
+        const size_t room = self->rcvhwm
+            - __atomic_load_n (&self->rcvq_depth, __ATOMIC_RELAXED);
+        while (zmtp_msgq_size (self->batch) < room) {
+            zmtp_msg_t *msg = zmtp_channel_recv_nowait (self->channel);
+            if (!msg) {
+                if (errno != EAGAIN)
+                    s_disconnected (self);
+                break;
+            }
+            zmtp_msgq_push (self->batch, &msg);
+        }
+        if (zmtp_msgq_size (self->batch)) {
+            pthread_mutex_lock (&self->mutex);
+            zmtp_msg_t *msg;
+            while ((msg = zmtp_msgq_pop (self->batch)))
+                zmtp_msgq_push (self->rcvq, &msg);
+            __atomic_store_n (&self->rcvq_depth,
+                zmtp_msgq_size (self->rcvq), __ATOMIC_RELAXED);
+            pthread_cond_broadcast (&self->cond);
+            pthread_mutex_unlock (&self->mutex);
+        }
+    }
+    if (self->lingering
+    && (!self->channel || zmtp_msgq_size (self->sndq) == 0
+        || (self->linger_deadline != -1
+            && zmtp_clock_mono () >= self->linger_deadline)))
+        s_io_release (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  I/O thread: start serving the dealer, with receive buffers in our
+//  own node's memory
+
+static void
+s_io_attach (void *arg, zmtp_msg_t *msg)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    if (self->channel)
+        zmtp_channel_relocate (self->channel);
+    zmtp_io_thread_add (self->io_thread, &s_io_handler, self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  I/O thread: take an outbound frame from the application
+
+static void
+s_io_send (void *arg, zmtp_msg_t *msg)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    const bool more = (zmtp_msg_flags (msg) & ZMTP_MSG_MORE) == ZMTP_MSG_MORE;
+    s_push (self, msg, true);
+    //  Trim once the message is complete, so it is dropped whole
+    if (!more && self->sndhwm_policy == ZMTP_HWM_DROP_OLDEST)
+        while (zmtp_msgq_size (self->sndq) > self->sndhwm
+           &&  s_drop_oldest (self) == 0);
+}
+
+
+//  --------------------------------------------------------------------------
+//  I/O thread: the application made room in the receive queue; nothing to
+//  do, the next poll picks up reading again
+
+static void
+s_io_resume (void *arg, zmtp_msg_t *msg)
+{
+}
+
+
+//  --------------------------------------------------------------------------
+//  I/O thread: the application is destroying the dealer; flush for up to
+//  the linger time, then let go
+
+static void
+s_io_detach (void *arg, zmtp_msg_t *msg)
+{
+    zmtp_dealer_t *self = (zmtp_dealer_t *) arg;
+    if (self->linger != 0 && self->channel && zmtp_msgq_size (self->sndq)) {
+        self->lingering = true;
+        self->linger_deadline =
+            self->linger < 0? -1: zmtp_clock_mono () + self->linger;
+    }
+    else
+        s_io_release (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  I/O thread: stop serving the dealer and tell the application
+
+static void
+s_io_release (zmtp_dealer_t *self)
+{
+    zmtp_io_thread_remove (self->io_thread, self);
+    self->lingering = false;
+    pthread_mutex_lock (&self->mutex);
+    self->released = true;
+    pthread_cond_broadcast (&self->cond);
+    pthread_mutex_unlock (&self->mutex);
 }
 
 
 //  --------------------------------------------------------------------------
 //  Selftest
 
+//  Peer that accepts one connection, expects one or two messages,
+//  optionally replies, and closes the connection.
+
+struct s_peer_args {
+    const char *endpoint;
+    const char *expect;
+    const char *reply;
+    const char *then;           //  Second message expected, if any
+    int fd;                     //  Socket to adopt if endpoint is NULL
+};
+
+static void *
+s_peer (void *arg)
+{
+    struct s_peer_args *args = (struct s_peer_args *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    int rc = args->endpoint
+        ? zmtp_channel_listen (channel, args->endpoint)
+        : zmtp_channel_adopt (channel, args->fd);
+    assert (rc == 0);
+    zmtp_msg_t *msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == strlen (args->expect));
+    assert (memcmp (zmtp_msg_data (msg),
+        args->expect, strlen (args->expect)) == 0);
+    zmtp_msg_destroy (&msg);
+    if (args->then) {
+        //  Read everything the dealer sends before closing, or its
+        //  write fails and it drops the connection with our reply
+        msg = zmtp_channel_recv (channel);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == strlen (args->then));
+        assert (memcmp (zmtp_msg_data (msg),
+            args->then, strlen (args->then)) == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    if (args->reply) {
+        msg = zmtp_msg_from_const_data (
+            0, (void *) args->reply, strlen (args->reply));
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  Peer that accepts one connection, waits until released, then counts
+//  the messages it receives until "END".
+
+struct s_sink_args {
+    const char *endpoint;
+    bool released;
+    size_t received;
+};
+
+static void *
+s_sink (void *arg)
+{
+    struct s_sink_args *args = (struct s_sink_args *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    int rc = zmtp_channel_listen (channel, args->endpoint);
+    assert (rc == 0);
+    while (!__atomic_load_n (&args->released, __ATOMIC_ACQUIRE))
+        usleep (1000);
+    while (true) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        assert (msg);
+        const bool end = zmtp_msg_size (msg) == 3
+                      && memcmp (zmtp_msg_data (msg), "END", 3) == 0;
+        zmtp_msg_destroy (&msg);
+        if (end)
+            break;
+        args->received++;
+    }
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
 void
 zmtp_dealer_test (bool verbose)
 {
     printf (" * zmtp_dealer: ");
     //  @selftest
+    const char *endpoint = "ipc://@zmtp-dealer-selftest";
+    struct s_peer_args first = { endpoint, "hello", NULL };
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_peer, &first);
+
+    zmtp_dealer_t *dealer = zmtp_dealer_new ();
+    assert (dealer);
+    zmtp_dealer_set_reconnect_ivl (dealer, 10);
+    zmtp_dealer_set_reconnect_ivl_max (dealer, 50);
+    zmtp_dealer_set_sndhwm (dealer, 2);
+    zmtp_dealer_set_sndhwm_policy (dealer, ZMTP_HWM_EAGAIN);
+    zmtp_dealer_set_histograms (dealer, true);
+    while (zmtp_dealer_connect (dealer, endpoint) == -1)
+        usleep (10 * 1000);
+
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "hello", 5);
+    int rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+
+    //  Peer is gone; messages are queued up to the limit
+    msg = zmtp_msg_from_const_data (0, "world", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_from_const_data (0, "again", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    assert (zmtp_dealer_sndq_size (dealer) == 2);
+    msg = zmtp_msg_from_const_data (0, "newest", 6);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == -1 && errno == EAGAIN);
+
+    //  Drop policies keep the queue at its limit
+    zmtp_dealer_set_sndhwm_policy (dealer, ZMTP_HWM_DROP_NEWEST);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    assert (zmtp_dealer_sndq_size (dealer) == 2);
+    assert (zmtp_dealer_dropped (dealer) == 1);
+    zmtp_dealer_set_sndhwm_policy (dealer, ZMTP_HWM_DROP_OLDEST);
+    msg = zmtp_msg_from_const_data (0, "latest", 6);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    assert (zmtp_dealer_sndq_size (dealer) == 2);
+    assert (zmtp_dealer_dropped (dealer) == 2);
+
+    //  Peer restarts; recv reconnects and the queue is flushed first
+    struct s_peer_args second = { endpoint, "again", "welcome back", "latest" };
+    pthread_create (&thread, NULL, s_peer, &second);
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 12);
+    assert (memcmp (zmtp_msg_data (msg), "welcome back", 12) == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+
+    //  Counters add up over both connections
+    zmtp_stats_t stats;
+    zmtp_dealer_stats (dealer, &stats);
+    assert (stats.handshakes == 2);
+    assert (stats.commands_out == 2 && stats.commands_in == 2);
+    assert (stats.frames_in == 3);
+
+    //  So do latencies; the two frames sent while the peer was away
+    //  waited in the queue, the first did not
+    zmtp_histogram_t *histogram =
+        zmtp_dealer_histogram (dealer, ZMTP_LATENCY_HANDSHAKE);
+    assert (zmtp_histogram_count (histogram) == 2);
+    assert (zmtp_histogram_min (histogram) > 0);
+    zmtp_histogram_destroy (&histogram);
+    histogram = zmtp_dealer_histogram (dealer, ZMTP_LATENCY_SEND);
+    assert (zmtp_histogram_count (histogram) == stats.frames_out);
+    zmtp_histogram_destroy (&histogram);
+    histogram = zmtp_dealer_histogram (dealer, ZMTP_LATENCY_QUEUE);
+    assert (zmtp_histogram_count (histogram) == 3);
+    assert (zmtp_histogram_min (histogram) == 0);
+    assert (zmtp_histogram_max (histogram) > 0);
+    zmtp_histogram_destroy (&histogram);
+    zmtp_dealer_set_linger (dealer, 0);
+    zmtp_dealer_destroy (&dealer);
+    assert (dealer == NULL);
+
+    //  A peer that does not read fills the socket, then the queue
+    struct s_sink_args sink = { "ipc://@zmtp-dealer-selftest-sink" };
+    pthread_create (&thread, NULL, s_sink, &sink);
+    dealer = zmtp_dealer_new ();
+    zmtp_dealer_set_sndhwm (dealer, 4);
+    zmtp_dealer_set_sndhwm_policy (dealer, ZMTP_HWM_EAGAIN);
+    while (zmtp_dealer_connect (dealer, sink.endpoint) == -1)
+        usleep (10 * 1000);
+    msg = zmtp_msg_new (0, 64 * 1024);
+    memset (zmtp_msg_data (msg), 0, zmtp_msg_size (msg));
+    size_t sent = 0;
+    while (zmtp_dealer_send (dealer, msg) == 0)
+        sent++;
+    assert (errno == EAGAIN);
+    assert (zmtp_dealer_sndq_size (dealer) == 4);
+
+    //  Blocking policy waits until the peer makes room
+    __atomic_store_n (&sink.released, true, __ATOMIC_RELEASE);
+    zmtp_dealer_set_sndhwm_policy (dealer, ZMTP_HWM_BLOCK);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    sent++;
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_from_const_data (0, "END", 3);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+
+    //  Destroy lingers until everything queued is written
+    zmtp_dealer_destroy (&dealer);
+    pthread_join (thread, NULL);
+    assert (sink.received == sent);
+
+    //  A dealer that only sends reconnects once the peer restarts
+    struct s_peer_args gone = { endpoint, "hello" };
+    pthread_create (&thread, NULL, s_peer, &gone);
+    dealer = zmtp_dealer_new ();
+    zmtp_dealer_set_reconnect_ivl (dealer, 10);
+    zmtp_dealer_set_reconnect_ivl_max (dealer, 50);
+    zmtp_dealer_set_sndhwm_policy (dealer, ZMTP_HWM_EAGAIN);
+    while (zmtp_dealer_connect (dealer, endpoint) == -1)
+        usleep (10 * 1000);
+    msg = zmtp_msg_from_const_data (0, "hello", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+    memset (&sink, 0, sizeof (sink));
+    sink.endpoint = endpoint;
+    sink.released = true;
+    pthread_create (&thread, NULL, s_sink, &sink);
+    msg = zmtp_msg_from_const_data (0, "tick", 4);
+    for (int tries = 0; tries < 500; tries++) {
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (rc == 0);
+        zmtp_dealer_stats (dealer, &stats);
+        if (stats.handshakes == 2 && zmtp_dealer_sndq_size (dealer) == 0)
+            break;
+        usleep (10 * 1000);
+    }
+    zmtp_msg_destroy (&msg);
+    assert (stats.handshakes == 2);
+    assert (zmtp_dealer_sndq_size (dealer) == 0);
+    msg = zmtp_msg_from_const_data (0, "END", 3);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    zmtp_dealer_destroy (&dealer);
+    pthread_join (thread, NULL);
+    assert (sink.received > 0);
+
+    //  A dealer can talk over a socketpair, the peer over the other end
+    int pair [2];
+    rc = socketpair (AF_UNIX, SOCK_STREAM, 0, pair);
+    assert (rc == 0);
+    struct s_peer_args paired = { NULL, "hello", "paired", NULL, pair [1] };
+    pthread_create (&thread, NULL, s_peer, &paired);
+    dealer = zmtp_dealer_new ();
+    rc = zmtp_dealer_adopt (dealer, pair [0]);
+    assert (rc == 0);
+    rc = zmtp_dealer_adopt (dealer, pair [0]);
+    assert (rc == -1 && errno == EISCONN);
+    msg = zmtp_msg_from_const_data (0, "hello", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 6);
+    assert (memcmp (zmtp_msg_data (msg), "paired", 6) == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+    zmtp_dealer_set_linger (dealer, 0);
+    zmtp_dealer_destroy (&dealer);
+
+    //  Activated sockets are ours only if the supervisor named our pid,
+    //  and are kept from our children. Put a socket of our own where the
+    //  first one goes, setting aside whatever the test runner left there.
+    const int listen_fd = ZMTP_LISTEN_FDS_START;
+    const int listen_flags = fcntl (listen_fd, F_GETFD);
+    const int saved = fcntl (listen_fd, F_DUPFD_CLOEXEC, listen_fd + 1);
+    const int activated = socket (AF_UNIX, SOCK_STREAM, 0);
+    assert (activated != -1);
+    rc = dup2 (activated, listen_fd);
+    assert (rc == listen_fd);
+    if (activated != listen_fd)
+        close (activated);
+    char pid [16];
+    snprintf (pid, sizeof pid, "%d", (int) getpid ());
+    setenv ("LISTEN_PID", "1", 1);
+    setenv ("LISTEN_FDS", "2", 1);
+    assert (zmtp_listen_fds () == 0);
+    assert ((fcntl (listen_fd, F_GETFD) & FD_CLOEXEC) == 0);
+    setenv ("LISTEN_PID", pid, 1);
+    setenv ("LISTEN_FDS", "1", 1);
+    assert (zmtp_listen_fds () == 1);
+    assert ((fcntl (listen_fd, F_GETFD) & FD_CLOEXEC) == FD_CLOEXEC);
+    assert (getenv ("LISTEN_PID") == NULL && getenv ("LISTEN_FDS") == NULL);
+    assert (zmtp_listen_fds () == 0);
+    close (listen_fd);
+    if (saved != -1) {
+        rc = dup2 (saved, listen_fd);
+        assert (rc == listen_fd);
+        fcntl (listen_fd, F_SETFD, listen_flags);
+        close (saved);
+    }
+
+    //  With an I/O thread, send returns at once and the thread writes
+    bool ok = zmtp_init ();
+    assert (ok);
+    struct s_peer_args third = { endpoint, "hello", "async" };
+    pthread_create (&thread, NULL, s_peer, &third);
+    dealer = zmtp_dealer_new ();
+    while (zmtp_dealer_connect (dealer, endpoint) == -1)
+        usleep (10 * 1000);
+    msg = zmtp_msg_from_const_data (0, "hello", 5);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_dealer_recv (dealer);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 5);
+    assert (memcmp (zmtp_msg_data (msg), "async", 5) == 0);
+    zmtp_msg_destroy (&msg);
+    pthread_join (thread, NULL);
+    zmtp_dealer_set_linger (dealer, 0);
+    zmtp_dealer_destroy (&dealer);
+
+    //  Senders block at the limit until the thread gets the peer to read
+    memset (&sink, 0, sizeof (sink));
+    sink.endpoint = "ipc://@zmtp-dealer-selftest-sink";
+    pthread_create (&thread, NULL, s_sink, &sink);
+    dealer = zmtp_dealer_new ();
+    zmtp_dealer_set_sndhwm (dealer, 4);
+    zmtp_dealer_set_histograms (dealer, true);
+    while (zmtp_dealer_connect (dealer, sink.endpoint) == -1)
+        usleep (10 * 1000);
+    __atomic_store_n (&sink.released, true, __ATOMIC_RELEASE);
+    msg = zmtp_msg_new (0, 64 * 1024);
+    memset (zmtp_msg_data (msg), 0, zmtp_msg_size (msg));
+    for (sent = 0; sent < 100; sent++) {
+        rc = zmtp_dealer_send (dealer, msg);
+        assert (rc == 0);
+        assert (zmtp_dealer_sndq_size (dealer) <= 4);
+    }
+    zmtp_msg_destroy (&msg);
+    //  Latencies can be read while the thread is still writing
+    histogram = zmtp_dealer_histogram (dealer, ZMTP_LATENCY_QUEUE);
+    assert (zmtp_histogram_count (histogram) <= sent);
+    assert (zmtp_histogram_percentile (histogram, 99)
+         <= zmtp_histogram_max (histogram));
+    zmtp_histogram_destroy (&histogram);
+    msg = zmtp_msg_from_const_data (0, "END", 3);
+    rc = zmtp_dealer_send (dealer, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    zmtp_dealer_destroy (&dealer);
+    pthread_join (thread, NULL);
+    assert (sink.received == sent);
+    ok = zmtp_deinit ();
+    assert (ok);
     //  @end
     printf ("OK\n");
 }
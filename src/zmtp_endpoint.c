@@ -12,9 +12,164 @@
 
 #include "zmtp_classes.h"
 
+//  Endpoints kept parsed for reuse; longer strings are parsed every time
+
+#define ZMTP_ENDPOINT_CACHE_SIZE    64
+#define ZMTP_ENDPOINT_KEY_MAX       256
+
+typedef struct {
+    char key [ZMTP_ENDPOINT_KEY_MAX];   //  Endpoint string
+    uint32_t hash;                  //  Hash of the string
+    zmtp_endpoint_t *endpoint;      //  Our reference, NULL if slot is free
+    int64_t expires;                //  When to parse it again
+} s_cached_t;
+
+static s_cached_t s_cache [ZMTP_ENDPOINT_CACHE_SIZE];
+static int s_cache_ttl = ZMTP_ENDPOINT_TTL;
+static pthread_mutex_t s_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static s_cached_t *
+    s_cache_find (const char *key, uint32_t hash, int64_t now);
+
+
+//  --------------------------------------------------------------------------
+//  Parse an endpoint string. Host and port are
+//  split in place in a fixed buffer, so nothing is allocated but the
+//  endpoint itself.
+
+zmtp_endpoint_t *
+zmtp_endpoint_new (const char *endpoint_str)
+{
+    assert (endpoint_str);
+
+    if (strncmp (endpoint_str, "ipc://", 6) == 0)
+        return (zmtp_endpoint_t *) zmtp_ipc_endpoint_new (endpoint_str + 6);
+    if (strncmp (endpoint_str, "tcp://", 6) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    const char *host = endpoint_str + 6;
+    const char *colon = strrchr (host, ':');
+    char *end = NULL;
+    const unsigned long port = colon? strtoul (colon + 1, &end, 10): 0;
+    size_t host_size = colon? (size_t) (colon - host): 0;
+    if (!colon || end == colon + 1 || *end || port > 65535
+    ||  host_size >= NI_MAXHOST) {
+        errno = EINVAL;
+        return NULL;
+    }
+    //  IPv6 literals are written in brackets, tcp://[::1]:5555
+    if (host_size >= 2 && host [0] == '[' && host [host_size - 1] == ']') {
+        host++;
+        host_size -= 2;
+    }
+    char addr [NI_MAXHOST];
+    memcpy (addr, host, host_size);
+    addr [host_size] = '\0';
+    zmtp_endpoint_t *self = (zmtp_endpoint_t *)
+        zmtp_tcp_endpoint_new (addr, (unsigned short) port);
+    if (!self)
+        errno = EINVAL;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the endpoint for a string, parsed at most once per TTL.
+//  Reconnect loops and pools ask for the same few endpoints over and
+//  over; this spares them the parsing and the allocations each time.
+//  Parsing happens outside the lock, so lookups of other endpoints do not
+//  wait for it.
+
+zmtp_endpoint_t *
+zmtp_endpoint_lookup (const char *endpoint_str)
+{
+    assert (endpoint_str);
+
+    const size_t size = strlen (endpoint_str);
+    if (size >= ZMTP_ENDPOINT_KEY_MAX
+    ||  __atomic_load_n (&s_cache_ttl, __ATOMIC_RELAXED) == 0)
+        return zmtp_endpoint_new (endpoint_str);
+
+    //  FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ (byte) endpoint_str [i]) * 16777619u;
+
+    pthread_mutex_lock (&s_cache_mutex);
+    s_cached_t *cached =
+        s_cache_find (endpoint_str, hash, zmtp_clock_mono ());
+    zmtp_endpoint_t *self =
+        cached? zmtp_endpoint_ref (cached->endpoint): NULL;
+    pthread_mutex_unlock (&s_cache_mutex);
+    if (self)
+        return self;
+
+    self = zmtp_endpoint_new (endpoint_str);
+    if (!self)
+        return NULL;
+
+    //  Keep it, unless another thread got there first, in a free slot or
+    //  else in place of the one that expires soonest
+    pthread_mutex_lock (&s_cache_mutex);
+    const int64_t now = zmtp_clock_mono ();
+    cached = s_cache_find (endpoint_str, hash, now);
+    if (!cached) {
+        cached = &s_cache [0];
+        for (size_t i = 0; i < ZMTP_ENDPOINT_CACHE_SIZE; i++) {
+            if (!s_cache [i].endpoint) {
+                cached = &s_cache [i];
+                break;
+            }
+            if (s_cache [i].expires < cached->expires)
+                cached = &s_cache [i];
+        }
+        zmtp_endpoint_destroy (&cached->endpoint);
+        memcpy (cached->key, endpoint_str, size + 1);
+        cached->hash = hash;
+        cached->endpoint = zmtp_endpoint_ref (self);
+        cached->expires =
+            now + __atomic_load_n (&s_cache_ttl, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock (&s_cache_mutex);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the live cache entry for a string, dropping it if it expired.
+//  Call with the cache locked.
+
+static s_cached_t *
+s_cache_find (const char *key, uint32_t hash, int64_t now)
+{
+    for (size_t i = 0; i < ZMTP_ENDPOINT_CACHE_SIZE; i++) {
+        s_cached_t *cached = &s_cache [i];
+        if (cached->endpoint && cached->hash == hash
+        &&  streq (cached->key, key)) {
+            if (cached->expires > now)
+                return cached;
+            zmtp_endpoint_destroy (&cached->endpoint);
+        }
+    }
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take another reference to the endpoint
+
+zmtp_endpoint_t *
+zmtp_endpoint_ref (zmtp_endpoint_t *self)
+{
+    assert (self);
+    __atomic_fetch_add (&self->refs, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
 
 //  --------------------------------------------------------------------------
-//  Destructor
+//  Destructor; frees the endpoint once its last reference is dropped
 
 void
 zmtp_endpoint_destroy (zmtp_endpoint_t **self_p)
@@ -22,12 +177,44 @@ zmtp_endpoint_destroy (zmtp_endpoint_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_endpoint_t *self = *self_p;
+        if (__atomic_fetch_sub (&self->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+            *self_p = NULL;
+            return;
+        }
         assert (self->destroy);
         self->destroy (self_p);
     }
 }
 
 
+//  --------------------------------------------------------------------------
+//  Set msecs cached endpoints are reused for. Hostnames are resolved on
+//  each connect, through the resolver's own cache, so a cached endpoint
+//  never holds a stale address. 0 stops caching and forgets what is
+//  cached.
+
+void
+zmtp_endpoint_cache_set_ttl (int ttl)
+{
+    __atomic_store_n (&s_cache_ttl, ttl > 0? ttl: 0, __ATOMIC_RELAXED);
+    if (ttl <= 0)
+        zmtp_endpoint_cache_purge ();
+}
+
+
+//  --------------------------------------------------------------------------
+//  Forget every cached endpoint; those in use stay valid until destroyed
+
+void
+zmtp_endpoint_cache_purge (void)
+{
+    pthread_mutex_lock (&s_cache_mutex);
+    for (size_t i = 0; i < ZMTP_ENDPOINT_CACHE_SIZE; i++)
+        zmtp_endpoint_destroy (&s_cache [i].endpoint);
+    pthread_mutex_unlock (&s_cache_mutex);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Connect to the endpoint
 
@@ -41,6 +228,20 @@ zmtp_endpoint_connect (zmtp_endpoint_t *self)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Connect to the endpoint, failing with ETIMEDOUT if the connection is not
+//  established within timeout milliseconds; -1 means wait forever.
+
+int
+zmtp_endpoint_connect_timeout (zmtp_endpoint_t *self, int timeout)
+{
+    assert (self);
+    assert (self->connect_timeout);
+
+    return self->connect_timeout (self, timeout);
+}
+
+
 //  --------------------------------------------------------------------------
 //  Listen for new connection on endpoint
 
@@ -0,0 +1,352 @@
+/*  =========================================================================
+    zmtp_histogram - log-bucketed latency histogram
+
+    Values below 16 have a bucket each; above that every power of two is
+    split into 16 buckets, as HdrHistogram does with one significant hex
+    digit, so recording is a bit scan and a shift and a whole histogram
+    is a few KB. Values of 2^40 ns (18 minutes) and more share the last
+    bucket.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Sub-buckets per power of two, as bits, and the powers covered
+
+#define ZMTP_HISTOGRAM_SUB_BITS     4
+#define ZMTP_HISTOGRAM_SUB_BUCKETS  (1 << ZMTP_HISTOGRAM_SUB_BITS)
+#define ZMTP_HISTOGRAM_MAX_BITS     40
+#define ZMTP_HISTOGRAM_BUCKETS \
+    ((ZMTP_HISTOGRAM_MAX_BITS - ZMTP_HISTOGRAM_SUB_BITS + 1) \
+    * ZMTP_HISTOGRAM_SUB_BUCKETS)
+
+//  Structure of our class
+
+struct _zmtp_histogram_t {
+    uint64_t count;             //  Values recorded
+    uint64_t sum;               //  Total of the values
+    uint64_t min;               //  Smallest value, if count > 0
+    uint64_t max;               //  Largest value
+    uint64_t buckets [ZMTP_HISTOGRAM_BUCKETS];
+};
+
+
+//  Return the bucket holding value
+
+static inline size_t
+s_bucket (uint64_t value)
+{
+    if (value < ZMTP_HISTOGRAM_SUB_BUCKETS)
+        return (size_t) value;
+    const int msb = 63 - __builtin_clzll (value);
+    if (msb >= ZMTP_HISTOGRAM_MAX_BITS)
+        return ZMTP_HISTOGRAM_BUCKETS - 1;
+    const int shift = msb - ZMTP_HISTOGRAM_SUB_BITS;
+    return (size_t) (shift + 1) * ZMTP_HISTOGRAM_SUB_BUCKETS
+         + (size_t) ((value >> shift) & (ZMTP_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+
+//  Return the highest value a bucket holds
+
+static uint64_t
+s_highest (size_t bucket)
+{
+    if (bucket < ZMTP_HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    if (bucket == ZMTP_HISTOGRAM_BUCKETS - 1)
+        return UINT64_MAX;
+    const int shift = (int) (bucket / ZMTP_HISTOGRAM_SUB_BUCKETS) - 1;
+    const uint64_t lowest = (uint64_t) (ZMTP_HISTOGRAM_SUB_BUCKETS
+        + bucket % ZMTP_HISTOGRAM_SUB_BUCKETS) << shift;
+    return lowest + ((uint64_t) 1 << shift) - 1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_histogram_t *
+zmtp_histogram_new (void)
+{
+    zmtp_histogram_t *self = (zmtp_histogram_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zmtp_histogram_destroy (zmtp_histogram_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_free (*self_p);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Record one value, in nanoseconds
+
+void
+zmtp_histogram_record (zmtp_histogram_t *self, uint64_t nsecs)
+{
+    assert (self);
+    const uint64_t count = __atomic_load_n (&self->count, __ATOMIC_RELAXED);
+    if (count == 0 || nsecs < __atomic_load_n (&self->min, __ATOMIC_RELAXED))
+        __atomic_store_n (&self->min, nsecs, __ATOMIC_RELAXED);
+    if (nsecs > __atomic_load_n (&self->max, __ATOMIC_RELAXED))
+        __atomic_store_n (&self->max, nsecs, __ATOMIC_RELAXED);
+    ZMTP_STAT_ADD (self->buckets [s_bucket (nsecs)], 1);
+    ZMTP_STAT_ADD (self->sum, nsecs);
+    __atomic_store_n (&self->count, count + 1, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Add the values of other into self, e.g. to total several channels.
+//  Other may be recording meanwhile; self must not be.
+
+void
+zmtp_histogram_merge (zmtp_histogram_t *self, zmtp_histogram_t *other)
+{
+    assert (self);
+    assert (other);
+    //  Count the buckets rather than trust other's count, so a snapshot
+    //  taken during a record stays consistent
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket < ZMTP_HISTOGRAM_BUCKETS; bucket++) {
+        const uint64_t n =
+            __atomic_load_n (&other->buckets [bucket], __ATOMIC_RELAXED);
+        if (n) {
+            ZMTP_STAT_ADD (self->buckets [bucket], n);
+            count += n;
+        }
+    }
+    if (count == 0)
+        return;
+    const uint64_t min = __atomic_load_n (&other->min, __ATOMIC_RELAXED);
+    const uint64_t max = __atomic_load_n (&other->max, __ATOMIC_RELAXED);
+    if (self->count == 0 || min < self->min)
+        __atomic_store_n (&self->min, min, __ATOMIC_RELAXED);
+    if (max > self->max)
+        __atomic_store_n (&self->max, max, __ATOMIC_RELAXED);
+    ZMTP_STAT_ADD (self->sum,
+        __atomic_load_n (&other->sum, __ATOMIC_RELAXED));
+    ZMTP_STAT_ADD (self->count, count);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a snapshot of the histogram; safe from any thread
+
+zmtp_histogram_t *
+zmtp_histogram_dup (zmtp_histogram_t *self)
+{
+    assert (self);
+    zmtp_histogram_t *copy = zmtp_histogram_new ();
+    zmtp_histogram_merge (copy, self);
+    return copy;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of values recorded
+
+uint64_t
+zmtp_histogram_count (zmtp_histogram_t *self)
+{
+    assert (self);
+    return __atomic_load_n (&self->count, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return smallest value recorded, or 0 if none
+
+uint64_t
+zmtp_histogram_min (zmtp_histogram_t *self)
+{
+    assert (self);
+    return __atomic_load_n (&self->min, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return largest value recorded, or 0 if none
+
+uint64_t
+zmtp_histogram_max (zmtp_histogram_t *self)
+{
+    assert (self);
+    return __atomic_load_n (&self->max, __ATOMIC_RELAXED);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return mean of the values recorded, or 0 if none
+
+double
+zmtp_histogram_mean (zmtp_histogram_t *self)
+{
+    assert (self);
+    const uint64_t count = __atomic_load_n (&self->count, __ATOMIC_RELAXED);
+    if (count == 0)
+        return 0;
+    return (double) __atomic_load_n (&self->sum, __ATOMIC_RELAXED)
+         / (double) count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the value at or below which the given percentage of values
+//  fall, e.g. 99.9, or 0 if none were recorded
+
+uint64_t
+zmtp_histogram_percentile (zmtp_histogram_t *self, double percent)
+{
+    assert (self);
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket < ZMTP_HISTOGRAM_BUCKETS; bucket++)
+        count += __atomic_load_n (&self->buckets [bucket], __ATOMIC_RELAXED);
+    if (count == 0)
+        return 0;
+
+    const double exact = percent / 100 * (double) count;
+    uint64_t rank = (uint64_t) exact;
+    if ((double) rank < exact || rank < 1)
+        rank++;
+    uint64_t seen = 0;
+    size_t bucket = 0;
+    for (; bucket < ZMTP_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += __atomic_load_n (&self->buckets [bucket], __ATOMIC_RELAXED);
+        if (seen >= rank)
+            break;
+    }
+    //  The bucket's top may lie beyond anything actually recorded
+    const uint64_t max = zmtp_histogram_max (self);
+    const uint64_t value = s_highest (bucket);
+    return value < max? value: max;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Write the histogram as text: a summary line, then one line per bucket
+//  in use giving its highest value, its count and the share of values up
+//  to and including it. Returns 0, or -1 if writing failed.
+
+int
+zmtp_histogram_export (zmtp_histogram_t *self, FILE *file)
+{
+    assert (self);
+    assert (file);
+    zmtp_histogram_t *snapshot = zmtp_histogram_dup (self);
+    fprintf (file, "# count %" PRIu64 " min %" PRIu64 " mean %.0f"
+        " p50 %" PRIu64 " p99 %" PRIu64 " p99.9 %" PRIu64 " max %" PRIu64
+        " nsecs\n",
+        snapshot->count, snapshot->min, zmtp_histogram_mean (snapshot),
+        zmtp_histogram_percentile (snapshot, 50),
+        zmtp_histogram_percentile (snapshot, 99),
+        zmtp_histogram_percentile (snapshot, 99.9), snapshot->max);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < ZMTP_HISTOGRAM_BUCKETS; bucket++) {
+        const uint64_t n = snapshot->buckets [bucket];
+        if (n == 0)
+            continue;
+        seen += n;
+        uint64_t value = s_highest (bucket);
+        if (value > snapshot->max)
+            value = snapshot->max;
+        fprintf (file, "%" PRIu64 " %" PRIu64 " %.6f\n",
+            value, n, (double) seen / (double) snapshot->count);
+    }
+    zmtp_histogram_destroy (&snapshot);
+    return ferror (file)? -1: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_histogram_test (bool verbose)
+{
+    printf (" * zmtp_histogram: ");
+    //  @selftest
+    //  Buckets tile the values without gaps and keep them within 1/16
+    for (size_t bucket = 1; bucket < ZMTP_HISTOGRAM_BUCKETS - 1; bucket++) {
+        assert (s_bucket (s_highest (bucket - 1) + 1) == bucket);
+        assert (s_bucket (s_highest (bucket)) == bucket);
+        const uint64_t lowest = s_highest (bucket - 1) + 1;
+        assert (s_highest (bucket) - lowest <= lowest / 16);
+    }
+    assert (s_bucket (UINT64_MAX) == ZMTP_HISTOGRAM_BUCKETS - 1);
+
+    zmtp_histogram_t *histogram = zmtp_histogram_new ();
+    assert (zmtp_histogram_count (histogram) == 0);
+    assert (zmtp_histogram_percentile (histogram, 50) == 0);
+    for (uint64_t value = 1; value <= 1000; value++)
+        zmtp_histogram_record (histogram, value * 1000);
+    assert (zmtp_histogram_count (histogram) == 1000);
+    assert (zmtp_histogram_min (histogram) == 1000);
+    assert (zmtp_histogram_max (histogram) == 1000000);
+    assert (zmtp_histogram_mean (histogram) == 500500);
+    uint64_t p50 = zmtp_histogram_percentile (histogram, 50);
+    assert (p50 >= 500000 && p50 <= 500000 + 500000 / 16);
+    uint64_t p99 = zmtp_histogram_percentile (histogram, 99);
+    assert (p99 >= 990000 && p99 <= 1000000);
+    assert (zmtp_histogram_percentile (histogram, 100) == 1000000);
+    assert (zmtp_histogram_percentile (histogram, 0)
+         <= 1000 + 1000 / 16);
+
+    //  Merging adds the other histogram's values
+    zmtp_histogram_t *other = zmtp_histogram_new ();
+    for (int i = 0; i < 1000; i++)
+        zmtp_histogram_record (other, 5);
+    zmtp_histogram_merge (histogram, other);
+    assert (zmtp_histogram_count (histogram) == 2000);
+    assert (zmtp_histogram_min (histogram) == 5);
+    assert (zmtp_histogram_percentile (histogram, 50) == 5);
+    p50 = zmtp_histogram_percentile (histogram, 75);
+    assert (p50 >= 500000 && p50 <= 500000 + 500000 / 16);
+    zmtp_histogram_destroy (&other);
+
+    other = zmtp_histogram_dup (histogram);
+    assert (zmtp_histogram_count (other) == 2000);
+    assert (zmtp_histogram_max (other) == 1000000);
+    zmtp_histogram_destroy (&other);
+
+    //  Export lists the buckets in use, ending with all values seen
+    FILE *file = tmpfile ();
+    assert (file);
+    assert (zmtp_histogram_export (histogram, file) == 0);
+    rewind (file);
+    char line [256];
+    assert (fgets (line, sizeof line, file));
+    assert (strncmp (line, "# count 2000 min 5 ", 19) == 0);
+    assert (fgets (line, sizeof line, file));
+    assert (strcmp (line, "5 1000 0.500000\n") == 0);
+    char last [256] = "";
+    while (fgets (line, sizeof line, file))
+        strcpy (last, line);
+    uint64_t value, count;
+    double share;
+    assert (sscanf (last, "%" SCNu64 " %" SCNu64 " %lf",
+        &value, &count, &share) == 3);
+    assert (value == 1000000 && share == 1);
+    fclose (file);
+    zmtp_histogram_destroy (&histogram);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,211 @@
+/*  =========================================================================
+    zmtp_identity - interned peer identities
+
+    Peers that reconnect present the same identity every time, and many
+    channels may route to one. Each distinct identity is stored once and
+    shared, so taking it from a READY costs a table lookup instead of an
+    allocation per connection.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Buckets of the intern table, a power of two
+
+#define ZMTP_IDENTITY_BUCKETS 256
+
+//  Structure of our class
+
+struct _zmtp_identity_t {
+    zmtp_identity_t *next;      //  Next in the same bucket
+    uint32_t hash;              //  FNV-1a of the bytes
+    int refs;                   //  References beyond the first
+    size_t size;                //  Size of the identity
+    byte data [];               //  The identity
+};
+
+static zmtp_identity_t *s_buckets [ZMTP_IDENTITY_BUCKETS];
+static size_t s_count;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+//  --------------------------------------------------------------------------
+//  Return the identity holding size bytes of data, creating it only if
+//  no one holds it yet
+
+zmtp_identity_t *
+zmtp_identity_intern (const void *data, size_t size)
+{
+    assert (data || size == 0);
+    if (size == 0 || size > ZMTP_IDENTITY_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ ((const byte *) data) [i]) * 16777619u;
+
+    pthread_mutex_lock (&s_mutex);
+    zmtp_identity_t **bucket =
+        &s_buckets [hash & (ZMTP_IDENTITY_BUCKETS - 1)];
+    zmtp_identity_t *self = *bucket;
+    while (self && (self->hash != hash || self->size != size
+                ||  memcmp (self->data, data, size) != 0))
+        self = self->next;
+    if (self)
+        zmtp_identity_ref (self);
+    else {
+        self = (zmtp_identity_t *) zmtp_malloc (sizeof *self + size);
+        assert (self);          //  For now, memory exhaustion is fatal
+        self->hash = hash;
+        self->refs = 0;
+        self->size = size;
+        memcpy (self->data, data, size);
+        self->next = *bucket;
+        *bucket = self;
+        s_count++;
+    }
+    pthread_mutex_unlock (&s_mutex);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take another reference to the identity
+
+zmtp_identity_t *
+zmtp_identity_ref (zmtp_identity_t *self)
+{
+    assert (self);
+    __atomic_fetch_add (&self->refs, 1, __ATOMIC_RELAXED);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; frees the identity once its last reference is dropped. The
+//  count drops under the lock, so a concurrent intern never finds an
+//  identity on its way out.
+
+void
+zmtp_identity_destroy (zmtp_identity_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_identity_t *self = *self_p;
+        *self_p = NULL;
+        pthread_mutex_lock (&s_mutex);
+        if (__atomic_fetch_sub (&self->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+            pthread_mutex_unlock (&s_mutex);
+            return;
+        }
+        zmtp_identity_t **link =
+            &s_buckets [self->hash & (ZMTP_IDENTITY_BUCKETS - 1)];
+        while (*link != self)
+            link = &(*link)->next;
+        *link = self->next;
+        s_count--;
+        pthread_mutex_unlock (&s_mutex);
+        zmtp_free (self);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the bytes of the identity
+
+const byte *
+zmtp_identity_data (zmtp_identity_t *self)
+{
+    assert (self);
+    return self->data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the size of the identity
+
+size_t
+zmtp_identity_size (zmtp_identity_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a hash of the identity
+
+uint32_t
+zmtp_identity_hash (zmtp_identity_t *self)
+{
+    assert (self);
+    return self->hash;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of identities held
+
+size_t
+zmtp_identity_count (void)
+{
+    pthread_mutex_lock (&s_mutex);
+    const size_t count = s_count;
+    pthread_mutex_unlock (&s_mutex);
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_identity_test (bool verbose)
+{
+    printf (" * zmtp_identity: ");
+    //  @selftest
+    const size_t held = zmtp_identity_count ();
+    assert (!zmtp_identity_intern ("", 0) && errno == EINVAL);
+    byte long_identity [ZMTP_IDENTITY_MAX + 1] = { 0 };
+    assert (!zmtp_identity_intern (long_identity, sizeof long_identity));
+    assert (errno == EINVAL);
+
+    //  The same bytes give the same identity, whoever asks
+    zmtp_identity_t *first = zmtp_identity_intern ("client-1", 8);
+    assert (first);
+    char copy [] = "client-1";
+    zmtp_identity_t *second = zmtp_identity_intern (copy, 8);
+    assert (second == first);
+    zmtp_identity_t *other = zmtp_identity_intern ("client-2", 8);
+    assert (other && other != first);
+    assert (zmtp_identity_hash (other) != zmtp_identity_hash (first));
+    assert (zmtp_identity_size (first) == 8);
+    assert (memcmp (zmtp_identity_data (first), "client-1", 8) == 0);
+    assert (zmtp_identity_count () == held + 2);
+
+    //  Binary identities of the longest size work too
+    zmtp_identity_t *binary = zmtp_identity_intern (
+        long_identity, ZMTP_IDENTITY_MAX);
+    assert (binary && zmtp_identity_size (binary) == ZMTP_IDENTITY_MAX);
+    zmtp_identity_destroy (&binary);
+
+    //  It lives until the last reference is dropped
+    zmtp_identity_t *third = zmtp_identity_ref (first);
+    zmtp_identity_destroy (&first);
+    zmtp_identity_destroy (&second);
+    assert (first == NULL && second == NULL);
+    assert (zmtp_identity_count () == held + 2);
+    zmtp_identity_destroy (&third);
+    zmtp_identity_destroy (&other);
+    assert (zmtp_identity_count () == held);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,749 @@
+/*  =========================================================================
+    zmtp_io_thread - background I/O thread
+
+    Each I/O thread polls the sockets of the objects registered with it and
+    runs commands posted by application threads. Commands travel over a
+    lock-free MPSC queue; the thread is only woken through its pipe when it
+    announced that it is about to sleep, so a busy thread takes commands
+    without any system call on either side.
+
+    A producer that talks to one I/O thread a lot, such as a socket's
+    owner, opens a handoff: a bounded SPSC ring for that pair alone. Only
+    the first command of a burst posts a command to drain the ring, so
+    the rest take no allocation and contend with no other producer. When
+    the ring is full, commands go around it through the shared queue,
+    each draining the ring before it runs, until the thread catches up.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+#include <poll.h>
+
+//  A command queued for the I/O thread
+
+typedef struct {
+    zmtp_mpscq_node_t node;     //  Must be first
+    zmtp_io_fn *fn;             //  Function to run
+    void *arg;                  //  Its object
+    zmtp_msg_t *msg;            //  Its message, if any
+    zmtp_io_handoff_t *handoff; //  Ring to drain first, if any
+} s_command_t;
+
+//  Capacity of each handoff ring
+
+#define ZMTP_IO_HANDOFF_RING    256
+
+//  A command carried by a handoff ring
+
+typedef struct {
+    zmtp_io_fn *fn;
+    void *arg;
+    zmtp_msg_t *msg;
+} s_handoff_item_t;
+
+//  Commands from one producer thread to one I/O thread
+
+struct _zmtp_io_handoff_t {
+    zmtp_io_thread_t *target;   //  Thread that runs the commands
+    zmtp_spscq_t *ring;         //  Producer pushes, target pops
+    int scheduled;              //  A drain command is queued on target
+    size_t overflowed;          //  Commands sent around the ring, not run
+};
+
+//  A registered handler
+
+typedef struct {
+    const zmtp_io_handler_t *handler;
+    void *arg;
+    bool removed;               //  Removed while dispatching
+} s_entry_t;
+
+//  Structure of our class
+
+struct _zmtp_io_thread_t {
+    pthread_t thread;           //  The I/O thread
+    zmtp_mpscq_t commands;      //  Commands from any thread
+    int sleeping;               //  Thread is about to block in poll
+    int wake [2];               //  Pipe to wake the thread
+    bool stopped;               //  Thread was told to exit
+    s_entry_t *entries;         //  Registered handlers
+    size_t nentries;            //  Number of handlers
+    size_t max_entries;         //  Size of entries array
+    struct pollfd *pollset;     //  Poll set, wake pipe first
+    size_t *polled;             //  Entry polled at each pollset slot
+    bool dispatching;           //  Entry indexes must not move
+    size_t removed;             //  Entries marked removed meanwhile
+};
+
+static void *
+    s_thread_main (void *arg);
+static void
+    s_stop (void *arg, zmtp_msg_t *msg);
+static void
+    s_post (zmtp_io_thread_t *self, zmtp_io_fn *fn, void *arg,
+            zmtp_msg_t *msg, zmtp_io_handoff_t *handoff);
+static void
+    s_handoff_run (zmtp_io_handoff_t *self);
+static void
+    s_handoff_drain (void *arg, zmtp_msg_t *msg);
+static void
+    s_handoff_close (void *arg, zmtp_msg_t *msg);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; starts the thread
+
+zmtp_io_thread_t *
+zmtp_io_thread_new (void)
+{
+    zmtp_io_thread_t *self = (zmtp_io_thread_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    zmtp_mpscq_init (&self->commands);
+    if (pipe (self->wake) == -1) {
+        zmtp_free (self);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        const int flags = fcntl (self->wake [i], F_GETFL, 0);
+        fcntl (self->wake [i], F_SETFL, flags | O_NONBLOCK);
+    }
+    if (pthread_create (&self->thread, NULL, s_thread_main, self)) {
+        close (self->wake [0]);
+        close (self->wake [1]);
+        zmtp_free (self);
+        return NULL;
+    }
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; stops and joins the thread
+
+void
+zmtp_io_thread_destroy (zmtp_io_thread_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_io_thread_t *self = *self_p;
+        zmtp_io_thread_post (self, s_stop, self, NULL);
+        pthread_join (self->thread, NULL);
+        //  Release commands posted after the stop
+        s_command_t *command;
+        while ((command = (s_command_t *) zmtp_mpscq_pop (&self->commands))) {
+            if (command->fn == s_handoff_close) {
+                zmtp_io_handoff_t *handoff = (zmtp_io_handoff_t *) command->arg;
+                s_handoff_item_t item;
+                while (zmtp_spscq_pop (handoff->ring, &item) == 0)
+                    zmtp_msg_destroy (&item.msg);
+                zmtp_spscq_destroy (&handoff->ring);
+                zmtp_free (handoff);
+            }
+            zmtp_msg_destroy (&command->msg);
+            zmtp_free (command);
+        }
+        close (self->wake [0]);
+        close (self->wake [1]);
+        zmtp_free (self->entries);
+        zmtp_free (self->pollset);
+        zmtp_free (self->polled);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pin the thread to one CPU. Returns 0 if OK, -1 with errno set if the
+//  CPU does not exist or the platform cannot pin threads.
+
+int
+zmtp_io_thread_set_cpu (zmtp_io_thread_t *self, int cpu)
+{
+    return zmtp_io_thread_set_cpus (self, &cpu, 1);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Let the thread run on any of the ncpus CPUs listed, e.g. those of one
+//  NUMA node. Returns 0 if OK, -1 with errno set if a CPU does not exist
+//  or the platform cannot pin threads.
+
+int
+zmtp_io_thread_set_cpus (zmtp_io_thread_t *self,
+                         const int *cpus, size_t ncpus)
+{
+    assert (self);
+    assert (cpus);
+#if defined (__UTYPE_LINUX)
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (size_t i = 0; i < ncpus; i++) {
+        if (cpus [i] < 0 || cpus [i] >= CPU_SETSIZE) {
+            errno = EINVAL;
+            return -1;
+        }
+        CPU_SET (cpus [i], &set);
+    }
+    const int rc = pthread_setaffinity_np (self->thread, sizeof set, &set);
+    if (rc) {
+        errno = rc;
+        return -1;
+    }
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue fn (arg, msg) to run on the I/O thread, in order with other
+//  commands. Safe to call from any thread; never blocks.
+
+void
+zmtp_io_thread_post (zmtp_io_thread_t *self,
+                     zmtp_io_fn *fn, void *arg, zmtp_msg_t *msg)
+{
+    assert (self);
+    assert (fn);
+    s_post (self, fn, arg, msg, NULL);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Open a handoff to the I/O thread
+
+zmtp_io_handoff_t *
+zmtp_io_handoff_new (zmtp_io_thread_t *target)
+{
+    assert (target);
+    zmtp_io_handoff_t *self =
+        (zmtp_io_handoff_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->target = target;
+    self->ring = zmtp_spscq_new (
+        sizeof (s_handoff_item_t), ZMTP_IO_HANDOFF_RING);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Close the handoff; the I/O thread runs what is still queued, then
+//  frees it
+
+void
+zmtp_io_handoff_destroy (zmtp_io_handoff_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_io_handoff_t *self = *self_p;
+        s_post (self->target, s_handoff_close, self, NULL, NULL);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue fn (arg, msg) to run on the handoff's I/O thread, in order with
+//  the handoff's other commands
+
+void
+zmtp_io_handoff_post (zmtp_io_handoff_t *self,
+                      zmtp_io_fn *fn, void *arg, zmtp_msg_t *msg)
+{
+    assert (self);
+    assert (fn);
+    s_handoff_item_t item = { fn, arg, msg };
+    if (__atomic_load_n (&self->overflowed, __ATOMIC_ACQUIRE) == 0
+    &&  zmtp_spscq_push (self->ring, &item) == 0) {
+        if (!__atomic_exchange_n (&self->scheduled, 1, __ATOMIC_SEQ_CST))
+            s_post (self->target, s_handoff_drain, self, NULL, NULL);
+        return;
+    }
+    //  The ring is full, or commands that went around it have not run
+    //  yet; go around it too, behind what the ring holds
+    __atomic_add_fetch (&self->overflowed, 1, __ATOMIC_RELEASE);
+    s_post (self->target, fn, arg, msg, self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue a command, waking the thread if it may be asleep
+
+static void
+s_post (zmtp_io_thread_t *self, zmtp_io_fn *fn, void *arg,
+        zmtp_msg_t *msg, zmtp_io_handoff_t *handoff)
+{
+    s_command_t *command = (s_command_t *) zmtp_malloc (sizeof *command);
+    assert (command);
+    command->fn = fn;
+    command->arg = arg;
+    command->msg = msg;
+    command->handoff = handoff;
+    zmtp_mpscq_push (&self->commands, &command->node);
+
+    //  Only pay for a system call if the thread may miss the command
+    if (__atomic_exchange_n (&self->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        const byte signal = 0;
+        while (write (self->wake [1], &signal, 1) == -1 && errno == EINTR);
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Start polling on behalf of handler; call on the I/O thread only
+
+void
+zmtp_io_thread_add (zmtp_io_thread_t *self,
+                    const zmtp_io_handler_t *handler, void *arg)
+{
+    assert (self);
+    assert (handler);
+    if (self->nentries == self->max_entries) {
+        self->max_entries = self->max_entries? self->max_entries * 2: 8;
+        self->entries = (s_entry_t *) zmtp_realloc (
+            self->entries, self->max_entries * sizeof *self->entries);
+        self->pollset = (struct pollfd *) zmtp_realloc (
+            self->pollset, (self->max_entries + 1) * sizeof *self->pollset);
+        self->polled = (size_t *) zmtp_realloc (
+            self->polled, (self->max_entries + 1) * sizeof *self->polled);
+        assert (self->entries && self->pollset && self->polled);
+    }
+    self->entries [self->nentries++] = (s_entry_t) { handler, arg, false };
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop polling on behalf of handler; call on the I/O thread only. A
+//  handler may remove itself or others from its own callbacks; while
+//  events are dispatched the entry is only marked, so the indexes taken
+//  for the poll set stay valid, and it is never called again.
+
+void
+zmtp_io_thread_remove (zmtp_io_thread_t *self, void *arg)
+{
+    assert (self);
+    for (size_t i = 0; i < self->nentries; i++)
+        if (self->entries [i].arg == arg && !self->entries [i].removed) {
+            if (self->dispatching) {
+                self->entries [i].removed = true;
+                self->removed++;
+            }
+            else {
+                memmove (&self->entries [i], &self->entries [i + 1],
+                    (self->nentries - i - 1) * sizeof *self->entries);
+                self->nentries--;
+            }
+            return;
+        }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Drop the entries marked removed while dispatching
+
+static void
+s_compact (zmtp_io_thread_t *self)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < self->nentries; i++)
+        if (!self->entries [i].removed)
+            self->entries [kept++] = self->entries [i];
+    self->nentries = kept;
+    self->removed = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Run queued commands; returns number run
+
+static size_t
+s_run_commands (zmtp_io_thread_t *self)
+{
+    size_t count = 0;
+    s_command_t *command;
+    while (!self->stopped
+       && (command = (s_command_t *) zmtp_mpscq_pop (&self->commands))) {
+        if (command->handoff) {
+            //  Went around a full ring; what the ring holds comes first
+            s_handoff_run (command->handoff);
+            command->fn (command->arg, command->msg);
+            __atomic_sub_fetch (
+                &command->handoff->overflowed, 1, __ATOMIC_RELEASE);
+        }
+        else
+            command->fn (command->arg, command->msg);
+        zmtp_free (command);
+        count++;
+    }
+    return count;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Run every command in a handoff's ring
+
+static void
+s_handoff_run (zmtp_io_handoff_t *self)
+{
+    s_handoff_item_t item;
+    while (zmtp_spscq_pop (self->ring, &item) == 0)
+        item.fn (item.arg, item.msg);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Command that drains a handoff's ring. Clearing the flag first means a
+//  command pushed after our last pop posts a new drain.
+
+static void
+s_handoff_drain (void *arg, zmtp_msg_t *msg)
+{
+    zmtp_io_handoff_t *self = (zmtp_io_handoff_t *) arg;
+    __atomic_store_n (&self->scheduled, 0, __ATOMIC_SEQ_CST);
+    s_handoff_run (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Command that runs what a closed handoff still holds and frees it
+
+static void
+s_handoff_close (void *arg, zmtp_msg_t *msg)
+{
+    zmtp_io_handoff_t *self = (zmtp_io_handoff_t *) arg;
+    s_handoff_run (self);
+    zmtp_spscq_destroy (&self->ring);
+    zmtp_free (self);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Thread body
+
+static void *
+s_thread_main (void *arg)
+{
+    zmtp_io_thread_t *self = (zmtp_io_thread_t *) arg;
+
+    while (!self->stopped) {
+        s_run_commands (self);
+        if (self->stopped)
+            break;
+
+        //  Collect sockets and the earliest timer
+        size_t npoll = 0;
+        int64_t next_timer = -1;
+        if (self->pollset == NULL) {
+            self->pollset =
+                (struct pollfd *) zmtp_malloc (sizeof *self->pollset);
+            self->polled = (size_t *) zmtp_malloc (sizeof *self->polled);
+            assert (self->pollset && self->polled);
+        }
+        self->pollset [npoll++] =
+            (struct pollfd) { .fd = self->wake [0], .events = POLLIN };
+        for (size_t i = 0; i < self->nentries; i++) {
+            short events = 0;
+            int64_t timer = -1;
+            const int fd = self->entries [i].handler->poll (
+                self->entries [i].arg, &events, &timer);
+            if (timer != -1 && (next_timer == -1 || timer < next_timer))
+                next_timer = timer;
+            if (fd != -1 && events) {
+                self->polled [npoll] = i;
+                self->pollset [npoll++] =
+                    (struct pollfd) { .fd = fd, .events = events };
+            }
+        }
+        int timeout = -1;
+        if (next_timer != -1) {
+            const int64_t now = zmtp_clock_mono ();
+            timeout = next_timer > now? (int) (next_timer - now): 0;
+        }
+        //  Announce we are going to sleep, then check once more for
+        //  commands that raced with the announcement
+        __atomic_store_n (&self->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!zmtp_mpscq_empty (&self->commands))
+            timeout = 0;
+        const int rc = poll (self->pollset, npoll, timeout);
+        __atomic_store_n (&self->sleeping, 0, __ATOMIC_SEQ_CST);
+        if (rc == -1) {
+            assert (errno == EINTR);
+            continue;
+        }
+        if (self->pollset [0].revents) {
+            byte buffer [64];
+            while (read (self->wake [0], buffer, sizeof buffer) > 0);
+        }
+
+        //  Dispatch; handlers removed meanwhile are only marked, so the
+        //  indexes taken above stay valid until we compact
+        const int64_t now = zmtp_clock_mono ();
+        self->dispatching = true;
+        for (size_t slot = 1; slot < npoll; slot++) {
+            const s_entry_t *entry = &self->entries [self->polled [slot]];
+            if (self->pollset [slot].revents && !entry->removed)
+                entry->handler->ready (
+                    entry->arg, self->pollset [slot].revents);
+        }
+        if (next_timer != -1 && now >= next_timer)
+            for (size_t i = 0; i < self->nentries; i++) {
+                if (self->entries [i].removed)
+                    continue;
+                short events;
+                int64_t timer = -1;
+                self->entries [i].handler->poll (
+                    self->entries [i].arg, &events, &timer);
+                if (timer != -1 && now >= timer && !self->entries [i].removed)
+                    self->entries [i].handler->ready (self->entries [i].arg, 0);
+            }
+        self->dispatching = false;
+        if (self->removed)
+            s_compact (self);
+    }
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Command that ends the thread
+
+static void
+s_stop (void *arg, zmtp_msg_t *msg)
+{
+    zmtp_io_thread_t *self = (zmtp_io_thread_t *) arg;
+    self->stopped = true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+struct s_echo {
+    zmtp_io_thread_t *thread;
+    int fd;                     //  Our end of a socketpair
+    size_t count;               //  Commands seen
+    int64_t timer;              //  Pending timer, -1 for none
+    bool fired;                 //  Timer went off
+    bool echoed;                //  Data was read and echoed
+    bool release;               //  Remove ourselves on the first event
+};
+
+static int
+s_echo_poll (void *arg, short *events, int64_t *timer)
+{
+    struct s_echo *echo = (struct s_echo *) arg;
+    *events = POLLIN;
+    *timer = echo->timer;
+    return echo->fd;
+}
+
+static void
+s_echo_ready (void *arg, short revents)
+{
+    struct s_echo *echo = (struct s_echo *) arg;
+    if (echo->release) {
+        zmtp_io_thread_remove (echo->thread, echo);
+        return;
+    }
+    if (revents & POLLIN) {
+        byte buffer [16];
+        const ssize_t rc = read (echo->fd, buffer, sizeof buffer);
+        if (rc > 0) {
+            //  Flag first; the write is what the test waits for
+            __atomic_store_n (&echo->echoed, true, __ATOMIC_RELEASE);
+            const ssize_t written = write (echo->fd, buffer, rc);
+            assert (written == rc);
+        }
+    }
+    if (revents == 0) {
+        __atomic_store_n (&echo->fired, true, __ATOMIC_RELEASE);
+        echo->timer = -1;
+    }
+}
+
+static const zmtp_io_handler_t s_echo_handler = {
+    .poll = s_echo_poll,
+    .ready = s_echo_ready
+};
+
+static void
+s_echo_add (void *arg, zmtp_msg_t *msg)
+{
+    struct s_echo *echo = (struct s_echo *) arg;
+    zmtp_io_thread_add (echo->thread, &s_echo_handler, echo);
+}
+
+static void
+s_echo_count (void *arg, zmtp_msg_t *msg)
+{
+    struct s_echo *echo = (struct s_echo *) arg;
+    echo->count++;
+    zmtp_msg_destroy (&msg);
+}
+
+static void
+s_echo_remove (void *arg, zmtp_msg_t *msg)
+{
+    struct s_echo *echo = (struct s_echo *) arg;
+    zmtp_io_thread_remove (echo->thread, echo);
+    assert (echo->count == 1000);
+    __atomic_store_n (&echo->count, SIZE_MAX, __ATOMIC_RELEASE);
+}
+
+#define S_HANDOFFS 5000
+
+struct s_relay {
+    zmtp_io_handoff_t *handoff;
+    size_t received;            //  Commands run on the target
+};
+
+static void
+s_relay_take (void *arg, zmtp_msg_t *msg)
+{
+    struct s_relay *relay = (struct s_relay *) arg;
+    size_t sequence;
+    memcpy (&sequence, zmtp_msg_data (msg), sizeof sequence);
+    assert (sequence == relay->received);
+    zmtp_msg_destroy (&msg);
+    __atomic_store_n (&relay->received, sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void
+s_relay_start (void *arg, zmtp_msg_t *msg)
+{
+    //  More than a ring holds, so part of it goes around the ring
+    struct s_relay *relay = (struct s_relay *) arg;
+    for (size_t sequence = 0; sequence < S_HANDOFFS; sequence++) {
+        msg = zmtp_msg_new (0, sizeof sequence);
+        memcpy (zmtp_msg_data (msg), &sequence, sizeof sequence);
+        zmtp_io_handoff_post (relay->handoff, s_relay_take, relay, msg);
+    }
+}
+
+void
+zmtp_io_thread_test (bool verbose)
+{
+    printf (" * zmtp_io_thread: ");
+    //  @selftest
+    zmtp_io_thread_t *thread = zmtp_io_thread_new ();
+    assert (thread);
+
+    int fds [2];
+    int rc = socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+    assert (rc == 0);
+    struct s_echo echo = {
+        .thread = thread, .fd = fds [1],
+        .timer = zmtp_clock_mono () + 20
+    };
+    zmtp_io_thread_post (thread, s_echo_add, &echo, NULL);
+    for (int i = 0; i < 1000; i++)
+        zmtp_io_thread_post (thread, s_echo_count, &echo,
+            zmtp_msg_from_const_data (0, "", 0));
+
+    //  Socket events wake the sleeping thread
+    rc = write (fds [0], "ping", 4);
+    assert (rc == 4);
+    char buffer [4];
+    rc = read (fds [0], buffer, 4);
+    assert (rc == 4 && memcmp (buffer, "ping", 4) == 0);
+    assert (__atomic_load_n (&echo.echoed, __ATOMIC_ACQUIRE));
+
+    //  Timers fire
+    while (!__atomic_load_n (&echo.fired, __ATOMIC_ACQUIRE))
+        usleep (1000);
+
+    //  Commands run in the order they were posted
+    zmtp_io_thread_post (thread, s_echo_remove, &echo, NULL);
+    while (__atomic_load_n (&echo.count, __ATOMIC_ACQUIRE) != SIZE_MAX)
+        usleep (1000);
+    //  Commands left over at destruction release their messages
+    zmtp_io_thread_post (thread, s_echo_count, &echo,
+        zmtp_msg_from_const_data (0, "", 0));
+    zmtp_io_thread_destroy (&thread);
+    assert (thread == NULL);
+    close (fds [0]);
+    close (fds [1]);
+
+    //  A handler that removes itself while others are ready in the same
+    //  round does not shift their events onto the wrong handler
+    thread = zmtp_io_thread_new ();
+    struct s_echo echoes [3];
+    int pairs [3][2];
+    for (int i = 0; i < 3; i++) {
+        rc = socketpair (AF_UNIX, SOCK_STREAM, 0, pairs [i]);
+        assert (rc == 0);
+        echoes [i] = (struct s_echo) {
+            .thread = thread, .fd = pairs [i][1], .timer = -1,
+            .release = i == 0
+        };
+        rc = write (pairs [i][0], "ping", 4);
+        assert (rc == 4);
+    }
+    for (int i = 0; i < 3; i++)
+        zmtp_io_thread_post (thread, s_echo_add, &echoes [i], NULL);
+    for (int i = 1; i < 3; i++) {
+        struct pollfd pollfd = { .fd = pairs [i][0], .events = POLLIN };
+        rc = poll (&pollfd, 1, 5000);
+        assert (rc == 1);
+        rc = read (pairs [i][0], buffer, 4);
+        assert (rc == 4 && memcmp (buffer, "ping", 4) == 0);
+    }
+    zmtp_io_thread_destroy (&thread);
+    assert (!echoes [0].echoed);
+    for (int i = 0; i < 3; i++) {
+        close (pairs [i][0]);
+        close (pairs [i][1]);
+    }
+
+    //  A handoff carries commands in order, from an application thread
+    //  or from another I/O thread
+    thread = zmtp_io_thread_new ();
+    struct s_relay relay = { zmtp_io_handoff_new (thread), 0 };
+    s_relay_start (&relay, NULL);
+    while (__atomic_load_n (&relay.received, __ATOMIC_ACQUIRE) < S_HANDOFFS)
+        usleep (1000);
+    zmtp_io_handoff_destroy (&relay.handoff);
+    assert (relay.handoff == NULL);
+    zmtp_io_thread_t *producer = zmtp_io_thread_new ();
+    relay = (struct s_relay) { zmtp_io_handoff_new (thread), 0 };
+    zmtp_io_thread_post (producer, s_relay_start, &relay, NULL);
+    while (__atomic_load_n (&relay.received, __ATOMIC_ACQUIRE) < S_HANDOFFS)
+        usleep (1000);
+    zmtp_io_thread_destroy (&producer);
+    zmtp_io_handoff_destroy (&relay.handoff);
+    zmtp_io_thread_destroy (&thread);
+
+#if defined (__UTYPE_LINUX)
+    //  Threads can be pinned to any CPU we may run on
+    thread = zmtp_io_thread_new ();
+    cpu_set_t cpus;
+    rc = sched_getaffinity (0, sizeof cpus, &cpus);
+    assert (rc == 0);
+    int cpu = 0;
+    while (!CPU_ISSET (cpu, &cpus))
+        cpu++;
+    rc = zmtp_io_thread_set_cpu (thread, cpu);
+    assert (rc == 0);
+    rc = zmtp_io_thread_set_cpu (thread, CPU_SETSIZE);
+    assert (rc == -1 && errno == EINVAL);
+    const int cpu_list [] = { cpu, CPU_SETSIZE };
+    rc = zmtp_io_thread_set_cpus (thread, cpu_list, 1);
+    assert (rc == 0);
+    rc = zmtp_io_thread_set_cpus (thread, cpu_list, 2);
+    assert (rc == -1 && errno == EINVAL);
+    zmtp_io_thread_destroy (&thread);
+#endif
+    //  @end
+    printf ("OK\n");
+}
@@ -17,23 +17,35 @@ struct zmtp_ipc_endpoint {
     struct sockaddr_un sockaddr;
 };
 
+//  Return the socket path as given, less the '@' of abstract names
+
+static inline const char *
+s_path (zmtp_ipc_endpoint_t *self)
+{
+    return self->sockaddr.sun_path [0] == '\0'
+        ? self->sockaddr.sun_path + 1
+        : self->sockaddr.sun_path;
+}
+
 zmtp_ipc_endpoint_t *
 zmtp_ipc_endpoint_new (const char *path)
 {
     zmtp_ipc_endpoint_t *self =
-        (zmtp_ipc_endpoint_t *) zmalloc (sizeof *self);
+        (zmtp_ipc_endpoint_t *) zmtp_zmalloc (sizeof *self);
     if (!self)
         return NULL;
 
     //  Initialize base class
     self->base = (zmtp_endpoint_t) {
         .connect = (int (*) (zmtp_endpoint_t *)) zmtp_ipc_endpoint_connect,
+        .connect_timeout = (int (*) (zmtp_endpoint_t *, int))
+            zmtp_ipc_endpoint_connect_timeout,
         .listen = (int (*) (zmtp_endpoint_t *)) zmtp_ipc_endpoint_listen,
         .destroy = (void (*) (zmtp_endpoint_t **)) zmtp_ipc_endpoint_destroy,
     };
 
     if (strlen (path) >= sizeof self->sockaddr.sun_path) {
-        free (self);
+        zmtp_free (self);
         return NULL;
     }
 
@@ -55,7 +67,7 @@ zmtp_ipc_endpoint_destroy (zmtp_ipc_endpoint_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_ipc_endpoint_t *self = *self_p;
-        free (self);
+        zmtp_free (self);
         *self_p = NULL;
     }
 }
@@ -80,13 +92,23 @@ zmtp_ipc_endpoint_connect (zmtp_ipc_endpoint_t *self)
     //  Connect the socket
     const int rc = connect (s, (const struct sockaddr *) &self->sockaddr, addrlen);
     if (rc == -1) {
+        ZMTP_TRACE3 (ipc_connect, -1, errno, s_path (self));
         close (s);
         return -1;
     }
-
+    ZMTP_TRACE3 (ipc_connect, s, 0, s_path (self));
     return s;
 }
 
+//  Local connects complete or fail without waiting for the network, so the
+//  timeout is not needed here.
+
+int
+zmtp_ipc_endpoint_connect_timeout (zmtp_ipc_endpoint_t *self, int timeout)
+{
+    return zmtp_ipc_endpoint_connect (self);
+}
+
 int
 zmtp_ipc_endpoint_listen (zmtp_ipc_endpoint_t *self)
 {
@@ -108,6 +130,7 @@ zmtp_ipc_endpoint_listen (zmtp_ipc_endpoint_t *self)
         if (rc == 0)
             rc = accept (s, NULL, NULL);
     }
+    ZMTP_TRACE3 (ipc_accept, rc, rc == -1? errno: 0, s_path (self));
     close (s);
     return rc;
 }
@@ -0,0 +1,476 @@
+/*  =========================================================================
+    zmtp_metrics - counters published in shared memory
+
+    A publisher thread copies the counters of every registered socket into
+    a POSIX shared memory segment each interval, so tools such as zmtp_top
+    can watch a running process without it doing anything. Records are
+    seqlocks: one writer, any number of readers in any process, and no
+    reader can slow the writer down.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//  Msecs between updates when publishing is started by ZMTP_METRICS
+
+#define ZMTP_METRICS_INTERVAL   100
+
+//  A registered socket
+
+typedef struct {
+    uint64_t id;                //  Serial number, 0 if slot is free
+    char endpoint [ZMTP_METRICS_ENDPOINT];
+    zmtp_metrics_fn *sample;    //  Fills in the counters
+    void *arg;                  //  Argument for sample
+} s_source_t;
+
+//  Publisher state; the mutex guards all of it, and publishing runs with
+//  it held, so a socket is never sampled after it is removed
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t s_env_once = PTHREAD_ONCE_INIT;
+static zmtp_metrics_segment_t *s_segment = NULL;
+static char *s_name = NULL;
+static int s_interval = 0;
+static bool s_stopping = false;
+static pthread_t s_thread;
+static uint64_t s_next_id = 0;
+static s_source_t s_sources [ZMTP_METRICS_SLOTS];
+
+static int
+    s_create (const char *name);
+static void *
+    s_publisher (void *arg);
+static void
+    s_publish (size_t slot);
+static void
+    s_copy_words (void *dest, const void *src, size_t size,
+                  int load_order, int store_order);
+static void
+    s_start_from_env (void);
+static void
+    s_stop_at_exit (void);
+
+
+//  --------------------------------------------------------------------------
+//  Create shared memory segment name, e.g. "/zmtp-myapp", and start a
+//  thread that publishes the counters of every registered socket into it
+//  each interval msecs. NULL names it "/zmtp-<pid>". Returns 0, or -1 if
+//  already publishing (EALREADY) or the segment cannot be created.
+
+int
+zmtp_metrics_start (const char *name, int interval)
+{
+    assert (interval > 0);
+    char default_name [32];
+    if (!name) {
+        snprintf (default_name, sizeof default_name,
+            "/zmtp-%ld", (long) getpid ());
+        name = default_name;
+    }
+    pthread_mutex_lock (&s_mutex);
+    if (s_segment) {
+        pthread_mutex_unlock (&s_mutex);
+        errno = EALREADY;
+        return -1;
+    }
+    s_interval = interval;
+    if (s_create (name) == -1) {
+        pthread_mutex_unlock (&s_mutex);
+        return -1;
+    }
+    s_name = zmtp_strdup (name);
+    assert (s_name);
+    s_stopping = false;
+    const int rc = pthread_create (&s_thread, NULL, s_publisher, NULL);
+    assert (rc == 0);
+    pthread_mutex_unlock (&s_mutex);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop publishing and remove the segment. Returns 0, or -1 if not
+//  publishing.
+
+int
+zmtp_metrics_stop (void)
+{
+    pthread_mutex_lock (&s_mutex);
+    if (!s_segment || s_stopping) {
+        pthread_mutex_unlock (&s_mutex);
+        return -1;
+    }
+    s_stopping = true;
+    pthread_cond_signal (&s_cond);
+    pthread_mutex_unlock (&s_mutex);
+    pthread_join (s_thread, NULL);
+
+    pthread_mutex_lock (&s_mutex);
+    munmap (s_segment, sizeof *s_segment);
+    s_segment = NULL;
+    shm_unlink (s_name);
+    zmtp_free (s_name);
+    s_name = NULL;
+    memset (s_sources, 0, sizeof s_sources);
+    pthread_mutex_unlock (&s_mutex);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Register a socket to publish, starting to publish first if environment
+//  variable ZMTP_METRICS names a segment ("1" for the default name).
+//  Returns the socket's slot, or -1 if not publishing or all slots are
+//  taken. sample must stay callable until the slot is removed.
+
+int
+zmtp_metrics_add (const char *endpoint, zmtp_metrics_fn *sample, void *arg)
+{
+    assert (endpoint);
+    assert (sample);
+    pthread_once (&s_env_once, s_start_from_env);
+
+    pthread_mutex_lock (&s_mutex);
+    int slot = -1;
+    if (s_segment && !s_stopping) {
+        for (size_t i = 0; i < ZMTP_METRICS_SLOTS; i++)
+            if (s_sources [i].id == 0) {
+                slot = (int) i;
+                break;
+            }
+        if (slot == -1)
+            ZMTP_STAT_ADD (s_segment->unpublished, 1);
+        else {
+            s_source_t *source = &s_sources [slot];
+            source->id = ++s_next_id;
+            snprintf (source->endpoint, sizeof source->endpoint,
+                "%s", endpoint);
+            source->sample = sample;
+            source->arg = arg;
+            s_publish (slot);
+        }
+    }
+    pthread_mutex_unlock (&s_mutex);
+    return slot;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Stop publishing a socket; sample is not called once this returns.
+//  Does nothing if slot is -1.
+
+void
+zmtp_metrics_remove (int slot)
+{
+    if (slot == -1)
+        return;
+    assert (slot < ZMTP_METRICS_SLOTS);
+    pthread_mutex_lock (&s_mutex);
+    memset (&s_sources [slot], 0, sizeof s_sources [slot]);
+    if (s_segment)
+        s_publish (slot);       //  Readers see the slot free at once
+    pthread_mutex_unlock (&s_mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Map segment name read-only, checking its layout. Returns NULL with
+//  errno set if it does not exist or is not a metrics segment. Release
+//  with zmtp_metrics_close.
+
+zmtp_metrics_segment_t *
+zmtp_metrics_open (const char *name)
+{
+    assert (name);
+    const int fd = shm_open (name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat (fd, &st) == -1
+    ||  (size_t) st.st_size != sizeof (zmtp_metrics_segment_t)) {
+        close (fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    zmtp_metrics_segment_t *segment = (zmtp_metrics_segment_t *) mmap (
+        NULL, sizeof *segment, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (segment == MAP_FAILED)
+        return NULL;
+    //  The publisher writes the magic last
+    if (__atomic_load_n (&segment->magic, __ATOMIC_ACQUIRE)
+            != ZMTP_METRICS_MAGIC
+    ||  segment->version != ZMTP_METRICS_VERSION) {
+        munmap (segment, sizeof *segment);
+        errno = EPROTO;
+        return NULL;
+    }
+    return segment;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Unmap a segment mapped by zmtp_metrics_open
+
+void
+zmtp_metrics_close (zmtp_metrics_segment_t **segment_p)
+{
+    assert (segment_p);
+    if (*segment_p) {
+        munmap (*segment_p, sizeof **segment_p);
+        *segment_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take a consistent copy of a record while the publisher may be writing
+//  it. Returns 0, or -1 if the slot is free.
+
+int
+zmtp_metrics_read (zmtp_metrics_segment_t *segment, size_t slot,
+                   zmtp_metrics_record_t *record)
+{
+    assert (segment);
+    assert (slot < ZMTP_METRICS_SLOTS);
+    assert (record);
+    const zmtp_metrics_record_t *source = &segment->records [slot];
+    while (true) {
+        const uint64_t seq = __atomic_load_n (&source->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield ();     //  Writer is halfway through
+            continue;
+        }
+        s_copy_words (record, source, sizeof *record,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+        if (__atomic_load_n (&source->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+    return record->id? 0: -1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Create and map the segment, replacing one left behind by a process
+//  that died. Called with the mutex held.
+
+static int
+s_create (const char *name)
+{
+    int fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1 && errno == EEXIST) {
+        zmtp_metrics_segment_t *stale = zmtp_metrics_open (name);
+        const bool dead = !stale
+            || (kill ((pid_t) stale->pid, 0) == -1 && errno == ESRCH);
+        zmtp_metrics_close (&stale);
+        if (!dead) {
+            errno = EEXIST;
+            return -1;
+        }
+        shm_unlink (name);
+        fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd == -1)
+        return -1;
+    if (ftruncate (fd, sizeof *s_segment) == -1) {
+        close (fd);
+        shm_unlink (name);
+        return -1;
+    }
+    void *map = mmap (NULL, sizeof *s_segment,
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        shm_unlink (name);
+        return -1;
+    }
+    s_segment = (zmtp_metrics_segment_t *) map;
+    s_segment->version = ZMTP_METRICS_VERSION;
+    s_segment->pid = (int64_t) getpid ();
+    s_segment->interval = s_interval;
+    __atomic_store_n (&s_segment->magic, ZMTP_METRICS_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Publisher thread: update every registered socket's record each interval
+
+static void *
+s_publisher (void *arg)
+{
+    pthread_mutex_lock (&s_mutex);
+    while (!s_stopping) {
+        for (size_t slot = 0; slot < ZMTP_METRICS_SLOTS; slot++)
+            if (s_sources [slot].id)
+                s_publish (slot);
+        __atomic_store_n (&s_segment->updated,
+            (uint64_t) zmtp_clock_mono (), __ATOMIC_RELEASE);
+
+        struct timespec deadline;
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += s_interval / 1000;
+        deadline.tv_nsec += (long) (s_interval % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!s_stopping
+        &&  pthread_cond_timedwait (&s_cond, &s_mutex, &deadline) == 0);
+    }
+    pthread_mutex_unlock (&s_mutex);
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Rewrite a slot's record from its source, or as free if it has none.
+//  Called with the mutex held.
+
+static void
+s_publish (size_t slot)
+{
+    const s_source_t *source = &s_sources [slot];
+    zmtp_metrics_record_t record = { .id = source->id };
+    if (source->id) {
+        memcpy (record.endpoint, source->endpoint, sizeof record.endpoint);
+        source->sample (source->arg, &record);
+    }
+    zmtp_metrics_record_t *target = &s_segment->records [slot];
+    const uint64_t seq = target->seq;
+    record.seq = seq + 2;
+    __atomic_store_n (&target->seq, seq + 1, __ATOMIC_RELAXED);
+    s_copy_words ((uint64_t *) target + 1, (uint64_t *) &record + 1,
+        sizeof record - sizeof record.seq, __ATOMIC_RELAXED, __ATOMIC_RELEASE);
+    __atomic_store_n (&target->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Copy size bytes a word at a time, as a reader and writer of a seqlock
+//  may do together. The reader loads with acquire and the writer stores
+//  with release, so neither needs a fence around the copy; on x86 all of
+//  these are plain moves.
+
+static void
+s_copy_words (void *dest, const void *src, size_t size,
+              int load_order, int store_order)
+{
+    uint64_t *to = (uint64_t *) dest;
+    const uint64_t *from = (const uint64_t *) src;
+    for (size_t i = 0; i < size / sizeof (uint64_t); i++)
+        __atomic_store_n (&to [i],
+            __atomic_load_n (&from [i], load_order), store_order);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Start publishing if ZMTP_METRICS asks for it, so operators can turn it
+//  on without changing the application
+
+static void
+s_start_from_env (void)
+{
+    const char *name = getenv ("ZMTP_METRICS");
+    if (!name || *name == '\0' || streq (name, "0"))
+        return;
+    if (streq (name, "1"))
+        name = NULL;
+    if (zmtp_metrics_start (name, ZMTP_METRICS_INTERVAL) == 0)
+        atexit (s_stop_at_exit);
+}
+
+static void
+s_stop_at_exit (void)
+{
+    zmtp_metrics_stop ();
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+static void
+s_test_sample (void *arg, zmtp_metrics_record_t *record)
+{
+    const uint64_t value =
+        __atomic_load_n ((uint64_t *) arg, __ATOMIC_RELAXED);
+    record->sndq = value;
+    record->rcvq = value;
+    record->stats.frames_out = value;
+}
+
+void
+zmtp_metrics_test (bool verbose)
+{
+    printf (" * zmtp_metrics: ");
+    //  @selftest
+    char name [32];
+    snprintf (name, sizeof name, "/zmtp-selftest-%ld", (long) getpid ());
+    assert (zmtp_metrics_open (name) == NULL);
+    assert (zmtp_metrics_stop () == -1);
+    uint64_t value = 0;
+    //  Sockets are not published unless publishing was started
+    if (!getenv ("ZMTP_METRICS"))
+        assert (zmtp_metrics_add ("tcp://a:1", s_test_sample, &value) == -1);
+
+    int rc = zmtp_metrics_start (name, 1);
+    assert (rc == 0);
+    rc = zmtp_metrics_start (name, 1);
+    assert (rc == -1 && errno == EALREADY);
+    zmtp_metrics_segment_t *segment = zmtp_metrics_open (name);
+    assert (segment);
+    assert (segment->pid == getpid ());
+
+    //  Records appear at once and follow the socket's counters
+    const int slot = zmtp_metrics_add ("tcp://a:1", s_test_sample, &value);
+    assert (slot >= 0);
+    zmtp_metrics_record_t record;
+    rc = zmtp_metrics_read (segment, slot, &record);
+    assert (rc == 0);
+    assert (streq (record.endpoint, "tcp://a:1"));
+    assert (record.sndq == 0);
+    for (uint64_t i = 1; i <= 1000; i++) {
+        __atomic_store_n (&value, i, __ATOMIC_RELAXED);
+        //  Whatever we catch, the fields belong to one update
+        rc = zmtp_metrics_read (segment, slot, &record);
+        assert (rc == 0);
+        assert (record.sndq == record.rcvq);
+        assert (record.sndq == record.stats.frames_out);
+        if (i % 100 == 0)
+            usleep (1000);
+    }
+    while (zmtp_metrics_read (segment, slot, &record) == 0
+        && record.sndq != 1000)
+        usleep (1000);
+    assert (record.sndq == 1000);
+
+    //  Removed sockets free their slot, and a new one gets a new id
+    const uint64_t id = record.id;
+    zmtp_metrics_remove (slot);
+    assert (zmtp_metrics_read (segment, slot, &record) == -1);
+    const int again = zmtp_metrics_add ("ipc://b", s_test_sample, &value);
+    assert (again == slot);
+    rc = zmtp_metrics_read (segment, slot, &record);
+    assert (rc == 0 && record.id > id);
+    zmtp_metrics_remove (again);
+
+    zmtp_metrics_close (&segment);
+    rc = zmtp_metrics_stop ();
+    assert (rc == 0);
+    assert (zmtp_metrics_open (name) == NULL);
+    //  @end
+    printf ("OK\n");
+}
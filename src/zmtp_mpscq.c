@@ -0,0 +1,178 @@
+/*  =========================================================================
+    zmtp_mpscq - lock-free multi-producer, single-consumer queue
+
+    Intrusive queue after Dmitry Vyukov's MPSC node-based design: a push is
+    one atomic exchange plus one store, a pop takes no atomic
+    read-modify-write at all. Producers never wait for each other or for
+    the consumer.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+
+//  --------------------------------------------------------------------------
+//  Initialize an empty queue
+
+void
+zmtp_mpscq_init (zmtp_mpscq_t *self)
+{
+    assert (self);
+    self->stub.next = NULL;
+    self->head = &self->stub;
+    self->tail = &self->stub;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append node; safe to call from any number of threads at once
+
+void
+zmtp_mpscq_push (zmtp_mpscq_t *self, zmtp_mpscq_node_t *node)
+{
+    assert (self);
+    assert (node);
+    __atomic_store_n (&node->next, NULL, __ATOMIC_RELAXED);
+    zmtp_mpscq_node_t *prev =
+        __atomic_exchange_n (&self->head, node, __ATOMIC_SEQ_CST);
+    //  Until this store the consumer sees the queue end at prev
+    __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove and return the oldest node, or NULL if the queue is empty or a
+//  producer is half-way through a push. Only one thread may pop.
+
+zmtp_mpscq_node_t *
+zmtp_mpscq_pop (zmtp_mpscq_t *self)
+{
+    assert (self);
+    zmtp_mpscq_node_t *tail = self->tail;
+    zmtp_mpscq_node_t *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &self->stub) {
+        if (next == NULL)
+            return NULL;
+        self->tail = next;
+        tail = next;
+        next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        self->tail = next;
+        return tail;
+    }
+    zmtp_mpscq_node_t *head = __atomic_load_n (&self->head, __ATOMIC_SEQ_CST);
+    if (tail != head)
+        return NULL;            //  Push in progress; try again later
+
+    //  Tail is the last node; put the stub behind it so it can be taken
+    zmtp_mpscq_push (self, &self->stub);
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        self->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return true if there is nothing to pop
+
+bool
+zmtp_mpscq_empty (zmtp_mpscq_t *self)
+{
+    assert (self);
+    return self->tail == &self->stub
+        && __atomic_load_n (&self->stub.next, __ATOMIC_SEQ_CST) == NULL
+        && __atomic_load_n (&self->head, __ATOMIC_SEQ_CST) == &self->stub;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define S_PRODUCERS 4
+#define S_ITEMS     100000
+
+struct s_item {
+    zmtp_mpscq_node_t node;
+    int producer;
+    int sequence;
+};
+
+struct s_producer_args {
+    zmtp_mpscq_t *queue;
+    int producer;
+    struct s_item *items;
+};
+
+static void *
+s_producer (void *arg)
+{
+    struct s_producer_args *args = (struct s_producer_args *) arg;
+    for (int i = 0; i < S_ITEMS; i++) {
+        args->items [i].producer = args->producer;
+        args->items [i].sequence = i;
+        zmtp_mpscq_push (args->queue, &args->items [i].node);
+    }
+    return NULL;
+}
+
+void
+zmtp_mpscq_test (bool verbose)
+{
+    printf (" * zmtp_mpscq: ");
+    //  @selftest
+    zmtp_mpscq_t queue;
+    zmtp_mpscq_init (&queue);
+    assert (zmtp_mpscq_empty (&queue));
+    assert (zmtp_mpscq_pop (&queue) == NULL);
+
+    //  Single thread keeps FIFO order
+    struct s_item items [3];
+    for (int i = 0; i < 3; i++) {
+        items [i].sequence = i;
+        zmtp_mpscq_push (&queue, &items [i].node);
+    }
+    assert (!zmtp_mpscq_empty (&queue));
+    for (int i = 0; i < 3; i++) {
+        struct s_item *item = (struct s_item *) zmtp_mpscq_pop (&queue);
+        assert (item && item->sequence == i);
+    }
+    assert (zmtp_mpscq_pop (&queue) == NULL);
+    assert (zmtp_mpscq_empty (&queue));
+
+    //  Concurrent producers; each producer's items arrive in order
+    pthread_t threads [S_PRODUCERS];
+    struct s_producer_args args [S_PRODUCERS];
+    for (int p = 0; p < S_PRODUCERS; p++) {
+        args [p] = (struct s_producer_args) {
+            &queue, p, (struct s_item *) malloc (S_ITEMS * sizeof (struct s_item))
+        };
+        pthread_create (&threads [p], NULL, s_producer, &args [p]);
+    }
+    int expected [S_PRODUCERS] = { 0 };
+    for (int received = 0; received < S_PRODUCERS * S_ITEMS; ) {
+        struct s_item *item = (struct s_item *) zmtp_mpscq_pop (&queue);
+        if (!item)
+            continue;
+        assert (item->sequence == expected [item->producer]);
+        expected [item->producer]++;
+        received++;
+    }
+    for (int p = 0; p < S_PRODUCERS; p++) {
+        pthread_join (threads [p], NULL);
+        free (args [p].items);
+    }
+    assert (zmtp_mpscq_pop (&queue) == NULL);
+    //  @end
+    printf ("OK\n");
+}
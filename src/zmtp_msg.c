@@ -11,6 +11,7 @@
 */
 
 #include "zmtp_classes.h"
+#include <sys/mman.h>
 
 
 
@@ -21,10 +22,10 @@
 zmtp_msg_t *
 zmtp_msg_new (byte flags, size_t size)
 {
-    zmtp_msg_t *self = (zmtp_msg_t *) zmalloc (sizeof *self);
+    zmtp_msg_t *self = (zmtp_msg_t *) zmtp_zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
     self->flags = flags;
-    self->data = (byte *) malloc (size);
+    self->data = (byte *) zmtp_malloc (size);
     assert (size == 0 || self->data);
     self->size = size;
     self->greedy = true;
@@ -34,13 +35,14 @@ zmtp_msg_new (byte flags, size_t size)
 
 //  --------------------------------------------------------------------------
 //  Constructor; takes ownership of data and frees it when destroying the
-//  message. Nullifies the data reference.
+//  message. data must come from the installed allocator. Nullifies the
+//  data reference.
 
 zmtp_msg_t *
 zmtp_msg_from_data (byte flags, byte **data_p, size_t size)
 {
     assert (data_p);
-    zmtp_msg_t *self = (zmtp_msg_t *) zmalloc (sizeof *self);
+    zmtp_msg_t *self = (zmtp_msg_t *) zmtp_zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
     self->flags = flags;
     self->data = *data_p;
@@ -58,7 +60,7 @@ zmtp_msg_from_data (byte flags, byte **data_p, size_t size)
 zmtp_msg_t *
 zmtp_msg_from_const_data (byte flags, void *data, size_t size)
 {
-    zmtp_msg_t *self = (zmtp_msg_t *) zmalloc (sizeof *self);
+    zmtp_msg_t *self = (zmtp_msg_t *) zmtp_zmalloc (sizeof *self);
     assert (self);              //  For now, memory exhaustion is fatal
     self->flags = flags;
     self->data = data;
@@ -69,7 +71,59 @@ zmtp_msg_from_const_data (byte flags, void *data, size_t size)
 
 
 //  --------------------------------------------------------------------------
-//  Destructor; frees message data and destroys the message
+//  Constructor that maps part of a file read-only. The mapping starts on
+//  the page holding offset and the body points into it, so any offset
+//  works.
+
+zmtp_msg_t *
+zmtp_msg_from_file (byte flags, int fd, off_t offset, size_t size)
+{
+    if (offset < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    byte *data = NULL;
+    if (size) {
+        const off_t page = (off_t) sysconf (_SC_PAGESIZE);
+        const size_t skip = (size_t) (offset % page);
+        //  A private read-only mapping shares the page cache all the
+        //  same, and kernels before 6.7 refuse shared ones of sealed
+        //  memfds
+        void *mapping = mmap (NULL, skip + size, PROT_READ, MAP_PRIVATE,
+            fd, offset - (off_t) skip);
+        if (mapping == MAP_FAILED)
+            return NULL;
+        data = (byte *) mapping + skip;
+    }
+    zmtp_msg_t *self = (zmtp_msg_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->flags = flags;
+    self->data = data;
+    self->size = size;
+    self->mapped = size > 0;
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a copy of the message; the copy owns its own data buffer
+
+zmtp_msg_t *
+zmtp_msg_dup (zmtp_msg_t *self)
+{
+    assert (self);
+    zmtp_msg_t *copy = zmtp_msg_new (self->flags, self->size);
+    if (self->size)
+        memcpy (copy->data, self->data, self->size);
+    copy->timestamp = self->timestamp;
+    return copy;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; frees message data and destroys the message. A message a
+//  channel still holds, such as a body the kernel is sending from, is
+//  only let go; the last holder destroys it.
 
 void
 zmtp_msg_destroy (zmtp_msg_t **self_p)
@@ -77,9 +131,23 @@ zmtp_msg_destroy (zmtp_msg_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_msg_t *self = *self_p;
+        //  Only holders add holders, so a sole holder needs no atomic
+        if (__atomic_load_n (&self->refs, __ATOMIC_ACQUIRE)
+        &&  __atomic_fetch_sub (&self->refs, 1, __ATOMIC_ACQ_REL)) {
+            *self_p = NULL;
+            return;
+        }
+        ZMTP_TRACE2 (msg_destroy, self, self->size);
         if (self->greedy)
-            free (self->data);
-        free (self);
+            zmtp_free (self->data);
+        else
+        if (self->mapped) {
+            //  The mapping starts on the page holding the body
+            const uintptr_t page = (uintptr_t) sysconf (_SC_PAGESIZE);
+            const uintptr_t skip = (uintptr_t) self->data % page;
+            munmap (self->data - skip, skip + self->size);
+        }
+        zmtp_free (self);
         *self_p = NULL;
     }
 }
@@ -116,6 +184,18 @@ zmtp_msg_size (zmtp_msg_t *self)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Return the time the kernel received the message, in nanoseconds since
+//  the epoch, or 0 if unknown
+
+int64_t
+zmtp_msg_timestamp (zmtp_msg_t *self)
+{
+    assert (self);
+    return self->timestamp;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Selftest
 
@@ -129,8 +209,38 @@ zmtp_msg_test (bool verbose)
     assert (zmtp_msg_flags (msg) == 0);
     assert (zmtp_msg_size (msg) == 6);
     assert (memcmp (zmtp_msg_data (msg), "hello", 6) == 0);
+    assert (zmtp_msg_timestamp (msg) == 0);
+    msg->timestamp = 1;
+    zmtp_msg_t *copy = zmtp_msg_dup (msg);
+    assert (copy);
+    assert (zmtp_msg_data (copy) != zmtp_msg_data (msg));
+    assert (zmtp_msg_size (copy) == 6);
+    assert (memcmp (zmtp_msg_data (copy), "hello", 6) == 0);
+    assert (zmtp_msg_timestamp (copy) == 1);
+    zmtp_msg_destroy (&copy);
     zmtp_msg_destroy (&msg);
     assert (msg == NULL);
+
+    //  A mapped file body need not start on a page boundary
+    char path [] = "/tmp/zmtp_msg_XXXXXX";
+    const int fd = mkstemp (path);
+    assert (fd != -1);
+    unlink (path);
+    const off_t offset = 5000;
+    ssize_t rc = pwrite (fd, "mapped", 6, offset);
+    assert (rc == 6);
+    msg = zmtp_msg_from_file (ZMTP_MSG_MORE, fd, offset, 6);
+    assert (msg);
+    close (fd);
+    assert (zmtp_msg_flags (msg) == ZMTP_MSG_MORE);
+    assert (zmtp_msg_size (msg) == 6);
+    assert (memcmp (zmtp_msg_data (msg), "mapped", 6) == 0);
+    copy = zmtp_msg_dup (msg);
+    zmtp_msg_destroy (&msg);
+    assert (memcmp (zmtp_msg_data (copy), "mapped", 6) == 0);
+    zmtp_msg_destroy (&copy);
+    msg = zmtp_msg_from_file (0, -1, 0, 6);
+    assert (msg == NULL && errno == EBADF);
     //  @end
     printf ("OK\n");
 }
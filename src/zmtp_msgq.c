@@ -0,0 +1,271 @@
+/*  =========================================================================
+    zmtp_msgq - FIFO queue of messages
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Initial number of slots in the ring; the ring doubles when full
+
+#define ZMTP_MSGQ_INITIAL_SLOTS 16
+
+//  A queued message and when it was queued, if the owner said
+
+typedef struct {
+    zmtp_msg_t *msg;
+    int64_t stamp;
+} s_slot_t;
+
+//  Structure of our class
+
+struct _zmtp_msgq_t {
+    s_slot_t *slots;            //  Ring of message references
+    size_t capacity;            //  Number of slots, power of two
+    size_t head;                //  Index of first message
+    size_t size;                //  Number of queued messages
+};
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_msgq_t *
+zmtp_msgq_new (void)
+{
+    zmtp_msgq_t *self = (zmtp_msgq_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->capacity = ZMTP_MSGQ_INITIAL_SLOTS;
+    self->slots =
+        (s_slot_t *) zmtp_zmalloc (self->capacity * sizeof *self->slots);
+    assert (self->slots);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; destroys all queued messages
+
+void
+zmtp_msgq_destroy (zmtp_msgq_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_msgq_t *self = *self_p;
+        while (self->size) {
+            zmtp_msg_t *msg = zmtp_msgq_pop (self);
+            zmtp_msg_destroy (&msg);
+        }
+        zmtp_free (self->slots);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append message to the tail of the queue; takes ownership of the
+//  message and nullifies the reference.
+
+void
+zmtp_msgq_push (zmtp_msgq_t *self, zmtp_msg_t **msg_p)
+{
+    zmtp_msgq_push_stamped (self, msg_p, 0);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Same as zmtp_msgq_push, keeping a timestamp with the message
+
+void
+zmtp_msgq_push_stamped (zmtp_msgq_t *self, zmtp_msg_t **msg_p, int64_t stamp)
+{
+    assert (self);
+    assert (msg_p && *msg_p);
+
+    if (self->size == self->capacity) {
+        //  Grow the ring, unwrapping it into the new slots
+        const size_t capacity = self->capacity * 2;
+        s_slot_t *slots = (s_slot_t *) zmtp_zmalloc (capacity * sizeof *slots);
+        assert (slots);
+        for (size_t i = 0; i < self->size; i++)
+            slots [i] = self->slots [(self->head + i) & (self->capacity - 1)];
+        zmtp_free (self->slots);
+        self->slots = slots;
+        self->capacity = capacity;
+        self->head = 0;
+    }
+    self->slots [(self->head + self->size) & (self->capacity - 1)] =
+        (s_slot_t) { .msg = *msg_p, .stamp = stamp };
+    self->size++;
+    *msg_p = NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove and return message at the head of the queue, or NULL if empty
+
+zmtp_msg_t *
+zmtp_msgq_pop (zmtp_msgq_t *self)
+{
+    assert (self);
+    if (self->size == 0)
+        return NULL;
+    zmtp_msg_t *msg = self->slots [self->head].msg;
+    self->head = (self->head + 1) & (self->capacity - 1);
+    self->size--;
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return message at the head of the queue without removing it
+
+zmtp_msg_t *
+zmtp_msgq_first (zmtp_msgq_t *self)
+{
+    assert (self);
+    return self->size? self->slots [self->head].msg: NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return timestamp of the message at the head of the queue, 0 if none
+
+int64_t
+zmtp_msgq_first_stamp (zmtp_msgq_t *self)
+{
+    assert (self);
+    return self->size? self->slots [self->head].stamp: 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return message at the given position from the head, or NULL
+
+zmtp_msg_t *
+zmtp_msgq_at (zmtp_msgq_t *self, size_t index)
+{
+    assert (self);
+    if (index >= self->size)
+        return NULL;
+    return self->slots [(self->head + index) & (self->capacity - 1)].msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove and return message at the given position from the head
+
+zmtp_msg_t *
+zmtp_msgq_remove (zmtp_msgq_t *self, size_t index)
+{
+    assert (self);
+    if (index >= self->size)
+        return NULL;
+    const size_t mask = self->capacity - 1;
+    zmtp_msg_t *msg = self->slots [(self->head + index) & mask].msg;
+    //  Close the gap by moving later messages one slot forward
+    for (size_t i = index + 1; i < self->size; i++)
+        self->slots [(self->head + i - 1) & mask] =
+            self->slots [(self->head + i) & mask];
+    self->size--;
+    return msg;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of queued messages
+
+size_t
+zmtp_msgq_size (zmtp_msgq_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_msgq_test (bool verbose)
+{
+    printf (" * zmtp_msgq: ");
+    //  @selftest
+    zmtp_msgq_t *msgq = zmtp_msgq_new ();
+    assert (msgq);
+    assert (zmtp_msgq_size (msgq) == 0);
+    assert (zmtp_msgq_pop (msgq) == NULL);
+
+    //  Push enough messages to force the ring to wrap and grow
+    for (int round = 0; round < 3; round++) {
+        for (size_t i = 0; i < 40; i++) {
+            zmtp_msg_t *msg = zmtp_msg_new (0, sizeof i);
+            memcpy (zmtp_msg_data (msg), &i, sizeof i);
+            zmtp_msgq_push (msgq, &msg);
+            assert (msg == NULL);
+        }
+        assert (zmtp_msgq_size (msgq) == 40);
+        for (size_t i = 0; i < 30; i++) {
+            zmtp_msg_t *msg = zmtp_msgq_pop (msgq);
+            assert (msg);
+            assert (memcmp (zmtp_msg_data (msg), &i, sizeof i) == 0);
+            zmtp_msg_destroy (&msg);
+        }
+        assert (zmtp_msgq_size (msgq) == 10);
+        size_t expected = 30;
+        assert (memcmp (zmtp_msg_data (zmtp_msgq_first (msgq)),
+            &expected, sizeof expected) == 0);
+        while (zmtp_msgq_size (msgq)) {
+            zmtp_msg_t *msg = zmtp_msgq_pop (msgq);
+            zmtp_msg_destroy (&msg);
+        }
+    }
+    //  Remove from the middle keeps the order of the rest
+    for (size_t i = 0; i < 5; i++) {
+        zmtp_msg_t *msg = zmtp_msg_new (0, sizeof i);
+        memcpy (zmtp_msg_data (msg), &i, sizeof i);
+        zmtp_msgq_push (msgq, &msg);
+    }
+    zmtp_msg_t *removed = zmtp_msgq_remove (msgq, 2);
+    assert (removed);
+    zmtp_msg_destroy (&removed);
+    assert (zmtp_msgq_remove (msgq, 4) == NULL);
+    const size_t remaining [] = { 0, 1, 3, 4 };
+    for (size_t i = 0; i < 4; i++)
+        assert (memcmp (zmtp_msg_data (zmtp_msgq_at (msgq, i)),
+            &remaining [i], sizeof remaining [i]) == 0);
+    assert (zmtp_msgq_at (msgq, 4) == NULL);
+    while (zmtp_msgq_size (msgq)) {
+        zmtp_msg_t *msg = zmtp_msgq_pop (msgq);
+        zmtp_msg_destroy (&msg);
+    }
+
+    //  Stamps stay with their messages as the queue moves and grows
+    assert (zmtp_msgq_first_stamp (msgq) == 0);
+    for (int64_t stamp = 1; stamp <= 40; stamp++) {
+        zmtp_msg_t *msg = zmtp_msg_new (0, 0);
+        zmtp_msgq_push_stamped (msgq, &msg, stamp);
+    }
+    removed = zmtp_msgq_remove (msgq, 0);
+    zmtp_msg_destroy (&removed);
+    for (int64_t stamp = 2; stamp <= 40; stamp++) {
+        assert (zmtp_msgq_first_stamp (msgq) == stamp);
+        zmtp_msg_t *msg = zmtp_msgq_pop (msgq);
+        zmtp_msg_destroy (&msg);
+    }
+
+    //  Destructor releases messages still queued
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "hello", 5);
+    zmtp_msgq_push (msgq, &msg);
+    zmtp_msgq_destroy (&msgq);
+    assert (msgq == NULL);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,263 @@
+/*  =========================================================================
+    zmtp_multipart - multipart message class
+
+    All parts of a message share one buffer, so an envelope of routing
+    frames plus a body costs two allocations whatever the number of
+    parts, and a channel writes or reads the whole message in one go.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Room made for parts and bytes when the message first grows
+
+#define ZMTP_MULTIPART_MIN_PARTS    8
+#define ZMTP_MULTIPART_MIN_SIZE     256
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; creates a message with no parts
+
+zmtp_multipart_t *
+zmtp_multipart_new (void)
+{
+    zmtp_multipart_t *self =
+        (zmtp_multipart_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor
+
+void
+zmtp_multipart_destroy (zmtp_multipart_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_multipart_t *self = *self_p;
+        zmtp_free (self->data);
+        zmtp_free (self->offsets);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append a part holding a copy of size bytes of data
+
+int
+zmtp_multipart_append (zmtp_multipart_t *self,
+                       const void *data, size_t size)
+{
+    assert (self);
+    assert (data || size == 0);
+    byte *body = zmtp_multipart_add (self, size);
+    if (!body)
+        return -1;
+    if (size)
+        memcpy (body, data, size);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Append a part of size bytes and return where to write its body. Both
+//  buffers at least double when they grow, so adding parts costs
+//  amortized constant time.
+
+byte *
+zmtp_multipart_add (zmtp_multipart_t *self, size_t size)
+{
+    assert (self);
+    if (self->parts + 1 > self->max_parts) {
+        const size_t max_parts = self->max_parts
+            ? self->max_parts * 2: ZMTP_MULTIPART_MIN_PARTS;
+        size_t *offsets = (size_t *) zmtp_realloc (
+            self->offsets, (max_parts + 1) * sizeof *offsets);
+        if (!offsets) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (!self->offsets)
+            offsets [0] = 0;
+        self->offsets = offsets;
+        self->max_parts = max_parts;
+    }
+    if (size > SIZE_MAX - self->size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (self->size + size > self->capacity || !self->data) {
+        size_t capacity = self->capacity
+            ? self->capacity: ZMTP_MULTIPART_MIN_SIZE;
+        while (capacity < self->size + size)
+            capacity = capacity > SIZE_MAX / 2
+                ? self->size + size: capacity * 2;
+        byte *data = (byte *) zmtp_realloc (self->data, capacity);
+        if (!data) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        self->data = data;
+        self->capacity = capacity;
+    }
+    byte *body = self->data + self->size;
+    self->size += size;
+    self->offsets [++self->parts] = self->size;
+    return body;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Remove all parts, keeping the memory for the next message
+
+void
+zmtp_multipart_reset (zmtp_multipart_t *self)
+{
+    assert (self);
+    self->size = 0;
+    self->parts = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of parts
+
+size_t
+zmtp_multipart_parts (zmtp_multipart_t *self)
+{
+    assert (self);
+    return self->parts;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return body of part index
+
+byte *
+zmtp_multipart_part_data (zmtp_multipart_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->parts);
+    return self->data + self->offsets [index];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return size of part index
+
+size_t
+zmtp_multipart_part_size (zmtp_multipart_t *self, size_t index)
+{
+    assert (self);
+    assert (index < self->parts);
+    return self->offsets [index + 1] - self->offsets [index];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the bodies of all parts, back to back
+
+byte *
+zmtp_multipart_data (zmtp_multipart_t *self)
+{
+    assert (self);
+    return self->data;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the total size of all parts
+
+size_t
+zmtp_multipart_size (zmtp_multipart_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return where each part starts, followed by the total size
+
+const size_t *
+zmtp_multipart_offsets (zmtp_multipart_t *self)
+{
+    assert (self);
+    static const size_t empty [1] = { 0 };
+    return self->offsets? self->offsets: empty;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+void
+zmtp_multipart_test (bool verbose)
+{
+    printf (" * zmtp_multipart: ");
+    //  @selftest
+    zmtp_multipart_t *multipart = zmtp_multipart_new ();
+    assert (multipart);
+    assert (zmtp_multipart_parts (multipart) == 0);
+    assert (zmtp_multipart_size (multipart) == 0);
+    assert (zmtp_multipart_offsets (multipart) [0] == 0);
+
+    //  A routing envelope, an empty delimiter and a body
+    int rc = zmtp_multipart_append (multipart, "peer", 4);
+    assert (rc == 0);
+    rc = zmtp_multipart_append (multipart, NULL, 0);
+    assert (rc == 0);
+    rc = zmtp_multipart_append (multipart, "hello", 5);
+    assert (rc == 0);
+    assert (zmtp_multipart_parts (multipart) == 3);
+    assert (zmtp_multipart_size (multipart) == 9);
+    assert (memcmp (zmtp_multipart_data (multipart), "peerhello", 9) == 0);
+    const size_t *offsets = zmtp_multipart_offsets (multipart);
+    assert (offsets [0] == 0 && offsets [1] == 4);
+    assert (offsets [2] == 4 && offsets [3] == 9);
+    assert (zmtp_multipart_part_size (multipart, 1) == 0);
+    assert (zmtp_multipart_part_size (multipart, 2) == 5);
+    assert (memcmp (zmtp_multipart_part_data (multipart, 2), "hello", 5)
+        == 0);
+
+    //  Growing keeps the parts already added
+    byte *body = zmtp_multipart_add (multipart, 100000);
+    assert (body);
+    memset (body, 'x', 100000);
+    for (size_t i = 0; i < 100; i++) {
+        rc = zmtp_multipart_append (multipart, &i, sizeof i);
+        assert (rc == 0);
+    }
+    assert (zmtp_multipart_parts (multipart) == 104);
+    assert (memcmp (zmtp_multipart_part_data (multipart, 0), "peer", 4)
+        == 0);
+    assert (zmtp_multipart_part_data (multipart, 3) [99999] == 'x');
+    size_t last;
+    memcpy (&last, zmtp_multipart_part_data (multipart, 103), sizeof last);
+    assert (last == 99);
+
+    //  Reset keeps the memory
+    const byte *data = zmtp_multipart_data (multipart);
+    zmtp_multipart_reset (multipart);
+    assert (zmtp_multipart_parts (multipart) == 0);
+    rc = zmtp_multipart_append (multipart, "again", 5);
+    assert (rc == 0);
+    assert (zmtp_multipart_data (multipart) == data);
+    assert (zmtp_multipart_part_size (multipart, 0) == 5);
+
+    zmtp_multipart_destroy (&multipart);
+    assert (multipart == NULL);
+    //  @end
+    printf ("OK\n");
+}
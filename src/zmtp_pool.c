@@ -0,0 +1,531 @@
+/*  =========================================================================
+    zmtp_pool - pool of connected channels
+
+    A client that opens a channel per request pays a connect and the
+    ZMTP handshake, several round trips, before its first byte. The pool
+    pays them ahead of time on a background thread: it keeps size channels
+    to one endpoint connected, hands idle ones out from a stack, and
+    replaces those that come back broken or break while idle.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+#include <poll.h>
+#include <sys/un.h>
+
+//  Defaults, msecs
+
+#define ZMTP_POOL_CONNECT_TIMEOUT       5000
+#define ZMTP_POOL_RECONNECT_IVL         100
+#define ZMTP_POOL_RECONNECT_IVL_MAX     30000
+#define ZMTP_POOL_CHECK_IVL             1000
+
+//  Structure of our class
+
+struct _zmtp_pool_t {
+    size_t size;                //  Channels to keep, idle or leased
+    int connect_timeout;        //  Connect deadline in msecs
+    int reconnect_ivl;          //  Initial reconnect interval, msecs
+    int reconnect_ivl_max;      //  Upper bound of the backoff, msecs
+    int check_ivl;              //  Msecs between health checks
+    char *endpoint;             //  Where to connect, NULL until connected
+    pthread_t thread;           //  Keeps the pool full
+    pthread_mutex_t mutex;      //  Guards everything below
+    pthread_cond_t ready;       //  Signals a channel to lease
+    pthread_cond_t wake;        //  Signals the thread: stop or refill
+    zmtp_channel_t **idle;      //  Channels to lease, last returned on top
+    size_t nidle;               //  Number of them
+    size_t leased;              //  Channels out with callers
+    bool stopping;              //  Thread is to stop
+};
+
+static void *
+    s_warmer (void *arg);
+static void
+    s_check (zmtp_pool_t *self);
+static int
+    s_wait (pthread_cond_t *cond, pthread_mutex_t *mutex, int64_t when);
+
+
+//  --------------------------------------------------------------------------
+//  Constructor
+
+zmtp_pool_t *
+zmtp_pool_new (size_t size)
+{
+    assert (size > 0);
+    zmtp_pool_t *self = (zmtp_pool_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    self->idle = (zmtp_channel_t **) zmtp_zmalloc (size * sizeof *self->idle);
+    assert (self->idle);
+    self->size = size;
+    self->connect_timeout = ZMTP_POOL_CONNECT_TIMEOUT;
+    self->reconnect_ivl = ZMTP_POOL_RECONNECT_IVL;
+    self->reconnect_ivl_max = ZMTP_POOL_RECONNECT_IVL_MAX;
+    self->check_ivl = ZMTP_POOL_CHECK_IVL;
+    pthread_mutex_init (&self->mutex, NULL);
+    pthread_cond_init (&self->ready, NULL);
+    pthread_cond_init (&self->wake, NULL);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; waits for a connect in progress to finish
+
+void
+zmtp_pool_destroy (zmtp_pool_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_pool_t *self = *self_p;
+        if (self->endpoint) {
+            pthread_mutex_lock (&self->mutex);
+            self->stopping = true;
+            pthread_cond_signal (&self->wake);
+            pthread_mutex_unlock (&self->mutex);
+            pthread_join (self->thread, NULL);
+        }
+        assert (self->leased == 0);
+        while (self->nidle)
+            zmtp_channel_destroy (&self->idle [--self->nidle]);
+        pthread_cond_destroy (&self->wake);
+        pthread_cond_destroy (&self->ready);
+        pthread_mutex_destroy (&self->mutex);
+        zmtp_free (self->endpoint);
+        zmtp_free (self->idle);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set connect deadline of pooled channels in msecs
+
+void
+zmtp_pool_set_connect_timeout (zmtp_pool_t *self, int timeout)
+{
+    assert (self);
+    self->connect_timeout = timeout;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set initial reconnect interval in msecs
+
+void
+zmtp_pool_set_reconnect_ivl (zmtp_pool_t *self, int ivl)
+{
+    assert (self);
+    self->reconnect_ivl = ivl;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set maximum reconnect interval in msecs
+
+void
+zmtp_pool_set_reconnect_ivl_max (zmtp_pool_t *self, int ivl_max)
+{
+    assert (self);
+    self->reconnect_ivl_max = ivl_max;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set msecs between health checks of idle channels
+
+void
+zmtp_pool_set_check_ivl (zmtp_pool_t *self, int ivl)
+{
+    assert (self);
+    self->check_ivl = ivl;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Start filling the pool with channels connected to endpoint_str
+
+int
+zmtp_pool_connect (zmtp_pool_t *self, const char *endpoint_str)
+{
+    assert (self);
+    assert (endpoint_str);
+    if (self->endpoint) {
+        errno = EALREADY;
+        return -1;
+    }
+    //  Parse now, so a bad endpoint fails here rather than on each
+    //  connect; the channels find it cached
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_lookup (endpoint_str);
+    if (!endpoint)
+        return -1;
+    zmtp_endpoint_destroy (&endpoint);
+    self->endpoint = zmtp_strdup (endpoint_str);
+    assert (self->endpoint);
+    const int rc = pthread_create (&self->thread, NULL, s_warmer, self);
+    assert (rc == 0);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take a channel out of the pool, waiting up to timeout msecs. Each
+//  channel is checked as it is taken, so one that broke since the last
+//  health check is replaced instead of handed out.
+
+zmtp_channel_t *
+zmtp_pool_lease (zmtp_pool_t *self, int timeout)
+{
+    assert (self);
+    const int64_t deadline =
+        timeout < 0? -1: zmtp_clock_mono () + timeout;
+    zmtp_channel_t *channel = NULL;
+    pthread_mutex_lock (&self->mutex);
+    while (!channel) {
+        if (self->nidle) {
+            channel = self->idle [--self->nidle];
+            if (!zmtp_channel_idle (channel)) {
+                zmtp_channel_destroy (&channel);
+                pthread_cond_signal (&self->wake);
+            }
+            continue;
+        }
+        if (timeout == 0) {
+            errno = EAGAIN;
+            break;
+        }
+        if (s_wait (&self->ready, &self->mutex, deadline) == ETIMEDOUT) {
+            errno = ETIMEDOUT;
+            break;
+        }
+    }
+    if (channel)
+        self->leased++;
+    pthread_mutex_unlock (&self->mutex);
+    return channel;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Give a leased channel back and nullify the reference
+
+void
+zmtp_pool_return (zmtp_pool_t *self, zmtp_channel_t **channel_p)
+{
+    assert (self);
+    assert (channel_p);
+    zmtp_channel_t *channel = *channel_p;
+    if (!channel)
+        return;
+    *channel_p = NULL;
+    if (!zmtp_channel_idle (channel))
+        zmtp_channel_destroy (&channel);
+
+    pthread_mutex_lock (&self->mutex);
+    assert (self->leased > 0);
+    self->leased--;
+    if (channel) {
+        self->idle [self->nidle++] = channel;
+        pthread_cond_signal (&self->ready);
+    }
+    else
+        pthread_cond_signal (&self->wake);
+    pthread_mutex_unlock (&self->mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of channels ready to lease
+
+size_t
+zmtp_pool_ready (zmtp_pool_t *self)
+{
+    assert (self);
+    pthread_mutex_lock (&self->mutex);
+    const size_t nidle = self->nidle;
+    pthread_mutex_unlock (&self->mutex);
+    return nidle;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Pool thread: connect channels until the pool is full, backing off
+//  while the endpoint refuses, and check idle ones every check_ivl. The
+//  connect and handshake run without the mutex, so leases and returns go
+//  on meanwhile.
+
+static void *
+s_warmer (void *arg)
+{
+    zmtp_pool_t *self = (zmtp_pool_t *) arg;
+    int backoff = self->reconnect_ivl;
+    int64_t connect_at = 0;
+    int64_t check_at = zmtp_clock_mono () + self->check_ivl;
+
+    pthread_mutex_lock (&self->mutex);
+    while (!self->stopping) {
+        const int64_t now = zmtp_clock_mono ();
+        if (now >= check_at) {
+            s_check (self);
+            check_at = now + self->check_ivl;
+        }
+        const bool short_of =
+            self->nidle + self->leased < self->size;
+        if (short_of && now >= connect_at) {
+            pthread_mutex_unlock (&self->mutex);
+            zmtp_channel_t *channel = zmtp_channel_new ();
+            if (channel) {
+                zmtp_channel_set_connect_timeout (
+                    channel, self->connect_timeout);
+                if (zmtp_channel_connect (channel, self->endpoint) == -1)
+                    zmtp_channel_destroy (&channel);
+            }
+            pthread_mutex_lock (&self->mutex);
+            if (channel) {
+                self->idle [self->nidle++] = channel;
+                pthread_cond_signal (&self->ready);
+                backoff = self->reconnect_ivl;
+            }
+            else {
+                connect_at = zmtp_clock_mono () + backoff;
+                backoff = backoff * 2 < self->reconnect_ivl_max
+                        ? backoff * 2: self->reconnect_ivl_max;
+            }
+            continue;
+        }
+        const int64_t wake_at =
+            short_of && connect_at < check_at? connect_at: check_at;
+        s_wait (&self->wake, &self->mutex, wake_at);
+    }
+    pthread_mutex_unlock (&self->mutex);
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destroy idle channels that the peer closed or sent to unasked. Call
+//  with the mutex held.
+
+static void
+s_check (zmtp_pool_t *self)
+{
+    for (size_t i = 0; i < self->nidle; )
+        if (zmtp_channel_idle (self->idle [i]))
+            i++;
+        else {
+            zmtp_channel_destroy (&self->idle [i]);
+            self->idle [i] = self->idle [--self->nidle];
+        }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Wait on cond until signalled or until monotonic msecs when, -1 for no
+//  deadline. Returns 0, or ETIMEDOUT if when has passed.
+
+static int
+s_wait (pthread_cond_t *cond, pthread_mutex_t *mutex, int64_t when)
+{
+    if (when == -1)
+        return pthread_cond_wait (cond, mutex);
+    const int64_t wait = when - zmtp_clock_mono ();
+    if (wait <= 0)
+        return ETIMEDOUT;
+    struct timespec deadline;
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait / 1000;
+    deadline.tv_nsec += (long) (wait % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait (cond, mutex, &deadline);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+//  Server for the test: accepts connections off a listener and echoes
+//  every message; closes all connections when drop is set
+
+struct s_server_args {
+    int listener;
+    int accepted;               //  Connections accepted so far
+    bool drop;                  //  Close every connection
+    bool stop;                  //  Exit
+};
+
+static void *
+s_server (void *arg)
+{
+    struct s_server_args *args = (struct s_server_args *) arg;
+    zmtp_channel_t *channels [8];
+    size_t count = 0;
+    while (!__atomic_load_n (&args->stop, __ATOMIC_ACQUIRE)) {
+        if (__atomic_exchange_n (&args->drop, false, __ATOMIC_ACQ_REL))
+            while (count)
+                zmtp_channel_destroy (&channels [--count]);
+        struct pollfd items [9] = {
+            { .fd = args->listener, .events = POLLIN }
+        };
+        for (size_t i = 0; i < count; i++)
+            items [i + 1] = (struct pollfd) {
+                .fd = zmtp_channel_fd (channels [i]), .events = POLLIN
+            };
+        poll (items, count + 1, 10);
+        //  Serve every channel, readable or not, as the handshake may
+        //  have read a first message ahead. Backwards, so a closed
+        //  channel can be replaced by the last.
+        for (size_t i = count; i-- > 0; ) {
+            zmtp_msg_t *msg;
+            while ((msg = zmtp_channel_recv_nowait (channels [i]))) {
+                zmtp_channel_send (channels [i], msg);
+                zmtp_msg_destroy (&msg);
+            }
+            if (errno != EAGAIN) {
+                zmtp_channel_destroy (&channels [i]);
+                channels [i] = channels [--count];
+            }
+        }
+        if (items [0].revents && count < 8) {
+            zmtp_channel_t *channel = zmtp_channel_new ();
+            if (zmtp_channel_adopt (channel, args->listener) == 0) {
+                channels [count++] = channel;
+                __atomic_fetch_add (&args->accepted, 1, __ATOMIC_RELEASE);
+            }
+            else
+                zmtp_channel_destroy (&channel);
+        }
+    }
+    while (count)
+        zmtp_channel_destroy (&channels [--count]);
+    return NULL;
+}
+
+static void
+s_echo (zmtp_channel_t *channel)
+{
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "hello", 5);
+    int rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_size (msg) == 5);
+    assert (memcmp (zmtp_msg_data (msg), "hello", 5) == 0);
+    zmtp_msg_destroy (&msg);
+}
+
+//  Wait until the pool is full again and the server has accepted at
+//  least accepted connections
+
+static void
+s_settle (zmtp_pool_t *pool, struct s_server_args *server, int accepted)
+{
+    const int64_t start = zmtp_clock_mono ();
+    while (zmtp_pool_ready (pool) < 2
+    ||  __atomic_load_n (&server->accepted, __ATOMIC_ACQUIRE) < accepted) {
+        assert (zmtp_clock_mono () - start < 5000);
+        usleep (1000);
+    }
+}
+
+void
+zmtp_pool_test (bool verbose)
+{
+    printf (" * zmtp_pool: ");
+    //  @selftest
+    const char name [] = "zmtp-pool-selftest";
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    memcpy (addr.sun_path + 1, name, sizeof name - 1);
+    struct s_server_args server = {
+        .listener = socket (AF_UNIX, SOCK_STREAM, 0)
+    };
+    assert (server.listener != -1);
+    int rc = bind (server.listener, (struct sockaddr *) &addr,
+        (socklen_t) (offsetof (struct sockaddr_un, sun_path) + sizeof name));
+    assert (rc == 0);
+    rc = listen (server.listener, 8);
+    assert (rc == 0);
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_server, &server);
+
+    zmtp_pool_t *pool = zmtp_pool_new (2);
+    assert (pool);
+    zmtp_pool_set_reconnect_ivl (pool, 10);
+    zmtp_pool_set_reconnect_ivl_max (pool, 50);
+    zmtp_pool_set_check_ivl (pool, 20);
+    rc = zmtp_pool_connect (pool, "udp://127.0.0.1:5555");
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_pool_connect (pool, "ipc://@zmtp-pool-selftest");
+    assert (rc == 0);
+    rc = zmtp_pool_connect (pool, "ipc://@zmtp-pool-selftest");
+    assert (rc == -1 && errno == EALREADY);
+
+    //  Leased channels are connected and handshaken
+    zmtp_channel_t *first = zmtp_pool_lease (pool, 5000);
+    assert (first);
+    s_echo (first);
+    zmtp_pool_return (pool, &first);
+    assert (first == NULL);
+    s_settle (pool, &server, 2);
+
+    //  Once all are out, leases wait or fail
+    first = zmtp_pool_lease (pool, 0);
+    zmtp_channel_t *second = zmtp_pool_lease (pool, 0);
+    assert (first && second);
+    zmtp_channel_t *channel = zmtp_pool_lease (pool, 0);
+    assert (channel == NULL && errno == EAGAIN);
+    const int64_t start = zmtp_clock_mono ();
+    channel = zmtp_pool_lease (pool, 50);
+    assert (channel == NULL && errno == ETIMEDOUT);
+    assert (zmtp_clock_mono () - start < 1000);
+
+    //  The channel returned last is leased first
+    zmtp_channel_t *returned = second;
+    zmtp_pool_return (pool, &second);
+    channel = zmtp_pool_lease (pool, 0);
+    assert (channel == returned);
+    zmtp_pool_return (pool, &channel);
+    zmtp_pool_return (pool, &first);
+
+    //  A channel returned in the middle of a reply is replaced
+    channel = zmtp_pool_lease (pool, 0);
+    assert (channel);
+    zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "hello", 5);
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    struct pollfd item = { .fd = zmtp_channel_fd (channel), .events = POLLIN };
+    rc = poll (&item, 1, 5000);
+    assert (rc == 1);
+    zmtp_pool_return (pool, &channel);
+    s_settle (pool, &server, 3);
+
+    //  Idle channels the peer closes are replaced in the background
+    __atomic_store_n (&server.drop, true, __ATOMIC_RELEASE);
+    s_settle (pool, &server, 5);
+    channel = zmtp_pool_lease (pool, 5000);
+    assert (channel);
+    s_echo (channel);
+    zmtp_pool_return (pool, &channel);
+
+    zmtp_pool_destroy (&pool);
+    assert (pool == NULL);
+    __atomic_store_n (&server.stop, true, __ATOMIC_RELEASE);
+    pthread_join (thread, NULL);
+    close (server.listener);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,393 @@
+/*  =========================================================================
+    zmtp_resolver - asynchronous hostname resolver with a cache
+
+    getaddrinfo blocks for as long as DNS takes, so names are looked up
+    on a few background threads and a connect waits for the answer no
+    longer than its deadline allows. Answers are cached for a TTL and
+    looked up again in the background before they expire, so a name in
+    steady use never makes a connect wait; failures are cached for a
+    shorter TTL so a dead name does not send every reconnect to DNS.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+//  Names cached at once, and most threads looking names up at once
+
+#define ZMTP_RESOLVER_CACHE_SIZE    32
+#define ZMTP_RESOLVER_THREADS       4
+
+//  Percent of its TTL after which an answer in use is refreshed ahead
+
+#define ZMTP_RESOLVER_REFRESH       75
+
+typedef struct {
+    char host [NI_MAXHOST];         //  Name, empty if slot is free
+    uint64_t generation;            //  Changes each time slot is reset
+    bool queued;                    //  Waiting for a thread
+    bool resolving;                 //  Queued or being looked up
+    bool answered;                  //  Holds addresses or a failure
+    int error;                      //  0, or errno of the failure
+    size_t count;                   //  Addresses held
+    struct sockaddr_storage addr [ZMTP_RESOLVER_MAX_ADDRS];
+    socklen_t addrlen [ZMTP_RESOLVER_MAX_ADDRS];
+    int64_t refresh;                //  When to look it up again ahead
+    int64_t expires;                //  When the answer goes stale
+    int64_t used;                   //  Last asked for, for eviction
+} s_entry_t;
+
+//  Resolver state, all guarded by the mutex
+
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t s_done = PTHREAD_COND_INITIALIZER;
+static s_entry_t s_cache [ZMTP_RESOLVER_CACHE_SIZE];
+static uint64_t s_generation = 0;
+static size_t s_queued = 0;
+static size_t s_threads = 0;
+static size_t s_idle = 0;
+static int s_ttl = ZMTP_RESOLVER_TTL;
+static int s_negative_ttl = ZMTP_RESOLVER_NEGATIVE_TTL;
+static zmtp_resolver_fn *s_fn = getaddrinfo;
+
+static s_entry_t *
+    s_find (const char *host);
+static s_entry_t *
+    s_entry (const char *host, int64_t now);
+static void
+    s_reset (s_entry_t *entry);
+static void
+    s_lookup (s_entry_t *entry);
+static void *
+    s_worker (void *arg);
+static void
+    s_answer (s_entry_t *entry, const struct addrinfo *result, int error);
+static void
+    s_copy (const s_entry_t *entry, unsigned short port,
+            zmtp_resolved_t *resolved);
+
+
+//  --------------------------------------------------------------------------
+//  Get the addresses of host with port filled in, waiting up to timeout
+//  msecs for a lookup in progress. Returns 0, or -1 with errno set.
+
+int
+zmtp_resolver_resolve (const char *host, unsigned short port, int timeout,
+                       zmtp_resolved_t *resolved)
+{
+    assert (host);
+    assert (resolved);
+    if (*host == '\0' || strlen (host) >= NI_MAXHOST) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct timespec deadline;
+    if (timeout > 0) {
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    int error = 0;
+    pthread_mutex_lock (&s_mutex);
+    s_entry_t *entry = s_entry (host, zmtp_clock_mono ());
+    while (entry && !entry->answered) {
+        if (timeout == 0)
+            error = EAGAIN;
+        else
+        if (timeout < 0)
+            pthread_cond_wait (&s_done, &s_mutex);
+        else
+        if (pthread_cond_timedwait (&s_done, &s_mutex, &deadline)
+                == ETIMEDOUT)
+            error = ETIMEDOUT;
+        if (error)
+            break;
+        //  Take the answer we waited for even if its TTL is already up;
+        //  look the name up afresh only if it was purged meanwhile
+        entry = s_find (host);
+        if (!entry)
+            entry = s_entry (host, zmtp_clock_mono ());
+    }
+    if (!entry)
+        error = EAGAIN;         //  Every slot is busy looking up a name
+    else
+    if (!error) {
+        error = entry->error;
+        if (!error)
+            s_copy (entry, port, resolved);
+    }
+    pthread_mutex_unlock (&s_mutex);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Start looking up host in the background unless its answer is cached
+
+void
+zmtp_resolver_prefetch (const char *host)
+{
+    assert (host);
+    if (*host == '\0' || strlen (host) >= NI_MAXHOST)
+        return;
+    pthread_mutex_lock (&s_mutex);
+    s_entry (host, zmtp_clock_mono ());
+    pthread_mutex_unlock (&s_mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Set msecs answers and failures are cached for
+
+void
+zmtp_resolver_set_ttl (int ttl, int negative_ttl)
+{
+    pthread_mutex_lock (&s_mutex);
+    s_ttl = ttl > 0? ttl: 0;
+    s_negative_ttl = negative_ttl > 0? negative_ttl: 0;
+    pthread_mutex_unlock (&s_mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Use fn to look up names, or getaddrinfo if NULL. Answers from the
+//  previous function are forgotten, and lookups it still has in progress
+//  are ignored when they finish.
+
+void
+zmtp_resolver_set_fn (zmtp_resolver_fn *fn)
+{
+    pthread_mutex_lock (&s_mutex);
+    s_fn = fn? fn: getaddrinfo;
+    pthread_mutex_unlock (&s_mutex);
+    zmtp_resolver_purge ();
+}
+
+
+//  --------------------------------------------------------------------------
+//  Forget every cached answer. Callers waiting on a lookup start it again.
+
+void
+zmtp_resolver_purge (void)
+{
+    pthread_mutex_lock (&s_mutex);
+    for (size_t i = 0; i < ZMTP_RESOLVER_CACHE_SIZE; i++)
+        s_reset (&s_cache [i]);
+    pthread_cond_broadcast (&s_done);
+    pthread_mutex_unlock (&s_mutex);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the entry for host, or NULL. Call with the mutex held.
+
+static s_entry_t *
+s_find (const char *host)
+{
+    for (size_t i = 0; i < ZMTP_RESOLVER_CACHE_SIZE; i++)
+        if (streq (s_cache [i].host, host))
+            return &s_cache [i];
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the entry for host, taking a free slot or else the least
+//  recently used one for a new name, and start a lookup if the entry has
+//  no fresh answer or is due for a refresh. Returns NULL if every slot is
+//  being looked up. Call with the mutex held.
+
+static s_entry_t *
+s_entry (const char *host, int64_t now)
+{
+    s_entry_t *entry = s_find (host);
+    if (!entry) {
+        for (size_t i = 0; i < ZMTP_RESOLVER_CACHE_SIZE; i++) {
+            s_entry_t *slot = &s_cache [i];
+            if (slot->resolving)
+                continue;
+            if (!entry || (entry->host [0]
+            &&  (!slot->host [0] || slot->used < entry->used)))
+                entry = slot;
+        }
+        if (!entry)
+            return NULL;
+        s_reset (entry);
+        strcpy (entry->host, host);
+    }
+    entry->used = now;
+    if (entry->answered && now >= entry->expires)
+        entry->answered = false;
+    if (!entry->answered || (!entry->error && now >= entry->refresh))
+        s_lookup (entry);
+    return entry;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Empty a slot. A thread still looking up its old name drops the answer
+//  when it sees the generation changed. Call with the mutex held.
+
+static void
+s_reset (s_entry_t *entry)
+{
+    if (entry->queued)
+        s_queued--;
+    entry->host [0] = '\0';
+    entry->generation = ++s_generation;
+    entry->queued = false;
+    entry->resolving = false;
+    entry->answered = false;
+    entry->count = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Queue a lookup of the entry unless one is in progress, starting another
+//  thread if every thread is busy. Call with the mutex held.
+
+static void
+s_lookup (s_entry_t *entry)
+{
+    if (entry->resolving)
+        return;
+    entry->resolving = true;
+    entry->queued = true;
+    s_queued++;
+    if (s_queued > s_idle && s_threads < ZMTP_RESOLVER_THREADS) {
+        pthread_attr_t attr;
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        if (pthread_create (&thread, &attr, s_worker, NULL) == 0)
+            s_threads++;
+        pthread_attr_destroy (&attr);
+    }
+    pthread_cond_signal (&s_work);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Lookup thread: take queued names and resolve them without holding the
+//  mutex. Threads stay for the life of the process, waiting for work.
+
+static void *
+s_worker (void *arg)
+{
+    pthread_mutex_lock (&s_mutex);
+    while (true) {
+        s_entry_t *entry = NULL;
+        for (size_t i = 0; i < ZMTP_RESOLVER_CACHE_SIZE && !entry; i++)
+            if (s_cache [i].queued)
+                entry = &s_cache [i];
+        if (!entry) {
+            s_idle++;
+            pthread_cond_wait (&s_work, &s_mutex);
+            s_idle--;
+            continue;
+        }
+        entry->queued = false;
+        s_queued--;
+        char host [NI_MAXHOST];
+        strcpy (host, entry->host);
+        const uint64_t generation = entry->generation;
+        zmtp_resolver_fn *fn = s_fn;
+        pthread_mutex_unlock (&s_mutex);
+
+        const struct addrinfo hints = {
+            .ai_family   = AF_UNSPEC,
+            .ai_socktype = SOCK_STREAM
+        };
+        struct addrinfo *result = NULL;
+        const int rc = fn (host, NULL, &hints, &result);
+        const int error = rc == 0? 0
+                        : rc == EAI_SYSTEM? errno
+                        : rc == EAI_MEMORY? ENOMEM
+                        : EHOSTUNREACH;
+        ZMTP_TRACE3 (resolve, rc, error, host);
+
+        pthread_mutex_lock (&s_mutex);
+        if (entry->generation == generation)
+            s_answer (entry, rc == 0? result: NULL, error);
+        pthread_cond_broadcast (&s_done);
+        if (result)
+            freeaddrinfo (result);
+    }
+    return NULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Store the outcome of a lookup. A failed refresh keeps the answer it
+//  was meant to replace until that goes stale, and tries again after the
+//  negative TTL. Call with the mutex held.
+
+static void
+s_answer (s_entry_t *entry, const struct addrinfo *result, int error)
+{
+    const int64_t now = zmtp_clock_mono ();
+    entry->resolving = false;
+    size_t count = 0;
+    for (const struct addrinfo *ai = result;
+            ai && count < ZMTP_RESOLVER_MAX_ADDRS; ai = ai->ai_next)
+        if ((ai->ai_family == AF_INET || ai->ai_family == AF_INET6)
+        &&  ai->ai_addrlen <= sizeof entry->addr [count]) {
+            memcpy (&entry->addr [count], ai->ai_addr, ai->ai_addrlen);
+            entry->addrlen [count++] = ai->ai_addrlen;
+        }
+    if (!error && count == 0)
+        error = EHOSTUNREACH;
+    if (error && entry->answered && !entry->error) {
+        entry->refresh = now + s_negative_ttl;
+        return;
+    }
+    const int ttl = error? s_negative_ttl: s_ttl;
+    entry->answered = true;
+    entry->error = error;
+    entry->count = error? 0: count;
+    entry->refresh = now + (int64_t) ttl * ZMTP_RESOLVER_REFRESH / 100;
+    entry->expires = now + ttl;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Copy an entry's addresses out with port filled in
+
+static void
+s_copy (const s_entry_t *entry, unsigned short port,
+        zmtp_resolved_t *resolved)
+{
+    struct addrinfo **tail = &resolved->addrinfo;
+    for (size_t i = 0; i < entry->count; i++) {
+        struct sockaddr_storage *addr = &resolved->addr [i];
+        *addr = entry->addr [i];
+        if (addr->ss_family == AF_INET6)
+            ((struct sockaddr_in6 *) addr)->sin6_port = htons (port);
+        else
+            ((struct sockaddr_in *) addr)->sin_port = htons (port);
+        resolved->ai [i] = (struct addrinfo) {
+            .ai_family   = addr->ss_family,
+            .ai_socktype = SOCK_STREAM,
+            .ai_addrlen  = entry->addrlen [i],
+            .ai_addr     = (struct sockaddr *) addr
+        };
+        *tail = &resolved->ai [i];
+        tail = &resolved->ai [i].ai_next;
+    }
+    *tail = NULL;
+}
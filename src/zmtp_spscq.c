@@ -0,0 +1,189 @@
+/*  =========================================================================
+    zmtp_spscq - bounded lock-free single-producer, single-consumer ring
+
+    Each side owns one index and only reads the other's. The indexes sit
+    on separate cache lines, and each side keeps a private copy of the
+    other's index that it refreshes only when the ring looks full or
+    empty, so in steady state a push or pop touches no shared line but
+    the slot itself.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+#define ZMTP_CACHE_LINE 64
+
+//  Structure of our class
+
+struct _zmtp_spscq_t {
+    //  Producer side
+    size_t head;                //  Next slot to fill
+    size_t tail_cache;          //  Last tail seen by the producer
+    byte pad1 [ZMTP_CACHE_LINE - 2 * sizeof (size_t)];
+    //  Consumer side
+    size_t tail;                //  Next slot to empty
+    size_t head_cache;          //  Last head seen by the consumer
+    byte pad2 [ZMTP_CACHE_LINE - 2 * sizeof (size_t)];
+    //  Shared, read-only
+    size_t mask;                //  Capacity - 1, capacity a power of two
+    size_t item_size;           //  Bytes per item
+    byte *items;                //  The slots
+};
+
+
+//  --------------------------------------------------------------------------
+//  Constructor; ring of at least capacity items of item_size bytes each
+
+zmtp_spscq_t *
+zmtp_spscq_new (size_t item_size, size_t capacity)
+{
+    assert (item_size > 0);
+    assert (capacity > 0);
+    zmtp_spscq_t *self = (zmtp_spscq_t *) zmtp_zmalloc (sizeof *self);
+    assert (self);              //  For now, memory exhaustion is fatal
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    self->mask = size - 1;
+    self->item_size = item_size;
+    self->items = (byte *) zmtp_malloc (size * item_size);
+    assert (self->items);
+    return self;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Destructor; items still queued are discarded
+
+void
+zmtp_spscq_destroy (zmtp_spscq_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zmtp_spscq_t *self = *self_p;
+        zmtp_free (self->items);
+        zmtp_free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Copy item into the ring; returns -1 if the ring is full. Only one
+//  thread may push.
+
+int
+zmtp_spscq_push (zmtp_spscq_t *self, const void *item)
+{
+    assert (self);
+    assert (item);
+    const size_t head = self->head;
+    if (head - self->tail_cache > self->mask) {
+        self->tail_cache = __atomic_load_n (&self->tail, __ATOMIC_ACQUIRE);
+        if (head - self->tail_cache > self->mask)
+            return -1;
+    }
+    memcpy (self->items + (head & self->mask) * self->item_size,
+        item, self->item_size);
+    __atomic_store_n (&self->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Copy the oldest item out of the ring; returns -1 if the ring is empty.
+//  Only one thread may pop.
+
+int
+zmtp_spscq_pop (zmtp_spscq_t *self, void *item)
+{
+    assert (self);
+    assert (item);
+    const size_t tail = self->tail;
+    if (tail == self->head_cache) {
+        self->head_cache = __atomic_load_n (&self->head, __ATOMIC_ACQUIRE);
+        if (tail == self->head_cache)
+            return -1;
+    }
+    memcpy (item, self->items + (tail & self->mask) * self->item_size,
+        self->item_size);
+    __atomic_store_n (&self->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return number of items queued; exact only on the consumer thread
+
+size_t
+zmtp_spscq_size (zmtp_spscq_t *self)
+{
+    assert (self);
+    return __atomic_load_n (&self->head, __ATOMIC_ACQUIRE)
+         - __atomic_load_n (&self->tail, __ATOMIC_ACQUIRE);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Selftest
+
+#define S_ITEMS 1000000
+
+static void *
+s_producer (void *arg)
+{
+    zmtp_spscq_t *ring = (zmtp_spscq_t *) arg;
+    for (uint64_t i = 0; i < S_ITEMS; i++)
+        while (zmtp_spscq_push (ring, &i) == -1)
+            sched_yield ();
+    return NULL;
+}
+
+void
+zmtp_spscq_test (bool verbose)
+{
+    printf (" * zmtp_spscq: ");
+    //  @selftest
+    zmtp_spscq_t *ring = zmtp_spscq_new (sizeof (uint64_t), 3);
+    assert (ring);
+    uint64_t value = 0;
+    assert (zmtp_spscq_pop (ring, &value) == -1);
+
+    //  Capacity is rounded up to a power of two
+    for (uint64_t i = 0; i < 4; i++)
+        assert (zmtp_spscq_push (ring, &i) == 0);
+    assert (zmtp_spscq_push (ring, &value) == -1);
+    assert (zmtp_spscq_size (ring) == 4);
+    for (uint64_t i = 0; i < 4; i++) {
+        assert (zmtp_spscq_pop (ring, &value) == 0);
+        assert (value == i);
+    }
+    assert (zmtp_spscq_pop (ring, &value) == -1);
+    zmtp_spscq_destroy (&ring);
+    assert (ring == NULL);
+
+    //  Items cross threads in order
+    ring = zmtp_spscq_new (sizeof (uint64_t), 256);
+    pthread_t thread;
+    pthread_create (&thread, NULL, s_producer, ring);
+    for (uint64_t expected = 0; expected < S_ITEMS; ) {
+        if (zmtp_spscq_pop (ring, &value) == 0) {
+            assert (value == expected);
+            expected++;
+        }
+        else
+            sched_yield ();
+    }
+    pthread_join (thread, NULL);
+    assert (zmtp_spscq_size (ring) == 0);
+    zmtp_spscq_destroy (&ring);
+    //  @end
+    printf ("OK\n");
+}
@@ -12,41 +12,78 @@
 
 #include "zmtp_classes.h"
 
+#include <ctype.h>
+#include <poll.h>
+
+//  Maximum number of resolved addresses we race in one connect
+#define ZMTP_TCP_MAX_ATTEMPTS 16
+
+//  Delay before starting the next connection attempt while earlier
+//  attempts are still in progress (RFC 8305 recommends 250 ms)
+#define ZMTP_TCP_ATTEMPT_DELAY 250
+
 struct zmtp_tcp_endpoint {
     zmtp_endpoint_t base;
-    struct addrinfo *addrinfo;
+    struct addrinfo *addrinfo;  //  Address literal, or NULL for a hostname
+    char *host;                 //  Hostname, resolved on each connect
+    unsigned short port;
 };
 
+static bool
+    s_is_hostname (const char *host);
+static const struct addrinfo *
+    s_addresses (zmtp_tcp_endpoint_t *self, int timeout,
+                 zmtp_resolved_t *resolved);
+static int
+    s_connect_start (const struct addrinfo *ai, bool *connected);
+static int
+    s_set_blocking (int s);
+
+
+//  --------------------------------------------------------------------------
+//  Create an endpoint for an IPv4 or IPv6 literal or a hostname. Literals
+//  are parsed here; hostnames are looked up in the background from now
+//  on, so the connect that needs them finds the answer waiting. Returns
+//  NULL if ip_addr is neither.
 
 zmtp_tcp_endpoint_t *
 zmtp_tcp_endpoint_new (const char *ip_addr, unsigned short port)
 {
     zmtp_tcp_endpoint_t *self =
-        (zmtp_tcp_endpoint_t *) zmalloc (sizeof *self);
+        (zmtp_tcp_endpoint_t *) zmtp_zmalloc (sizeof *self);
     if (!self)
         return NULL;
 
     //  Initialize base class
     self->base = (zmtp_endpoint_t) {
         .connect = (int (*) (zmtp_endpoint_t *)) zmtp_tcp_endpoint_connect,
+        .connect_timeout = (int (*) (zmtp_endpoint_t *, int))
+            zmtp_tcp_endpoint_connect_timeout,
         .listen = (int (*) (zmtp_endpoint_t *)) zmtp_tcp_endpoint_listen,
         .destroy = (void (*) (zmtp_endpoint_t **)) zmtp_tcp_endpoint_destroy,
     };
 
-    //  Resolve address
+    //  Parse address; both IPv4 and IPv6 literals are accepted
     const struct addrinfo hints = {
-        .ai_family   = AF_INET,
+        .ai_family   = AF_UNSPEC,
         .ai_socktype = SOCK_STREAM,
         .ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV
     };
     char service [8 + 1];
     snprintf (service, sizeof service, "%u", port);
-    if (getaddrinfo (ip_addr, service, &hints, &self->addrinfo)) {
-        free (self);
-        return NULL;
+    if (getaddrinfo (ip_addr, service, &hints, &self->addrinfo) == 0)
+        return self;
+    self->addrinfo = NULL;
+    if (s_is_hostname (ip_addr)) {
+        self->host = zmtp_strdup (ip_addr);
+        self->port = port;
+        if (self->host) {
+            zmtp_resolver_prefetch (self->host);
+            return self;
+        }
     }
-
-    return self;
+    zmtp_free (self);
+    return NULL;
 }
 
 
@@ -56,8 +93,10 @@ zmtp_tcp_endpoint_destroy (zmtp_tcp_endpoint_t **self_p)
     assert (self_p);
     if (*self_p) {
         zmtp_tcp_endpoint_t *self = *self_p;
-        freeaddrinfo (self->addrinfo);
-        free (self);
+        if (self->addrinfo)
+            freeaddrinfo (self->addrinfo);
+        zmtp_free (self->host);
+        zmtp_free (self);
         *self_p = NULL;
     }
 }
@@ -65,29 +104,148 @@ zmtp_tcp_endpoint_destroy (zmtp_tcp_endpoint_t **self_p)
 
 int
 zmtp_tcp_endpoint_connect (zmtp_tcp_endpoint_t *self)
+{
+    return zmtp_tcp_endpoint_connect_timeout (self, -1);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Connect to the endpoint, giving up after timeout milliseconds (-1 means
+//  no deadline). All resolved addresses are raced, alternating between
+//  address families, with a new attempt started every
+//  ZMTP_TCP_ATTEMPT_DELAY msecs until one completes. A hostname's lookup
+//  counts against the deadline. Returns a connected, blocking socket, or
+//  -1 with errno set (ETIMEDOUT if the deadline passed, EHOSTUNREACH if
+//  the hostname does not resolve).
+
+int
+zmtp_tcp_endpoint_connect_timeout (zmtp_tcp_endpoint_t *self, int timeout)
 {
     assert (self);
 
-    const int s = socket (AF_INET, SOCK_STREAM, 0);
-    if (s == -1)
+    const int64_t deadline =
+        timeout < 0 ? -1 : zmtp_clock_mono () + timeout;
+    zmtp_resolved_t resolved;
+    const struct addrinfo *addrinfo = s_addresses (self, timeout, &resolved);
+    if (!addrinfo) {
+        ZMTP_TRACE2 (tcp_connect, -1, errno);
         return -1;
+    }
 
-    const int rc = connect (
-        s, self->addrinfo->ai_addr, self->addrinfo->ai_addrlen);
-    if (rc == -1) {
-        close (s);
-        return -1;
+    //  Interleave address families so a dead IPv6 route cannot delay
+    //  the first IPv4 attempt by more than one attempt delay
+    const struct addrinfo *by_family [2][ZMTP_TCP_MAX_ATTEMPTS];
+    size_t count [2] = { 0, 0 };
+    const int first_family = addrinfo->ai_family;
+    for (const struct addrinfo *ai = addrinfo; ai; ai = ai->ai_next) {
+        const int index = ai->ai_family == first_family? 0: 1;
+        if (count [index] < ZMTP_TCP_MAX_ATTEMPTS)
+            by_family [index][count [index]++] = ai;
+    }
+    const struct addrinfo *candidates [ZMTP_TCP_MAX_ATTEMPTS];
+    size_t ncandidates = 0;
+    for (size_t i = 0; ncandidates < ZMTP_TCP_MAX_ATTEMPTS; i++) {
+        if (i >= count [0] && i >= count [1])
+            break;
+        if (i < count [0])
+            candidates [ncandidates++] = by_family [0][i];
+        if (i < count [1] && ncandidates < ZMTP_TCP_MAX_ATTEMPTS)
+            candidates [ncandidates++] = by_family [1][i];
     }
 
-    return s;
+    struct pollfd pollset [ZMTP_TCP_MAX_ATTEMPTS];
+    size_t npending = 0;
+    size_t next = 0;
+    int64_t next_attempt = 0;
+    int last_error = ECONNREFUSED;
+    int winner = -1;
+
+    while (winner == -1) {
+        const int64_t now = zmtp_clock_mono ();
+        if (deadline != -1 && now >= deadline) {
+            last_error = ETIMEDOUT;
+            break;
+        }
+        //  Start the next attempt if it is due
+        if (next < ncandidates && (npending == 0 || now >= next_attempt)) {
+            bool connected;
+            const int s = s_connect_start (candidates [next++], &connected);
+            if (s == -1)
+                last_error = errno;
+            else
+            if (connected) {
+                //  Connected immediately (typically loopback)
+                winner = s;
+                break;
+            }
+            else {
+                pollset [npending++] =
+                    (struct pollfd) { .fd = s, .events = POLLOUT };
+                next_attempt = now + ZMTP_TCP_ATTEMPT_DELAY;
+            }
+            continue;
+        }
+        if (npending == 0)
+            break;              //  All addresses failed
+
+        //  Wait for any pending attempt, the next attempt, or the deadline
+        int64_t wait = -1;
+        if (next < ncandidates)
+            wait = next_attempt - now;
+        if (deadline != -1 && (wait == -1 || deadline - now < wait))
+            wait = deadline - now;
+        const int rc = poll (pollset, npending, (int) wait);
+        if (rc == -1 && errno != EINTR) {
+            last_error = errno;
+            break;
+        }
+        for (size_t i = 0; rc > 0 && i < npending; ) {
+            if (pollset [i].revents == 0) {
+                i++;
+                continue;
+            }
+            int err = 0;
+            socklen_t errlen = sizeof err;
+            if (getsockopt (pollset [i].fd,
+                    SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+                err = errno;
+            if (err == 0) {
+                winner = pollset [i].fd;
+                pollset [i] = pollset [--npending];
+                break;
+            }
+            last_error = err;
+            close (pollset [i].fd);
+            pollset [i] = pollset [--npending];
+        }
+    }
+
+    //  Abandon the attempts that lost the race
+    for (size_t i = 0; i < npending; i++)
+        close (pollset [i].fd);
+
+    if (winner == -1 || s_set_blocking (winner) == -1) {
+        if (winner != -1)
+            close (winner);
+        ZMTP_TRACE2 (tcp_connect, -1, last_error);
+        errno = last_error;
+        return -1;
+    }
+    ZMTP_TRACE2 (tcp_connect, winner, 0);
+    return winner;
 }
 
+
 int
 zmtp_tcp_endpoint_listen (zmtp_tcp_endpoint_t *self)
 {
     assert (self);
 
-    const int s = socket (AF_INET, SOCK_STREAM, 0);
+    zmtp_resolved_t resolved;
+    const struct addrinfo *addrinfo = s_addresses (self, -1, &resolved);
+    if (!addrinfo)
+        return -1;
+    const int s = socket (addrinfo->ai_family, SOCK_STREAM, 0);
     if (s == -1)
         return -1;
 
@@ -95,13 +253,102 @@ zmtp_tcp_endpoint_listen (zmtp_tcp_endpoint_t *self)
     int rc = setsockopt (s, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
     assert (rc == 0);
 
-    rc = bind (
-        s, self->addrinfo->ai_addr, self->addrinfo->ai_addrlen);
+    rc = bind (s, addrinfo->ai_addr, addrinfo->ai_addrlen);
     if (rc == 0) {
         rc = listen (s, 1);
         if (rc == 0)
             rc = accept (s, NULL, NULL);
     }
+    ZMTP_TRACE2 (tcp_accept, rc, rc == -1? errno: 0);
     close (s);
     return rc;
 }
+
+
+//  --------------------------------------------------------------------------
+//  Return true if host is a syntactically valid hostname (RFC 1123): dot
+//  separated labels of letters, digits and hyphens. Underscores are let
+//  through, as some internal zones use them.
+
+static bool
+s_is_hostname (const char *host)
+{
+    const size_t size = strlen (host);
+    if (size == 0 || size >= NI_MAXHOST)
+        return false;
+    size_t label = 0;
+    for (const char *c = host; *c; c++) {
+        if (*c == '.') {
+            if (label == 0)
+                return false;
+            label = 0;
+        }
+        else
+        if (isalnum ((unsigned char) *c) || *c == '-' || *c == '_') {
+            if (++label > 63)
+                return false;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return the endpoint's addresses: its literal, or its hostname's
+//  addresses copied into resolved, waiting up to timeout msecs for them.
+//  Returns NULL with errno set if the hostname has none yet.
+
+static const struct addrinfo *
+s_addresses (zmtp_tcp_endpoint_t *self, int timeout,
+             zmtp_resolved_t *resolved)
+{
+    if (self->addrinfo)
+        return self->addrinfo;
+    if (zmtp_resolver_resolve (self->host, self->port, timeout, resolved))
+        return NULL;
+    return resolved->addrinfo;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Create a non-blocking socket for the address and start connecting it.
+//  Returns the socket, setting connected if the connection completed
+//  immediately; -1 on failure.
+
+static int
+s_connect_start (const struct addrinfo *ai, bool *connected)
+{
+    const int s = socket (ai->ai_family, SOCK_STREAM, 0);
+    if (s == -1)
+        return -1;
+    const int flags = fcntl (s, F_GETFL, 0);
+    if (flags == -1 || fcntl (s, F_SETFL, flags | O_NONBLOCK) == -1) {
+        close (s);
+        return -1;
+    }
+    *connected = connect (s, ai->ai_addr, ai->ai_addrlen) == 0;
+    if (*connected)
+        return s;
+    if (errno != EINPROGRESS) {
+        const int err = errno;
+        close (s);
+        errno = err;
+        return -1;
+    }
+    return s;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Put socket back into blocking mode
+
+static int
+s_set_blocking (int s)
+{
+    const int flags = fcntl (s, F_GETFL, 0);
+    if (flags == -1)
+        return -1;
+    return fcntl (s, F_SETFL, flags & ~O_NONBLOCK);
+}
@@ -0,0 +1,65 @@
+/*  =========================================================================
+    zmtp_util - internal helpers
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+
+//  --------------------------------------------------------------------------
+//  Return current monotonic time in milliseconds
+
+int64_t
+zmtp_clock_mono (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return current monotonic time in microseconds
+
+int64_t
+zmtp_clock_usecs (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return current monotonic time in nanoseconds. On Linux this is read
+//  from the vDSO, no system call, which is cheap enough to time frames.
+
+int64_t
+zmtp_clock_nsecs (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Take a snapshot of counters that another thread may be updating
+
+void
+zmtp_stats_copy (zmtp_stats_t *dest, const zmtp_stats_t *src)
+{
+    assert (dest);
+    assert (src);
+    const uint64_t *from = (const uint64_t *) src;
+    uint64_t *to = (uint64_t *) dest;
+    for (size_t i = 0; i < sizeof *src / sizeof (uint64_t); i++)
+        to [i] = __atomic_load_n (&from [i], __ATOMIC_RELAXED);
+}
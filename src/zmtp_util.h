@@ -1,10 +0,0 @@
-#ifndef __ZMTP_UTIL_H__
-#define __ZMTP_UTIL_H__
-
-#include <stdbool.h>
-#include <stdint.h>
-
-
-
-
-#endif
@@ -1,12 +1,20 @@
 #include "zmtpnet.h"
 
+//  Writes to a peer that went away must fail with EPIPE instead of
+//  raising SIGPIPE, so callers can reconnect.
+#if defined (MSG_NOSIGNAL)
+#   define ZMTP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#   define ZMTP_SEND_FLAGS 0
+#endif
+
 int
 zmtp_tcp_send (int fd, const void *data, size_t len)
 {
     size_t bytes_sent = 0;
     while (bytes_sent < len) {
         const ssize_t rc = send (
-            fd, (char *) data + bytes_sent, len - bytes_sent, 0);
+            fd, (char *) data + bytes_sent, len - bytes_sent, ZMTP_SEND_FLAGS);
         if (rc == -1 && errno == EINTR)
             continue;
         if (rc == -1)
@@ -38,7 +46,7 @@ int zmtp_udp_send (int fd, const void *data, size_t len)
       size_t bytes_sent = 0;
     while (bytes_sent < len) {
         const ssize_t rc = send (
-            fd, (char *) data + bytes_sent, len - bytes_sent, 0);
+            fd, (char *) data + bytes_sent, len - bytes_sent, ZMTP_SEND_FLAGS);
         if (rc == -1 && errno == EINTR)
             continue;
         if (rc == -1)
@@ -0,0 +1,136 @@
+/*  =========================================================================
+    zmtpport - allocator hooks
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtp_classes.h"
+
+static void *
+    s_malloc (void *hint, size_t size);
+static void *
+    s_realloc (void *hint, void *ptr, size_t size);
+static void
+    s_free (void *hint, void *ptr);
+
+//  The C library's allocator, used until another is installed
+
+static const zmtp_allocator_t s_system = {
+    .alloc = s_malloc,
+    .realloc = s_realloc,
+    .free = s_free
+};
+
+//  Installed allocator; written only while the library is idle, so the
+//  hot paths read it without synchronization
+
+static zmtp_allocator_t s_allocator = {
+    .alloc = s_malloc,
+    .realloc = s_realloc,
+    .free = s_free
+};
+
+
+//  --------------------------------------------------------------------------
+//  Take all memory from allocator from now on, or from the C library again
+//  if allocator is NULL. Call before creating any object or starting I/O
+//  threads, and release everything before switching again: memory must go
+//  back to the allocator it came from; the endpoints the library caches are
+//  released here. Returns false if allocator lacks a function.
+
+bool zmtp_set_allocator (const zmtp_allocator_t *allocator)
+{
+    if (!allocator) {
+        zmtp_endpoint_cache_purge ();
+        s_allocator = s_system;
+        return true;
+    }
+    if (!allocator->alloc || !allocator->realloc || !allocator->free)
+        return false;
+    zmtp_endpoint_cache_purge ();
+    s_allocator = *allocator;
+    return true;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate size bytes
+
+void *
+zmtp_malloc (size_t size)
+{
+    return s_allocator.alloc (s_allocator.hint, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocate size bytes set to zero
+
+void *
+zmtp_zmalloc (size_t size)
+{
+    void *ptr = s_allocator.alloc (s_allocator.hint, size);
+    if (ptr)
+        memset (ptr, 0, size);
+    return ptr;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Resize a block, moving it if needed
+
+void *
+zmtp_realloc (void *ptr, size_t size)
+{
+    return s_allocator.realloc (s_allocator.hint, ptr, size);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Release a block
+
+void
+zmtp_free (void *ptr)
+{
+    if (ptr)
+        s_allocator.free (s_allocator.hint, ptr);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Return a copy of string
+
+char *
+zmtp_strdup (const char *string)
+{
+    const size_t size = strlen (string) + 1;
+    char *copy = (char *) zmtp_malloc (size);
+    if (copy)
+        memcpy (copy, string, size);
+    return copy;
+}
+
+
+static void *
+s_malloc (void *hint, size_t size)
+{
+    return malloc (size);
+}
+
+static void *
+s_realloc (void *hint, void *ptr, size_t size)
+{
+    return realloc (ptr, size);
+}
+
+static void
+s_free (void *hint, void *ptr)
+{
+    free (ptr);
+}
@@ -11,6 +11,7 @@
 */
 
 #include "zmtpinc.h"
+#include "zmtp_classes.h"
 
 
 #include <poll.h>
@@ -83,6 +84,36 @@ s_echo_serv (void *arg)
     return NULL;
 }
 
+//  Allocator that counts what it hands out, to check where the library
+//  allocates
+
+struct alloc_counts {
+    size_t allocs;
+    size_t frees;
+};
+
+static void *
+s_count_alloc (void *hint, size_t size)
+{
+    ((struct alloc_counts *) hint)->allocs++;
+    return malloc (size);
+}
+
+static void *
+s_count_realloc (void *hint, void *ptr, size_t size)
+{
+    if (!ptr)
+        ((struct alloc_counts *) hint)->allocs++;
+    return realloc (ptr, size);
+}
+
+static void
+s_count_free (void *hint, void *ptr)
+{
+    ((struct alloc_counts *) hint)->frees++;
+    free (ptr);
+}
+
 struct script_line {
     char cmd;           // 'i' for input, 'o' for output, 'x' terminator
     size_t data_len;    //  length of data
@@ -145,6 +176,390 @@ s_test_server (void *arg)
     return NULL;
 }
 
+//  ZMTP peer on an ipc:// endpoint that takes memfds, echoes messages
+//  until it gets an empty one, and counts those that arrived mapped
+
+struct memfd_peer_t {
+    const char *endpoint;
+    size_t mapped;
+};
+
+static void *
+s_memfd_peer (void *arg)
+{
+    struct memfd_peer_t *params = (struct memfd_peer_t *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    int rc = zmtp_channel_set_memfd (channel, 65536);
+    assert (rc == 0);
+    rc = zmtp_channel_listen (channel, params->endpoint);
+    assert (rc == 0);
+    while (true) {
+        zmtp_msg_t *msg = zmtp_channel_recv (channel);
+        assert (msg);
+        if (msg->mapped)
+            params->mapped++;
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        const size_t size = zmtp_msg_size (msg);
+        zmtp_msg_destroy (&msg);
+        if (size == 0)
+            break;
+    }
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  ZMTP peer that listens as the given socket type with identity
+//  "server", and keeps the identity the other side gave
+
+struct ready_peer_t {
+    const char *endpoint;
+    int socket_type;
+    int rc;
+    int error;
+    zmtp_identity_t *identity;
+};
+
+static void *
+s_ready_peer (void *arg)
+{
+    struct ready_peer_t *params = (struct ready_peer_t *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    int rc = zmtp_channel_set_socket_type (channel, params->socket_type);
+    assert (rc == 0);
+    rc = zmtp_channel_set_identity (channel, "server", 6);
+    assert (rc == 0);
+    params->rc = zmtp_channel_listen (channel, params->endpoint);
+    params->error = errno;
+    if (zmtp_channel_peer_identity (channel))
+        params->identity =
+            zmtp_identity_ref (zmtp_channel_peer_identity (channel));
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  ZMTP peer that connects to an endpoint and echoes one message
+
+static void *
+s_connect_echo (void *arg)
+{
+    const char *endpoint = (const char *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    while (zmtp_channel_connect (channel, endpoint) == -1)
+        usleep (10 * 1000);
+    zmtp_msg_t *msg = zmtp_channel_recv (channel);
+    assert (msg);
+    const int rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  ZMTP peer over the given end of a socketpair that hangs up shortly
+//  after the other side starts sending
+
+static void *
+s_hangup_peer (void *arg)
+{
+    const int fd = *(int *) arg;
+    zmtp_channel_t *channel = zmtp_channel_new ();
+    const int rc = zmtp_channel_adopt (channel, fd);
+    assert (rc == 0);
+    struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+    while (poll (&pollfd, 1, -1) == -1)
+        assert (errno == EINTR);
+    usleep (100 * 1000);        //  Long enough to fill the socket buffer
+    zmtp_channel_destroy (&channel);
+    return NULL;
+}
+
+//  Create a listening TCP socket on the loopback interface, which is
+//  never accepted from; returns the socket and its port.
+
+static int
+s_loopback_listener (int family, int backlog, unsigned short *port)
+{
+    const int s = socket (family, SOCK_STREAM, 0);
+    if (s == -1)
+        return -1;
+    struct sockaddr_storage addr = { .ss_family = family };
+    if (family == AF_INET6)
+        ((struct sockaddr_in6 *) &addr)->sin6_addr = in6addr_loopback;
+    else
+        ((struct sockaddr_in *) &addr)->sin_addr.s_addr =
+            htonl (INADDR_LOOPBACK);
+    socklen_t addrlen = family == AF_INET6
+        ? sizeof (struct sockaddr_in6): sizeof (struct sockaddr_in);
+    if (bind (s, (struct sockaddr *) &addr, addrlen) == -1
+    ||  listen (s, backlog) == -1
+    ||  getsockname (s, (struct sockaddr *) &addr, &addrlen) == -1) {
+        close (s);
+        return -1;
+    }
+    *port = ntohs (family == AF_INET6
+        ? ((struct sockaddr_in6 *) &addr)->sin6_port
+        : ((struct sockaddr_in *) &addr)->sin_port);
+    return s;
+}
+
+void
+zmtp_tcp_endpoint_test (bool verbose)
+{
+    printf (" * zmtp_tcp_endpoint: ");
+    //  @selftest
+    unsigned short port;
+    const int listener = s_loopback_listener (AF_INET, 1, &port);
+    assert (listener != -1);
+
+    //  Connect races resolved addresses and returns a blocking socket
+    zmtp_tcp_endpoint_t *endpoint = zmtp_tcp_endpoint_new ("127.0.0.1", port);
+    assert (endpoint);
+    int s = zmtp_tcp_endpoint_connect_timeout (endpoint, 1000);
+    assert (s != -1);
+    assert ((fcntl (s, F_GETFL, 0) & O_NONBLOCK) == 0);
+    close (s);
+    zmtp_tcp_endpoint_destroy (&endpoint);
+
+    //  Once the listen backlog is full the peer drops our SYNs; the
+    //  deadline must cut the attempt short
+    endpoint = zmtp_tcp_endpoint_new ("127.0.0.1", port);
+    assert (endpoint);
+    int queued [4];
+    size_t nqueued = 0;
+    int64_t start;
+    while (true) {
+        start = zmtp_clock_mono ();
+        s = zmtp_tcp_endpoint_connect_timeout (endpoint, 200);
+        if (s == -1)
+            break;
+        assert (nqueued < 4);
+        queued [nqueued++] = s;
+    }
+    assert (errno == ETIMEDOUT);
+    assert (zmtp_clock_mono () - start < 1000);
+    while (nqueued)
+        close (queued [--nqueued]);
+    zmtp_tcp_endpoint_destroy (&endpoint);
+
+    //  Refused connection fails fast rather than waiting for the deadline
+    close (listener);
+    endpoint = zmtp_tcp_endpoint_new ("127.0.0.1", port);
+    assert (endpoint);
+    start = zmtp_clock_mono ();
+    s = zmtp_tcp_endpoint_connect_timeout (endpoint, 5000);
+    assert (s == -1);
+    assert (errno == ECONNREFUSED);
+    assert (zmtp_clock_mono () - start < 1000);
+    zmtp_tcp_endpoint_destroy (&endpoint);
+
+    //  IPv6 literals resolve when the host has IPv6 loopback
+    const int listener6 = s_loopback_listener (AF_INET6, 1, &port);
+    if (listener6 != -1) {
+        endpoint = zmtp_tcp_endpoint_new ("::1", port);
+        assert (endpoint);
+        s = zmtp_tcp_endpoint_connect_timeout (endpoint, 1000);
+        assert (s != -1);
+        close (s);
+        zmtp_tcp_endpoint_destroy (&endpoint);
+        close (listener6);
+    }
+
+    //  Hostnames are resolved in the background, here from /etc/hosts
+    const int named = s_loopback_listener (AF_INET, 1, &port);
+    assert (named != -1);
+    endpoint = zmtp_tcp_endpoint_new ("localhost", port);
+    assert (endpoint);
+    s = zmtp_tcp_endpoint_connect_timeout (endpoint, 5000);
+    assert (s != -1);
+    close (s);
+    zmtp_tcp_endpoint_destroy (&endpoint);
+    close (named);
+
+    //  Anything else is refused up front
+    endpoint = zmtp_tcp_endpoint_new ("local host", port);
+    assert (endpoint == NULL);
+    endpoint = zmtp_tcp_endpoint_new ("local..host", port);
+    assert (endpoint == NULL);
+    //  @end
+    printf ("OK\n");
+}
+
+void
+zmtp_endpoint_test (bool verbose)
+{
+    printf (" * zmtp_endpoint: ");
+    //  @selftest
+    const char *invalid [] = {
+        "udp://127.0.0.1:5555", "tcp://127.0.0.1", "tcp://127.0.0.1:",
+        "tcp://127.0.0.1:99999", "tcp://127.0.0.1:55x", "tcp://[::1]",
+        "tcp://local host:5555"
+    };
+    for (size_t i = 0; i < sizeof invalid / sizeof *invalid; i++) {
+        zmtp_endpoint_t *endpoint = zmtp_endpoint_new (invalid [i]);
+        assert (endpoint == NULL && errno == EINVAL);
+        endpoint = zmtp_endpoint_lookup (invalid [i]);
+        assert (endpoint == NULL && errno == EINVAL);
+    }
+    zmtp_endpoint_t *endpoint = zmtp_endpoint_new ("tcp://[::1]:5555");
+    assert (endpoint);
+    zmtp_endpoint_destroy (&endpoint);
+    endpoint = zmtp_endpoint_new ("ipc://@zmtp-endpoint");
+    assert (endpoint);
+    zmtp_endpoint_destroy (&endpoint);
+
+    //  A cached endpoint is shared and costs no allocation; each
+    //  reference is destroyed on its own
+    struct alloc_counts counts = { 0 };
+    const zmtp_allocator_t counting = {
+        s_count_alloc, s_count_realloc, s_count_free, &counts
+    };
+    assert (zmtp_set_allocator (&counting));
+    endpoint = zmtp_endpoint_lookup ("tcp://127.0.0.1:5555");
+    assert (endpoint);
+    const struct alloc_counts before = counts;
+    zmtp_endpoint_t *again = zmtp_endpoint_lookup ("tcp://127.0.0.1:5555");
+    assert (again == endpoint);
+    assert (counts.allocs == before.allocs);
+    zmtp_endpoint_destroy (&again);
+    zmtp_endpoint_destroy (&endpoint);
+    assert (counts.frees == before.frees);
+
+    //  Expired entries are parsed again; the TTL applies to entries cached
+    //  from now on
+    zmtp_endpoint_cache_purge ();
+    zmtp_endpoint_cache_set_ttl (1);
+    endpoint = zmtp_endpoint_lookup ("tcp://127.0.0.1:5555");
+    usleep (5 * 1000);
+    again = zmtp_endpoint_lookup ("tcp://127.0.0.1:5555");
+    assert (again && again != endpoint);
+    zmtp_endpoint_destroy (&again);
+    zmtp_endpoint_destroy (&endpoint);
+
+    //  Without a TTL nothing is kept
+    zmtp_endpoint_cache_set_ttl (0);
+    endpoint = zmtp_endpoint_lookup ("tcp://127.0.0.1:5555");
+    again = zmtp_endpoint_lookup ("tcp://127.0.0.1:5555");
+    assert (endpoint && again && again != endpoint);
+    zmtp_endpoint_destroy (&again);
+    zmtp_endpoint_destroy (&endpoint);
+    zmtp_endpoint_cache_set_ttl (ZMTP_ENDPOINT_TTL);
+    zmtp_set_allocator (NULL);
+    assert (counts.allocs == counts.frees);
+    //  @end
+    printf ("OK\n");
+}
+
+//  Stub resolver: names starting zmtp-test- are loopback, zmtp-test-slow
+//  only after a delay, and all others do not exist
+
+static int s_stub_calls = 0;
+
+static int
+s_stub_resolve (const char *node, const char *service,
+                const struct addrinfo *hints, struct addrinfo **res)
+{
+    __atomic_fetch_add (&s_stub_calls, 1, __ATOMIC_RELAXED);
+    if (strncmp (node, "zmtp-test-", 10) != 0)
+        return EAI_NONAME;
+    if (streq (node, "zmtp-test-slow"))
+        usleep (300 * 1000);
+    const struct addrinfo numeric = {
+        .ai_family   = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags    = AI_NUMERICHOST
+    };
+    return getaddrinfo ("127.0.0.1", service, &numeric, res);
+}
+
+static int
+s_stub_calls_now (void)
+{
+    return __atomic_load_n (&s_stub_calls, __ATOMIC_RELAXED);
+}
+
+void
+zmtp_resolver_test (bool verbose)
+{
+    printf (" * zmtp_resolver: ");
+    //  @selftest
+    zmtp_resolver_set_fn (s_stub_resolve);
+    zmtp_resolved_t resolved;
+
+    //  A name not looked up yet is not waited for without a timeout
+    int rc = zmtp_resolver_resolve ("zmtp-test-host", 5555, 0, &resolved);
+    assert (rc == -1 && errno == EAGAIN);
+    rc = zmtp_resolver_resolve ("zmtp-test-host", 5555, 5000, &resolved);
+    assert (rc == 0);
+    const struct sockaddr_in *addr =
+        (const struct sockaddr_in *) resolved.addrinfo->ai_addr;
+    assert (addr->sin_family == AF_INET);
+    assert (ntohs (addr->sin_port) == 5555);
+    assert (resolved.addrinfo->ai_next == NULL);
+
+    //  Answers are cached and serve any port
+    int calls = s_stub_calls_now ();
+    rc = zmtp_resolver_resolve ("zmtp-test-host", 6666, 0, &resolved);
+    assert (rc == 0);
+    addr = (const struct sockaddr_in *) resolved.addrinfo->ai_addr;
+    assert (ntohs (addr->sin_port) == 6666);
+    assert (s_stub_calls_now () == calls);
+
+    //  So are failures
+    rc = zmtp_resolver_resolve ("no-such-host", 5555, 5000, &resolved);
+    assert (rc == -1 && errno == EHOSTUNREACH);
+    calls = s_stub_calls_now ();
+    rc = zmtp_resolver_resolve ("no-such-host", 5555, 0, &resolved);
+    assert (rc == -1 && errno == EHOSTUNREACH);
+    assert (s_stub_calls_now () == calls);
+
+    //  A slow lookup holds the caller no longer than its deadline
+    int64_t start = zmtp_clock_mono ();
+    rc = zmtp_resolver_resolve ("zmtp-test-slow", 5555, 50, &resolved);
+    assert (rc == -1 && errno == ETIMEDOUT);
+    assert (zmtp_clock_mono () - start < 250);
+    rc = zmtp_resolver_resolve ("zmtp-test-slow", 5555, 5000, &resolved);
+    assert (rc == 0);
+
+    //  An answer in use is looked up again before it expires, and served
+    //  from the cache meanwhile
+    zmtp_resolver_set_ttl (1000, 1000);
+    zmtp_resolver_purge ();
+    rc = zmtp_resolver_resolve ("zmtp-test-host", 5555, 5000, &resolved);
+    assert (rc == 0);
+    calls = s_stub_calls_now ();
+    usleep (800 * 1000);
+    rc = zmtp_resolver_resolve ("zmtp-test-host", 5555, 0, &resolved);
+    assert (rc == 0);
+    start = zmtp_clock_mono ();
+    while (s_stub_calls_now () == calls) {
+        assert (zmtp_clock_mono () - start < 5000);
+        usleep (1000);
+    }
+    zmtp_resolver_set_ttl (ZMTP_RESOLVER_TTL, ZMTP_RESOLVER_NEGATIVE_TTL);
+
+    //  Endpoints connect through it
+    unsigned short port;
+    const int listener = s_loopback_listener (AF_INET, 1, &port);
+    assert (listener != -1);
+    zmtp_tcp_endpoint_t *endpoint =
+        zmtp_tcp_endpoint_new ("zmtp-test-host", port);
+    assert (endpoint);
+    const int s = zmtp_tcp_endpoint_connect_timeout (endpoint, 5000);
+    assert (s != -1);
+    close (s);
+    zmtp_tcp_endpoint_destroy (&endpoint);
+    close (listener);
+    endpoint = zmtp_tcp_endpoint_new ("no-such-host", port);
+    assert (endpoint);
+    rc = zmtp_tcp_endpoint_connect_timeout (endpoint, 5000);
+    assert (rc == -1 && errno == EHOSTUNREACH);
+    zmtp_tcp_endpoint_destroy (&endpoint);
+    zmtp_resolver_set_fn (NULL);
+    //  @end
+    printf ("OK\n");
+}
+
 //  --------------------------------------------------------------------------
 //  Selftest
 
@@ -158,6 +573,13 @@ zmtp_channel_test (bool verbose)
     struct echo_serv_t echo_serv_params = { .port = 22001 };
     pthread_create (&thread, NULL, s_echo_serv, &echo_serv_params);
     sleep (1);
+    struct alloc_counts counts = { 0 };
+    const zmtp_allocator_t counting = {
+        s_count_alloc, s_count_realloc, s_count_free, &counts
+    };
+    const zmtp_allocator_t incomplete = { s_count_alloc };
+    assert (!zmtp_set_allocator (&incomplete));
+    assert (zmtp_set_allocator (&counting));
     zmtp_channel_t *channel = zmtp_channel_new ();
     assert (channel);
     int rc = zmtp_channel_tcp_connect (channel, "127.0.0.1", 22001);
@@ -169,7 +591,10 @@ zmtp_channel_test (bool verbose)
         "4444",
         "55555"
     };
-        
+
+    //  In steady state the channel allocates nothing itself; each round
+    //  trip takes only our message and the one received (frame and body)
+    const struct alloc_counts before = counts;
     for (int i = 0; i < 5; i++) {
         zmtp_msg_t *msg = zmtp_msg_from_const_data (
             0, test_strings [i], strlen (test_strings [i]));
@@ -184,8 +609,449 @@ zmtp_channel_test (bool verbose)
         zmtp_msg_destroy (&msg);
         zmtp_msg_destroy (&msg2);
     }
+    assert (counts.allocs - before.allocs == 5 * 3);
+    assert (counts.frees - before.frees == 5 * 3);
+    //  Traffic is counted, the READY commands included
+    zmtp_stats_t stats;
+    zmtp_channel_stats (channel, &stats);
+    assert (stats.frames_out == 6 && stats.frames_in == 6);
+    assert (stats.commands_out == 1 && stats.commands_in == 1);
+    assert (stats.bytes_out == 6 + 15 && stats.bytes_in == 6 + 15);
+    assert (stats.send_calls >= 6 && stats.recv_calls >= 6);
+    assert (stats.allocations == 6);
+    assert (stats.handshakes == 1);
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+    assert (counts.allocs > 0 && counts.allocs == counts.frees);
+    zmtp_set_allocator (NULL);
+
+    //  Kernel timestamps fall between sending and receiving the echo, and
+    //  each sent frame's transmit time is reported in order
+    echo_serv_params.port = 22002;
+    pthread_create (&thread, NULL, s_echo_serv, &echo_serv_params);
+    sleep (1);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    rc = zmtp_channel_set_timestamping (channel, 4);
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_channel_set_timestamping (
+        channel, ZMTP_TIMESTAMP_RX | ZMTP_TIMESTAMP_TX);
+    assert (rc == 0);
+    rc = zmtp_channel_tcp_connect (channel, "127.0.0.1", 22002);
+    assert (rc == 0);
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    const int64_t sent_at = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    for (int i = 0; i < 3; i++) {
+        zmtp_msg_t *msg = zmtp_msg_from_const_data (0, "stamp", 5);
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+        msg = zmtp_channel_recv (channel);
+        assert (msg);
+        clock_gettime (CLOCK_REALTIME, &ts);
+        const int64_t now = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+        assert (zmtp_msg_timestamp (msg) >= sent_at);
+        assert (zmtp_msg_timestamp (msg) <= now);
+        zmtp_msg_destroy (&msg);
+    }
+    for (uint64_t expected = 0; expected < 3; expected++) {
+        uint64_t frame;
+        int64_t stamp;
+        for (int tries = 0; tries < 1000; tries++) {
+            rc = zmtp_channel_send_timestamp (channel, &frame, &stamp);
+            if (rc == 0)
+                break;
+            assert (errno == EAGAIN);
+            usleep (1000);
+        }
+        assert (rc == 0);
+        assert (frame == expected);
+        assert (stamp >= sent_at);
+    }
+    uint64_t frame;
+    int64_t stamp;
+    rc = zmtp_channel_send_timestamp (channel, &frame, &stamp);
+    assert (rc == -1 && errno == EAGAIN);
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+
+    //  Large bodies are handed to the kernel, which holds their messages
+    //  until it is done with them, however soon the sender lets go; small
+    //  ones are copied
+    echo_serv_params.port = 22003;
+    pthread_create (&thread, NULL, s_echo_serv, &echo_serv_params);
+    sleep (1);
+    memset (&counts, 0, sizeof counts);
+    assert (zmtp_set_allocator (&counting));
+    channel = zmtp_channel_new ();
+    assert (channel);
+    rc = zmtp_channel_set_zerocopy (channel, 65536);
+    assert (rc == 0);
+    rc = zmtp_channel_tcp_connect (channel, "127.0.0.1", 22003);
+    assert (rc == 0);
+    zmtp_msg_t *zc_sent [3];
+    for (int i = 0; i < 3; i++) {
+        const size_t size = i == 1? 1000: 200000;
+        zmtp_msg_t *msg = zmtp_msg_new (0, size);
+        memset (zmtp_msg_data (msg), 'a' + i, size);
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        assert (msg->greedy && msg->refs == (i != 1));
+        zc_sent [i] = msg;
+        if (i == 2)
+            zmtp_msg_destroy (&zc_sent [i]);
+        msg = zmtp_channel_recv (channel);
+        assert (msg);
+        assert (zmtp_msg_size (msg) == size);
+        assert (zmtp_msg_data (msg) [0] == 'a' + i);
+        assert (zmtp_msg_data (msg) [size - 1] == 'a' + i);
+        zmtp_msg_destroy (&msg);
+    }
+    for (int tries = 0; tries < 1000; tries++) {
+        if (zmtp_channel_zerocopy_pending (channel) == 0)
+            break;
+        usleep (1000);
+    }
+    assert (zmtp_channel_zerocopy_pending (channel) == 0);
+    for (int i = 0; i < 2; i++) {
+        assert (zc_sent [i]->refs == 0);
+        assert (zmtp_msg_data (zc_sent [i]) [0] == 'a' + i);
+        zmtp_msg_destroy (&zc_sent [i]);
+    }
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+    assert (counts.allocs > 0 && counts.allocs == counts.frees);
+    zmtp_set_allocator (NULL);
+
+    //  Large bodies go to a local peer as memfds it maps, small ones down
+    //  the socket; the peer sends them back the same way
+    struct memfd_peer_t memfd_peer = { "ipc://@zmtp-channel-memfd" };
+    pthread_create (&thread, NULL, s_memfd_peer, &memfd_peer);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    rc = zmtp_channel_set_memfd (channel, 65536);
+    assert (rc == 0);
+    while (zmtp_channel_connect (channel, memfd_peer.endpoint) == -1)
+        usleep (10 * 1000);
+    const size_t sizes [] = { 1000000, 100, 65536, 0 };
+    for (int i = 0; i < 4; i++) {
+        zmtp_msg_t *msg = zmtp_msg_new (ZMTP_MSG_MORE, sizes [i]);
+        memset (zmtp_msg_data (msg), 'a' + i, sizes [i]);
+        rc = zmtp_channel_send (channel, msg);
+        assert (rc == 0);
+        zmtp_msg_destroy (&msg);
+        msg = zmtp_channel_recv (channel);
+        assert (msg);
+        assert (zmtp_msg_flags (msg) == ZMTP_MSG_MORE);
+        assert (zmtp_msg_size (msg) == sizes [i]);
+        assert (msg->mapped == (sizes [i] >= 65536));
+        for (size_t at = 0; at < sizes [i]; at += 4093)
+            assert (zmtp_msg_data (msg) [at] == 'a' + i);
+        zmtp_msg_destroy (&msg);
+    }
+    pthread_join (thread, NULL);
+    assert (memfd_peer.mapped == 2);
+    zmtp_channel_stats (channel, &stats);
+    assert (stats.bytes_in == 6 + 1000000 + 100 + 65536);
+    assert (stats.commands_in == 1);
+    zmtp_channel_destroy (&channel);
+
+    //  A channel accepts a connection on a listener it was handed, which
+    //  stays open for the next one
+    unsigned short listener_port;
+    const int listener = s_loopback_listener (AF_INET, 1, &listener_port);
+    assert (listener != -1);
+    char listener_endpoint [32];
+    snprintf (listener_endpoint, sizeof listener_endpoint,
+        "tcp://127.0.0.1:%u", listener_port);
+    pthread_create (&thread, NULL, s_connect_echo, listener_endpoint);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_adopt (channel, listener);
+    assert (rc == 0);
+    assert (zmtp_channel_fd (channel) != listener);
+    zmtp_msg_t *adopted = zmtp_msg_from_const_data (0, "adopted", 7);
+    rc = zmtp_channel_send (channel, adopted);
+    assert (rc == 0);
+    zmtp_msg_destroy (&adopted);
+    adopted = zmtp_channel_recv (channel);
+    assert (adopted && zmtp_msg_size (adopted) == 7);
+    zmtp_msg_destroy (&adopted);
+    pthread_join (thread, NULL);
+    zmtp_channel_destroy (&channel);
+    assert (fcntl (listener, F_GETFD) != -1);
+    close (listener);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_adopt (channel, listener);
+    assert (rc == -1 && errno == EBADF);
+    zmtp_channel_destroy (&channel);
+
+    //  Parts of a file go out as frames, by sendfile or from a mapping
+    echo_serv_params.port = 22004;
+    pthread_create (&thread, NULL, s_echo_serv, &echo_serv_params);
+    sleep (1);
+    char path [] = "/tmp/zmtp_channel_XXXXXX";
+    const int file = mkstemp (path);
+    assert (file != -1);
+    unlink (path);
+    byte blob [100000];
+    for (size_t i = 0; i < sizeof blob; i++)
+        blob [i] = (byte) (i * 7);
+    rc = write (file, blob, sizeof blob);
+    assert (rc == sizeof blob);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    rc = zmtp_channel_tcp_connect (channel, "127.0.0.1", 22004);
+    assert (rc == 0);
+    rc = zmtp_channel_send_file (channel, file, 99000, 2000, 0);
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_channel_send_file (channel, file, 0, 10, ZMTP_MSG_COMMAND);
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_channel_send_file (channel, file, 1000, 50000, ZMTP_MSG_MORE);
+    assert (rc == 0);
+    zmtp_msg_t *mapped = zmtp_msg_from_file (0, file, 3, 20000);
+    assert (mapped);
+    rc = zmtp_channel_send (channel, mapped);
+    assert (rc == 0);
+    zmtp_msg_destroy (&mapped);
+    zmtp_msg_t *msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_flags (msg) == ZMTP_MSG_MORE);
+    assert (zmtp_msg_size (msg) == 50000);
+    assert (memcmp (zmtp_msg_data (msg), blob + 1000, 50000) == 0);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_channel_recv (channel);
+    assert (msg);
+    assert (zmtp_msg_flags (msg) == 0);
+    assert (zmtp_msg_size (msg) == 20000);
+    assert (memcmp (zmtp_msg_data (msg), blob + 3, 20000) == 0);
+    zmtp_msg_destroy (&msg);
+    zmtp_channel_stats (channel, &stats);
+    assert (stats.frames_out == 3 && stats.bytes_out == 6 + 70000);
+    zmtp_channel_destroy (&channel);
+    close (file);
+    pthread_join (thread, NULL);
+
+    //  A file sent to a peer that hangs up midway fails with EPIPE and
+    //  raises no SIGPIPE; the socket buffer fills long before the end, so
+    //  the send has to wait for room
+    strcpy (path, "/tmp/zmtp_channel_XXXXXX");
+    const int big_file = mkstemp (path);
+    assert (big_file != -1);
+    unlink (path);
+    rc = ftruncate (big_file, 16 * 1024 * 1024);
+    assert (rc == 0);
+    int hangup_pair [2];
+    rc = socketpair (AF_UNIX, SOCK_STREAM, 0, hangup_pair);
+    assert (rc == 0);
+    pthread_create (&thread, NULL, s_hangup_peer, &hangup_pair [1]);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_adopt (channel, hangup_pair [0]);
+    assert (rc == 0);
+    rc = zmtp_channel_send_file (channel, big_file, 0, 16 * 1024 * 1024, 0);
+    assert (rc == -1 && (errno == EPIPE || errno == ECONNRESET));
+    zmtp_channel_stats (channel, &stats);
+    assert (stats.eagains > 0);
+    pthread_join (thread, NULL);
+    zmtp_channel_destroy (&channel);
+    close (big_file);
+
+    //  A multipart message goes out in one write and comes back whole,
+    //  or frame by frame with the MORE flag on all but the last
+    echo_serv_params.port = 22005;
+    pthread_create (&thread, NULL, s_echo_serv, &echo_serv_params);
+    sleep (1);
+    channel = zmtp_channel_new ();
+    assert (channel);
+    rc = zmtp_channel_tcp_connect (channel, "127.0.0.1", 22005);
+    assert (rc == 0);
+    zmtp_multipart_t *multipart = zmtp_multipart_new ();
+    rc = zmtp_channel_send_multipart (channel, multipart);
+    assert (rc == -1 && errno == EINVAL);
+    zmtp_multipart_append (multipart, "peer", 4);
+    zmtp_multipart_append (multipart, NULL, 0);
+    byte *body = zmtp_multipart_add (multipart, 100000);
+    memcpy (body, blob, 100000);
+    zmtp_multipart_append (multipart, "tail", 4);
+    for (int i = 0; i < 2; i++) {
+        rc = zmtp_channel_send_multipart (channel, multipart);
+        assert (rc == 0);
+    }
+    zmtp_multipart_t *echoed = zmtp_channel_recv_multipart (channel);
+    assert (echoed);
+    assert (zmtp_multipart_parts (echoed) == 4);
+    assert (zmtp_multipart_size (echoed) == 100008);
+    assert (memcmp (zmtp_multipart_data (echoed),
+        zmtp_multipart_data (multipart), 100008) == 0);
+    assert (zmtp_multipart_part_size (echoed, 1) == 0);
+    zmtp_multipart_destroy (&echoed);
+    for (size_t part = 0; part < 4; part++) {
+        msg = zmtp_channel_recv (channel);
+        assert (msg);
+        assert (zmtp_msg_flags (msg) == (part < 3? ZMTP_MSG_MORE: 0));
+        assert (zmtp_msg_size (msg)
+            == zmtp_multipart_part_size (multipart, part));
+        assert (memcmp (zmtp_msg_data (msg),
+            zmtp_multipart_part_data (multipart, part),
+            zmtp_msg_size (msg)) == 0);
+        zmtp_msg_destroy (&msg);
+    }
+    zmtp_channel_stats (channel, &stats);
+    assert (stats.frames_out == 9 && stats.bytes_out == 6 + 2 * 100008);
+    zmtp_channel_destroy (&channel);
+    pthread_join (thread, NULL);
+
+    //  A large part coming back as a memfd is read into the message too
+    memfd_peer.endpoint = "ipc://@zmtp-channel-multipart";
+    memfd_peer.mapped = 0;
+    pthread_create (&thread, NULL, s_memfd_peer, &memfd_peer);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_set_memfd (channel, 65536);
+    assert (rc == 0);
+    while (zmtp_channel_connect (channel, memfd_peer.endpoint) == -1)
+        usleep (10 * 1000);
+    zmtp_multipart_reset (multipart);
+    zmtp_multipart_append (multipart, "peer", 4);
+    zmtp_multipart_append (multipart, blob, 100000);
+    zmtp_multipart_append (multipart, NULL, 0);
+    rc = zmtp_channel_send_multipart (channel, multipart);
+    assert (rc == 0);
+    echoed = zmtp_channel_recv_multipart (channel);
+    assert (echoed);
+    assert (zmtp_multipart_parts (echoed) == 3);
+    assert (zmtp_multipart_part_size (echoed, 1) == 100000);
+    assert (memcmp (zmtp_multipart_part_data (echoed, 1), blob, 100000)
+        == 0);
+    zmtp_multipart_destroy (&echoed);
+    pthread_join (thread, NULL);
+    assert (memfd_peer.mapped == 0);
     zmtp_channel_destroy (&channel);
+    zmtp_multipart_destroy (&multipart);
+
+    //  A peer passing more descriptors than we hold loses the extra ones,
+    //  and every one it passed is closed in the end
+    memfd_peer.endpoint = "ipc://@zmtp-channel-fds";
+    pthread_create (&thread, NULL, s_memfd_peer, &memfd_peer);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_set_memfd (channel, 65536);
+    assert (rc == 0);
+    while (zmtp_channel_connect (channel, memfd_peer.endpoint) == -1)
+        usleep (10 * 1000);
+    int pipe_fds [2];
+    rc = pipe (pipe_fds);
+    assert (rc == 0);
+    int passed [24];
+    for (size_t i = 0; i < 24; i++)
+        passed [i] = pipe_fds [1];
+    union {
+        char buf [CMSG_SPACE (sizeof passed)];
+        struct cmsghdr align;
+    } control;
+    struct iovec fds_iov = { .iov_base = "\0\1x", .iov_len = 3 };
+    struct msghdr fds_msg = {
+        .msg_iov = &fds_iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR (&fds_msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof passed);
+    memcpy (CMSG_DATA (cmsg), passed, sizeof passed);
+    rc = sendmsg (zmtp_channel_fd (channel), &fds_msg, 0);
+    assert (rc == 3);
+    close (pipe_fds [1]);
+    msg = zmtp_channel_recv (channel);
+    assert (msg && zmtp_msg_size (msg) == 1);
+    zmtp_msg_destroy (&msg);
+    msg = zmtp_msg_new (0, 0);
+    rc = zmtp_channel_send (channel, msg);
+    assert (rc == 0);
+    zmtp_msg_destroy (&msg);
     pthread_join (thread, NULL);
+    struct pollfd pipe_poll = { .fd = pipe_fds [0], .events = POLLIN };
+    rc = poll (&pipe_poll, 1, 5000);
+    assert (rc == 1);
+    char none;
+    rc = read (pipe_fds [0], &none, 1);
+    assert (rc == 0);           //  No write end is left open
+    close (pipe_fds [0]);
+    zmtp_channel_destroy (&channel);
+
+    //  READY carries socket types and identities; the peer's properties
+    //  are read in place and its identity is interned
+    struct ready_peer_t ready_peer = {
+        "ipc://@zmtp-channel-ready", ZMTP_ROUTER
+    };
+    pthread_create (&thread, NULL, s_ready_peer, &ready_peer);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_set_socket_type (channel, ZMTP_STREAM + 1);
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_channel_set_identity (channel, blob, ZMTP_IDENTITY_MAX + 1);
+    assert (rc == -1 && errno == EINVAL);
+    rc = zmtp_channel_set_socket_type (channel, ZMTP_DEALER);
+    assert (rc == 0);
+    rc = zmtp_channel_set_identity (channel, "client-1", 8);
+    assert (rc == 0);
+    while (zmtp_channel_connect (channel, ready_peer.endpoint) == -1)
+        usleep (10 * 1000);
+    pthread_join (thread, NULL);
+    assert (ready_peer.rc == 0);
+    zmtp_identity_t *identity = zmtp_identity_intern ("client-1", 8);
+    assert (ready_peer.identity == identity);
+    zmtp_identity_destroy (&identity);
+    zmtp_identity_destroy (&ready_peer.identity);
+    assert (zmtp_channel_peer_socket_type (channel) == ZMTP_ROUTER);
+    size_t property_size;
+    const byte *property =
+        zmtp_channel_peer_property (channel, "socket-type", &property_size);
+    assert (property && property_size == 6);
+    assert (memcmp (property, "ROUTER", 6) == 0);
+    assert (!zmtp_channel_peer_property (channel, "Resource", &property_size));
+    identity = zmtp_channel_peer_identity (channel);
+    assert (identity && zmtp_identity_size (identity) == 6);
+    assert (memcmp (zmtp_identity_data (identity), "server", 6) == 0);
+    zmtp_channel_destroy (&channel);
+
+    //  Socket types that may not talk to each other fail the handshake
+    ready_peer.socket_type = ZMTP_PULL;
+    pthread_create (&thread, NULL, s_ready_peer, &ready_peer);
+    channel = zmtp_channel_new ();
+    rc = zmtp_channel_set_socket_type (channel, ZMTP_PUB);
+    assert (rc == 0);
+    while ((rc = zmtp_channel_connect (channel, ready_peer.endpoint)) == -1
+        && errno != EPROTO)
+        usleep (10 * 1000);
+    assert (rc == -1);
+    assert (zmtp_channel_peer_socket_type (channel) == -1);
+    assert (!zmtp_channel_peer_property (channel, "Identity", &property_size));
+    pthread_join (thread, NULL);
+    assert (ready_peer.rc == -1 && ready_peer.error == EPROTO);
+    assert (ready_peer.identity == NULL);
+    zmtp_channel_destroy (&channel);
+
+    //  Peers that do not speak ZMTP v3 fail the handshake
+    const struct {
+        const char *greeting;
+        size_t size;
+    } strangers [] = {
+        { "GET / HTTP/1.1\r\n", 16 },                   //  Not ZMTP
+        { "\xFF\0\0\0\0\0\0\0\1\x7E\3", 11 },  //  ZMTP 1.0
+        { "\xFF\0\0\0\0\0\0\0\1\x7F\2", 11 }   //  ZMTP 2
+    };
+    for (size_t i = 0; i < sizeof strangers / sizeof strangers [0]; i++) {
+        int stranger [2];
+        rc = socketpair (AF_UNIX, SOCK_STREAM, 0, stranger);
+        assert (rc == 0);
+        rc = send (stranger [1], strangers [i].greeting, strangers [i].size, 0);
+        assert (rc == (int) strangers [i].size);
+        channel = zmtp_channel_new ();
+        rc = zmtp_channel_adopt (channel, stranger [0]);
+        assert (rc == -1 && errno == EPROTO);
+        zmtp_channel_destroy (&channel);
+        close (stranger [1]);
+    }
 
     //  Test flow, initial handshake, receive "ping 1" and "ping 2" messages,
     //  then send "pong 1" and "ping 2"
@@ -269,8 +1135,38 @@ zmtp_msg_test (bool verbose)
     assert (zmtp_msg_flags (msg) == 0);
     assert (zmtp_msg_size (msg) == 6);
     assert (memcmp (zmtp_msg_data (msg), "hello", 6) == 0);
+    assert (zmtp_msg_timestamp (msg) == 0);
+    msg->timestamp = 1;
+    zmtp_msg_t *copy = zmtp_msg_dup (msg);
+    assert (copy);
+    assert (zmtp_msg_data (copy) != zmtp_msg_data (msg));
+    assert (zmtp_msg_size (copy) == 6);
+    assert (memcmp (zmtp_msg_data (copy), "hello", 6) == 0);
+    assert (zmtp_msg_timestamp (copy) == 1);
+    zmtp_msg_destroy (&copy);
     zmtp_msg_destroy (&msg);
     assert (msg == NULL);
+
+    //  A mapped file body need not start on a page boundary
+    char path [] = "/tmp/zmtp_msg_XXXXXX";
+    const int fd = mkstemp (path);
+    assert (fd != -1);
+    unlink (path);
+    const off_t offset = 5000;
+    ssize_t rc = pwrite (fd, "mapped", 6, offset);
+    assert (rc == 6);
+    msg = zmtp_msg_from_file (ZMTP_MSG_MORE, fd, offset, 6);
+    assert (msg);
+    close (fd);
+    assert (zmtp_msg_flags (msg) == ZMTP_MSG_MORE);
+    assert (zmtp_msg_size (msg) == 6);
+    assert (memcmp (zmtp_msg_data (msg), "mapped", 6) == 0);
+    copy = zmtp_msg_dup (msg);
+    zmtp_msg_destroy (&msg);
+    assert (memcmp (zmtp_msg_data (copy), "mapped", 6) == 0);
+    zmtp_msg_destroy (&copy);
+    msg = zmtp_msg_from_file (0, -1, 0, 6);
+    assert (msg == NULL && errno == EBADF);
     //  @end
     printf ("OK\n");
 }
@@ -287,6 +1183,22 @@ int main (int argc, char *argv [])
 //     zmtp_msg_test (verbose);
 //     printf ("Tests passed OK\n");
     zmtp_msg_test (false);
+    zmtp_msgq_test (false);
+    zmtp_multipart_test (false);
+    zmtp_histogram_test (false);
+    zmtp_arena_test (false);
+    zmtp_metrics_test (false);
+    zmtp_codec_test (false);
+    zmtp_identity_test (false);
+    zmtp_mpscq_test (false);
+    zmtp_spscq_test (false);
+    zmtp_tcp_endpoint_test (false);
+    zmtp_endpoint_test (false);
+    zmtp_resolver_test (false);
     zmtp_channel_test (false);
+    zmtp_pool_test (false);
+    zmtp_io_thread_test (false);
+    zmtp_ctx_test (false);
+    zmtp_dealer_test (false);
     return 0;
 }
@@ -0,0 +1,291 @@
+/*  =========================================================================
+    zmtp_top - live traffic of libzmtp sockets in running processes
+
+    Attaches read-only to the shared memory segments that processes
+    publish their counters in (see zmtp_init_metrics, or run them with
+    ZMTP_METRICS=1) and shows, per socket, frame and byte rates each way,
+    queue depths and drops, busiest first. The watched processes do no
+    extra work while zmtp_top runs.
+
+        zmtp_top [-b] [-d seconds] [-n count] [segment ...]
+
+    With no segments named, watches every /dev/shm/zmtp-* segment. -b
+    prints one table after another instead of redrawing the screen, -d
+    sets the refresh delay (default 1) and -n exits after count tables.
+
+    Copyright (c) contributors as noted in the AUTHORS file.
+    This file is part of libzmtp, the C ZMTP stack.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#include "zmtpinc.h"
+#include "zmtp_classes.h"
+
+#include <dirent.h>
+
+//  Most segments watched at once
+
+#define MAX_SEGMENTS    64
+
+//  A segment name is a slash and a file name in /dev/shm
+
+typedef struct {
+    char name [NAME_MAX + 2];
+    zmtp_metrics_segment_t *segment;
+    ino_t dead;                 //  File of a dead publisher, 0 if none
+} segment_t;
+
+//  One socket, as seen in the last two samples
+
+typedef struct {
+    int64_t pid;
+    zmtp_metrics_record_t now;
+    zmtp_metrics_record_t before;
+    bool has_before;
+    bool seen;
+    double rate;                //  Bytes per second both ways, for sorting
+} row_t;
+
+static segment_t s_segments [MAX_SEGMENTS];
+static size_t s_nsegments = 0;
+static row_t *s_rows = NULL;
+static size_t s_nrows = 0;
+
+
+//  Return the inode of a segment's file, or 0 if it is gone
+
+static ino_t
+s_inode (const char *name)
+{
+    char path [sizeof "/dev/shm" + NAME_MAX + 1];
+    struct stat st;
+    if (snprintf (path, sizeof path, "/dev/shm%s", name) >= (int) sizeof path
+    ||  stat (path, &st) == -1)
+        return 0;
+    return st.st_ino;
+}
+
+
+//  Attach to a segment unless already attached, or attach again if its
+//  publisher died and it was created anew. Returns 0, or -1 with errno set.
+
+static int
+s_attach (const char *name)
+{
+    segment_t *slot = NULL;
+    for (size_t i = 0; i < s_nsegments && !slot; i++)
+        if (streq (s_segments [i].name, name))
+            slot = &s_segments [i];
+    if (slot && slot->segment)
+        return 0;
+    //  Until a new publisher replaces it, the file is the dead one's
+    if (slot && slot->dead && s_inode (name) == slot->dead)
+        return 0;
+    if (!slot && strlen (name) >= sizeof slot->name) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (!slot && s_nsegments == MAX_SEGMENTS) {
+        errno = EMFILE;
+        return -1;
+    }
+    zmtp_metrics_segment_t *segment = zmtp_metrics_open (name);
+    if (!segment)
+        return -1;
+    if (!slot) {
+        slot = &s_segments [s_nsegments++];
+        snprintf (slot->name, sizeof slot->name, "%s", name);
+    }
+    slot->segment = segment;
+    slot->dead = 0;
+    return 0;
+}
+
+
+//  Attach to every zmtp-* segment in /dev/shm
+
+static void
+s_discover (void)
+{
+    DIR *dir = opendir ("/dev/shm");
+    if (!dir)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir (dir)))
+        if (strncmp (entry->d_name, "zmtp-", 5) == 0) {
+            char name [NAME_MAX + 2];
+            if (snprintf (name, sizeof name, "/%s", entry->d_name)
+                < (int) sizeof name)
+                s_attach (name);
+        }
+    closedir (dir);
+}
+
+
+//  Read every published record, keeping the previous sample of each socket
+
+static void
+s_sample (void)
+{
+    for (size_t i = 0; i < s_nrows; i++)
+        s_rows [i].seen = false;
+    for (size_t i = 0; i < s_nsegments; i++) {
+        zmtp_metrics_segment_t *segment = s_segments [i].segment;
+        if (!segment)
+            continue;
+        if (kill ((pid_t) segment->pid, 0) == -1 && errno == ESRCH) {
+            //  Publisher died without removing its segment; remember the
+            //  file so discovery leaves it alone
+            s_segments [i].dead = s_inode (s_segments [i].name);
+            zmtp_metrics_close (&s_segments [i].segment);
+            continue;
+        }
+        for (size_t slot = 0; slot < ZMTP_METRICS_SLOTS; slot++) {
+            zmtp_metrics_record_t record;
+            if (zmtp_metrics_read (segment, slot, &record) == -1)
+                continue;
+            row_t *row = NULL;
+            for (size_t r = 0; r < s_nrows && !row; r++)
+                if (s_rows [r].pid == segment->pid
+                &&  s_rows [r].now.id == record.id)
+                    row = &s_rows [r];
+            if (row) {
+                row->before = row->now;
+                row->has_before = true;
+            }
+            else {
+                s_rows = (row_t *) realloc (s_rows,
+                    (s_nrows + 1) * sizeof *s_rows);
+                assert (s_rows);
+                row = &s_rows [s_nrows++];
+                memset (row, 0, sizeof *row);
+                row->pid = segment->pid;
+            }
+            row->now = record;
+            row->seen = true;
+        }
+    }
+    //  Forget sockets that went away
+    size_t kept = 0;
+    for (size_t i = 0; i < s_nrows; i++)
+        if (s_rows [i].seen)
+            s_rows [kept++] = s_rows [i];
+    s_nrows = kept;
+}
+
+
+static int
+s_compare (const void *left, const void *right)
+{
+    const double a = ((const row_t *) left)->rate;
+    const double b = ((const row_t *) right)->rate;
+    return a < b? 1: a > b? -1: 0;
+}
+
+
+//  Print one table of rates over the last seconds
+
+static void
+s_print (double seconds, bool batch)
+{
+    for (size_t i = 0; i < s_nrows; i++) {
+        row_t *row = &s_rows [i];
+        row->rate = row->has_before
+            ? (double) (row->now.stats.bytes_out - row->before.stats.bytes_out
+                      + row->now.stats.bytes_in - row->before.stats.bytes_in)
+              / seconds
+            : 0;
+    }
+    qsort (s_rows, s_nrows, sizeof *s_rows, s_compare);
+
+    if (!batch)
+        printf ("\033[H\033[2J");
+    size_t nprocesses = 0;
+    for (size_t i = 0; i < s_nsegments; i++)
+        if (s_segments [i].segment)
+            nprocesses++;
+    printf ("zmtp_top - %zu sockets in %zu processes, every %.1f s\n\n",
+        s_nrows, nprocesses, seconds);
+    printf ("%7s %-32s %10s %9s %10s %9s %7s %7s %8s %8s\n",
+        "PID", "ENDPOINT", "FRAMES/s>", "MB/s>", "FRAMES/s<", "MB/s<",
+        "SNDQ", "RCVQ", "DROPPED", "EAGAIN/s");
+    for (size_t i = 0; i < s_nrows; i++) {
+        const row_t *row = &s_rows [i];
+        const zmtp_stats_t *now = &row->now.stats;
+        const zmtp_stats_t *before = &row->before.stats;
+        double frames_out = 0, bytes_out = 0, frames_in = 0, bytes_in = 0;
+        double eagains = 0;
+        if (row->has_before) {
+            frames_out = (double) (now->frames_out - before->frames_out);
+            bytes_out = (double) (now->bytes_out - before->bytes_out);
+            frames_in = (double) (now->frames_in - before->frames_in);
+            bytes_in = (double) (now->bytes_in - before->bytes_in);
+            eagains = (double) (now->eagains - before->eagains);
+        }
+        printf ("%7" PRId64 " %-32.32s %10.0f %9.2f %10.0f %9.2f"
+            " %7" PRIu64 " %7" PRIu64 " %8" PRIu64 " %8.0f\n",
+            row->pid, row->now.endpoint,
+            frames_out / seconds, bytes_out / seconds / (1024 * 1024),
+            frames_in / seconds, bytes_in / seconds / (1024 * 1024),
+            row->now.sndq, row->now.rcvq, row->now.dropped,
+            eagains / seconds);
+    }
+    if (batch)
+        printf ("\n");
+    fflush (stdout);
+}
+
+
+int main (int argc, char *argv [])
+{
+    bool batch = false;
+    double delay = 1;
+    long count = -1;
+    int arg = 1;
+    for (; arg < argc && argv [arg][0] == '-'; arg++) {
+        if (streq (argv [arg], "-b"))
+            batch = true;
+        else
+        if (streq (argv [arg], "-d") && arg + 1 < argc)
+            delay = atof (argv [++arg]);
+        else
+        if (streq (argv [arg], "-n") && arg + 1 < argc)
+            count = atol (argv [++arg]);
+        else {
+            printf ("usage: zmtp_top [-b] [-d seconds] [-n count] "
+                    "[segment ...]\n");
+            return 1;
+        }
+    }
+    if (delay <= 0)
+        delay = 1;
+    const bool discover = arg == argc;
+    for (; arg < argc; arg++)
+        if (s_attach (argv [arg]) == -1) {
+            printf ("zmtp_top: cannot open %s: %s\n",
+                argv [arg], strerror (errno));
+            return 1;
+        }
+
+    if (discover)
+        s_discover ();
+    s_sample ();
+    int64_t last = zmtp_clock_usecs ();
+    while (count == -1 || count-- > 0) {
+        usleep ((useconds_t) (delay * 1e6));
+        if (discover)
+            s_discover ();
+        s_sample ();
+        const int64_t now = zmtp_clock_usecs ();
+        s_print ((double) (now - last) / 1e6, batch);
+        last = now;
+    }
+    for (size_t i = 0; i < s_nsegments; i++)
+        zmtp_metrics_close (&s_segments [i].segment);
+    free (s_rows);
+    return 0;
+}